@@ -1,13 +1,46 @@
 #include "utl.h"
 #include "io.h"
 #include "db.h"
+#include "import.h"
 #include "app.h"
 
-// function codes
+#define STATS_MEM_SITES 10  // number of call sites in a FC_STATS response
 
-#define FC_EXEC 1
-#define FC_QUERY 2
-#define FC_QUIT 9
+// scratch memory per request
+
+#define APP_ARENA_SIZE (64*1024)  // initial size, grows if a request needs more
+
+// partitioned queries
+
+#define MAX_PARTITIONS 64
+#define PART_CHUNK_SIZE (256*1024)  // a partition hands over rows in chunks of this size
+#define PART_MAX_CHUNKS 4           // max. number of chunks a partition buffers before it waits
+
+// export
+
+#define EXPORT_MAX_ROW 0x7FFFFFFF  // max. size of an exported row, in bytes
+
+// latency histograms per function code and phase
+
+#define PH_TOTAL   0
+#define PH_READ    1  // reading request frames, see Reader_nanos
+#define PH_DECODE  2
+#define PH_PREPARE 3
+#define PH_BIND    4
+#define PH_STEP    5  // FC_EXEC binds and steps in one call, it counts as step
+#define PH_ENCODE  6
+#define PH_FLUSH   7  // writing response frames, see Writer_nanos
+#define NPHASES    8
+
+static const char *phaseNames[NPHASES] = {"total", "read", "decode", "prepare", "bind", "step", "encode", "flush"};
+
+static const char *fcNames[FC_MAX + 1] = {NULL, "exec", "query", "pquery", "stats", "execcol", "import", "export", NULL, "quit"};
+
+/* App_fcName returns the name of a function code, e.g. "exec", or NULL if
+   fc is not known. */
+const char *App_fcName(int fc) {
+    return fc >= 0 && fc <= FC_MAX ? fcNames[fc] : NULL;
+}
 
 // class App
 
@@ -15,6 +48,20 @@ struct app_s {
     Db *db;
     Reader *r;
     Writer *w;
+    Db *readers[MAX_PARTITIONS];  // read connections for FC_PQUERY, opened on demand
+    int groupMax;                 // max. number of FC_EXEC requests per group commit, 0 or 1 is off
+    int groupWaitMillis;          // how long a group commit waits for the next request
+    int64_t ngroups;
+    int64_t ngrouped;
+    Arena *arena;                 // scratch memory, reset after each request
+    Stats *stats;                 // FC_STATS response, reused
+    int64_t nrequests[FC_MAX + 1];
+    Histogram *latency[FC_MAX + 1][NPHASES];  // created on first use
+    BOOL timing;                  // measure phases, not only total
+    int64_t lap;                  // end of the last phase, see _lap
+    int64_t phases[NPHASES];      // phase times of the current request
+    Trace *trace;                 // or NULL
+    int64_t traceNames[FC_MAX + 1];  // text ids of fcNames
 };
 
 App *newApp(Db *db, Reader *r, Writer *w) {
@@ -25,152 +72,1447 @@ App *newApp(Db *db, Reader *r, Writer *w) {
     this->db = db;
     this->r = r;
     this->w = w;
+    memset(this->readers, 0, sizeof(this->readers));
+    this->groupMax = 0;
+    this->groupWaitMillis = 0;
+    this->ngroups = 0;
+    this->ngrouped = 0;
+    this->arena = newArena(APP_ARENA_SIZE);
+    Db_setArena(db, this->arena);
+    this->stats = newStats();
+    memset(this->nrequests, 0, sizeof(this->nrequests));
+    memset(this->latency, 0, sizeof(this->latency));
+    this->timing = FALSE;
+    this->trace = NULL;
+    memset(this->traceNames, 0, sizeof(this->traceNames));
     return this;
 }
 
+/* App_setGroupCommit turns on group commit: Up to maxBatch pipelined
+   FC_EXEC write requests are committed in one transaction. */
+void App_setGroupCommit(App *this, int maxBatch, int maxWaitMillis) {
+    ASSERT(this);
+    this->groupMax = maxBatch;
+    this->groupWaitMillis = maxWaitMillis;
+}
+
+/* App_setTiming turns on latency histograms per phase of a request. The
+   total latency is always measured. */
+void App_setTiming(App *this, BOOL timing) {
+    ASSERT(this);
+    this->timing = timing;
+}
+
+/* App_setTrace records requests, statements and frames in trace. */
+void App_setTrace(App *this, Trace *trace) {
+    ASSERT(this);
+    ASSERT(trace);
+    this->trace = trace;
+    for (int fc = 0; fc <= FC_MAX; fc++) {
+        if (App_fcName(fc)) {
+            this->traceNames[fc] = Trace_text(trace, App_fcName(fc));
+        }
+    }
+    Db_setTrace(this->db, trace);
+    Reader_setTrace(this->r, trace);
+    Writer_setTrace(this->w, trace);
+}
+
 void App_free(App *this) {
     ASSERT(this);
+    if (this->ngroups) {
+        LOG_INFO2("group commit: %" PRId64 " groups, %" PRId64 " requests", this->ngroups, this->ngrouped);
+    }
+    for (int fc = 0; fc <= FC_MAX; fc++) {
+        for (int ph = 0; ph < NPHASES; ph++) {
+            if (this->latency[fc][ph]) {
+                char name[64];
+                snprintf(name, sizeof(name), "latency %s %s (ns)", App_fcName(fc), phaseNames[ph]);
+                Histogram_print(this->latency[fc][ph], name);
+                Histogram_free(this->latency[fc][ph]);
+            }
+        }
+    }
+    for (int i = 0; i < MAX_PARTITIONS; i++) {
+        if (this->readers[i]) {
+            Db_free(this->readers[i]);
+        }
+    }
+    Db_setArena(this->db, NULL);
+    Arena_print(this->arena, "arena");
+    Arena_free(this->arena);
+    Stats_free(this->stats);
     memFree(this);
 }
 
-static void _fcExec(App *this) {
-    const char *sql = Reader_readString(this->r);
-    ASSERT(sql);
-    BOOL ok = Db_prepare(this->db, sql);
+/* _lap ends the current phase of a request and adds its time. */
+static void _lap(App *this, int phase) {
+    if (this->timing) {
+        int64_t now = nanotime();
+        this->phases[phase] += now - this->lap;
+        this->lap = now;
+    }
+}
+
+static void _recordLatency(App *this, int fc, int phase, int64_t nanos) {
+    Histogram *hist = this->latency[fc][phase];
+    if (!hist) {
+        hist = this->latency[fc][phase] = newHistogram();
+    }
+    Histogram_record(hist, nanos);
+}
+
+static void _readParam(Reader *r, Value *param, int iparam) {
+    param->type = Reader_readByte(r);
+    switch (param->type) {
+        case VT_NULL:
+            // NULL has no further value
+            break;
+        case VT_INT32:
+            param->i32 = Reader_readInt32(r);
+            break;
+        case VT_INT64:
+            param->i64 = Reader_readInt64(r);
+            break;
+        case VT_DOUBLE:
+            param->d = Reader_readDouble(r);
+            break;
+        case VT_STRING:
+            param->p = Reader_readString(r);  // TODO optimize: get string length and pass that to bind function
+            break;
+        case VT_BLOB:
+            param->p = Reader_readBlob(r, &(param->sz));
+            break;
+        default:
+            ASSERT_FAIL("_readParam: invalid params[%d].type = %d", iparam, param->type);
+    }
+}
+
+static void _writeRow(Writer *w, const Value *values, int ncols) {
+    Writer_writeByte(w, 1);  // hasRow = TRUE
+    for (int icol = 0; icol < ncols; icol++) {
+        Value val = values[icol];
+        Writer_writeByte(w, val.type);
+        switch (val.type) {
+            case VT_NULL:
+                // no furhter data
+                break;
+            case VT_INT32:
+                Writer_writeInt32(w, val.i32);
+                break;
+            case VT_INT64:
+                Writer_writeInt64(w, val.i64);
+                break;
+            case VT_DOUBLE:
+                Writer_writeDouble(w, val.d);
+                break;
+            case VT_STRING:
+                // large values are sent from the row's memory, see Writer_markFrame
+                Writer_writeBlobRef(w, val.p, strlen(val.p) + 1);
+                break;
+            case VT_BLOB:
+                // sqlite3_column_blob returns NULL for an empty blob
+                Writer_writeBlobRef(w, val.p ? val.p : "", val.sz);
+                break;
+            default:
+                ASSERT_FAIL("_writeRow: unknown values[%d].type %d", icol, val.type);
+        }
+    }
+}
+
+/* _encodeRow writes the current row of db, with its row codec if codec is
+   set (see Db_setRowCodec), else from the fetched values. */
+static void _encodeRow(Writer *w, Db *db, BOOL codec, const Value *values, int ncols) {
+    if (codec) {
+        Db_encodeRow(db, w);
+    } else {
+        _writeRow(w, values, ncols);
+    }
+}
+
+/* _tooLarge formats the error message for a row that does not fit into a
+   frame of max bytes. */
+static void _tooLarge(char *errmsg, size_t size, size_t max) {
+    snprintf(errmsg, size, "row exceeds max. frame size of %zu bytes, see -bufmax", max);
+}
+
+/* _refit is called when a write since mark did not fit into the max.
+   capacity of the response Writer. It drops that write and flushes the
+   frame before mark, so the write can be retried in an empty frame. It
+   returns FALSE if there was nothing before mark. */
+static BOOL _refit(App *this, size_t mark) {
+    Writer_rewind(this->w, mark);
+    if (mark == 0) {
+        return FALSE;
+    }
+    Writer_flush(this->w);
+    return TRUE;
+}
+
+/* _putRow writes a row to the response. A row that does not fit into an
+   empty frame is dropped, and the query fails. */
+static BOOL _putRow(App *this, BOOL codec, const Value *values, int ncols, char **perrmsg) {
+    size_t mark = Writer_mark(this->w);
+    _encodeRow(this->w, this->db, codec, values, ncols);
+    if (Writer_full(this->w) && _refit(this, mark)) {
+        _encodeRow(this->w, this->db, codec, values, ncols);
+    }
+    if (Writer_full(this->w)) {
+        Writer_rewind(this->w, 0);
+        char errmsg[128];
+        _tooLarge(errmsg, sizeof(errmsg), Writer_maxCapacity(this->w));
+        *perrmsg = Arena_strdup(this->arena, errmsg);
+        return FALSE;
+    }
+    Writer_markFrame(this->w);
+    return TRUE;
+}
+
+/* _endQuery writes the end of a FC_QUERY or FC_PQUERY response. */
+static void _endQuery(App *this, BOOL ok, const char *errmsg) {
+    size_t mark = Writer_mark(this->w);
+    for (;;) {
+        Writer_writeByte(this->w, 0);  // hasRow = FALSE
+        Writer_writeByte(this->w, ok);
+        if (!ok) {
+            Writer_writeString(this->w, errmsg);
+        }
+        if (!Writer_full(this->w) || !_refit(this, mark)) {
+            break;
+        }
+        mark = 0;
+    }
+}
+
+/* _execIterations reads the iterations of a FC_EXEC request and, if ok,
+   executes the prepared statement for each of them. */
+static BOOL _execIterations(App *this, BOOL ok) {
     int niterations = Reader_readInt32(this->r);
     int nparams = Reader_readInt32(this->r);
-    Value *params = (Value *)memAlloc(nparams * sizeof(Value), __FILE__, __LINE__);
+    Value *params = (Value *)Arena_alloc(this->arena, nparams * sizeof(Value));
     for (int i = 0; i < niterations; i++) {
         for (int iparam = 0; iparam < nparams; iparam++) {
-            params[iparam].type = Reader_readByte(this->r);
-            switch (params[iparam].type) {
-                case VT_NULL:
-                    // NULL has no further value
-                    break;
-                case VT_INT32:
-                    params[iparam].i32 = Reader_readInt32(this->r);
-                    break;
-                case VT_INT64:
-                    params[iparam].i64 = Reader_readInt64(this->r);
-                    break;
-                case VT_DOUBLE:
-                    params[iparam].d = Reader_readDouble(this->r);
-                    break;
-                case VT_STRING:
-                    params[iparam].p = Reader_readString(this->r);  // TODO optimize: get string length and pass that to bind function
-                    break;
-                case VT_BLOB:
-                    params[iparam].p = Reader_readBlob(this->r, &(params[iparam].sz));
-                    break;
-                default:
-                    ASSERT_FAIL("_fcExec: invalid params[%d].type = %d", iparam, params[iparam].type);
-            }
+            _readParam(this->r, &params[iparam], iparam);
         }
+        _lap(this, PH_DECODE);
         if (ok) {
             ok = Db_bind_step_reset(this->db, params, nparams);
+            _lap(this, PH_STEP);
+        }
+    }
+    return ok;
+}
+
+// group commit
+
+#define GROUP_SAVEPOINT "sqinn_group"
+
+/* _readIterations reads all params of a FC_EXEC request, before it is
+   executed. Strings and blobs are copied into the arena, because the next
+   frame overwrites the Reader's buffer. */
+static Value *_readIterations(App *this, int *pniterations, int *pnparams) {
+    int niterations = Reader_readInt32(this->r);
+    int nparams = Reader_readInt32(this->r);
+    Value *params = (Value *)Arena_alloc(this->arena, (size_t)niterations * nparams * sizeof(Value) + 1);
+    for (int i = 0; i < niterations * nparams; i++) {
+        Value *param = &params[i];
+        _readParam(this->r, param, i % nparams);
+        if (param->type == VT_STRING) {
+            param->p = Arena_strdup(this->arena, param->p);
+        } else if (param->type == VT_BLOB) {
+            char *p = (char *)Arena_alloc(this->arena, param->sz + 1);
+            memcpy(p, param->p, param->sz);
+            param->p = p;
         }
     }
-    memFree(params);
+    _lap(this, PH_DECODE);
+    *pniterations = niterations;
+    *pnparams = nparams;
+    return params;
+}
+
+static BOOL _runIterations(App *this, const Value *params, int niterations, int nparams) {
+    BOOL ok = TRUE;
+    for (int i = 0; ok && i < niterations; i++) {
+        ok = Db_bind_step_reset(this->db, &params[i * nparams], nparams);
+    }
+    _lap(this, PH_STEP);
+    return ok;
+}
+
+/* _canGroup reports whether the prepared statement may run in a group. */
+static BOOL _canGroup(App *this) {
+    return Db_isWrite(this->db) && !Db_isStandalone(this->db);
+}
+
+/* _execPending reports whether the next request is a FC_EXEC that has
+   arrived, waiting at most millis. */
+static BOOL _execPending(App *this, int millis) {
+    return Reader_hasInput(this->r, millis) && Reader_peekByte(this->r) == FC_EXEC && !Reader_rejected(this->r);
+}
+
+/* A Result is the outcome of one FC_EXEC request in a group. */
+typedef struct result_s {
+    BOOL ok;
+    char *errmsg;  // NULL if ok
+} Result;
+
+static void _failResults(App *this, Result *results, int from, int to, const char *errmsg) {
+    for (int i = from; i < to; i++) {
+        if (results[i].ok) {
+            results[i].ok = FALSE;
+            results[i].errmsg = Arena_strdup(this->arena, errmsg);
+        }
+    }
+}
+
+/* _execGroup executes the FC_EXEC request whose statement has just been
+   prepared and whose params have been read, and all FC_EXEC requests that
+   arrive within groupWaitMillis after it, in one transaction. Each request
+   runs in its own savepoint, so a failing request does not affect the
+   others. Responses are sent after COMMIT. If the transaction cannot be
+   begun, the requests fail with that error. If a request rolls back the
+   transaction, the requests before it in that transaction fail. */
+static void _execGroup(App *this, const Value *params, int niterations, int nparams) {
+    Result *results = (Result *)Arena_alloc(this->arena, (this->groupMax + 1) * sizeof(Result));
+    int n = 0;
+    int first = 0;  // first request of the current transaction
+    BOOL standalone = FALSE;
+    BOOL prepared = TRUE;  // statement of the current request is prepared
+    BOOL begun = Db_exec(this->db, "BEGIN");
+    int64_t deadline = nanotime() + (int64_t)this->groupWaitMillis * 1000 * 1000;
+    for (;;) {
+        Result *res = &results[n++];
+        res->ok = FALSE;
+        res->errmsg = NULL;
+        if (prepared && begun && !Db_inTransaction(this->db)) {
+            // the request before has rolled back the transaction, begin a new one
+            first = n - 1;
+            begun = Db_exec(this->db, "BEGIN");
+        }
+        // without the savepoint, a failing request's writes would be committed
+        BOOL savepoint = prepared && begun && Db_exec(this->db, "SAVEPOINT " GROUP_SAVEPOINT);
+        if (!savepoint) {
+            res->errmsg = Arena_strdup(this->arena, Db_errmsg(this->db));
+            if (n > 1) {
+                _execIterations(this, FALSE);
+            }
+        } else {
+            res->ok = n == 1 ? _runIterations(this, params, niterations, nparams) : _execIterations(this, TRUE);
+            if (!res->ok) {
+                res->errmsg = Arena_strdup(this->arena, Db_errmsg(this->db));
+                if (Db_inTransaction(this->db)) {
+                    Db_exec(this->db, "ROLLBACK TO " GROUP_SAVEPOINT);
+                }
+            }
+            if (Db_inTransaction(this->db)) {
+                Db_exec(this->db, "RELEASE " GROUP_SAVEPOINT);
+            } else {
+                // the request has rolled back the transaction (e.g. ON CONFLICT ROLLBACK)
+                _failResults(this, results, first, n - 1, "group commit: transaction was rolled back");
+                first = n;
+            }
+        }
+        Db_finalize(this->db);
+        _lap(this, PH_STEP);
+        // collect next request, if it arrives before the deadline
+        int64_t wait = (deadline - nanotime()) / (1000 * 1000);
+        if (!begun || n == this->groupMax || !_execPending(this, wait > 0 ? (int)wait : 0)) {
+            break;
+        }
+        Reader_readByte(this->r);  // FC_EXEC
+        this->nrequests[FC_EXEC]++;
+        const char *sql = Reader_readString(this->r);
+        _lap(this, PH_DECODE);
+        prepared = Db_prepare(this->db, sql);
+        _lap(this, PH_PREPARE);
+        if (prepared && !_canGroup(this)) {
+            // e.g. BEGIN, COMMIT or VACUUM, must not run inside the group
+            standalone = TRUE;
+            break;
+        }
+    }
+    if (begun && !Db_inTransaction(this->db)) {
+        _failResults(this, results, first, n, "group commit: transaction was rolled back");
+    } else if (Db_inTransaction(this->db) && !Db_exec(this->db, "COMMIT")) {
+        char *errmsg = Arena_strdup(this->arena, Db_errmsg(this->db));
+        Db_exec(this->db, "ROLLBACK");
+        _failResults(this, results, first, n, errmsg);
+    }
+    if (standalone) {
+        Result *res = &results[n++];
+        res->ok = _execIterations(this, TRUE);
+        res->errmsg = res->ok ? NULL : Arena_strdup(this->arena, Db_errmsg(this->db));
+        Db_finalize(this->db);
+    }
+    _lap(this, PH_STEP);
+    this->ngroups++;
+    this->ngrouped += n;
+    // one response per request
+    for (int i = 0; i < n; i++) {
+        Writer_writeByte(this->w, results[i].ok);
+        if (!results[i].ok) {
+            Writer_writeString(this->w, results[i].errmsg);
+        }
+        Writer_flush(this->w);
+    }
+    _lap(this, PH_ENCODE);
+}
+
+static void _fcExec(App *this) {
+    const char *sql = Reader_readString(this->r);
+    ASSERT(sql);
+    _lap(this, PH_DECODE);
+    BOOL ok = Db_prepare(this->db, sql);
+    _lap(this, PH_PREPARE);
+    if (ok && this->groupMax > 1 && _canGroup(this) && !Db_inTransaction(this->db)) {
+        // a group only pays off if another FC_EXEC is already there
+        int niterations, nparams;
+        Value *params = _readIterations(this, &niterations, &nparams);
+        if (_execPending(this, 0)) {
+            _execGroup(this, params, niterations, nparams);
+            return;
+        }
+        ok = _runIterations(this, params, niterations, nparams);
+    } else {
+        ok = _execIterations(this, ok);
+    }
     Writer_writeByte(this->w, ok);
     if (!ok) {
         Writer_writeString(this->w, Db_errmsg(this->db));
     }
+    _lap(this, PH_ENCODE);
     Db_finalize(this->db);
+    _lap(this, PH_STEP);
+}
+
+// columnar exec
+
+#define EXECCOL_BLOCK 256     // iterations that are decoded at once
+#define EXECCOL_MIN_PARAM 9   // min. bytes of a param: type, nulls length and data length
+
+/* A ParamColumn holds the values of one parameter of a FC_EXECCOL request,
+   for all iterations. */
+typedef struct paramcolumn_s {
+    char type;
+    const unsigned char *nulls;  // bit i is set if iteration i is NULL, or NULL if there are no NULLs
+    size_t nnulls;               // bytes in nulls
+    const char *data;            // packed array, or run of strings or blobs
+    size_t len;
+    size_t off;                  // of the next string or blob
+} ParamColumn;
+
+static int _getInt32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return (int)(((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | (uint32_t)u[3]);
+}
+
+static int64_t _getInt64(const char *p) {
+    return (int64_t)(((uint64_t)(uint32_t)_getInt32(p) << 32) | (uint32_t)_getInt32(p + 4));
+}
+
+static double _getDouble(const char *p) {
+    int64_t v = _getInt64(p);
+    double d;
+    memcpy(&d, &v, 8);
+    return d;
+}
+
+static BOOL _isNullAt(const ParamColumn *col, int i) {
+    return col->nulls && (col->nulls[i >> 3] >> (i & 7)) & 1;
+}
+
+/* _readColumn reads the null bitmap and data of a ParamColumn and copies
+   them into the arena, because the frame they were read from may be
+   overwritten by the next one. */
+static void _readColumn(App *this, ParamColumn *col) {
+    size_t nlen, len;
+    const char *nulls = Reader_readBlob(this->r, &nlen);
+    col->nulls = NULL;
+    if (nlen) {
+        unsigned char *copy = (unsigned char *)Arena_alloc(this->arena, nlen);
+        memcpy(copy, nulls, nlen);
+        col->nulls = copy;
+    }
+    const char *data = Reader_readBlob(this->r, &len);
+    col->data = NULL;
+    if (len) {
+        char *copy = (char *)Arena_alloc(this->arena, len);
+        memcpy(copy, data, len);
+        col->data = copy;
+    }
+    col->nnulls = nlen;
+    col->len = len;
+    col->off = 0;
+}
+
+/* _checkColumn checks that a ParamColumn holds niter values, so that they
+   can be decoded without further checks. */
+static BOOL _checkColumn(ParamColumn *col, int niter, int iparam, char *errmsg, size_t size) {
+    if (col->nnulls && col->nnulls != ((size_t)niter + 7) / 8) {
+        snprintf(errmsg, size, "param %d: null bitmap of %zu bytes, want %zu", iparam, col->nnulls, ((size_t)niter + 7) / 8);
+        return FALSE;
+    }
+    size_t width = 0;
+    switch (col->type) {
+        case VT_INT32:
+            width = 4;
+            break;
+        case VT_INT64:
+        case VT_DOUBLE:
+            width = 8;
+            break;
+        case VT_STRING:
+        case VT_BLOB:
+            break;
+        default:
+            snprintf(errmsg, size, "param %d: invalid type %d", iparam, col->type);
+            return FALSE;
+    }
+    if (width) {
+        if (col->len != (size_t)niter * width) {
+            snprintf(errmsg, size, "param %d: data of %zu bytes, want %zu", iparam, col->len, (size_t)niter * width);
+            return FALSE;
+        }
+        return TRUE;
+    }
+    size_t off = 0;
+    for (int i = 0; i < niter; i++) {
+        if (_isNullAt(col, i)) {
+            continue;
+        }
+        int n = off + 4 <= col->len ? _getInt32(col->data + off) : -1;
+        BOOL valid = n >= 0 && (size_t)n <= col->len - off - 4;
+        if (valid && col->type == VT_STRING) {
+            valid = n > 0 && col->data[off + 4 + n - 1] == '\0';
+        }
+        if (!valid) {
+            snprintf(errmsg, size, "param %d: invalid %s at iteration %d", iparam, col->type == VT_STRING ? "string" : "blob", i);
+            return FALSE;
+        }
+        off += 4 + (size_t)n;
+    }
+    if (off != col->len) {
+        snprintf(errmsg, size, "param %d: %zu bytes after last value", iparam, col->len - off);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* _decodeColumn decodes the values of n iterations, starting at first, to
+   values[0], values[stride], values[2 * stride], ... */
+static void _decodeColumn(ParamColumn *col, int first, int n, Value *values, int stride) {
+    switch (col->type) {
+        case VT_INT32:
+            for (int i = 0; i < n; i++, values += stride) {
+                values->type = _isNullAt(col, first + i) ? VT_NULL : VT_INT32;
+                values->i32 = _getInt32(col->data + (size_t)(first + i) * 4);
+            }
+            break;
+        case VT_INT64:
+            for (int i = 0; i < n; i++, values += stride) {
+                values->type = _isNullAt(col, first + i) ? VT_NULL : VT_INT64;
+                values->i64 = _getInt64(col->data + (size_t)(first + i) * 8);
+            }
+            break;
+        case VT_DOUBLE:
+            for (int i = 0; i < n; i++, values += stride) {
+                values->type = _isNullAt(col, first + i) ? VT_NULL : VT_DOUBLE;
+                values->d = _getDouble(col->data + (size_t)(first + i) * 8);
+            }
+            break;
+        case VT_STRING:
+        case VT_BLOB:
+            for (int i = 0; i < n; i++, values += stride) {
+                if (_isNullAt(col, first + i)) {
+                    values->type = VT_NULL;
+                    continue;
+                }
+                values->type = col->type;
+                values->sz = (size_t)_getInt32(col->data + col->off);
+                values->p = col->data + col->off + 4;
+                col->off += 4 + values->sz;
+            }
+            break;
+        default:
+            ASSERT_FAIL("_decodeColumn: invalid type %d", col->type);
+    }
+}
+
+/* _fcExecCol executes a statement like FC_EXEC, but the parameters come
+   in columns: one typed array per parameter, see rfc.txt. The columns are
+   decoded in blocks of EXECCOL_BLOCK iterations, then bound and stepped
+   one iteration after the other. A request with invalid counts is
+   rejected before anything is allocated, and the rest of its frame is
+   skipped. */
+static void _fcExecCol(App *this) {
+    const char *sql = Reader_readString(this->r);
+    int niter = Reader_readInt32(this->r);
+    int nparams = Reader_readInt32(this->r);
+    char errmsg[128] = {0};
+    if (niter < 0 || nparams < 0) {
+        snprintf(errmsg, sizeof(errmsg), "invalid request: %d iterations, %d params", niter, nparams);
+    } else if ((size_t)nparams > Reader_remaining(this->r) / EXECCOL_MIN_PARAM) {
+        snprintf(errmsg, sizeof(errmsg), "invalid request: %d params do not fit into a frame of %zu bytes", nparams, Reader_remaining(this->r));
+    }
+    if (errmsg[0]) {
+        Reader_skipFrame(this->r);
+        _lap(this, PH_DECODE);
+        Writer_writeByte(this->w, FALSE);
+        Writer_writeString(this->w, errmsg);
+        _lap(this, PH_ENCODE);
+        return;
+    }
+    ParamColumn *cols = (ParamColumn *)Arena_alloc(this->arena, nparams * sizeof(ParamColumn));
+    for (int iparam = 0; iparam < nparams; iparam++) {
+        cols[iparam].type = Reader_readByte(this->r);
+    }
+    for (int iparam = 0; iparam < nparams; iparam++) {
+        _readColumn(this, &cols[iparam]);
+    }
+    BOOL ok = TRUE;
+    for (int iparam = 0; ok && iparam < nparams; iparam++) {
+        ok = _checkColumn(&cols[iparam], niter, iparam, errmsg, sizeof(errmsg));
+    }
+    _lap(this, PH_DECODE);
+    if (ok) {
+        ok = Db_prepare(this->db, sql);
+        _lap(this, PH_PREPARE);
+    }
+    Value *block = (Value *)Arena_alloc(this->arena, (size_t)EXECCOL_BLOCK * (size_t)nparams * sizeof(Value));
+    for (int first = 0; ok && first < niter; first += EXECCOL_BLOCK) {
+        int n = niter - first < EXECCOL_BLOCK ? niter - first : EXECCOL_BLOCK;
+        for (int iparam = 0; iparam < nparams; iparam++) {
+            _decodeColumn(&cols[iparam], first, n, block + iparam, nparams);
+        }
+        _lap(this, PH_DECODE);
+        for (int i = 0; ok && i < n; i++) {
+            ok = Db_bind_step_reset(this->db, block + (size_t)i * nparams, nparams);
+        }
+        _lap(this, PH_STEP);
+    }
+    Writer_writeByte(this->w, ok);
+    if (!ok) {
+        Writer_writeString(this->w, errmsg[0] ? errmsg : Db_errmsg(this->db));
+    }
+    _lap(this, PH_ENCODE);
+    Db_finalize(this->db);
+    _lap(this, PH_STEP);
+}
+
+// import
+
+static void _writeImportRecord(App *this, char kind, Import *imp) {
+    Writer_writeByte(this->w, kind);
+    if (kind == 0) {
+        Writer_writeByte(this->w, Import_ok(imp));
+    }
+    Writer_writeInt64(this->w, Import_rows(imp));
+    Writer_writeInt64(this->w, Import_bytes(imp));
+    Writer_writeInt64(this->w, Import_nanos(imp));
+    if (kind == 0 && !Import_ok(imp)) {
+        Writer_writeString(this->w, Import_errmsg(imp));
+    }
+}
+
+/* _fcImport loads a CSV or TSV file that the server can read into a
+   table, see Import. It sends a progress record after each committed
+   batch, each in its own frame, then the final record. */
+static void _fcImport(App *this) {
+    const char *filename = Reader_readString(this->r);
+    const char *table = Reader_readString(this->r);
+    int ncols = Reader_readInt32(this->r);
+    ASSERT(ncols >= 0);
+    const char **columns = (const char **)Arena_alloc(this->arena, (ncols + 1) * sizeof(char *));
+    for (int i = 0; i < ncols; i++) {
+        columns[i] = Reader_readString(this->r);
+    }
+    char sep = Reader_readByte(this->r);
+    BOOL header = Reader_readByte(this->r);
+    int nthreads = Reader_readInt32(this->r);
+    int batch = Reader_readInt32(this->r);
+    _lap(this, PH_DECODE);
+    Import *imp = newImport(this->db, filename, table, columns, ncols, sep, header, nthreads, batch);
+    _lap(this, PH_PREPARE);
+    while (Import_next(imp)) {
+        _lap(this, PH_STEP);
+        _writeImportRecord(this, 1, imp);
+        Writer_flush(this->w);
+        _lap(this, PH_ENCODE);
+    }
+    _lap(this, PH_STEP);
+    _writeImportRecord(this, 0, imp);
+    _lap(this, PH_ENCODE);
+    Import_free(imp);
 }
 
 static void _fcQuery(App *this) {
     const char *sql = Reader_readString(this->r);
+    _lap(this, PH_DECODE);
     BOOL ok = Db_prepare(this->db, sql);
+    _lap(this, PH_PREPARE);
+    char *errmsg = NULL;
     // read and bind parameters
     {
         int nparams = Reader_readInt32(this->r);
-        Value *params = (Value *)memAlloc(nparams * sizeof(Value), __FILE__, __LINE__);
+        Value *params = (Value *)Arena_alloc(this->arena, nparams * sizeof(Value));
         for (int iparam = 0; iparam < nparams; iparam++) {
-            params[iparam].type = Reader_readByte(this->r);
-            switch (params[iparam].type) {
-                case VT_NULL:
-                    // NULL has no further value
-                    break;
-                case VT_INT32:
-                    params[iparam].i32 = Reader_readInt32(this->r);
-                    break;
-                case VT_INT64:
-                    params[iparam].i64 = Reader_readInt64(this->r);
-                    break;
-                case VT_DOUBLE:
-                    params[iparam].d = Reader_readDouble(this->r);
-                    break;
-                case VT_STRING:
-                    params[iparam].p = Reader_readString(this->r);  // TODO optimize get string length and pass that to bind function
-                    break;
-                case VT_BLOB:
-                    params[iparam].p = Reader_readBlob(this->r, &params[iparam].sz);
-                    break;
-                default:
-                    ASSERT_FAIL("_fcQuery: invalid params[%d].type = %d", iparam, params[iparam].type);
-            }
+            _readParam(this->r, &params[iparam], iparam);
         }
+        _lap(this, PH_DECODE);
         if (ok) {
             ok = Db_bind(this->db, params, nparams);
+            _lap(this, PH_BIND);
         }
-        memFree(params);
     }
     // fetch column values
     {
         // read column types
         int ncols = Reader_readInt32(this->r);
-        char *coltypes = (char *)memAlloc(ncols, __FILE__, __LINE__);
+        char *coltypes = (char *)Arena_alloc(this->arena, ncols);
         for (int icol = 0; icol < ncols; icol++) {
             coltypes[icol] = Reader_readByte(this->r);
         }
-        Value *values = (Value *)memAlloc(ncols * sizeof(Value), __FILE__, __LINE__);
-        // fetch all rows
+        Value *values = (Value *)Arena_alloc(this->arena, ncols * sizeof(Value));
+        _lap(this, PH_DECODE);
+        // fetch all rows, or encode them without fetching if the column types have a row codec
+        BOOL codec = ok && Db_setRowCodec(this->db, coltypes, ncols);
         BOOL hasRow = TRUE;
         while (ok && hasRow) {
-            for (int icol = 0; icol < ncols; icol++) {
+            for (int icol = 0; !codec && icol < ncols; icol++) {
                 values[icol].type = coltypes[icol];
             }
-            ok = Db_step_fetch(this->db, &hasRow, values, ncols);
+            ok = Db_step_fetch(this->db, &hasRow, values, codec ? 0 : ncols);
+            _lap(this, PH_STEP);
             if (ok && hasRow) {
-                Writer_writeByte(this->w, 1);  // hasRow = TRUE
-                for (int icol = 0; icol < ncols; icol++) {
-                    Value val = values[icol];
-                    Writer_writeByte(this->w, val.type);
-                    switch (val.type) {
-                        case VT_NULL:
-                            // no furhter data
-                            break;
-                        case VT_INT32:
-                            Writer_writeInt32(this->w, val.i32);
-                            break;
-                        case VT_INT64:
-                            Writer_writeInt64(this->w, val.i64);
-                            break;
-                        case VT_DOUBLE:
-                            Writer_writeDouble(this->w, val.d);
-                            break;
-                        case VT_STRING:
-                            Writer_writeString(this->w, val.p);
-                            break;
-                        case VT_BLOB:
-                            Writer_writeBlob(this->w, val.p, val.sz);
-                            break;
-                        default:
-                            ASSERT_FAIL("_fcQuery: unknown values[%d].type %d", icol, val.type);
+                ok = _putRow(this, codec, values, ncols, &errmsg);
+                _lap(this, PH_ENCODE);
+            }
+        }  // end while
+    }
+    _endQuery(this, ok, errmsg ? errmsg : Db_errmsg(this->db));
+    _lap(this, PH_ENCODE);
+    Db_finalize(this->db);
+    _lap(this, PH_STEP);
+}
+
+// export
+
+/* An Export is the target file of a FC_EXPORT request. */
+typedef struct export_s {
+    const char *filename;
+    FILE *fp;
+    int format;     // EXPORT_...
+    int64_t rows;
+    int64_t bytes;
+} Export;
+
+static void _writeText(Writer *w, const char *text) {
+    Writer_writeRaw(w, text, strlen(text));
+}
+
+static void _writeHex(Writer *w, const char *data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    char *p = Writer_reserve(w, 2 * len);
+    for (size_t i = 0; p && i < len; i++) {
+        *p++ = digits[(unsigned char)data[i] >> 4];
+        *p++ = digits[data[i] & 15];
+    }
+}
+
+static void _writeNumber(Writer *w, const Value *val) {
+    char buf[32];
+    int n = 0;
+    switch (val->type) {
+        case VT_INT32:
+            n = snprintf(buf, sizeof(buf), "%d", val->i32);
+            break;
+        case VT_INT64:
+            n = snprintf(buf, sizeof(buf), "%" PRId64, val->i64);
+            break;
+        case VT_DOUBLE:
+            n = snprintf(buf, sizeof(buf), "%.17g", val->d);
+            break;
+        default:
+            ASSERT_FAIL("_writeNumber: invalid type %d", val->type);
+    }
+    Writer_writeRaw(w, buf, n);
+}
+
+/* _writeCsvString writes a CSV field, quoted if needed, see RFC 4180. An
+   empty string is quoted, so that it differs from NULL. */
+static void _writeCsvString(Writer *w, const char *str) {
+    if (*str && !strpbrk(str, ",\"\r\n")) {
+        _writeText(w, str);
+        return;
+    }
+    Writer_writeByte(w, '"');
+    for (const char *q; (q = strchr(str, '"')); str = q + 1) {
+        Writer_writeRaw(w, str, q - str + 1);
+        Writer_writeByte(w, '"');
+    }
+    _writeText(w, str);
+    Writer_writeByte(w, '"');
+}
+
+static void _writeCsvHeader(Writer *w, Db *db, int ncols) {
+    for (int icol = 0; icol < ncols; icol++) {
+        if (icol) {
+            Writer_writeByte(w, ',');
+        }
+        _writeCsvString(w, Db_columnName(db, icol));
+    }
+    Writer_writeByte(w, '\n');
+}
+
+/* _writeCsvRow writes a CSV record. NULL is an empty field, a blob is
+   written in hex. */
+static void _writeCsvRow(Writer *w, const Value *values, int ncols) {
+    for (int icol = 0; icol < ncols; icol++) {
+        const Value *val = &values[icol];
+        if (icol) {
+            Writer_writeByte(w, ',');
+        }
+        switch (val->type) {
+            case VT_NULL:
+                break;
+            case VT_STRING:
+                _writeCsvString(w, val->p);
+                break;
+            case VT_BLOB:
+                _writeHex(w, val->p, val->sz);
+                break;
+            default:
+                _writeNumber(w, val);
+        }
+    }
+    Writer_writeByte(w, '\n');
+}
+
+static void _writeJsonString(Writer *w, const char *str) {
+    Writer_writeByte(w, '"');
+    const char *run = str;
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        Writer_writeRaw(w, run, str - run);
+        char esc[8];
+        switch (c) {
+            case '\n':
+                strcpy(esc, "\\n");
+                break;
+            case '\r':
+                strcpy(esc, "\\r");
+                break;
+            case '\t':
+                strcpy(esc, "\\t");
+                break;
+            case '"':
+            case '\\':
+                snprintf(esc, sizeof(esc), "\\%c", c);
+                break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+        }
+        _writeText(w, esc);
+        run = str + 1;
+    }
+    Writer_writeRaw(w, run, str - run);
+    Writer_writeByte(w, '"');
+}
+
+/* _writeJsonRow writes a row as a JSON object on one line, keyed by
+   column name. A blob is a hex string, a non-finite double is null. */
+static void _writeJsonRow(Writer *w, Db *db, const Value *values, int ncols) {
+    Writer_writeByte(w, '{');
+    for (int icol = 0; icol < ncols; icol++) {
+        const Value *val = &values[icol];
+        if (icol) {
+            Writer_writeByte(w, ',');
+        }
+        _writeJsonString(w, Db_columnName(db, icol));
+        Writer_writeByte(w, ':');
+        switch (val->type) {
+            case VT_NULL:
+                _writeText(w, "null");
+                break;
+            case VT_DOUBLE:
+                if (val->d - val->d != 0) {
+                    _writeText(w, "null");  // inf or nan
+                } else {
+                    _writeNumber(w, val);
+                }
+                break;
+            case VT_STRING:
+                _writeJsonString(w, val->p);
+                break;
+            case VT_BLOB:
+                Writer_writeByte(w, '"');
+                _writeHex(w, val->p, val->sz);
+                Writer_writeByte(w, '"');
+                break;
+            default:
+                _writeNumber(w, val);
+        }
+    }
+    _writeText(w, "}\n");
+}
+
+/* _formatRow writes the current row of db in an EXPORT_... format. Format
+   0, the rows of a FC_PQUERY response, and EXPORT_BINARY are the same. */
+static void _formatRow(Writer *w, Db *db, int format, BOOL codec, const Value *values, int ncols) {
+    switch (format) {
+        case EXPORT_CSV:
+            _writeCsvRow(w, values, ncols);
+            break;
+        case EXPORT_JSONL:
+            _writeJsonRow(w, db, values, ncols);
+            break;
+        default:
+            _encodeRow(w, db, codec, values, ncols);
+    }
+}
+
+static BOOL _exportWrite(App *this, Export *export, const char *data, size_t len, char **perrmsg) {
+    if (len && fwrite(data, 1, len, export->fp) != len) {
+        char errmsg[600];
+        snprintf(errmsg, sizeof(errmsg), "export: cannot write '%.500s'", export->filename);
+        *perrmsg = Arena_strdup(this->arena, errmsg);
+        return FALSE;
+    }
+    export->bytes += len;
+    return TRUE;
+}
+
+// partitioned query
+
+/* A Part is one partition of a FC_PQUERY request. It runs in its own thread
+   and hands over its encoded rows in chunks. */
+typedef struct part_s {
+    Db *db;                   // read connection, in a read transaction
+    const char *sql;
+    Value *params;            // params[0] and params[1] hold the partition range
+    int nparams;
+    const char *coltypes;
+    int ncols;
+    size_t maxChunk;          // max. size of a chunk, see Writer_maxCapacity
+    int format;               // 0 for FC_PQUERY, EXPORT_... for FC_EXPORT
+    BOOL header;              // start with the CSV header
+    Value *values;            // ncols values
+    Mutex *mutex;             // shared by all parts of a request
+    Cond *cond;               // shared by all parts of a request
+    Writer *chunks[PART_MAX_CHUNKS];
+    int first;                // index of first queued chunk
+    int nchunks;              // number of queued chunks
+    BOOL done;
+    BOOL cancel;
+    BOOL ok;
+    char *errmsg;             // NULL if ok
+    int64_t rows;
+} Part;
+
+static BOOL _pushChunk(Part *part, Writer *chunk, BOOL done) {
+    Mutex_lock(part->mutex);
+    while (part->nchunks == PART_MAX_CHUNKS && !part->cancel) {
+        Cond_wait(part->cond, part->mutex);
+    }
+    BOOL cancel = part->cancel;
+    if (cancel) {
+        Writer_free(chunk);
+    } else {
+        part->chunks[(part->first + part->nchunks) % PART_MAX_CHUNKS] = chunk;
+        part->nchunks++;
+    }
+    part->done = done;
+    Cond_broadcast(part->cond);
+    Mutex_unlock(part->mutex);
+    return !cancel;
+}
+
+static Writer *_popChunk(Part *part) {
+    Mutex_lock(part->mutex);
+    while (part->nchunks == 0 && !part->done) {
+        Cond_wait(part->cond, part->mutex);
+    }
+    Writer *chunk = NULL;
+    if (part->nchunks) {
+        chunk = part->chunks[part->first];
+        part->first = (part->first + 1) % PART_MAX_CHUNKS;
+        part->nchunks--;
+        Cond_broadcast(part->cond);
+    }
+    Mutex_unlock(part->mutex);
+    return chunk;
+}
+
+static Writer *_newChunk(Part *part) {
+    size_t init = PART_CHUNK_SIZE < part->maxChunk ? PART_CHUNK_SIZE : part->maxChunk;
+    Writer *chunk = newBufWriter(init);
+    Writer_setCapacity(chunk, init, part->maxChunk);
+    return chunk;
+}
+
+static void _partMain(void *arg) {
+    Part *part = (Part *)arg;
+    BOOL ok = Db_prepare(part->db, part->sql);
+    if (ok) {
+        ok = Db_bind(part->db, part->params, part->nparams);
+    }
+    Value *values = part->values;
+    Writer *chunk = _newChunk(part);
+    BOOL tooLarge = FALSE;
+    BOOL next = TRUE;
+    BOOL codec = ok && part->format != EXPORT_CSV && part->format != EXPORT_JSONL
+        && Db_setRowCodec(part->db, part->coltypes, part->ncols);
+    if (ok && part->header) {
+        _writeCsvHeader(chunk, part->db, part->ncols);
+    }
+    BOOL hasRow = TRUE;
+    while (ok && next && hasRow) {
+        for (int icol = 0; !codec && icol < part->ncols; icol++) {
+            values[icol].type = part->coltypes[icol];
+        }
+        ok = Db_step_fetch(part->db, &hasRow, values, codec ? 0 : part->ncols);
+        if (ok && hasRow) {
+            size_t mark = Writer_mark(chunk);
+            _formatRow(chunk, part->db, part->format, codec, values, part->ncols);
+            if (Writer_full(chunk) && mark > 0) {
+                // hand over the rows before, retry in a new chunk
+                Writer_rewind(chunk, mark);
+                next = _pushChunk(part, chunk, FALSE);
+                chunk = _newChunk(part);
+                _formatRow(chunk, part->db, part->format, codec, values, part->ncols);
+            }
+            if (Writer_full(chunk)) {
+                Writer_rewind(chunk, 0);
+                ok = FALSE;
+                tooLarge = TRUE;
+                break;
+            }
+            part->rows++;
+            size_t len;
+            Writer_data(chunk, &len);
+            if (len >= PART_CHUNK_SIZE) {
+                next = _pushChunk(part, chunk, FALSE);
+                chunk = _newChunk(part);
+            }
+        }
+    }
+    part->ok = ok;
+    if (tooLarge) {
+        char errmsg[128];
+        if (part->format) {
+            snprintf(errmsg, sizeof(errmsg), "export: row exceeds max. size of %zu bytes", part->maxChunk);
+        } else {
+            _tooLarge(errmsg, sizeof(errmsg), part->maxChunk);
+        }
+        part->errmsg = memStrdup(errmsg, __FILE__, __LINE__);
+    } else if (!ok) {
+        part->errmsg = memStrdup(Db_errmsg(part->db), __FILE__, __LINE__);
+    }
+    Db_finalize(part->db);
+    _pushChunk(part, chunk, TRUE);
+}
+
+/* _partBounds computes the range [lo,hi) of partition ipart. */
+static void _partBounds(int64_t lo, int64_t hi, int npart, int ipart, Value *plo, Value *phi) {
+    uint64_t width = (uint64_t)hi - (uint64_t)lo;
+    uint64_t size = width / npart;
+    uint64_t rest = width % npart;
+    uint64_t start = size * ipart + ((uint64_t)ipart < rest ? (uint64_t)ipart : rest);
+    uint64_t end = start + size + ((uint64_t)ipart < rest ? 1 : 0);
+    *plo = (Value) {.type = VT_INT64, .i64 = (int64_t)((uint64_t)lo + start)};
+    *phi = (Value) {.type = VT_INT64, .i64 = (int64_t)((uint64_t)lo + end)};
+}
+
+static BOOL _openReaders(App *this, int npart) {
+    for (int i = 0; i < npart; i++) {
+        if (!this->readers[i]) {
+            this->readers[i] = Db_openReader(this->db);
+            if (!this->readers[i]) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/* _cancelParts stops the partitions from..to-1 that are still running. */
+static void _cancelParts(Part *parts, int from, int to) {
+    if (from >= to) {
+        return;
+    }
+    Mutex_lock(parts[from].mutex);
+    for (int j = from; j < to; j++) {
+        parts[j].cancel = TRUE;
+    }
+    Cond_broadcast(parts[from].cond);
+    Mutex_unlock(parts[from].mutex);
+}
+
+/* _pqueryParallel runs the partitions concurrently on reader connections
+   and merges their rows in partition order, into the response, or into
+   the file of export if not NULL. */
+static BOOL _pqueryParallel(App *this, const char *sql, int64_t lo, int64_t hi, int npart, Value *params, int nparams, const char *coltypes, int ncols, Export *export, char **perrmsg) {
+    // all readers must see the same snapshot
+    if (!Db_beginRead(this->db, NULL)) {
+        *perrmsg = Arena_strdup(this->arena, Db_errmsg(this->db));
+        return FALSE;
+    }
+    int nbegun = 0;
+    while (nbegun < npart && Db_beginRead(this->readers[nbegun], this->db)) {
+        nbegun++;
+    }
+    BOOL ok = nbegun == npart;
+    if (!ok) {
+        *perrmsg = Arena_strdup(this->arena, Db_errmsg(this->readers[nbegun]));
+    }
+    Mutex *mutex = newMutex();
+    Cond *cond = newCond();
+    Part *parts = (Part *)Arena_alloc(this->arena, npart * sizeof(Part));
+    Thread **threads = (Thread **)Arena_alloc(this->arena, npart * sizeof(Thread *));
+    if (ok) {
+        for (int i = 0; i < npart; i++) {
+            Part *part = &parts[i];
+            memset(part, 0, sizeof(Part));
+            part->db = this->readers[i];
+            part->sql = sql;
+            part->params = (Value *)Arena_alloc(this->arena, nparams * sizeof(Value));
+            memcpy(part->params, params, nparams * sizeof(Value));
+            _partBounds(lo, hi, npart, i, &part->params[0], &part->params[1]);
+            part->nparams = nparams;
+            part->coltypes = coltypes;
+            part->ncols = ncols;
+            part->maxChunk = export ? EXPORT_MAX_ROW : Writer_maxCapacity(this->w);
+            part->format = export ? export->format : 0;
+            part->header = export && export->format == EXPORT_CSV && i == 0;
+            part->values = (Value *)Arena_alloc(this->arena, ncols * sizeof(Value));
+            part->mutex = mutex;
+            part->cond = cond;
+            threads[i] = newThread(_partMain, part);
+        }
+        // merge rows in partition order
+        for (int i = 0; i < npart; i++) {
+            Writer *chunk;
+            while ((chunk = _popChunk(&parts[i]))) {
+                _lap(this, PH_STEP);
+                if (ok && export) {
+                    size_t len;
+                    const char *data = Writer_data(chunk, &len);
+                    ok = _exportWrite(this, export, data, len, perrmsg);
+                    if (!ok) {
+                        _cancelParts(parts, i + 1, npart);
+                    }
+                } else if (ok) {
+                    size_t len;
+                    const char *data = Writer_data(chunk, &len);
+                    if (len) {
+                        // a chunk fits into an empty frame
+                        size_t mark = Writer_mark(this->w);
+                        Writer_writeRaw(this->w, data, len);
+                        if (Writer_full(this->w) && _refit(this, mark)) {
+                            Writer_writeRaw(this->w, data, len);
+                        }
+                        ASSERT(!Writer_full(this->w));
+                        Writer_markFrame(this->w);
                     }
                 }
-                Writer_markFrame(this->w);
+                Writer_free(chunk);
+                _lap(this, PH_ENCODE);
             }
-        }  // end while
-        Writer_writeByte(this->w, 0);  // hasRow = FALSE
-        memFree(values);
-        memFree(coltypes);
+            if (ok && !parts[i].ok) {
+                ok = FALSE;
+                *perrmsg = Arena_strdup(this->arena, parts[i].errmsg);
+                _cancelParts(parts, i + 1, npart);
+            }
+        }
+        for (int i = 0; i < npart; i++) {
+            Thread_join(threads[i]);
+            memFree(parts[i].errmsg);
+            if (export) {
+                export->rows += parts[i].rows;
+            }
+        }
+    }
+    Cond_free(cond);
+    Mutex_free(mutex);
+    for (int i = 0; i < nbegun; i++) {
+        Db_endRead(this->readers[i]);
+        Db_mergeStmtStats(this->db, this->readers[i]);
+    }
+    Db_endRead(this->db);
+    return ok;
+}
+
+static BOOL _pquerySerial(App *this, const char *sql, int64_t lo, int64_t hi, int npart, Value *params, int nparams, const char *coltypes, int ncols, char **perrmsg) {
+    BOOL ok = Db_prepare(this->db, sql);
+    _lap(this, PH_PREPARE);
+    Value *values = (Value *)Arena_alloc(this->arena, ncols * sizeof(Value));
+    BOOL codec = ok && Db_setRowCodec(this->db, coltypes, ncols);
+    for (int i = 0; ok && i < npart; i++) {
+        _partBounds(lo, hi, npart, i, &params[0], &params[1]);
+        ok = Db_bind(this->db, params, nparams);
+        _lap(this, PH_BIND);
+        BOOL hasRow = TRUE;
+        while (ok && hasRow) {
+            for (int icol = 0; !codec && icol < ncols; icol++) {
+                values[icol].type = coltypes[icol];
+            }
+            ok = Db_step_fetch(this->db, &hasRow, values, codec ? 0 : ncols);
+            _lap(this, PH_STEP);
+            if (ok && hasRow) {
+                ok = _putRow(this, codec, values, ncols, perrmsg);
+                _lap(this, PH_ENCODE);
+            }
+        }
+        Db_reset(this->db);
+        _lap(this, PH_STEP);
+    }
+    return ok;
+}
+
+static void _fcPquery(App *this) {
+    const char *sql = Reader_readString(this->r);
+    int64_t lo = Reader_readInt64(this->r);
+    int64_t hi = Reader_readInt64(this->r);
+    int npart = Reader_readInt32(this->r);
+    if (hi <= lo || npart < 1) {
+        npart = 1;
+    } else if (npart > MAX_PARTITIONS) {
+        npart = MAX_PARTITIONS;
+    }
+    // params[0] and params[1] are the partition range, client params follow
+    int nparams = 2 + Reader_readInt32(this->r);
+    Value *params = (Value *)Arena_alloc(this->arena, nparams * sizeof(Value));
+    for (int iparam = 2; iparam < nparams; iparam++) {
+        _readParam(this->r, &params[iparam], iparam);
+    }
+    int ncols = Reader_readInt32(this->r);
+    char *coltypes = (char *)Arena_alloc(this->arena, ncols);
+    for (int icol = 0; icol < ncols; icol++) {
+        coltypes[icol] = Reader_readByte(this->r);
+    }
+    _lap(this, PH_DECODE);
+    // run partitions in parallel if we can open readers, else one after another
+    BOOL ok;
+    char *errmsg = NULL;
+    if (npart > 1 && !Db_inTransaction(this->db) && _openReaders(this, npart)) {
+        LOG_DEBUG1("_fcPquery: %d partitions in parallel", npart);
+        ok = _pqueryParallel(this, sql, lo, hi, npart, params, nparams, coltypes, ncols, NULL, &errmsg);
+    } else {
+        LOG_DEBUG1("_fcPquery: %d partitions serial", npart);
+        ok = _pquerySerial(this, sql, lo, hi, npart, params, nparams, coltypes, ncols, &errmsg);
+        if (!ok && !errmsg) {
+            errmsg = Arena_strdup(this->arena, Db_errmsg(this->db));
+        }
+        Db_finalize(this->db);
+        _lap(this, PH_STEP);
+    }
+    _endQuery(this, ok, errmsg);
+    _lap(this, PH_ENCODE);
+}
+
+/* _exportSerial runs the partitions one after another on the server's
+   connection, or the query once if npart is 0, and writes the rows to
+   the file in chunks. */
+static BOOL _exportSerial(App *this, const char *sql, int64_t lo, int64_t hi, int npart, Value *params, int nparams, const char *coltypes, int ncols, Export *export, char **perrmsg) {
+    BOOL ok = Db_prepare(this->db, sql);
+    _lap(this, PH_PREPARE);
+    Value *values = (Value *)Arena_alloc(this->arena, ncols * sizeof(Value));
+    BOOL codec = ok && export->format == EXPORT_BINARY && Db_setRowCodec(this->db, coltypes, ncols);
+    Writer *chunk = newBufWriter(PART_CHUNK_SIZE);
+    Writer_setCapacity(chunk, PART_CHUNK_SIZE, EXPORT_MAX_ROW);
+    if (ok && export->format == EXPORT_CSV) {
+        _writeCsvHeader(chunk, this->db, ncols);
+    }
+    for (int i = 0; ok && i < (npart ? npart : 1); i++) {
+        if (npart) {
+            _partBounds(lo, hi, npart, i, &params[0], &params[1]);
+            ok = Db_bind(this->db, params, nparams);
+        } else {
+            ok = Db_bind(this->db, params + 2, nparams - 2);
+        }
+        _lap(this, PH_BIND);
+        BOOL hasRow = TRUE;
+        while (ok && hasRow) {
+            for (int icol = 0; !codec && icol < ncols; icol++) {
+                values[icol].type = coltypes[icol];
+            }
+            ok = Db_step_fetch(this->db, &hasRow, values, codec ? 0 : ncols);
+            _lap(this, PH_STEP);
+            if (ok && hasRow) {
+                _formatRow(chunk, this->db, export->format, codec, values, ncols);
+                size_t len;
+                const char *data = Writer_data(chunk, &len);
+                if (Writer_full(chunk)) {
+                    char errmsg[128];
+                    snprintf(errmsg, sizeof(errmsg), "export: row exceeds max. size of %d bytes", EXPORT_MAX_ROW);
+                    *perrmsg = Arena_strdup(this->arena, errmsg);
+                    ok = FALSE;
+                    break;
+                }
+                export->rows++;
+                if (len >= PART_CHUNK_SIZE) {
+                    ok = _exportWrite(this, export, data, len, perrmsg);
+                    Writer_rewind(chunk, 0);
+                }
+                _lap(this, PH_ENCODE);
+            }
+        }
+        Db_reset(this->db);
+        _lap(this, PH_STEP);
+    }
+    if (ok) {
+        size_t len;
+        const char *data = Writer_data(chunk, &len);
+        ok = _exportWrite(this, export, data, len, perrmsg);
+    }
+    Writer_free(chunk);
+    return ok;
+}
+
+/* _fcExport runs a query like FC_PQUERY, or like FC_QUERY if npart is 0,
+   and writes the rows to a file instead of the response. The response
+   has only the number of rows and bytes. */
+static void _fcExport(App *this) {
+    const char *sql = Reader_readString(this->r);
+    int64_t lo = Reader_readInt64(this->r);
+    int64_t hi = Reader_readInt64(this->r);
+    int npart = Reader_readInt32(this->r);
+    if (npart < 0) {
+        npart = 0;
+    } else if (npart > 0 && hi <= lo) {
+        npart = 1;
+    } else if (npart > MAX_PARTITIONS) {
+        npart = MAX_PARTITIONS;
+    }
+    // params[0] and params[1] are the partition range, client params follow
+    int nparams = 2 + Reader_readInt32(this->r);
+    Value *params = (Value *)Arena_alloc(this->arena, nparams * sizeof(Value));
+    for (int iparam = 2; iparam < nparams; iparam++) {
+        _readParam(this->r, &params[iparam], iparam);
+    }
+    int ncols = Reader_readInt32(this->r);
+    char *coltypes = (char *)Arena_alloc(this->arena, ncols);
+    for (int icol = 0; icol < ncols; icol++) {
+        coltypes[icol] = Reader_readByte(this->r);
+    }
+    Export export = {0};
+    export.filename = Reader_readString(this->r);
+    export.format = Reader_readByte(this->r);
+    _lap(this, PH_DECODE);
+    BOOL ok = FALSE;
+    char *errmsg = NULL;
+    char buf[600];
+    if (export.format < EXPORT_CSV || export.format > EXPORT_BINARY) {
+        snprintf(buf, sizeof(buf), "export: invalid format %d", export.format);
+        errmsg = Arena_strdup(this->arena, buf);
+    } else if (!(export.fp = fopen(export.filename, "wb"))) {
+        snprintf(buf, sizeof(buf), "export: cannot open '%.500s'", export.filename);
+        errmsg = Arena_strdup(this->arena, buf);
+    } else if (npart > 1 && !Db_inTransaction(this->db) && _openReaders(this, npart)) {
+        LOG_DEBUG1("_fcExport: %d partitions in parallel", npart);
+        ok = _pqueryParallel(this, sql, lo, hi, npart, params, nparams, coltypes, ncols, &export, &errmsg);
+    } else {
+        LOG_DEBUG1("_fcExport: %d partitions serial", npart);
+        ok = _exportSerial(this, sql, lo, hi, npart, params, nparams, coltypes, ncols, &export, &errmsg);
+        if (!ok && !errmsg) {
+            errmsg = Arena_strdup(this->arena, Db_errmsg(this->db));
+        }
+        Db_finalize(this->db);
+        _lap(this, PH_STEP);
+    }
+    if (ok && export.format == EXPORT_BINARY) {
+        ok = _exportWrite(this, &export, "", 1, &errmsg);  // no more rows
+    }
+    if (export.fp) {
+        if (fclose(export.fp) != 0 && ok) {
+            snprintf(buf, sizeof(buf), "export: cannot write '%.500s'", export.filename);
+            errmsg = Arena_strdup(this->arena, buf);
+            ok = FALSE;
+        }
+        if (!ok) {
+            remove(export.filename);
+        }
     }
     Writer_writeByte(this->w, ok);
-    if (!ok) {
-        Writer_writeString(this->w, Db_errmsg(this->db));
+    if (ok) {
+        Writer_writeInt64(this->w, export.rows);
+        Writer_writeInt64(this->w, export.bytes);
+    } else {
+        Writer_writeString(this->w, errmsg);
+    }
+    LOG_INFO3("export: %" PRId64 " rows, %" PRId64 " bytes to '%s'", export.rows, export.bytes, export.filename);
+    _lap(this, PH_ENCODE);
+}
+
+/* App_stats adds the counters of all modules. */
+void App_stats(App *this, Stats *stats) {
+    ASSERT(this);
+    Stats_add(stats, "app.requests.exec", this->nrequests[FC_EXEC]);
+    Stats_add(stats, "app.requests.query", this->nrequests[FC_QUERY]);
+    Stats_add(stats, "app.requests.pquery", this->nrequests[FC_PQUERY]);
+    Stats_add(stats, "app.requests.stats", this->nrequests[FC_STATS]);
+    Stats_add(stats, "app.requests.execcol", this->nrequests[FC_EXECCOL]);
+    Stats_add(stats, "app.requests.import", this->nrequests[FC_IMPORT]);
+    Stats_add(stats, "app.requests.export", this->nrequests[FC_EXPORT]);
+    Stats_add(stats, "app.groups", this->ngroups);
+    Stats_add(stats, "app.grouped", this->ngrouped);
+    for (int fc = 0; fc <= FC_MAX; fc++) {
+        for (int ph = 0; ph < NPHASES; ph++) {
+            if (this->latency[fc][ph]) {
+                char name[64];
+                snprintf(name, sizeof(name), "app.latency.%s.%s", App_fcName(fc), phaseNames[ph]);
+                Histogram_stats(this->latency[fc][ph], stats, name);
+            }
+        }
+    }
+    Arena_stats(this->arena, stats, "arena");
+    Reader_stats(this->r, stats);
+    Writer_stats(this->w, stats);
+    Db_stats(this->db, stats);
+    for (int i = 0; i < MAX_PARTITIONS; i++) {
+        if (this->readers[i]) {
+            Db_stats(this->readers[i], stats);  // db.* are totals over all connections
+        }
+    }
+    Db_memoryStats(stats);
+    memStats(stats, STATS_MEM_SITES);
+}
+
+static void _fcStats(App *this) {
+    Stats_reset(this->stats);
+    App_stats(this, this->stats);
+    int n = Stats_count(this->stats);
+    Writer_writeByte(this->w, TRUE);  // ok
+    Writer_writeInt32(this->w, n);
+    for (int i = 0; i < n; i++) {
+        Writer_writeString(this->w, Stats_name(this->stats, i));
+        Writer_writeInt64(this->w, Stats_value(this->stats, i));
+    }
+}
+
+/* _reject answers a request whose frame exceeded the max. capacity of the
+   Reader. The frame has been skipped, only its function code was read. */
+static void _reject(App *this, char fc) {
+    char errmsg[128];
+    snprintf(errmsg, sizeof(errmsg), "request frame of %zu bytes exceeds max. frame size, see -bufmax", Reader_rejected(this->r));
+    LOG_INFO1("App_step: %s", errmsg);
+    if (fc == FC_EXEC || fc == FC_EXECCOL || fc == FC_EXPORT) {
+        Writer_writeByte(this->w, FALSE);
+        Writer_writeString(this->w, errmsg);
+    } else if (fc == FC_IMPORT) {
+        Writer_writeByte(this->w, 0);  // final record
+        Writer_writeByte(this->w, FALSE);
+        Writer_writeInt64(this->w, 0);
+        Writer_writeInt64(this->w, 0);
+        Writer_writeInt64(this->w, 0);
+        Writer_writeString(this->w, errmsg);
+    } else {
+        _endQuery(this, FALSE, errmsg);
     }
-    Db_finalize(this->db);
 }
 
 static void _fcQuit(App *this) {
@@ -180,8 +1522,33 @@ static void _fcQuit(App *this) {
 BOOL App_step(App *this) {
     ASSERT(this);
     LOG_DEBUG0("App_step: await request");
+    int64_t read0 = Reader_nanos(this->r);
     char fc = Reader_readByte(this->r);
+    int64_t start = nanotime();
+    int64_t firstRead = Reader_nanos(this->r) - read0;  // first frame, before start
+    int64_t write0 = Writer_nanos(this->w);
+    if (this->timing) {
+        memset(this->phases, 0, sizeof(this->phases));
+        this->lap = start;
+    }
+    int64_t traceName = 0;
+    if (0 <= fc && fc <= FC_MAX) {
+        this->nrequests[(int)fc]++;
+        traceName = this->traceNames[(int)fc];
+    }
+    if (traceName) {
+        Trace_event(this->trace, TR_BEGIN, traceName, 0);
+    }
     BOOL next = TRUE;
+    if (Reader_rejected(this->r) && (fc == FC_EXEC || fc == FC_QUERY || fc == FC_PQUERY || fc == FC_EXECCOL || fc == FC_IMPORT || fc == FC_EXPORT)) {
+        _reject(this, fc);
+        Writer_flush(this->w);
+        if (traceName) {
+            Trace_event(this->trace, TR_END, traceName, 0);
+        }
+        Arena_reset(this->arena);
+        return next;
+    }
     switch (fc) {
         case FC_EXEC:
             LOG_DEBUG0("App_step: FC_EXEC");
@@ -191,6 +1558,26 @@ BOOL App_step(App *this) {
             LOG_DEBUG0("App_step: FC_QUERY");
             _fcQuery(this);
             break;
+        case FC_PQUERY:
+            LOG_DEBUG0("App_step: FC_PQUERY");
+            _fcPquery(this);
+            break;
+        case FC_STATS:
+            LOG_DEBUG0("App_step: FC_STATS");
+            _fcStats(this);
+            break;
+        case FC_EXECCOL:
+            LOG_DEBUG0("App_step: FC_EXECCOL");
+            _fcExecCol(this);
+            break;
+        case FC_IMPORT:
+            LOG_DEBUG0("App_step: FC_IMPORT");
+            _fcImport(this);
+            break;
+        case FC_EXPORT:
+            LOG_DEBUG0("App_step: FC_EXPORT");
+            _fcExport(this);
+            break;
         case FC_QUIT:
             LOG_DEBUG0("App_step: FC_QUIT");
             _fcQuit(this);
@@ -201,6 +1588,26 @@ BOOL App_step(App *this) {
             break;
     }
     Writer_flush(this->w);
+    _lap(this, PH_ENCODE);
+    _recordLatency(this, fc, PH_TOTAL, nanotime() - start + firstRead);
+    if (this->timing) {
+        // frames are read while decoding and written while encoding
+        int64_t read = Reader_nanos(this->r) - read0;
+        int64_t flush = Writer_nanos(this->w) - write0;
+        this->phases[PH_READ] = read;
+        this->phases[PH_DECODE] -= read - firstRead;
+        this->phases[PH_FLUSH] = flush;
+        this->phases[PH_ENCODE] -= flush;
+        for (int ph = PH_TOTAL + 1; ph < NPHASES; ph++) {
+            if (this->phases[ph] > 0) {
+                _recordLatency(this, fc, ph, this->phases[ph]);
+            }
+        }
+    }
+    if (traceName) {
+        Trace_event(this->trace, TR_END, traceName, 0);
+    }
+    Arena_reset(this->arena);
     return next;
 }
 
@@ -358,6 +1765,24 @@ static void testValueTypesAndErrors() {
         ASSERT_INT(0, Reader_readByte(r));              // no more rows
         ASSERT_INT(1, Reader_readByte(r));              // ok
     }
+    {
+        // an empty blob
+        Writer_writeByte(w, FC_QUERY);
+        Writer_writeString(w, "SELECT x''");
+        Writer_writeInt32(w, 0);        // 0 params
+        Writer_writeInt32(w, 1);        // 1 column
+        Writer_writeByte(w, VT_BLOB);   // columns[0].type
+        //
+        ASSERT(App_step(app));
+        //
+        ASSERT_INT(1, Reader_readByte(r));        // has row
+        ASSERT_INT(VT_BLOB, Reader_readByte(r));  // value type
+        size_t len;
+        Reader_readBlob(r, &len);
+        ASSERT_INT(0, len);                       // value length
+        ASSERT_INT(0, Reader_readByte(r));        // no more rows
+        ASSERT_INT(1, Reader_readByte(r));        // ok
+    }
     {
         Writer_writeByte(w, FC_QUERY);
         Writer_writeString(w, "SELECT i,d,s,b FROM users WHERE i>? ORDER BY i");
@@ -640,9 +2065,857 @@ static void testValueTypesAndErrors() {
     Db_free(db);
 }
 
+static void _testPquery(const char *dbname) {
+    // setup
+    Db *db = newDb(dbname, FALSE);
+    ASSERT(Db_setStmtStats(db, 16));
+    char buf[4 * 1024];
+    Reader *r = newMemReader(buf, sizeof(buf));
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    {
+        Writer_writeByte(w, FC_EXEC);
+        Writer_writeString(w, "PRAGMA journal_mode=WAL");
+        Writer_writeInt32(w, 1);  // 1 iteration
+        Writer_writeInt32(w, 0);  // 0 params per iteration
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+    }
+    {
+        Writer_writeByte(w, FC_EXEC);
+        Writer_writeString(w, "CREATE TABLE items(id INTEGER PRIMARY KEY NOT NULL)");
+        Writer_writeInt32(w, 1);  // 1 iteration
+        Writer_writeInt32(w, 0);  // 0 params per iteration
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+    }
+    {
+        Writer_writeByte(w, FC_EXEC);
+        Writer_writeString(w, "INSERT INTO items(id) VALUES(?)");
+        Writer_writeInt32(w, 100);  // 100 iterations
+        Writer_writeInt32(w, 1);    // 1 param per iteration
+        for (int i = 1; i <= 100; i++) {
+            Writer_writeByte(w, VT_INT64);
+            Writer_writeInt64(w, i);
+        }
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+    }
+    {
+        // rows of all partitions, merged in partition order
+        Writer_writeByte(w, FC_PQUERY);
+        Writer_writeString(w, "SELECT id FROM items WHERE id >= ?1 AND id < ?2 AND id % ?3 = 0 ORDER BY id");
+        Writer_writeInt64(w, 1);        // lo
+        Writer_writeInt64(w, 101);      // hi
+        Writer_writeInt32(w, 4);        // 4 partitions
+        Writer_writeInt32(w, 1);        // 1 param
+        Writer_writeByte(w, VT_INT64);  //     param 0 type
+        Writer_writeInt64(w, 2);        //     param 0 value
+        Writer_writeInt32(w, 1);        // 1 column
+        Writer_writeByte(w, VT_INT64);  //     column 0 type
+        ASSERT(App_step(app));
+        for (int i = 2; i <= 100; i += 2) {
+            ASSERT_INT(1, Reader_readByte(r));         // has row
+            ASSERT_INT(VT_INT64, Reader_readByte(r));  //   value type
+            ASSERT_INT64(i, Reader_readInt64(r));      //   value
+        }
+        ASSERT_INT(0, Reader_readByte(r));  // no more rows
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+    }
+    {
+        // partial aggregates, one row per partition
+        Writer_writeByte(w, FC_PQUERY);
+        Writer_writeString(w, "SELECT COUNT(*) FROM items WHERE id >= ? AND id < ?");
+        Writer_writeInt64(w, 1);        // lo
+        Writer_writeInt64(w, 101);      // hi
+        Writer_writeInt32(w, 3);        // 3 partitions
+        Writer_writeInt32(w, 0);        // 0 params
+        Writer_writeInt32(w, 1);        // 1 column
+        Writer_writeByte(w, VT_INT32);  //     column 0 type
+        ASSERT(App_step(app));
+        int counts[] = {34, 33, 33};
+        for (int i = 0; i < 3; i++) {
+            ASSERT_INT(1, Reader_readByte(r));         // has row
+            ASSERT_INT(VT_INT32, Reader_readByte(r));  //   value type
+            ASSERT_INT(counts[i], Reader_readInt32(r));
+        }
+        ASSERT_INT(0, Reader_readByte(r));  // no more rows
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+    }
+    {
+        Writer_writeByte(w, FC_PQUERY);
+        Writer_writeString(w, "SELECT id FROM no_such_table WHERE id >= ? AND id < ?");
+        Writer_writeInt64(w, 1);        // lo
+        Writer_writeInt64(w, 101);      // hi
+        Writer_writeInt32(w, 2);        // 2 partitions
+        Writer_writeInt32(w, 0);        // 0 params
+        Writer_writeInt32(w, 1);        // 1 column
+        Writer_writeByte(w, VT_INT64);  //     column 0 type
+        ASSERT(App_step(app));
+        ASSERT_INT(0, Reader_readByte(r));  // no more rows
+        ASSERT_INT(0, Reader_readByte(r));  // not ok
+        ASSERT_STR("no such table: no_such_table", Reader_readString(r));
+    }
+    {
+        // statements of reader connections show up in the writer's stats
+        const char *sql = "SELECT calls FROM sqinn_stmt_stats WHERE sql LIKE 'SELECT COUNT(*) FROM items%'";
+        ASSERT(Db_prepare(db, sql));
+        BOOL hasRow = FALSE;
+        Value calls;
+        calls.type = VT_INT64;
+        ASSERT(Db_step_fetch(db, &hasRow, &calls, 1));
+        ASSERT(hasRow);
+        ASSERT(calls.i64 >= 1);
+        Db_finalize(db);
+    }
+    // free
+    App_free(app);
+    Writer_free(w);
+    Reader_free(r);
+    Db_free(db);
+}
+
+static void testPquery() {
+    // serial on in-memory databases, parallel on database files
+    _testPquery(":memory:");
+    const char *dbname = "sqinn_test_pquery.db";
+    remove(dbname);
+    _testPquery(dbname);
+    remove(dbname);
+}
+
+static void _writeExec(Writer *w, const char *sql) {
+    Writer_writeByte(w, FC_EXEC);
+    Writer_writeString(w, sql);
+    Writer_writeInt32(w, 1);  // 1 iteration
+    Writer_writeInt32(w, 0);  // 0 params per iteration
+}
+
+static void _writeCount(Writer *w) {
+    Writer_writeByte(w, FC_QUERY);
+    Writer_writeString(w, "SELECT COUNT(*) FROM users");
+    Writer_writeInt32(w, 0);        // 0 params
+    Writer_writeInt32(w, 1);        // 1 column
+    Writer_writeByte(w, VT_INT32);  //     column 0 type
+}
+
+static void testGroupCommit() {
+    // setup: pipelined requests, read from a buffer that holds all of them
+    Db *db = newDb(":memory:", FALSE);
+    char reqbuf[2 * 1024];
+    Writer *wreq = newMemWriter(reqbuf, sizeof(reqbuf));
+    _writeExec(wreq, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL)");
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(1)");
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(1)");  // must fail
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(2)");
+    _writeCount(wreq);
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(5)");
+    _writeExec(wreq, "INSERT OR ROLLBACK INTO users(id) VALUES(1)");  // rolls back the group
+    _writeCount(wreq);
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(3)");
+    _writeExec(wreq, "BEGIN");  // must not run inside the group
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(4)");
+    _writeExec(wreq, "COMMIT");
+    _writeCount(wreq);
+    Writer_writeByte(wreq, FC_QUIT);
+    size_t reqlen;
+    Writer_data(wreq, &reqlen);
+    char buf[2 * 1024];
+    Reader *r = newMemReader(reqbuf, reqlen);
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    Reader *rres = newMemReader(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    App_setGroupCommit(app, 10, 0);
+    // first group: CREATE TABLE and three INSERTs
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT(0, Reader_readByte(rres));  // not ok
+    ASSERT_STR("UNIQUE constraint failed: users.id", Reader_readString(rres));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT64(1, app->ngroups);
+    ASSERT_INT64(4, app->ngrouped);
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));         // has row
+    ASSERT_INT(VT_INT32, Reader_readByte(rres));  //   value type
+    ASSERT_INT(2, Reader_readInt32(rres));        //   count
+    ASSERT_INT(0, Reader_readByte(rres));         // no more rows
+    ASSERT_INT(1, Reader_readByte(rres));         // ok
+    // second group: the last request rolls back the INSERT before it
+    ASSERT(App_step(app));
+    ASSERT_INT(0, Reader_readByte(rres));  // not ok
+    ASSERT_STR("group commit: transaction was rolled back", Reader_readString(rres));
+    ASSERT_INT(0, Reader_readByte(rres));  // not ok
+    ASSERT_STR("UNIQUE constraint failed: users.id", Reader_readString(rres));
+    ASSERT(!Db_inTransaction(db));
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));         // has row
+    ASSERT_INT(VT_INT32, Reader_readByte(rres));  //   value type
+    ASSERT_INT(2, Reader_readInt32(rres));        //   count
+    ASSERT_INT(0, Reader_readByte(rres));         // no more rows
+    ASSERT_INT(1, Reader_readByte(rres));         // ok
+    // third group: INSERT, then BEGIN outside the group
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT(Db_inTransaction(db));
+    // explicit transactions are not grouped
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT64(3, app->ngroups);
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));         // has row
+    ASSERT_INT(VT_INT32, Reader_readByte(rres));  //   value type
+    ASSERT_INT(4, Reader_readInt32(rres));        //   count
+    ASSERT_INT(0, Reader_readByte(rres));         // no more rows
+    ASSERT_INT(1, Reader_readByte(rres));         // ok
+    ASSERT(!App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT(!Reader_hasInput(r, 0));
+    // free
+    App_free(app);
+    Reader_free(rres);
+    Writer_free(w);
+    Reader_free(r);
+    Writer_free(wreq);
+    Db_free(db);
+}
+
+static void testGroupCommitStandalone() {
+    // setup
+    Db *db = newDb(":memory:", FALSE);
+    char reqbuf[1024];
+    Writer *wreq = newMemWriter(reqbuf, sizeof(reqbuf));
+    _writeExec(wreq, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL)");
+    _writeCount(wreq);
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(1)");
+    _writeExec(wreq, "VACUUM");  // must not run inside the group
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(2)");
+    _writeExec(wreq, "  pragma user_version = 7");
+    size_t reqlen;
+    Writer_data(wreq, &reqlen);
+    char buf[1024];
+    Reader *r = newMemReader(reqbuf, reqlen);
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    Reader *rres = newMemReader(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    App_setGroupCommit(app, 10, 0);
+    // a request without a FC_EXEC behind it is not grouped
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT64(0, app->ngroups);
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // has row
+    Reader_readByte(rres);
+    Reader_readInt32(rres);
+    ASSERT_INT(0, Reader_readByte(rres));  // no more rows
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    // INSERT in a group, VACUUM after its COMMIT
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT64(1, app->ngroups);
+    ASSERT_INT64(2, app->ngrouped);
+    // INSERT, then PRAGMA after its COMMIT
+    ASSERT(App_step(app));
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT_INT(1, Reader_readByte(rres));  // ok
+    ASSERT(!Db_inTransaction(db));
+    ASSERT(!Reader_hasInput(r, 0));
+    ASSERT(Db_prepare(db, "PRAGMA user_version"));
+    BOOL hasRow;
+    Value version = {VT_INT32};
+    ASSERT(Db_step_fetch(db, &hasRow, &version, 1));
+    ASSERT_INT(7, version.i32);
+    Db_finalize(db);
+    // free
+    App_free(app);
+    Reader_free(rres);
+    Writer_free(w);
+    Reader_free(r);
+    Writer_free(wreq);
+    Db_free(db);
+}
+
+static void testSteadyState() {
+    // setup: the same requests, over and over
+    Db *db = newDb(":memory:", FALSE);
+    Db_exec(db, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL, name TEXT)");
+    int nrequests = 20;
+    char reqbuf[4 * 1024];
+    Writer *wreq = newMemWriter(reqbuf, sizeof(reqbuf));
+    for (int i = 0; i < nrequests; i++) {
+        Writer_writeByte(wreq, FC_EXEC);
+        Writer_writeString(wreq, "INSERT INTO users(id, name) VALUES(?, ?)");
+        Writer_writeInt32(wreq, 1);  // 1 iteration
+        Writer_writeInt32(wreq, 2);  // 2 params per iteration
+        Writer_writeByte(wreq, VT_INT32);
+        Writer_writeInt32(wreq, i);
+        Writer_writeByte(wreq, VT_STRING);
+        Writer_writeString(wreq, "Alice");
+        Writer_writeByte(wreq, FC_QUERY);
+        Writer_writeString(wreq, "SELECT id, name FROM users WHERE id = ?");
+        Writer_writeInt32(wreq, 1);  // 1 param
+        Writer_writeByte(wreq, VT_INT32);
+        Writer_writeInt32(wreq, i);
+        Writer_writeInt32(wreq, 2);  // 2 columns
+        Writer_writeByte(wreq, VT_INT32);
+        Writer_writeByte(wreq, VT_STRING);
+    }
+    size_t reqlen;
+    Writer_data(wreq, &reqlen);
+    char buf[1024];
+    Reader *r = newMemReader(reqbuf, reqlen);
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    // warm up caches, then expect no more heap allocations
+    ASSERT(App_step(app));
+    ASSERT(App_step(app));
+    int before = mallocs;
+    for (int i = 1; i < nrequests; i++) {
+        ASSERT(App_step(app));
+        ASSERT(App_step(app));
+    }
+    ASSERT_INT(before, mallocs);
+    // free
+    App_free(app);
+    Writer_free(w);
+    Reader_free(r);
+    Writer_free(wreq);
+    Db_free(db);
+}
+
+static void testStats() {
+    // setup
+    Db *db = newDb(":memory:", FALSE);
+    Db_setStmtCacheSize(db, 64);
+    char reqbuf[1024];
+    Writer *wreq = newMemWriter(reqbuf, sizeof(reqbuf));
+    _writeExec(wreq, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL)");
+    _writeCount(wreq);
+    Writer_writeByte(wreq, FC_STATS);
+    size_t reqlen;
+    Writer_data(wreq, &reqlen);
+    static char buf[64 * 1024];
+    Reader *r = newMemReader(reqbuf, reqlen);
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    App_setTiming(app, TRUE);
+    ASSERT(App_step(app));
+    ASSERT(App_step(app));
+    ASSERT(App_step(app));
+    // response
+    Reader *rres = newMemReader(buf, sizeof(buf));
+    ASSERT_INT(1, Reader_readByte(rres));  // FC_EXEC ok
+    ASSERT_INT(1, Reader_readByte(rres));         // FC_QUERY has row
+    ASSERT_INT(VT_INT32, Reader_readByte(rres));  //   value type
+    ASSERT_INT(0, Reader_readInt32(rres));        //   count
+    ASSERT_INT(0, Reader_readByte(rres));         // no more rows
+    ASSERT_INT(1, Reader_readByte(rres));         // ok
+    ASSERT_INT(1, Reader_readByte(rres));  // FC_STATS ok
+    int n = Reader_readInt32(rres);
+    Stats *stats = newStats();
+    for (int i = 0; i < n; i++) {
+        const char *name = Reader_readString(rres);
+        Stats_add(stats, name, Reader_readInt64(rres));
+    }
+    ASSERT_INT64(1, Stats_get(stats, "app.requests.exec", -1));
+    ASSERT_INT64(1, Stats_get(stats, "app.requests.query", -1));
+    ASSERT_INT64(1, Stats_get(stats, "app.requests.stats", -1));
+    ASSERT_INT64(2, Stats_get(stats, "db.stmtCacheSize", -1));
+    ASSERT_INT64(1, Stats_get(stats, "db.connections", -1));
+    ASSERT(Stats_get(stats, "sqlite.memoryUsed", -1) > 0);
+    ASSERT(Stats_get(stats, "db.schemaUsed", -1) > 0);
+    ASSERT(Stats_get(stats, "mem.mallocs", -1) > 0);
+    ASSERT_INT64(-1, Stats_get(stats, "no.such.stat", -1));
+    // latency of the requests before FC_STATS
+    ASSERT_INT64(1, Stats_get(stats, "app.latency.exec.total.count", -1));
+    ASSERT_INT64(1, Stats_get(stats, "app.latency.exec.prepare.count", -1));
+    ASSERT_INT64(1, Stats_get(stats, "app.latency.query.total.count", -1));
+    ASSERT_INT64(1, Stats_get(stats, "app.latency.query.step.count", -1));
+    ASSERT(Stats_get(stats, "app.latency.query.total.max", -1) >= Stats_get(stats, "app.latency.query.step.max", -1));
+    ASSERT_INT64(-1, Stats_get(stats, "app.latency.stats.total.count", -1));
+    // free
+    Stats_free(stats);
+    Reader_free(rres);
+    App_free(app);
+    Writer_free(w);
+    Reader_free(r);
+    Writer_free(wreq);
+    Db_free(db);
+}
+
+static void testResponseLimit() {
+    // setup: a response writer with a small max. capacity
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL, name TEXT)"));
+    ASSERT(Db_exec(db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i < 100) INSERT INTO users(id, name) SELECT i, 'Alice' FROM n"));
+    ASSERT(Db_exec(db, "INSERT INTO users(id, name) VALUES(101, hex(zeroblob(1000)))"));
+    char reqbuf[1024];
+    Writer *wreq = newMemWriter(reqbuf, sizeof(reqbuf));
+    Writer_writeByte(wreq, FC_QUERY);
+    Writer_writeString(wreq, "SELECT name FROM users ORDER BY id");
+    Writer_writeInt32(wreq, 0);         // 0 params
+    Writer_writeInt32(wreq, 1);         // 1 column
+    Writer_writeByte(wreq, VT_STRING);  //     column 0 type
+    _writeCount(wreq);
+    size_t reqlen;
+    Writer_data(wreq, &reqlen);
+    Reader *r = newMemReader(reqbuf, reqlen);
+    FILE *f = tmpfile();
+    ASSERT(f);
+    Writer *w = newFdWriter(fileno(f));
+    Writer_setCapacity(w, 256, 1024);
+    App *app = newApp(db, r, w);
+    ASSERT(App_step(app));
+    ASSERT(App_step(app));
+    // the rows are split across frames, the row that does not fit fails the query
+    static char buf[16 * 1024];
+    rewind(f);
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    size_t len = 0;
+    for (size_t off = 0; off < n; ) {
+        Reader *rlen = newMemReader(buf + off, 4);
+        size_t flen = (size_t)Reader_readInt32(rlen);
+        Reader_free(rlen);
+        ASSERT(flen <= 1024);
+        memmove(buf + len, buf + off + 4, flen);
+        len += flen;
+        off += 4 + flen;
+    }
+    Reader *rres = newMemReader(buf, len);
+    for (int i = 0; i < 100; i++) {
+        ASSERT_INT(1, Reader_readByte(rres));          // has row
+        ASSERT_INT(VT_STRING, Reader_readByte(rres));  //   value type
+        ASSERT_STR("Alice", Reader_readString(rres));  //   name
+    }
+    ASSERT_INT(0, Reader_readByte(rres));  // no more rows
+    ASSERT_INT(0, Reader_readByte(rres));  // not ok
+    ASSERT_STR("row exceeds max. frame size of 1024 bytes, see -bufmax", Reader_readString(rres));
+    // the next request works
+    ASSERT_INT(1, Reader_readByte(rres));         // has row
+    ASSERT_INT(VT_INT32, Reader_readByte(rres));  //   value type
+    ASSERT_INT(101, Reader_readInt32(rres));      //   count
+    ASSERT_INT(0, Reader_readByte(rres));         // no more rows
+    ASSERT_INT(1, Reader_readByte(rres));         // ok
+    // free
+    Reader_free(rres);
+    App_free(app);
+    Writer_free(w);
+    fclose(f);
+    Reader_free(r);
+    Writer_free(wreq);
+    Db_free(db);
+}
+
+static void testTrace() {
+    // setup
+    const char *filename = "sqinn_test_app.trace";
+    Trace *trace = newTrace(filename, 1024);
+    ASSERT(trace);
+    Db *db = newDb(":memory:", FALSE);
+    char reqbuf[1024];
+    Writer *wreq = newMemWriter(reqbuf, sizeof(reqbuf));
+    _writeExec(wreq, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL)");
+    _writeExec(wreq, "INSERT INTO users(id) VALUES(1)");
+    _writeCount(wreq);
+    size_t reqlen;
+    Writer_data(wreq, &reqlen);
+    char buf[1024];
+    Reader *r = newMemReader(reqbuf, reqlen);
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    App_setTrace(app, trace);
+    ASSERT(App_step(app));
+    ASSERT(App_step(app));
+    ASSERT(App_step(app));
+    App_free(app);
+    Db_free(db);
+    Trace_free(trace);
+    // requests are spans, statements are spans with their rows
+    FILE *out = tmpfile();
+    ASSERT(out);
+    ASSERT(traceToJson(filename, out));
+    static char json[16 * 1024];
+    rewind(out);
+    size_t n = fread(json, 1, sizeof(json) - 1, out);
+    json[n] = 0;
+    fclose(out);
+    ASSERT(strstr(json, "{\"name\":\"exec\",\"cat\":\"request\",\"ph\":\"B\""));
+    ASSERT(strstr(json, "{\"name\":\"query\",\"cat\":\"request\",\"ph\":\"E\""));
+    ASSERT(strstr(json, "{\"name\":\"INSERT INTO users(id) VALUES(1)\",\"cat\":\"sql\",\"ph\":\"X\""));
+    char *count = strstr(json, "{\"name\":\"SELECT COUNT(*) FROM users\",\"cat\":\"sql\",\"ph\":\"X\"");
+    ASSERT(count);
+    ASSERT(strstr(count, "\"args\":{\"rows\":1,"));
+    // free
+    remove(filename);
+    Writer_free(w);
+    Reader_free(r);
+    Writer_free(wreq);
+}
+
+static void testExecCol() {
+    // setup
+    Db *db = newDb(":memory:", FALSE);
+    static char buf[64 * 1024];
+    Reader *r = newMemReader(buf, sizeof(buf));
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    ASSERT(Db_exec(db, "CREATE TABLE t(a INTEGER, b REAL, c TEXT, d BLOB, e INTEGER)"));
+    // columns of 600 iterations, more than one block
+    const int niter = 600;
+    unsigned char anulls[(600 + 7) / 8] = {0};
+    unsigned char cnulls[(600 + 7) / 8] = {0};
+    Writer *a = newBufWriter(1024);
+    Writer *b = newBufWriter(1024);
+    Writer *c = newBufWriter(1024);
+    Writer *d = newBufWriter(1024);
+    Writer *e = newBufWriter(1024);
+    int64_t sumA = 0, countA = 0, countC = 0, lenC = 0, lenD = 0, sumE = 0;
+    double sumB = 0;
+    for (int i = 0; i < niter; i++) {
+        Writer_writeInt64(a, 1000000000000LL + i);
+        if (i % 7 == 0) {
+            anulls[i >> 3] |= 1 << (i & 7);
+        } else {
+            sumA += 1000000000000LL + i;
+            countA++;
+        }
+        Writer_writeDouble(b, i + 0.5);
+        sumB += i + 0.5;
+        if (i % 5 == 0) {
+            cnulls[i >> 3] |= 1 << (i & 7);
+        } else {
+            char str[32];
+            snprintf(str, sizeof(str), "str%d", i);
+            Writer_writeString(c, str);
+            countC++;
+            lenC += strlen(str);
+        }
+        char bytes[3] = {1, 2, 3};
+        Writer_writeBlob(d, bytes, i % 4);
+        lenD += i % 4;
+        Writer_writeInt32(e, -i);
+        sumE -= i;
+    }
+    {
+        Writer_writeByte(w, FC_EXECCOL);
+        Writer_writeString(w, "INSERT INTO t(a, b, c, d, e) VALUES (?, ?, ?, ?, ?)");
+        Writer_writeInt32(w, niter);
+        Writer_writeInt32(w, 5);
+        Writer_writeByte(w, VT_INT64);
+        Writer_writeByte(w, VT_DOUBLE);
+        Writer_writeByte(w, VT_STRING);
+        Writer_writeByte(w, VT_BLOB);
+        Writer_writeByte(w, VT_INT32);
+        Writer *cols[5] = {a, b, c, d, e};
+        for (int i = 0; i < 5; i++) {
+            Writer_writeBlob(w, (const char *)(i == 0 ? anulls : cnulls), i == 0 || i == 2 ? sizeof(anulls) : 0);
+            size_t len;
+            const char *data = Writer_data(cols[i], &len);
+            Writer_writeBlob(w, data, len);
+        }
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+    }
+    {
+        Writer_writeByte(w, FC_QUERY);
+        Writer_writeString(w, "SELECT count(*), count(a), sum(a), sum(b), count(c), sum(length(c)), sum(length(d)), sum(e) FROM t");
+        Writer_writeInt32(w, 0);
+        Writer_writeInt32(w, 8);
+        const char coltypes[8] = {VT_INT64, VT_INT64, VT_INT64, VT_DOUBLE, VT_INT64, VT_INT64, VT_INT64, VT_INT64};
+        for (int i = 0; i < 8; i++) {
+            Writer_writeByte(w, coltypes[i]);
+        }
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // has row
+        int64_t want[8] = {niter, countA, sumA, 0, countC, lenC, lenD, sumE};
+        for (int i = 0; i < 8; i++) {
+            ASSERT_INT(coltypes[i], Reader_readByte(r));
+            if (coltypes[i] == VT_DOUBLE) {
+                ASSERT_DOUBLE(sumB, Reader_readDouble(r));
+            } else {
+                ASSERT_INT64(want[i], Reader_readInt64(r));
+            }
+        }
+        ASSERT_INT(0, Reader_readByte(r));  // no more rows
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+    }
+    // invalid columns are reported before anything is executed
+    struct {
+        char type;
+        const char *data;
+        size_t len;
+        const char *errmsg;
+    } cases[] = {
+        {VT_INT64, "\0\0\0\0\0\0\0\1", 8, "param 0: data of 8 bytes, want 16"},
+        {VT_STRING, "\0\0\0\2x\0\0\0\0\2xy", 12, "param 0: invalid string at iteration 1"},
+        {VT_STRING, "\0\0\0\2x\0\0\0\0\2y\0\0", 13, "param 0: 1 bytes after last value"},
+        {VT_BLOB, "\0\0\0\1x\0\0\0\7y", 10, "param 0: invalid blob at iteration 1"},
+        {9, "", 0, "param 0: invalid type 9"},
+    };
+    for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+        Writer_writeByte(w, FC_EXECCOL);
+        Writer_writeString(w, "INSERT INTO t(a) VALUES (?)");
+        Writer_writeInt32(w, 2);
+        Writer_writeInt32(w, 1);
+        Writer_writeByte(w, cases[i].type);
+        Writer_writeBlob(w, "", 0);
+        Writer_writeBlob(w, cases[i].data, cases[i].len);
+        ASSERT(App_step(app));
+        ASSERT_INT(0, Reader_readByte(r));  // not ok
+        ASSERT_STR(cases[i].errmsg, Reader_readString(r));
+    }
+    {
+        // a wrong null bitmap
+        Writer_writeByte(w, FC_EXECCOL);
+        Writer_writeString(w, "INSERT INTO t(a) VALUES (?)");
+        Writer_writeInt32(w, 9);
+        Writer_writeInt32(w, 1);
+        Writer_writeByte(w, VT_INT32);
+        char data[36] = {0};
+        Writer_writeBlob(w, "\1", 1);
+        Writer_writeBlob(w, data, sizeof(data));
+        ASSERT(App_step(app));
+        ASSERT_INT(0, Reader_readByte(r));  // not ok
+        ASSERT_STR("param 0: null bitmap of 1 bytes, want 2", Reader_readString(r));
+    }
+    {
+        // counts that cannot be right are rejected before anything is allocated
+        Writer_writeByte(w, FC_EXECCOL);
+        Writer_writeString(w, "INSERT INTO t(a) VALUES (?)");
+        Writer_writeInt32(w, 1);
+        Writer_writeInt32(w, -1);
+        ASSERT(App_step(app));
+        ASSERT_INT(0, Reader_readByte(r));  // not ok
+        ASSERT_STR("invalid request: 1 iterations, -1 params", Reader_readString(r));
+        Writer_writeByte(w, FC_EXECCOL);
+        Writer_writeString(w, "INSERT INTO t(a) VALUES (?)");
+        Writer_writeInt32(w, 1);
+        Writer_writeInt32(w, 0x7fffffff);
+        ASSERT(App_step(app));
+        ASSERT_INT(0, Reader_readByte(r));  // not ok
+        ASSERT(strstr(Reader_readString(r), "invalid request: 2147483647 params do not fit into a frame of "));
+    }
+    ASSERT(Db_prepare(db, "SELECT count(*) FROM t"));
+    BOOL hasRow;
+    Value count = {VT_INT64};
+    ASSERT(Db_step_fetch(db, &hasRow, &count, 1));
+    ASSERT_INT64(niter, count.i64);
+    Db_finalize(db);
+    // free
+    Writer_free(a);
+    Writer_free(b);
+    Writer_free(c);
+    Writer_free(d);
+    Writer_free(e);
+    App_free(app);
+    Writer_free(w);
+    Reader_free(r);
+    Db_free(db);
+}
+
+static void _writeImport(Writer *w, const char *filename, int batch) {
+    Writer_writeByte(w, FC_IMPORT);
+    Writer_writeString(w, filename);
+    Writer_writeString(w, "t");
+    Writer_writeInt32(w, 2);
+    Writer_writeString(w, "id");
+    Writer_writeString(w, "name");
+    Writer_writeByte(w, ',');
+    Writer_writeByte(w, TRUE);  // header
+    Writer_writeInt32(w, 0);    // default threads
+    Writer_writeInt32(w, batch);
+}
+
+static void testImportRequest() {
+    // setup
+    const char *filename = "sqinn_test_app.csv";
+    FILE *fp = fopen(filename, "wb");
+    ASSERT(fp);
+    fprintf(fp, "id,name\n");
+    for (int i = 1; i <= 250; i++) {
+        fprintf(fp, "%d,name %d\n", i, i);
+    }
+    fclose(fp);
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT)"));
+    static char buf[64 * 1024];
+    Reader *r = newMemReader(buf, sizeof(buf));
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    // one progress record per batch, then the final record
+    _writeImport(w, filename, 100);
+    ASSERT(App_step(app));
+    int64_t want[] = {100, 200, 250};
+    for (int i = 0; i < 3; i++) {
+        ASSERT_INT(1, Reader_readByte(r));  // progress
+        ASSERT_INT64(want[i], Reader_readInt64(r));
+        ASSERT(Reader_readInt64(r) > 0);    // bytes
+        ASSERT(Reader_readInt64(r) > 0);    // nanos
+    }
+    ASSERT_INT(0, Reader_readByte(r));  // final
+    ASSERT_INT(1, Reader_readByte(r));  // ok
+    ASSERT_INT64(250, Reader_readInt64(r));
+    ASSERT(Reader_readInt64(r) > 0);
+    ASSERT(Reader_readInt64(r) > 0);
+    // the same rows again violate the primary key
+    _writeImport(w, filename, 0);
+    ASSERT(App_step(app));
+    ASSERT_INT(0, Reader_readByte(r));  // final
+    ASSERT_INT(0, Reader_readByte(r));  // not ok
+    ASSERT_INT64(0, Reader_readInt64(r));
+    ASSERT_INT64(0, Reader_readInt64(r));
+    ASSERT(Reader_readInt64(r) > 0);
+    ASSERT_STR("UNIQUE constraint failed: t.id", Reader_readString(r));
+    // free
+    App_free(app);
+    Writer_free(w);
+    Reader_free(r);
+    Db_free(db);
+    remove(filename);
+}
+
+static void _writeExport(Writer *w, const char *sql, int npart, const char *filename, int format) {
+    Writer_writeByte(w, FC_EXPORT);
+    Writer_writeString(w, sql);
+    Writer_writeInt64(w, 1);     // lo
+    Writer_writeInt64(w, 1001);  // hi
+    Writer_writeInt32(w, npart);
+    Writer_writeInt32(w, 0);     // 0 params
+    Writer_writeInt32(w, 4);     // 4 columns
+    Writer_writeByte(w, VT_INT64);
+    Writer_writeByte(w, VT_STRING);
+    Writer_writeByte(w, VT_DOUBLE);
+    Writer_writeByte(w, VT_BLOB);
+    Writer_writeString(w, filename);
+    Writer_writeByte(w, format);
+}
+
+static size_t _readFile(const char *filename, char *buf, size_t size) {
+    FILE *fp = fopen(filename, "rb");
+    ASSERT(fp);
+    size_t n = fread(buf, 1, size - 1, fp);
+    fclose(fp);
+    buf[n] = 0;
+    return n;
+}
+
+static void testExport() {
+    // setup
+    const char *dbname = "sqinn_test_export.db";
+    const char *filename = "sqinn_test_export.out";
+    remove(dbname);
+    Db *db = newDb(dbname, FALSE);
+    static char buf[64 * 1024];
+    Reader *r = newMemReader(buf, sizeof(buf));
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    ASSERT(Db_exec(db, "PRAGMA journal_mode=WAL"));
+    ASSERT(Db_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, score REAL, data BLOB)"));
+    ASSERT(Db_exec(db, "INSERT INTO t VALUES(1, 'plain', 1.5, NULL), (2, 'say \"hi\", bye', NULL, x'00ff'), (3, '', -2, x'')"));
+    static char file[256 * 1024];
+    {
+        // CSV, with a header
+        _writeExport(w, "SELECT id, name, score, data FROM t ORDER BY id", 0, filename, EXPORT_CSV);
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+        ASSERT_INT64(3, Reader_readInt64(r));
+        ASSERT_INT64(67, Reader_readInt64(r));
+        ASSERT_INT(67, _readFile(filename, file, sizeof(file)));
+        ASSERT_STR("id,name,score,data\n1,plain,1.5,\n2,\"say \"\"hi\"\", bye\",,00ff\n3,\"\",-2,\n", file);
+    }
+    {
+        // JSONL
+        _writeExport(w, "SELECT id, name, score, data AS \"da\ta\" FROM t WHERE id < 3 ORDER BY id", 0, filename, EXPORT_JSONL);
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+        ASSERT_INT64(2, Reader_readInt64(r));
+        Reader_readInt64(r);
+        _readFile(filename, file, sizeof(file));
+        ASSERT_STR("{\"id\":1,\"name\":\"plain\",\"score\":1.5,\"da\\ta\":null}\n"
+            "{\"id\":2,\"name\":\"say \\\"hi\\\", bye\",\"score\":null,\"da\\ta\":\"00ff\"}\n", file);
+    }
+    {
+        // binary, the rows of a FC_QUERY response
+        _writeExport(w, "SELECT id, name, score, data FROM t WHERE id = 1", 0, filename, EXPORT_BINARY);
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+        ASSERT_INT64(1, Reader_readInt64(r));
+        ASSERT_INT64(1 + 9 + 11 + 9 + 1 + 1, Reader_readInt64(r));
+        _readFile(filename, file, sizeof(file));
+        ASSERT_INT(1, file[0]);             // has row
+        ASSERT_INT(VT_INT64, file[1]);
+        ASSERT_STR("plain", file + 15);
+        ASSERT_INT(0, file[31]);            // no more rows
+    }
+    // partitions in parallel write the same file as one query
+    const char *fill = "WITH RECURSIVE s(i) AS (SELECT 4 UNION ALL SELECT i + 1 FROM s WHERE i < 1000) "
+        "INSERT INTO t SELECT i, 'name ' || i, i / 4.0, randomblob(i % 7) FROM s";
+    ASSERT(Db_exec(db, fill));
+    static char file2[sizeof(file)];
+    for (int format = EXPORT_CSV; format <= EXPORT_BINARY; format++) {
+        _writeExport(w, "SELECT id, name, score, data FROM t ORDER BY id", 0, filename, format);
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+        ASSERT_INT64(1000, Reader_readInt64(r));
+        int64_t bytes = Reader_readInt64(r);
+        ASSERT_INT64(bytes, _readFile(filename, file, sizeof(file)));
+        _writeExport(w, "SELECT id, name, score, data FROM t WHERE id >= ?1 AND id < ?2 ORDER BY id", 4, filename, format);
+        ASSERT(App_step(app));
+        ASSERT_INT(1, Reader_readByte(r));  // ok
+        ASSERT_INT64(1000, Reader_readInt64(r));
+        ASSERT_INT64(bytes, Reader_readInt64(r));
+        _readFile(filename, file2, sizeof(file2));
+        ASSERT(memcmp(file, file2, bytes) == 0);
+    }
+    {
+        // errors remove the file
+        _writeExport(w, "SELECT id, name, score, data FROM no_such_table", 0, filename, EXPORT_CSV);
+        ASSERT(App_step(app));
+        ASSERT_INT(0, Reader_readByte(r));  // not ok
+        ASSERT_STR("no such table: no_such_table", Reader_readString(r));
+        ASSERT(!fopen(filename, "rb"));
+        _writeExport(w, "SELECT id, name, score, data FROM t", 0, filename, 9);
+        ASSERT(App_step(app));
+        ASSERT_INT(0, Reader_readByte(r));  // not ok
+        ASSERT_STR("export: invalid format 9", Reader_readString(r));
+    }
+    // free
+    App_free(app);
+    Writer_free(w);
+    Reader_free(r);
+    Db_free(db);
+    remove(dbname);
+    remove("sqinn_test_export.db-wal");
+    remove("sqinn_test_export.db-shm");
+}
+
 void testApp() {
     LOG_INFO0("testApp testBasic");
     testBasic();
     LOG_INFO0("testApp testValueTypesAndErrors");
     testValueTypesAndErrors();
+    LOG_INFO0("testApp testExecCol");
+    testExecCol();
+    LOG_INFO0("testApp testImportRequest");
+    testImportRequest();
+    LOG_INFO0("testApp testExport");
+    testExport();
+    LOG_INFO0("testApp testPquery");
+    testPquery();
+    LOG_INFO0("testApp testGroupCommit");
+    testGroupCommit();
+    LOG_INFO0("testApp testGroupCommitStandalone");
+    testGroupCommitStandalone();
+    LOG_INFO0("testApp testSteadyState");
+    testSteadyState();
+    LOG_INFO0("testApp testResponseLimit");
+    testResponseLimit();
+    LOG_INFO0("testApp testStats");
+    testStats();
+    LOG_INFO0("testApp testTrace");
+    testTrace();
 }
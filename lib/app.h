@@ -1,11 +1,33 @@
 #ifndef APP_H
 #define APP_H
 
+/* Function codes, see rfc.txt. */
+#define FC_EXEC 1
+#define FC_QUERY 2
+#define FC_PQUERY 3
+#define FC_STATS 4
+#define FC_EXECCOL 5
+#define FC_IMPORT 6
+#define FC_EXPORT 7
+#define FC_QUIT 9
+#define FC_MAX 9
+
+/* File formats of FC_EXPORT, see rfc.txt. */
+#define EXPORT_CSV    1
+#define EXPORT_JSONL  2
+#define EXPORT_BINARY 3
+
+const char *App_fcName(int fc);
+
 /* An App reads requests, processes them, and writes responses. */
 typedef struct app_s App;
 App *newApp(Db *db, Reader *r, Writer *w);
 void App_free(App *this);
+void App_setGroupCommit(App *this, int maxBatch, int maxWaitMillis);
+void App_setTiming(App *this, BOOL timing);
+void App_setTrace(App *this, Trace *trace);
 BOOL App_step(App *this); // TRUE if next, FALSE if not (must exit then)
+void App_stats(App *this, Stats *stats);
 
 //
 // Test
@@ -0,0 +1,1124 @@
+#include "utl.h"
+#include "io.h"
+#include "db.h"
+#include "app.h"
+#include "bench.h"
+
+#define BENCH_MAX_RESULTS 16
+#define BENCH_BATCH 1000          // rows per insert request
+#define BENCH_SCAN_ROWS 1000      // rows per range scan
+#define BENCH_MAX_SCANS 100
+#define BENCH_WIDE_ROWS 10000     // max. rows in the wide table
+#define BENCH_WIDE_COLS 16
+#define BENCH_BLOBS 50
+#define BENCH_BLOB_SIZE (1024*1024)
+
+#ifdef _WIN32
+  #define NULL_DEVICE "NUL"
+#else
+  #define NULL_DEVICE "/dev/null"
+#endif
+
+/* A BenchResult holds the measurements of one workload on one target. */
+typedef struct benchresult_s {
+    const char *workload;
+    const char *target;  // "sqinn" (over pipes) or "sqlite" (direct)
+    int64_t ops;         // requests
+    int64_t rows;        // rows written or read
+    int64_t bytes;       // string and blob bytes written or read
+    int64_t nanos;       // total time
+    int64_t *lat;        // latency of each request, in nanos
+} BenchResult;
+
+// class Bench
+
+struct bench_s {
+    int nrows;
+    int nlookups;
+    // current target
+    const char *target;
+    Db *db;              // direct, or NULL if over pipes
+    Reader *r;           // over pipes
+    Writer *w;           // over pipes
+    uint64_t seed;       // same sequence of random ids for each target
+    Value *params;
+    Value *values;
+    char *blob;
+    Writer *column;      // scratch for FC_EXECCOL columns
+    BenchResult results[BENCH_MAX_RESULTS];
+    int nresults;
+};
+
+Bench *newBench(int nrows, int nlookups) {
+    ASSERT(nrows > 0);
+    ASSERT(nlookups > 0);
+    Bench *this = (Bench *)memAlloc(sizeof(Bench), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Bench));
+    this->nrows = nrows;
+    this->nlookups = nlookups;
+    this->params = (Value *)memAlloc(BENCH_BATCH * (1 + BENCH_WIDE_COLS) * sizeof(Value), __FILE__, __LINE__);
+    this->values = (Value *)memAlloc((1 + BENCH_WIDE_COLS) * sizeof(Value), __FILE__, __LINE__);
+    this->blob = (char *)memAlloc(BENCH_BLOB_SIZE, __FILE__, __LINE__);
+    this->column = newBufWriter(64 * 1024);
+    for (int i = 0; i < BENCH_BLOB_SIZE; i++) {
+        this->blob[i] = (char)i;
+    }
+    return this;
+}
+
+void Bench_free(Bench *this) {
+    for (int i = 0; i < this->nresults; i++) {
+        memFree(this->results[i].lat);
+    }
+    Writer_free(this->column);
+    memFree(this->blob);
+    memFree(this->values);
+    memFree(this->params);
+    memFree(this);
+}
+
+static int _random(Bench *this, int n) {
+    // xorshift64
+    this->seed ^= this->seed << 13;
+    this->seed ^= this->seed >> 7;
+    this->seed ^= this->seed << 17;
+    return (int)(this->seed % (uint64_t)n);
+}
+
+static BenchResult *_begin(Bench *this, const char *workload, int64_t nops) {
+    ASSERT(this->nresults < BENCH_MAX_RESULTS);
+    BenchResult *res = &this->results[this->nresults++];
+    memset(res, 0, sizeof(BenchResult));
+    res->workload = workload;
+    res->target = this->target;
+    res->lat = (int64_t *)memAlloc((size_t)nops * sizeof(int64_t), __FILE__, __LINE__);
+    return res;
+}
+
+// requests, over pipes or direct
+
+/* _exec executes sql for niterations with nparams each. */
+static void _exec(Bench *this, const char *sql, int niterations, int nparams) {
+    const Value *params = this->params;
+    if (this->db) {
+        BOOL ok = Db_prepare(this->db, sql);
+        for (int i = 0; ok && i < niterations; i++) {
+            ok = Db_bind_step_reset(this->db, params + i * nparams, nparams);
+        }
+        ASSERTF(ok, "bench: %s: %s", sql, Db_errmsg(this->db));
+        Db_finalize(this->db);
+        return;
+    }
+    Writer_writeByte(this->w, FC_EXEC);
+    Writer_writeString(this->w, sql);
+    Writer_writeInt32(this->w, niterations);
+    Writer_writeInt32(this->w, nparams);
+    for (int i = 0; i < niterations * nparams; i++) {
+        const Value *param = &params[i];
+        Writer_writeByte(this->w, param->type);
+        switch (param->type) {
+            case VT_INT32:
+                Writer_writeInt32(this->w, param->i32);
+                break;
+            case VT_INT64:
+                Writer_writeInt64(this->w, param->i64);
+                break;
+            case VT_DOUBLE:
+                Writer_writeDouble(this->w, param->d);
+                break;
+            case VT_STRING:
+                Writer_writeString(this->w, param->p);
+                break;
+            case VT_BLOB:
+                Writer_writeBlob(this->w, param->p, param->sz);
+                break;
+        }
+    }
+    Writer_flush(this->w);
+    BOOL ok = Reader_readByte(this->r);
+    ASSERTF(ok, "bench: %s: %s", sql, Reader_readString(this->r));
+}
+
+/* _execCol executes sql like _exec, but sends the params as FC_EXECCOL
+   columns. The params must not be NULL. */
+static void _execCol(Bench *this, const char *sql, int niterations, int nparams) {
+    if (this->db) {
+        _exec(this, sql, niterations, nparams);
+        return;
+    }
+    const Value *params = this->params;
+    Writer_writeByte(this->w, FC_EXECCOL);
+    Writer_writeString(this->w, sql);
+    Writer_writeInt32(this->w, niterations);
+    Writer_writeInt32(this->w, nparams);
+    for (int p = 0; p < nparams; p++) {
+        Writer_writeByte(this->w, params[p].type);
+    }
+    for (int p = 0; p < nparams; p++) {
+        Writer_rewind(this->column, 0);
+        for (int i = 0; i < niterations; i++) {
+            const Value *param = &params[i * nparams + p];
+            ASSERT(param->type == params[p].type);
+            switch (param->type) {
+                case VT_INT32:
+                    Writer_writeInt32(this->column, param->i32);
+                    break;
+                case VT_INT64:
+                    Writer_writeInt64(this->column, param->i64);
+                    break;
+                case VT_DOUBLE:
+                    Writer_writeDouble(this->column, param->d);
+                    break;
+                case VT_STRING:
+                    Writer_writeString(this->column, param->p);
+                    break;
+                case VT_BLOB:
+                    Writer_writeBlob(this->column, param->p, param->sz);
+                    break;
+            }
+        }
+        size_t len;
+        const char *data = Writer_data(this->column, &len);
+        Writer_writeBlob(this->w, "", 0);  // no NULLs
+        Writer_writeBlob(this->w, data, len);
+    }
+    Writer_flush(this->w);
+    BOOL ok = Reader_readByte(this->r);
+    ASSERTF(ok, "bench: %s: %s", sql, Reader_readString(this->r));
+}
+
+/* _query fetches all rows of sql and returns their number. */
+static int64_t _query(Bench *this, const char *sql, int nparams, const char *coltypes, int ncols, int64_t *pbytes) {
+    int64_t nrows = 0;
+    if (this->db) {
+        BOOL ok = Db_prepare(this->db, sql) && Db_bind(this->db, this->params, nparams);
+        BOOL hasRow = TRUE;
+        while (ok && hasRow) {
+            for (int icol = 0; icol < ncols; icol++) {
+                this->values[icol].type = coltypes[icol];
+            }
+            ok = Db_step_fetch(this->db, &hasRow, this->values, ncols);
+            if (ok && hasRow) {
+                nrows++;
+                for (int icol = 0; icol < ncols; icol++) {
+                    Value *val = &this->values[icol];
+                    *pbytes += val->type == VT_STRING ? (int64_t)strlen(val->p) : val->type == VT_BLOB ? (int64_t)val->sz : 0;
+                }
+            }
+        }
+        ASSERTF(ok, "bench: %s: %s", sql, Db_errmsg(this->db));
+        Db_finalize(this->db);
+        return nrows;
+    }
+    Writer_writeByte(this->w, FC_QUERY);
+    Writer_writeString(this->w, sql);
+    Writer_writeInt32(this->w, nparams);
+    for (int i = 0; i < nparams; i++) {
+        ASSERT(this->params[i].type == VT_INT64);
+        Writer_writeByte(this->w, VT_INT64);
+        Writer_writeInt64(this->w, this->params[i].i64);
+    }
+    Writer_writeInt32(this->w, ncols);
+    for (int icol = 0; icol < ncols; icol++) {
+        Writer_writeByte(this->w, coltypes[icol]);
+    }
+    Writer_flush(this->w);
+    while (Reader_readByte(this->r)) {
+        nrows++;
+        for (int icol = 0; icol < ncols; icol++) {
+            size_t len;
+            switch (Reader_readByte(this->r)) {
+                case VT_INT32:
+                    Reader_readInt32(this->r);
+                    break;
+                case VT_INT64:
+                    Reader_readInt64(this->r);
+                    break;
+                case VT_DOUBLE:
+                    Reader_readDouble(this->r);
+                    break;
+                case VT_STRING:
+                    *pbytes += (int64_t)strlen(Reader_readString(this->r));
+                    break;
+                case VT_BLOB:
+                    Reader_readBlob(this->r, &len);
+                    *pbytes += (int64_t)len;
+                    break;
+            }
+        }
+    }
+    BOOL ok = Reader_readByte(this->r);
+    ASSERTF(ok, "bench: %s: %s", sql, Reader_readString(this->r));
+    return nrows;
+}
+
+// workloads
+
+/* _benchInsert inserts nrows into table, with FC_EXEC requests or, if
+   columnar, with FC_EXECCOL requests. */
+static void _benchInsert(Bench *this, const char *workload, const char *table, BOOL columnar) {
+    char sql[256];
+    snprintf(sql, sizeof(sql), "DROP TABLE IF EXISTS %s", table);
+    _exec(this, sql, 1, 0);
+    snprintf(sql, sizeof(sql), "CREATE TABLE %s(id INTEGER PRIMARY KEY NOT NULL, name TEXT, age INTEGER, rating REAL)", table);
+    _exec(this, sql, 1, 0);
+    snprintf(sql, sizeof(sql), "INSERT INTO %s(id, name, age, rating) VALUES(?, ?, ?, ?)", table);
+    int nops = (this->nrows + BENCH_BATCH - 1) / BENCH_BATCH;
+    BenchResult *res = _begin(this, workload, nops);
+    char (*names)[16] = (char (*)[16])memAlloc(BENCH_BATCH * 16, __FILE__, __LINE__);
+    int64_t t0 = nanotime();
+    _exec(this, "BEGIN", 1, 0);
+    for (int op = 0; op < nops; op++) {
+        int first = op * BENCH_BATCH;
+        int n = this->nrows - first < BENCH_BATCH ? this->nrows - first : BENCH_BATCH;
+        for (int i = 0; i < n; i++) {
+            snprintf(names[i], 16, "user%d", first + i);
+            Value *params = &this->params[i * 4];
+            params[0] = (Value) {.type = VT_INT64, .i64 = first + i + 1};
+            params[1] = (Value) {.type = VT_STRING, .p = names[i]};
+            params[2] = (Value) {.type = VT_INT64, .i64 = (first + i) % 100};
+            params[3] = (Value) {.type = VT_DOUBLE, .d = (first + i) * 0.01};
+            res->bytes += (int64_t)strlen(names[i]);
+        }
+        int64_t t = nanotime();
+        if (columnar) {
+            _execCol(this, sql, n, 4);
+        } else {
+            _exec(this, sql, n, 4);
+        }
+        res->lat[res->ops++] = nanotime() - t;
+        res->rows += n;
+    }
+    _exec(this, "COMMIT", 1, 0);
+    res->nanos = nanotime() - t0;
+    memFree(names);
+}
+
+static void _benchLookup(Bench *this) {
+    BenchResult *res = _begin(this, "lookup", this->nlookups);
+    int64_t t0 = nanotime();
+    for (int op = 0; op < this->nlookups; op++) {
+        this->params[0] = (Value) {.type = VT_INT64, .i64 = 1 + _random(this, this->nrows)};
+        int64_t t = nanotime();
+        res->rows += _query(this, "SELECT name, age, rating FROM bench_users WHERE id = ?", 1, "\x04\x02\x03", 3, &res->bytes);
+        res->lat[res->ops++] = nanotime() - t;
+    }
+    res->nanos = nanotime() - t0;
+}
+
+/* _scans returns the number of range scans over a table of nrows. */
+static int _scans(int nrows) {
+    int n = nrows / BENCH_SCAN_ROWS;
+    return n < 1 ? 1 : n > BENCH_MAX_SCANS ? BENCH_MAX_SCANS : n;
+}
+
+static void _benchScan(Bench *this) {
+    int nops = _scans(this->nrows);
+    BenchResult *res = _begin(this, "scan", nops);
+    int64_t t0 = nanotime();
+    for (int op = 0; op < nops; op++) {
+        int64_t lo = 1 + _random(this, this->nrows);
+        this->params[0] = (Value) {.type = VT_INT64, .i64 = lo};
+        this->params[1] = (Value) {.type = VT_INT64, .i64 = lo + BENCH_SCAN_ROWS};
+        int64_t t = nanotime();
+        res->rows += _query(this, "SELECT id, name, age, rating FROM bench_users WHERE id >= ? AND id < ?", 2, "\x02\x04\x02\x03", 4, &res->bytes);
+        res->lat[res->ops++] = nanotime() - t;
+    }
+    res->nanos = nanotime() - t0;
+}
+
+static void _benchWide(Bench *this) {
+    // 4 integer, 4 real and 8 text columns
+    static const char *text = "abcdefghijklmnopqrstuvwxyz0123456789";
+    char coltypes[1 + BENCH_WIDE_COLS];
+    coltypes[0] = VT_INT64;
+    for (int icol = 0; icol < BENCH_WIDE_COLS; icol++) {
+        coltypes[1 + icol] = icol < 4 ? VT_INT64 : icol < 8 ? VT_DOUBLE : VT_STRING;
+    }
+    _exec(this, "DROP TABLE IF EXISTS bench_wide", 1, 0);
+    _exec(this, "CREATE TABLE bench_wide(id INTEGER PRIMARY KEY NOT NULL, "
+        "i0 INTEGER, i1 INTEGER, i2 INTEGER, i3 INTEGER, d0 REAL, d1 REAL, d2 REAL, d3 REAL, "
+        "s0 TEXT, s1 TEXT, s2 TEXT, s3 TEXT, s4 TEXT, s5 TEXT, s6 TEXT, s7 TEXT)", 1, 0);
+    int nrows = this->nrows < BENCH_WIDE_ROWS ? this->nrows : BENCH_WIDE_ROWS;
+    _exec(this, "BEGIN", 1, 0);
+    for (int first = 0; first < nrows; first += BENCH_BATCH) {
+        int n = nrows - first < BENCH_BATCH ? nrows - first : BENCH_BATCH;
+        for (int i = 0; i < n; i++) {
+            Value *params = &this->params[i * (1 + BENCH_WIDE_COLS)];
+            params[0] = (Value) {.type = VT_INT64, .i64 = first + i + 1};
+            for (int icol = 0; icol < BENCH_WIDE_COLS; icol++) {
+                Value *param = &params[1 + icol];
+                param->type = coltypes[1 + icol];
+                param->i64 = first + i + icol;
+                param->d = (first + i) * 0.5 + icol;
+                param->p = text + icol;
+            }
+        }
+        _exec(this, "INSERT INTO bench_wide VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", n, 1 + BENCH_WIDE_COLS);
+    }
+    _exec(this, "COMMIT", 1, 0);
+    // measure the reads
+    int nops = _scans(nrows);
+    BenchResult *res = _begin(this, "wide", nops);
+    int64_t t0 = nanotime();
+    for (int op = 0; op < nops; op++) {
+        int64_t lo = 1 + _random(this, nrows);
+        this->params[0] = (Value) {.type = VT_INT64, .i64 = lo};
+        this->params[1] = (Value) {.type = VT_INT64, .i64 = lo + BENCH_SCAN_ROWS};
+        int64_t t = nanotime();
+        res->rows += _query(this, "SELECT * FROM bench_wide WHERE id >= ? AND id < ?", 2, coltypes, 1 + BENCH_WIDE_COLS, &res->bytes);
+        res->lat[res->ops++] = nanotime() - t;
+    }
+    res->nanos = nanotime() - t0;
+}
+
+static void _benchBlobs(Bench *this) {
+    _exec(this, "DROP TABLE IF EXISTS bench_blobs", 1, 0);
+    _exec(this, "CREATE TABLE bench_blobs(id INTEGER PRIMARY KEY NOT NULL, data BLOB)", 1, 0);
+    BenchResult *res = _begin(this, "blobWrite", BENCH_BLOBS);
+    int64_t t0 = nanotime();
+    for (int op = 0; op < BENCH_BLOBS; op++) {
+        this->params[0] = (Value) {.type = VT_INT64, .i64 = op + 1};
+        this->params[1] = (Value) {.type = VT_BLOB, .p = this->blob, .sz = BENCH_BLOB_SIZE};
+        int64_t t = nanotime();
+        _exec(this, "INSERT INTO bench_blobs(id, data) VALUES(?, ?)", 1, 2);
+        res->lat[res->ops++] = nanotime() - t;
+        res->rows++;
+        res->bytes += BENCH_BLOB_SIZE;
+    }
+    res->nanos = nanotime() - t0;
+    res = _begin(this, "blobRead", BENCH_BLOBS);
+    t0 = nanotime();
+    for (int op = 0; op < BENCH_BLOBS; op++) {
+        this->params[0] = (Value) {.type = VT_INT64, .i64 = 1 + _random(this, BENCH_BLOBS)};
+        int64_t t = nanotime();
+        res->rows += _query(this, "SELECT data FROM bench_blobs WHERE id = ?", 1, "\x05", 1, &res->bytes);
+        res->lat[res->ops++] = nanotime() - t;
+    }
+    res->nanos = nanotime() - t0;
+}
+
+static void _runWorkloads(Bench *this) {
+    this->seed = 88172645463325252ULL;
+    LOG_INFO1("bench %s: insert", this->target);
+    _benchInsert(this, "insert", "bench_users", FALSE);
+    LOG_INFO1("bench %s: insertCol", this->target);
+    _benchInsert(this, "insertCol", "bench_users_col", TRUE);
+    LOG_INFO1("bench %s: lookup", this->target);
+    _benchLookup(this);
+    LOG_INFO1("bench %s: scan", this->target);
+    _benchScan(this);
+    LOG_INFO1("bench %s: wide", this->target);
+    _benchWide(this);
+    LOG_INFO1("bench %s: blobs", this->target);
+    _benchBlobs(this);
+}
+
+/* Bench_runChild runs the workloads over the pipes of a child process,
+   argv is its command line, usually 'sqinn run [options...]'. */
+BOOL Bench_runChild(Bench *this, char *const argv[]) {
+    Child *child = newChild(argv);
+    if (!child) {
+        LOG_INFO1("bench: cannot start %s", argv[0]);
+        return FALSE;
+    }
+    this->target = "sqinn";
+    this->db = NULL;
+    this->r = newFdReader(Child_stdout(child));
+    this->w = newFdWriter(Child_stdin(child));
+    _runWorkloads(this);
+    Writer_writeByte(this->w, FC_QUIT);
+    Writer_flush(this->w);
+    BOOL ok = Reader_readByte(this->r);
+    Writer_free(this->w);
+    Reader_free(this->r);
+    this->w = NULL;
+    this->r = NULL;
+    int code = Child_wait(child);
+    if (code != 0) {
+        LOG_INFO1("bench: child exit code %d", code);
+    }
+    return ok && code == 0;
+}
+
+/* Bench_runDb runs the workloads directly against db. */
+void Bench_runDb(Bench *this, Db *db) {
+    this->target = "sqlite";
+    this->db = db;
+    _runWorkloads(this);
+    this->db = NULL;
+}
+
+static int _cmpInt64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* _percentile returns the p-th percentile of n sorted latencies in micros. */
+static double _percentile(const int64_t *lat, int64_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    int64_t i = (int64_t)(p * (double)n + 0.999999) - 1;  // nearest rank
+    i = i < 0 ? 0 : i >= n ? n - 1 : i;
+    return (double)lat[i] / 1e3;
+}
+
+static BenchResult *_find(Bench *this, const char *workload, const char *target) {
+    for (int i = 0; i < this->nresults; i++) {
+        BenchResult *res = &this->results[i];
+        if (strcmp(res->workload, workload) == 0 && strcmp(res->target, target) == 0) {
+            return res;
+        }
+    }
+    return NULL;
+}
+
+/* Bench_printJson prints the results. 'vsDirect' is the time over pipes
+   divided by the time of the same workload against SQLite directly. */
+void Bench_printJson(Bench *this, FILE *out) {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"rows\": %d,\n", this->nrows);
+    fprintf(out, "  \"lookups\": %d,\n", this->nlookups);
+    fprintf(out, "  \"results\": [");
+    for (int i = 0; i < this->nresults; i++) {
+        BenchResult *res = &this->results[i];
+        qsort(res->lat, (size_t)res->ops, sizeof(int64_t), _cmpInt64);
+        double secs = (double)res->nanos / 1e9;
+        fprintf(out, "%s\n    {\"workload\": \"%s\", \"target\": \"%s\"", i ? "," : "", res->workload, res->target);
+        fprintf(out, ", \"ops\": %" PRId64 ", \"rows\": %" PRId64 ", \"bytes\": %" PRId64 ", \"seconds\": %.6f",
+            res->ops, res->rows, res->bytes, secs);
+        fprintf(out, ", \"opsPerSec\": %.1f, \"rowsPerSec\": %.1f",
+            secs > 0 ? (double)res->ops / secs : 0, secs > 0 ? (double)res->rows / secs : 0);
+        fprintf(out, ", \"p50us\": %.1f, \"p99us\": %.1f, \"p999us\": %.1f",
+            _percentile(res->lat, res->ops, 0.5), _percentile(res->lat, res->ops, 0.99), _percentile(res->lat, res->ops, 0.999));
+        BenchResult *direct = strcmp(res->target, "sqinn") == 0 ? _find(this, res->workload, "sqlite") : NULL;
+        if (direct && direct->nanos > 0) {
+            fprintf(out, ", \"vsDirect\": %.3f", (double)res->nanos / (double)direct->nanos);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// class CodecBench
+
+#define CODEC_BUF (1024*1024)  // a batch of values is written to and read from a buffer of this size
+#define CODEC_MAX_BYTES (256LL*1024*1024)  // max. bytes per measurement, caps the ops of large values
+#define CODEC_MAX_RESULTS 32
+#define CODEC_WIDE_COLS 16
+#define CODEC_BLOB_SIZE 4096
+
+/* The values and rows that are measured. */
+#define CK_BYTE      0
+#define CK_INT32     1
+#define CK_INT64     2
+#define CK_DOUBLE    3
+#define CK_STRING16  4
+#define CK_STRING1K  5
+#define CK_BLOB16    6
+#define CK_BLOB64K   7
+#define CK_ROW       8  // rows start here
+#define CK_ROWNARROW 8  // id, name, age, rating
+#define CK_ROWWIDE   9  // 16 mixed columns
+#define CK_ROWBLOB  10  // id, 4K blob
+#define CK_COUNT    11
+
+static const char *codecNames[CK_COUNT] = {"byte", "int32", "int64", "double", "string16", "string1k", "blob16", "blob64k", "rowNarrow", "rowWide", "rowBlob"};
+
+/* A CodecResult holds the measurement of one function on one value or row. */
+typedef struct codecresult_s {
+    const char *name;   // e.g. "Writer_writeInt32"
+    const char *value;  // e.g. "int32"
+    int64_t ops;
+    int64_t bytes;      // encoded bytes
+    int64_t nanos;
+} CodecResult;
+
+struct codecbench_s {
+    int64_t nops;
+    char *buf;
+    char *str16;
+    char *str1k;
+    char *blob;         // 64K
+    Value narrow[4];
+    Value wide[CODEC_WIDE_COLS];
+    Value blobRow[2];
+    Value values[CODEC_WIDE_COLS];  // decoded row
+    int64_t sink;       // keeps the compiler from dropping reads
+    CodecResult results[CODEC_MAX_RESULTS];
+    int nresults;
+};
+
+CodecBench *newCodecBench(int64_t nops) {
+    ASSERT(nops > 0);
+    CodecBench *this = (CodecBench *)memAlloc(sizeof(CodecBench), __FILE__, __LINE__);
+    memset(this, 0, sizeof(CodecBench));
+    this->nops = nops;
+    this->buf = (char *)memAlloc(CODEC_BUF, __FILE__, __LINE__);
+    this->str16 = (char *)memAlloc(16, __FILE__, __LINE__);
+    memset(this->str16, 'a', 15);
+    this->str16[15] = 0;
+    this->str1k = (char *)memAlloc(1024, __FILE__, __LINE__);
+    memset(this->str1k, 'b', 1023);
+    this->str1k[1023] = 0;
+    this->blob = (char *)memAlloc(64 * 1024, __FILE__, __LINE__);
+    for (int i = 0; i < 64 * 1024; i++) {
+        this->blob[i] = (char)i;
+    }
+    this->narrow[0] = (Value){.type = VT_INT64, .i64 = 1234567};
+    this->narrow[1] = (Value){.type = VT_STRING, .p = this->str16};
+    this->narrow[2] = (Value){.type = VT_INT32, .i32 = 42};
+    this->narrow[3] = (Value){.type = VT_DOUBLE, .d = 4.5};
+    for (int i = 0; i < CODEC_WIDE_COLS; i++) {
+        this->wide[i] = this->narrow[i % 4];
+    }
+    this->blobRow[0] = this->narrow[0];
+    this->blobRow[1] = (Value){.type = VT_BLOB, .p = this->blob, .sz = CODEC_BLOB_SIZE};
+    return this;
+}
+
+void CodecBench_free(CodecBench *this) {
+    ASSERT(this);
+    memFree(this->blob);
+    memFree(this->str1k);
+    memFree(this->str16);
+    memFree(this->buf);
+    memFree(this);
+}
+
+static const Value *_codecRow(CodecBench *this, int kind, int *pncols) {
+    switch (kind) {
+        case CK_ROWNARROW: *pncols = 4; return this->narrow;
+        case CK_ROWWIDE: *pncols = CODEC_WIDE_COLS; return this->wide;
+        default: *pncols = 2; return this->blobRow;
+    }
+}
+
+/* _encode writes one value or row of a kind, like a response does. */
+static void _encode(CodecBench *this, Writer *w, int kind) {
+    switch (kind) {
+        case CK_BYTE: Writer_writeByte(w, 1); break;
+        case CK_INT32: Writer_writeInt32(w, 123456); break;
+        case CK_INT64: Writer_writeInt64(w, 1234567890123); break;
+        case CK_DOUBLE: Writer_writeDouble(w, 3.25); break;
+        case CK_STRING16: Writer_writeString(w, this->str16); break;
+        case CK_STRING1K: Writer_writeString(w, this->str1k); break;
+        case CK_BLOB16: Writer_writeBlob(w, this->blob, 16); break;
+        case CK_BLOB64K: Writer_writeBlob(w, this->blob, 64 * 1024); break;
+        default: {
+            int ncols;
+            const Value *row = _codecRow(this, kind, &ncols);
+            Writer_writeByte(w, 1);  // hasRow
+            for (int i = 0; i < ncols; i++) {
+                Writer_writeByte(w, row[i].type);
+                switch (row[i].type) {
+                    case VT_INT32: Writer_writeInt32(w, row[i].i32); break;
+                    case VT_INT64: Writer_writeInt64(w, row[i].i64); break;
+                    case VT_DOUBLE: Writer_writeDouble(w, row[i].d); break;
+                    case VT_STRING: Writer_writeString(w, row[i].p); break;
+                    case VT_BLOB: Writer_writeBlob(w, row[i].p, row[i].sz); break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+/* _decode reads one value or row of a kind, like a client does. */
+static void _decode(CodecBench *this, Reader *r, int kind) {
+    size_t len;
+    switch (kind) {
+        case CK_BYTE: this->sink += Reader_readByte(r); break;
+        case CK_INT32: this->sink += Reader_readInt32(r); break;
+        case CK_INT64: this->sink += Reader_readInt64(r); break;
+        case CK_DOUBLE: this->sink += (int64_t)Reader_readDouble(r); break;
+        case CK_STRING16:
+        case CK_STRING1K: this->sink += Reader_readString(r)[0]; break;
+        case CK_BLOB16:
+        case CK_BLOB64K: this->sink += Reader_readBlob(r, &len)[0] + len; break;
+        default: {
+            int ncols;
+            _codecRow(this, kind, &ncols);
+            this->sink += Reader_readByte(r);  // hasRow
+            for (int i = 0; i < ncols; i++) {
+                Value *val = &this->values[i];
+                val->type = Reader_readByte(r);
+                switch (val->type) {
+                    case VT_INT32: val->i32 = Reader_readInt32(r); break;
+                    case VT_INT64: val->i64 = Reader_readInt64(r); break;
+                    case VT_DOUBLE: val->d = Reader_readDouble(r); break;
+                    case VT_STRING: val->p = Reader_readString(r); break;
+                    case VT_BLOB: val->p = Reader_readBlob(r, &val->sz); break;
+                }
+            }
+            this->sink += this->values[0].i64;
+            break;
+        }
+    }
+}
+
+static void _addCodecResult(CodecBench *this, const char *name, int kind, int64_t ops, int64_t bytes, int64_t nanos) {
+    ASSERT(this->nresults < CODEC_MAX_RESULTS);
+    CodecResult *res = &this->results[this->nresults++];
+    res->name = name;
+    res->value = codecNames[kind];
+    res->ops = ops;
+    res->bytes = bytes;
+    res->nanos = nanos;
+}
+
+/* _codecOps returns the number of values of a kind that are measured, in
+   batches that fill at most CODEC_BUF, and the encoded size of a value. */
+static int64_t _codecOps(CodecBench *this, int kind, size_t *psize, int64_t *pbatch) {
+    Writer *w = newMemWriter(this->buf, CODEC_BUF);
+    _encode(this, w, kind);
+    size_t size = Writer_mark(w);
+    Writer_free(w);
+    int64_t batch = CODEC_BUF / size;
+    int64_t nops = this->nops < CODEC_MAX_BYTES / (int64_t)size ? this->nops : CODEC_MAX_BYTES / (int64_t)size;
+    nops = nops < batch ? nops : (nops / batch) * batch;
+    if (nops < batch) {
+        batch = nops;
+    }
+    *psize = size;
+    *pbatch = batch;
+    return nops;
+}
+
+/* _codecKind measures the encoding and the decoding of nops values of a
+   kind, in batches that fill at most CODEC_BUF, over memory. */
+static void _codecKind(CodecBench *this, int kind, const char *writeName, const char *readName) {
+    size_t size;
+    int64_t batch;
+    int64_t nops = _codecOps(this, kind, &size, &batch);
+    Writer *w = newMemWriter(this->buf, CODEC_BUF);
+    // encode
+    int64_t t0 = nanotime();
+    for (int64_t done = 0; done < nops; done += batch) {
+        Writer_rewind(w, 0);
+        for (int64_t i = 0; i < batch; i++) {
+            _encode(this, w, kind);
+        }
+    }
+    _addCodecResult(this, writeName, kind, nops, nops * (int64_t)size, nanotime() - t0);
+    ASSERT(Writer_mark(w) == batch * size);
+    Writer_free(w);
+    // decode
+    t0 = nanotime();
+    for (int64_t done = 0; done < nops; done += batch) {
+        Reader *r = newMemReader(this->buf, (size_t)(batch * size));
+        for (int64_t i = 0; i < batch; i++) {
+            _decode(this, r, kind);
+        }
+        Reader_free(r);
+    }
+    _addCodecResult(this, readName, kind, nops, nops * (int64_t)size, nanotime() - t0);
+}
+
+/* _codecIo measures rows like _codecKind, but the way sqinn runs: rows are
+   encoded into a Writer that owns its buffer and grows it from a small
+   start, and decoded by a Reader that reads each batch as a frame from a
+   file. */
+static void _codecIo(CodecBench *this, int kind) {
+    size_t size;
+    int64_t batch;
+    int64_t nops = _codecOps(this, kind, &size, &batch);
+    // encode
+    Writer *w = newBufWriter(4 * 1024);
+    int64_t t0 = nanotime();
+    for (int64_t done = 0; done < nops; done += batch) {
+        Writer_rewind(w, 0);
+        for (int64_t i = 0; i < batch; i++) {
+            _encode(this, w, kind);
+        }
+    }
+    _addCodecResult(this, "encodeRow/bufWriter", kind, nops, nops * (int64_t)size, nanotime() - t0);
+    ASSERT(Writer_mark(w) == batch * size);
+    // one frame, read again for each batch
+    FILE *f = tmpfile();
+    ASSERT(f);
+    Writer *fw = newFdWriter(fileno(f));
+    size_t len;
+    const char *data = Writer_data(w, &len);
+    Writer_writeRaw(fw, data, len);
+    Writer_flush(fw);
+    Writer_free(fw);
+    Writer_free(w);
+    // decode
+    Reader *r = newFdReader(fileno(f));
+    t0 = nanotime();
+    for (int64_t done = 0; done < nops; done += batch) {
+        lseek(fileno(f), 0, SEEK_SET);
+        for (int64_t i = 0; i < batch; i++) {
+            _decode(this, r, kind);
+        }
+    }
+    _addCodecResult(this, "decodeRow/fdReader", kind, nops, nops * (int64_t)size, nanotime() - t0);
+    Reader_free(r);
+    fclose(f);
+}
+
+void CodecBench_run(CodecBench *this) {
+    ASSERT(this);
+    this->nresults = 0;
+    _codecKind(this, CK_BYTE, "Writer_writeByte", "Reader_readByte");
+    _codecKind(this, CK_INT32, "Writer_writeInt32", "Reader_readInt32");
+    _codecKind(this, CK_INT64, "Writer_writeInt64", "Reader_readInt64");
+    _codecKind(this, CK_DOUBLE, "Writer_writeDouble", "Reader_readDouble");
+    _codecKind(this, CK_STRING16, "Writer_writeString", "Reader_readString");
+    _codecKind(this, CK_STRING1K, "Writer_writeString", "Reader_readString");
+    _codecKind(this, CK_BLOB16, "Writer_writeBlob", "Reader_readBlob");
+    _codecKind(this, CK_BLOB64K, "Writer_writeBlob", "Reader_readBlob");
+    for (int kind = CK_ROW; kind < CK_COUNT; kind++) {
+        _codecKind(this, kind, "encodeRow", "decodeRow");
+    }
+    for (int kind = CK_ROW; kind < CK_COUNT; kind++) {
+        _codecIo(this, kind);
+    }
+    LOG_INFO1("codec bench: sink %" PRId64, this->sink);
+}
+
+void CodecBench_printJson(CodecBench *this, FILE *out) {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"ops\": %" PRId64 ",\n", this->nops);
+    fprintf(out, "  \"results\": [");
+    for (int i = 0; i < this->nresults; i++) {
+        CodecResult *res = &this->results[i];
+        double secs = (double)res->nanos / 1e9;
+        fprintf(out, "%s\n    {\"function\": \"%s\", \"value\": \"%s\", \"ops\": %" PRId64 ", \"bytes\": %" PRId64,
+            i ? "," : "", res->name, res->value, res->ops, res->bytes);
+        fprintf(out, ", \"seconds\": %.6f, \"nsPerOp\": %.2f, \"bytesPerSec\": %.0f}",
+            secs, res->ops ? (double)res->nanos / res->ops : 0, secs > 0 ? res->bytes / secs : 0);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// class Replay
+
+struct replay_s {
+    char *buf;           // payloads of all frames
+    size_t bufsz;
+    size_t *offsets;     // offset of each frame in buf
+    int64_t *times;      // arrival time of each frame
+    int nframes;
+    Reader *r;           // over buf
+    FILE *out;           // null device
+    Writer *w;           // responses, discarded
+    BOOL paced;
+    int64_t nrequests;
+    int64_t nanos;
+    Histogram *latency[FC_MAX + 1];
+};
+
+static uint32_t _getInt32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static int64_t _getInt64(const unsigned char *p) {
+    return (int64_t)(((uint64_t)_getInt32(p) << 32) | _getInt32(p + 4));
+}
+
+Replay *newReplay(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    if (size < 0) {
+        fclose(fp);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = (unsigned char *)memAlloc(size > 0 ? size : 1, __FILE__, __LINE__);
+    size_t n = fread(data, 1, size, fp);
+    fclose(fp);
+    if (n < 8 || memcmp(data, RECORD_MAGIC, 8) != 0) {
+        memFree(data);
+        return NULL;
+    }
+    // count frames, a truncated last frame is ignored
+    int nframes = 0;
+    size_t total = 0;
+    for (size_t off = 8; off + 12 <= n; ) {
+        size_t len = (size_t)_getInt32(data + off + 8);
+        if (off + 12 + len > n) {
+            break;
+        }
+        nframes++;
+        total += len;
+        off += 12 + len;
+    }
+    if (!total) {
+        memFree(data);
+        return NULL;
+    }
+    Replay *this = (Replay *)memAlloc(sizeof(Replay), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Replay));
+    this->buf = (char *)memAlloc(total, __FILE__, __LINE__);
+    this->offsets = (size_t *)memAlloc((nframes + 1) * sizeof(size_t), __FILE__, __LINE__);
+    this->times = (int64_t *)memAlloc((nframes + 1) * sizeof(int64_t), __FILE__, __LINE__);
+    size_t off = 8;
+    for (int i = 0; i < nframes; i++) {
+        size_t len = (size_t)_getInt32(data + off + 8);
+        this->offsets[i] = this->bufsz;
+        this->times[i] = _getInt64(data + off);
+        memcpy(this->buf + this->bufsz, data + off + 12, len);
+        this->bufsz += len;
+        off += 12 + len;
+    }
+    this->nframes = nframes;
+    memFree(data);
+    this->r = newMemReader(this->buf, this->bufsz);
+    this->out = fopen(NULL_DEVICE, "wb");
+    ASSERT(this->out);
+    this->w = newFdWriter(fileno(this->out));
+    return this;
+}
+
+void Replay_free(Replay *this) {
+    ASSERT(this);
+    for (int fc = 0; fc <= FC_MAX; fc++) {
+        if (this->latency[fc]) {
+            Histogram_free(this->latency[fc]);
+        }
+    }
+    Writer_free(this->w);
+    fclose(this->out);
+    Reader_free(this->r);
+    memFree(this->times);
+    memFree(this->offsets);
+    memFree(this->buf);
+    memFree(this);
+}
+
+Reader *Replay_reader(Replay *this) {
+    return this->r;
+}
+
+Writer *Replay_writer(Replay *this) {
+    return this->w;
+}
+
+static void _waitUntil(int64_t due) {
+    for (;;) {
+        int64_t left = due - nanotime();
+        if (left <= 0) {
+            return;
+        }
+        if (left > 2 * 1000 * 1000) {
+            sleepMillis((int)(left / 1000 / 1000) - 1);
+        }
+    }
+}
+
+/* Replay_run runs the recorded requests through app, until the recording
+   ends or a FC_QUIT request. If paced, each request starts at its recorded
+   time, relative to the first one, and its latency counts from then, so
+   that a replay that falls behind shows up as latency. */
+void Replay_run(Replay *this, App *app, BOOL paced) {
+    ASSERT(this);
+    ASSERT(app);
+    this->paced = paced;
+    int64_t start = nanotime();
+    int frame = 0;
+    while (Reader_hasInput(this->r, 0)) {
+        size_t off = Reader_offset(this->r);
+        while (frame + 1 < this->nframes && this->offsets[frame + 1] <= off) {
+            frame++;
+        }
+        int64_t t0 = nanotime();
+        if (paced) {
+            t0 = start + this->times[frame] - this->times[0];
+            _waitUntil(t0);
+        }
+        int fc = Reader_peekByte(this->r);
+        BOOL next = App_step(app);
+        int64_t nanos = nanotime() - t0;
+        this->nrequests++;
+        if (0 <= fc && fc <= FC_MAX) {
+            if (!this->latency[fc]) {
+                this->latency[fc] = newHistogram();
+            }
+            Histogram_record(this->latency[fc], nanos);
+        }
+        if (!next) {
+            break;
+        }
+    }
+    this->nanos = nanotime() - start;
+}
+
+void Replay_printJson(Replay *this, FILE *out) {
+    double secs = (double)this->nanos / 1e9;
+    double recorded = this->nframes ? (double)(this->times[this->nframes - 1] - this->times[0]) / 1e9 : 0;
+    fprintf(out, "{\n");
+    fprintf(out, "  \"paced\": %s,\n", this->paced ? "true" : "false");
+    fprintf(out, "  \"frames\": %d,\n", this->nframes);
+    fprintf(out, "  \"requests\": %" PRId64 ",\n", this->nrequests);
+    fprintf(out, "  \"recordedSeconds\": %.6f,\n", recorded);
+    fprintf(out, "  \"seconds\": %.6f,\n", secs);
+    fprintf(out, "  \"requestsPerSec\": %.1f,\n", secs > 0 ? (double)this->nrequests / secs : 0);
+    fprintf(out, "  \"latency\": [");
+    const char *sep = "";
+    for (int fc = 0; fc <= FC_MAX; fc++) {
+        Histogram *hist = this->latency[fc];
+        if (!hist) {
+            continue;
+        }
+        fprintf(out, "%s\n    {\"fc\": \"%s\", \"count\": %" PRId64, sep, App_fcName(fc) ? App_fcName(fc) : "?", Histogram_count(hist));
+        fprintf(out, ", \"p50us\": %.1f, \"p99us\": %.1f, \"p999us\": %.1f, \"maxus\": %.1f}",
+            Histogram_percentile(hist, 50) / 1e3, Histogram_percentile(hist, 99) / 1e3,
+            Histogram_percentile(hist, 99.9) / 1e3, Histogram_max(hist) / 1e3);
+        sep = ",";
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+//
+// Test
+//
+
+static void testReplay() {
+    const char *filename = "sqinn_test.rec";
+    // record requests, one frame each, as a client sends them
+    FILE *f = tmpfile();
+    ASSERT(f);
+    Writer *wreq = newFdWriter(fileno(f));
+    Writer_writeByte(wreq, FC_EXEC);
+    Writer_writeString(wreq, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT)");
+    Writer_writeInt32(wreq, 1);  // 1 iteration
+    Writer_writeInt32(wreq, 0);  // 0 params
+    Writer_flush(wreq);
+    for (int i = 0; i < 3; i++) {
+        Writer_writeByte(wreq, FC_EXEC);
+        Writer_writeString(wreq, "INSERT INTO t(name) VALUES(?)");
+        Writer_writeInt32(wreq, 1);  // 1 iteration
+        Writer_writeInt32(wreq, 1);  // 1 param
+        Writer_writeByte(wreq, VT_STRING);
+        Writer_writeString(wreq, "Alice");
+        Writer_flush(wreq);
+    }
+    Writer_writeByte(wreq, FC_QUERY);
+    Writer_writeString(wreq, "SELECT COUNT(*) FROM t");
+    Writer_writeInt32(wreq, 0);        // 0 params
+    Writer_writeInt32(wreq, 1);        // 1 column
+    Writer_writeByte(wreq, VT_INT32);  //     column 0 type
+    Writer_flush(wreq);
+    Writer_writeByte(wreq, FC_QUIT);
+    Writer_flush(wreq);
+    rewind(f);
+    Reader *r = newFdReader(fileno(f));
+    ASSERT(Reader_record(r, filename));
+    Db *db = newDb(":memory:", FALSE);
+    char buf[1024];
+    Writer *w = newMemWriter(buf, sizeof(buf));
+    App *app = newApp(db, r, w);
+    while (App_step(app)) {
+        ;
+    }
+    App_free(app);
+    Writer_free(w);
+    Reader_free(r);
+    Db_free(db);
+    Writer_free(wreq);
+    fclose(f);
+    // replay against an empty database
+    ASSERT(!newReplay("sqinn_no_such_file.rec"));
+    Replay *replay = newReplay(filename);
+    ASSERT(replay);
+    ASSERT_INT(6, replay->nframes);
+    db = newDb(":memory:", FALSE);
+    app = newApp(db, Replay_reader(replay), Replay_writer(replay));
+    Replay_run(replay, app, TRUE);
+    App_free(app);
+    ASSERT_INT64(6, replay->nrequests);
+    ASSERT_INT64(4, Histogram_count(replay->latency[FC_EXEC]));
+    ASSERT_INT64(1, Histogram_count(replay->latency[FC_QUERY]));
+    ASSERT_INT64(1, Histogram_count(replay->latency[FC_QUIT]));
+    // the writes were replayed
+    ASSERT(Db_prepare(db, "SELECT COUNT(*) FROM t"));
+    BOOL hasRow;
+    Value value = {.type = VT_INT32};
+    ASSERT(Db_step_fetch(db, &hasRow, &value, 1));
+    ASSERT_INT(3, value.i32);
+    Db_finalize(db);
+    Db_free(db);
+    FILE *out = tmpfile();
+    ASSERT(out);
+    Replay_printJson(replay, out);
+    ASSERT(ftell(out) > 0);
+    fclose(out);
+    Replay_free(replay);
+    remove(filename);
+}
+
+static void testCodecBench() {
+    CodecBench *codec = newCodecBench(1000);
+    CodecBench_run(codec);
+    ASSERT_INT(2 * CK_COUNT + 2 * (CK_COUNT - CK_ROW), codec->nresults);
+    CodecResult *res = &codec->results[2];  // Writer_writeInt32
+    ASSERT_STR("Writer_writeInt32", res->name);
+    ASSERT_INT64(1000, res->ops);
+    ASSERT_INT64(4000, res->bytes);
+    // a 64K blob batch holds 15 values, the ops are rounded down to whole batches
+    res = &codec->results[2 * CK_BLOB64K + 1];
+    ASSERT_STR("Reader_readBlob", res->name);
+    ASSERT_STR("blob64k", res->value);
+    ASSERT_INT64(990, res->ops);
+    res = &codec->results[2 * CK_ROWNARROW];
+    ASSERT_STR("encodeRow", res->name);
+    ASSERT_INT64(1000 * (1 + 9 + 21 + 5 + 9), res->bytes);
+    // the same rows over a growing Writer and a file Reader
+    res = &codec->results[2 * CK_COUNT];
+    ASSERT_STR("encodeRow/bufWriter", res->name);
+    ASSERT_STR("rowNarrow", res->value);
+    ASSERT_INT64(1000 * (1 + 9 + 21 + 5 + 9), res->bytes);
+    res = &codec->results[2 * CK_COUNT + 1];
+    ASSERT_STR("decodeRow/fdReader", res->name);
+    ASSERT_INT64(1000, res->ops);
+    FILE *f = tmpfile();
+    ASSERT(f);
+    CodecBench_printJson(codec, f);
+    ASSERT(ftell(f) > 0);
+    fclose(f);
+    CodecBench_free(codec);
+}
+
+void testBench() {
+    Bench *bench = newBench(2500, 100);
+    Db *db = newDb(":memory:", FALSE);
+    Bench_runDb(bench, db);
+    Db_free(db);
+    ASSERT_INT(7, bench->nresults);
+    BenchResult *res = _find(bench, "insert", "sqlite");
+    ASSERT(res);
+    ASSERT_INT64(3, res->ops);
+    ASSERT_INT64(2500, res->rows);
+    res = _find(bench, "insertCol", "sqlite");
+    ASSERT_INT64(2500, res->rows);
+    res = _find(bench, "lookup", "sqlite");
+    ASSERT_INT64(100, res->rows);
+    res = _find(bench, "scan", "sqlite");
+    ASSERT_INT64(2, res->ops);
+    ASSERT(res->rows > 0 && res->rows <= 2 * BENCH_SCAN_ROWS);
+    res = _find(bench, "blobRead", "sqlite");
+    ASSERT_INT64((int64_t)BENCH_BLOBS * BENCH_BLOB_SIZE, res->bytes);
+    // percentiles
+    int64_t lat[] = {1000, 2000, 3000, 4000};
+    ASSERT_DOUBLE(2.0, _percentile(lat, 4, 0.5));
+    ASSERT_DOUBLE(4.0, _percentile(lat, 4, 0.99));
+    ASSERT_DOUBLE(1.0, _percentile(lat, 4, 0.0));
+    FILE *f = tmpfile();
+    ASSERT(f);
+    Bench_printJson(bench, f);
+    ASSERT(ftell(f) > 0);
+    fclose(f);
+    Bench_free(bench);
+    LOG_INFO0("testBench testReplay");
+    testReplay();
+    LOG_INFO0("testBench testCodecBench");
+    testCodecBench();
+}
@@ -0,0 +1,40 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* A Bench runs standard workloads (bulk insert, point lookup, range scan,
+   wide rows, large blobs) and measures throughput and latency. It runs
+   them over the sqinn protocol against a 'sqinn run' child process, and
+   directly against a Db, so that the difference is the protocol overhead. */
+typedef struct bench_s Bench;
+Bench *newBench(int nrows, int nlookups);
+void Bench_free(Bench *this);
+BOOL Bench_runChild(Bench *this, char *const argv[]);
+void Bench_runDb(Bench *this, Db *db);
+void Bench_printJson(Bench *this, FILE *out);
+
+/* A CodecBench measures the Reader/Writer primitives, one value type at a
+   time, and the encoding and decoding of whole rows of typical shapes. */
+typedef struct codecbench_s CodecBench;
+CodecBench *newCodecBench(int64_t nops);
+void CodecBench_free(CodecBench *this);
+void CodecBench_run(CodecBench *this);
+void CodecBench_printJson(CodecBench *this, FILE *out);
+
+/* A Replay re-runs the requests of a recording (see Reader_record) through
+   an App, as fast as possible or at the recorded pacing, and measures
+   throughput and latency per function code. */
+typedef struct replay_s Replay;
+Replay *newReplay(const char *filename);  // NULL if the file is not a recording or empty
+void Replay_free(Replay *this);
+Reader *Replay_reader(Replay *this);
+Writer *Replay_writer(Replay *this);
+void Replay_run(Replay *this, App *app, BOOL paced);
+void Replay_printJson(Replay *this, FILE *out);
+
+//
+// Test
+//
+
+void testBench();
+
+#endif  // BENCH_H
@@ -1,38 +1,1758 @@
 #include "utl.h"
+#include "io.h"
 #include "db.h"
 #include "sqlite3.h"
 
+// counting VFS
+
+#define COUNTING_VFS_NAME "sqinn-counting"
+
+/* A CountFile wraps a file of the underlying VFS, which follows it in memory. */
+typedef struct countfile_s {
+    sqlite3_file base;
+    sqlite3_file *real;
+} CountFile;
+
+static struct {
+    sqlite3_vfs vfs;
+    sqlite3_vfs *root;  // the VFS that does the work, NULL if not registered
+    int64_t reads;       // xRead calls: pages copied by pread
+    int64_t readBytes;
+    int64_t fetches;     // xFetch calls that returned mapped memory
+    int64_t fetchMisses; // xFetch calls that fell back to xRead
+} countvfs;
+
+#define REAL(f) (((CountFile *)(f))->real)
+
+static int _cfClose(sqlite3_file *f) {
+    return REAL(f)->pMethods->xClose(REAL(f));
+}
+
+static int _cfRead(sqlite3_file *f, void *buf, int amt, sqlite3_int64 off) {
+    ATOMIC_ADD64(&countvfs.reads, 1);
+    ATOMIC_ADD64(&countvfs.readBytes, amt);
+    return REAL(f)->pMethods->xRead(REAL(f), buf, amt, off);
+}
+
+static int _cfWrite(sqlite3_file *f, const void *buf, int amt, sqlite3_int64 off) {
+    return REAL(f)->pMethods->xWrite(REAL(f), buf, amt, off);
+}
+
+static int _cfTruncate(sqlite3_file *f, sqlite3_int64 size) {
+    return REAL(f)->pMethods->xTruncate(REAL(f), size);
+}
+
+static int _cfSync(sqlite3_file *f, int flags) {
+    return REAL(f)->pMethods->xSync(REAL(f), flags);
+}
+
+static int _cfFileSize(sqlite3_file *f, sqlite3_int64 *psize) {
+    return REAL(f)->pMethods->xFileSize(REAL(f), psize);
+}
+
+static int _cfLock(sqlite3_file *f, int lock) {
+    return REAL(f)->pMethods->xLock(REAL(f), lock);
+}
+
+static int _cfUnlock(sqlite3_file *f, int lock) {
+    return REAL(f)->pMethods->xUnlock(REAL(f), lock);
+}
+
+static int _cfCheckReservedLock(sqlite3_file *f, int *pres) {
+    return REAL(f)->pMethods->xCheckReservedLock(REAL(f), pres);
+}
+
+static int _cfFileControl(sqlite3_file *f, int op, void *arg) {
+    return REAL(f)->pMethods->xFileControl(REAL(f), op, arg);
+}
+
+static int _cfSectorSize(sqlite3_file *f) {
+    return REAL(f)->pMethods->xSectorSize(REAL(f));
+}
+
+static int _cfDeviceCharacteristics(sqlite3_file *f) {
+    return REAL(f)->pMethods->xDeviceCharacteristics(REAL(f));
+}
+
+static int _cfShmMap(sqlite3_file *f, int region, int size, int extend, void volatile **pp) {
+    return REAL(f)->pMethods->xShmMap(REAL(f), region, size, extend, pp);
+}
+
+static int _cfShmLock(sqlite3_file *f, int offset, int n, int flags) {
+    return REAL(f)->pMethods->xShmLock(REAL(f), offset, n, flags);
+}
+
+static void _cfShmBarrier(sqlite3_file *f) {
+    REAL(f)->pMethods->xShmBarrier(REAL(f));
+}
+
+static int _cfShmUnmap(sqlite3_file *f, int deleteFlag) {
+    return REAL(f)->pMethods->xShmUnmap(REAL(f), deleteFlag);
+}
+
+static int _cfFetch(sqlite3_file *f, sqlite3_int64 off, int amt, void **pp) {
+    int rc = REAL(f)->pMethods->xFetch(REAL(f), off, amt, pp);
+    if (rc == SQLITE_OK && *pp) {
+        ATOMIC_ADD64(&countvfs.fetches, 1);
+    } else {
+        ATOMIC_ADD64(&countvfs.fetchMisses, 1);
+    }
+    return rc;
+}
+
+static int _cfUnfetch(sqlite3_file *f, sqlite3_int64 off, void *p) {
+    return REAL(f)->pMethods->xUnfetch(REAL(f), off, p);
+}
+
+/* the methods of a CountFile, by the io methods version of the real file */
+static const sqlite3_io_methods countIoMethods[3] = {
+    {1, _cfClose, _cfRead, _cfWrite, _cfTruncate, _cfSync, _cfFileSize, _cfLock, _cfUnlock,
+        _cfCheckReservedLock, _cfFileControl, _cfSectorSize, _cfDeviceCharacteristics,
+        NULL, NULL, NULL, NULL, NULL, NULL},
+    {2, _cfClose, _cfRead, _cfWrite, _cfTruncate, _cfSync, _cfFileSize, _cfLock, _cfUnlock,
+        _cfCheckReservedLock, _cfFileControl, _cfSectorSize, _cfDeviceCharacteristics,
+        _cfShmMap, _cfShmLock, _cfShmBarrier, _cfShmUnmap, NULL, NULL},
+    {3, _cfClose, _cfRead, _cfWrite, _cfTruncate, _cfSync, _cfFileSize, _cfLock, _cfUnlock,
+        _cfCheckReservedLock, _cfFileControl, _cfSectorSize, _cfDeviceCharacteristics,
+        _cfShmMap, _cfShmLock, _cfShmBarrier, _cfShmUnmap, _cfFetch, _cfUnfetch},
+};
+
+static int _cvOpen(sqlite3_vfs *vfs, const char *name, sqlite3_file *f, int flags, int *poutFlags) {
+    CountFile *cf = (CountFile *)f;
+    cf->real = (sqlite3_file *)&cf[1];
+    int rc = countvfs.root->xOpen(countvfs.root, name, cf->real, flags, poutFlags);
+    const sqlite3_io_methods *real = cf->real->pMethods;
+    if (real) {
+        int version = real->iVersion < 3 ? real->iVersion : 3;
+        cf->base.pMethods = &countIoMethods[version - 1];
+    } else {
+        cf->base.pMethods = NULL;
+    }
+    return rc;
+}
+
+static int _cvDelete(sqlite3_vfs *vfs, const char *name, int syncDir) {
+    return countvfs.root->xDelete(countvfs.root, name, syncDir);
+}
+
+static int _cvAccess(sqlite3_vfs *vfs, const char *name, int flags, int *pres) {
+    return countvfs.root->xAccess(countvfs.root, name, flags, pres);
+}
+
+static int _cvFullPathname(sqlite3_vfs *vfs, const char *name, int n, char *out) {
+    return countvfs.root->xFullPathname(countvfs.root, name, n, out);
+}
+
+static void *_cvDlOpen(sqlite3_vfs *vfs, const char *filename) {
+    return countvfs.root->xDlOpen(countvfs.root, filename);
+}
+
+static void _cvDlError(sqlite3_vfs *vfs, int n, char *msg) {
+    countvfs.root->xDlError(countvfs.root, n, msg);
+}
+
+static void (*_cvDlSym(sqlite3_vfs *vfs, void *handle, const char *symbol))(void) {
+    return countvfs.root->xDlSym(countvfs.root, handle, symbol);
+}
+
+static void _cvDlClose(sqlite3_vfs *vfs, void *handle) {
+    countvfs.root->xDlClose(countvfs.root, handle);
+}
+
+static int _cvRandomness(sqlite3_vfs *vfs, int n, char *out) {
+    return countvfs.root->xRandomness(countvfs.root, n, out);
+}
+
+static int _cvSleep(sqlite3_vfs *vfs, int micros) {
+    return countvfs.root->xSleep(countvfs.root, micros);
+}
+
+static int _cvCurrentTime(sqlite3_vfs *vfs, double *pnow) {
+    return countvfs.root->xCurrentTime(countvfs.root, pnow);
+}
+
+static int _cvGetLastError(sqlite3_vfs *vfs, int n, char *msg) {
+    return countvfs.root->xGetLastError ? countvfs.root->xGetLastError(countvfs.root, n, msg) : 0;
+}
+
+static int _cvCurrentTimeInt64(sqlite3_vfs *vfs, sqlite3_int64 *pnow) {
+    return countvfs.root->xCurrentTimeInt64(countvfs.root, pnow);
+}
+
+/* Db_configCountingVfs registers a VFS that counts pages that are read
+   with pread (xRead) and pages that are served from memory-mapped I/O
+   (xFetch), and makes it the default. It must be called before the
+   first Db is opened. */
+BOOL Db_configCountingVfs() {
+    if (countvfs.root) {
+        return TRUE;
+    }
+    sqlite3_vfs *root = sqlite3_vfs_find(NULL);
+    if (!root) {
+        LOG_INFO0("Db_configCountingVfs: no default VFS");
+        return FALSE;
+    }
+    sqlite3_vfs *vfs = &countvfs.vfs;
+    memset(vfs, 0, sizeof(sqlite3_vfs));
+    vfs->iVersion = root->iVersion < 2 ? root->iVersion : 2;
+    vfs->szOsFile = (int)sizeof(CountFile) + root->szOsFile;
+    vfs->mxPathname = root->mxPathname;
+    vfs->zName = COUNTING_VFS_NAME;
+    vfs->xOpen = _cvOpen;
+    vfs->xDelete = _cvDelete;
+    vfs->xAccess = _cvAccess;
+    vfs->xFullPathname = _cvFullPathname;
+    vfs->xDlOpen = _cvDlOpen;
+    vfs->xDlError = _cvDlError;
+    vfs->xDlSym = _cvDlSym;
+    vfs->xDlClose = _cvDlClose;
+    vfs->xRandomness = _cvRandomness;
+    vfs->xSleep = _cvSleep;
+    vfs->xCurrentTime = _cvCurrentTime;
+    vfs->xGetLastError = _cvGetLastError;
+    if (vfs->iVersion >= 2) {
+        vfs->xCurrentTimeInt64 = _cvCurrentTimeInt64;
+    }
+    countvfs.root = root;
+    int rc = sqlite3_vfs_register(vfs, 1);
+    if (rc != SQLITE_OK) {
+        LOG_INFO1("Db_configCountingVfs: %s", sqlite3_errstr(rc));
+        countvfs.root = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void _countingVfsStats(Stats *stats) {
+    Stats_add(stats, "vfs.reads", countvfs.reads);
+    Stats_add(stats, "vfs.readBytes", countvfs.readBytes);
+    Stats_add(stats, "vfs.fetches", countvfs.fetches);
+    Stats_add(stats, "vfs.fetchMisses", countvfs.fetchMisses);
+}
+
+// SQLite memory
+
+#define SQLMEM_MIN_SHIFT 4            // smallest size class is 16 bytes
+#define SQLMEM_NCLASSES 12            // size classes 16 bytes ... 32 KB, larger allocations go to malloc
+#define SQLMEM_SLAB_SIZE (64*1024)    // size classes get their blocks in slabs of that size
+#define SQLMEM_HDR 8                  // every allocation is preceded by its usable size
+#define SQLMEM_SLAB_HDR 16            // slab link, keeps blocks 16-byte aligned
+#define SQLMEM_HEAP_MIN_ALLOC 64      // min. allocation size of the MEMSYS5 heap
+
+/* A MemBlock is a free block of a size class, or the link of a slab. */
+typedef struct memblock_s {
+    struct memblock_s *next;
+} MemBlock;
+
+/* A MemClass hands out blocks of one size. The last class holds the
+   statistics of allocations that are too large for a size class. */
+typedef struct memclass_s {
+    Mutex *mutex;
+    MemBlock *free;   // free blocks
+    MemBlock *slabs;  // all slabs, released on shutdown
+    int64_t nalloc;   // number of allocations
+    int64_t inuse;    // blocks in use
+    int64_t peak;     // max. blocks in use
+    int64_t nslabs;
+} MemClass;
+
+static struct {
+    int mode;                               // see DB_MEM_...
+    sqlite3_mem_methods saved;              // methods that were installed before
+    MemClass classes[SQLMEM_NCLASSES + 1];  // size classes and large allocations
+    void *heap;                             // DB_MEM_HEAP only
+    void *pageCache;                        // see Db_configPageCache
+} sqlmem;
+
+static int _sqlmemClass(int64_t total) {
+    int c = 0;
+    int64_t size = 1 << SQLMEM_MIN_SHIFT;
+    while (size < total && c < SQLMEM_NCLASSES) {
+        size <<= 1;
+        c++;
+    }
+    return c;
+}
+
+static int _sqlmemRoundup(int n) {
+    int c = _sqlmemClass((int64_t)n + SQLMEM_HDR);
+    if (c < SQLMEM_NCLASSES) {
+        return (1 << (c + SQLMEM_MIN_SHIFT)) - SQLMEM_HDR;
+    }
+    return (n + 7) & ~7;
+}
+
+static void *_sqlmemMalloc(int n) {
+    n = _sqlmemRoundup(n);
+    int c = _sqlmemClass((int64_t)n + SQLMEM_HDR);
+    MemClass *mc = &sqlmem.classes[c];
+    char *block = NULL;
+    if (c == SQLMEM_NCLASSES) {
+        block = (char *)malloc(SQLMEM_HDR + n);
+    }
+    Mutex_lock(mc->mutex);
+    if (c < SQLMEM_NCLASSES) {
+        if (!mc->free) {
+            // carve a new slab into blocks
+            int blockSize = 1 << (c + SQLMEM_MIN_SHIFT);
+            int nblocks = SQLMEM_SLAB_SIZE / blockSize;
+            char *slab = (char *)malloc(SQLMEM_SLAB_HDR + SQLMEM_SLAB_SIZE);
+            if (slab) {
+                MemBlock *link = (MemBlock *)slab;
+                link->next = mc->slabs;
+                mc->slabs = link;
+                mc->nslabs++;
+                char *first = slab + SQLMEM_SLAB_HDR;
+                for (int i = nblocks - 1; i >= 0; i--) {
+                    MemBlock *b = (MemBlock *)(first + (size_t)i * blockSize);
+                    b->next = mc->free;
+                    mc->free = b;
+                }
+            }
+        }
+        if (mc->free) {
+            block = (char *)mc->free;
+            mc->free = mc->free->next;
+        }
+    }
+    if (block) {
+        mc->nalloc++;
+        mc->inuse++;
+        if (mc->inuse > mc->peak) {
+            mc->peak = mc->inuse;
+        }
+    }
+    Mutex_unlock(mc->mutex);
+    if (!block) {
+        return NULL;
+    }
+    *(int64_t *)block = n;
+    return block + SQLMEM_HDR;
+}
+
+static int _sqlmemSize(void *p) {
+    return (int)*(int64_t *)((char *)p - SQLMEM_HDR);
+}
+
+static void _sqlmemFree(void *p) {
+    char *block = (char *)p - SQLMEM_HDR;
+    int c = _sqlmemClass(*(int64_t *)block + SQLMEM_HDR);
+    MemClass *mc = &sqlmem.classes[c];
+    Mutex_lock(mc->mutex);
+    mc->inuse--;
+    if (c < SQLMEM_NCLASSES) {
+        MemBlock *b = (MemBlock *)block;
+        b->next = mc->free;
+        mc->free = b;
+    }
+    Mutex_unlock(mc->mutex);
+    if (c == SQLMEM_NCLASSES) {
+        free(block);
+    }
+}
+
+static void *_sqlmemRealloc(void *p, int n) {
+    int size = _sqlmemSize(p);
+    if (_sqlmemRoundup(n) == size) {
+        return p;
+    }
+    void *q = _sqlmemMalloc(n);
+    if (q) {
+        memcpy(q, p, size < n ? size : n);
+        _sqlmemFree(p);
+    }
+    return q;
+}
+
+static int _sqlmemInit(void *appData) {
+    for (int c = 0; c <= SQLMEM_NCLASSES; c++) {
+        memset(&sqlmem.classes[c], 0, sizeof(MemClass));
+        sqlmem.classes[c].mutex = newMutex();
+    }
+    return SQLITE_OK;
+}
+
+static void _sqlmemShutdown(void *appData) {
+    for (int c = 0; c <= SQLMEM_NCLASSES; c++) {
+        MemClass *mc = &sqlmem.classes[c];
+        while (mc->slabs) {
+            MemBlock *next = mc->slabs->next;
+            free(mc->slabs);
+            mc->slabs = next;
+        }
+        mc->free = NULL;
+        Mutex_free(mc->mutex);
+        mc->mutex = NULL;
+    }
+}
+
+/* Db_configMemory installs the allocator that SQLite uses: the system
+   malloc, a size-class pool, or a fixed heap of heapSize bytes (needs
+   SQLITE_ENABLE_MEMSYS5, at most INT_MAX). It must be called before the
+   first Db is opened. */
+BOOL Db_configMemory(int mode, size_t heapSize) {
+    if (mode == DB_MEM_HEAP && (heapSize == 0 || heapSize > INT_MAX)) {
+        // SQLITE_CONFIG_HEAP takes an int
+        LOG_INFO1("Db_configMemory: heap size %zu must be between 1 and 2147483647", heapSize);
+        return FALSE;
+    }
+    int rc = sqlite3_config(SQLITE_CONFIG_GETMALLOC, &sqlmem.saved);
+    if (rc != SQLITE_OK) {
+        LOG_INFO1("Db_configMemory: cannot get allocator: %s", sqlite3_errstr(rc));
+        return FALSE;
+    }
+    if (mode == DB_MEM_POOL) {
+        sqlite3_mem_methods methods = {
+            _sqlmemMalloc,
+            _sqlmemFree,
+            _sqlmemRealloc,
+            _sqlmemSize,
+            _sqlmemRoundup,
+            _sqlmemInit,
+            _sqlmemShutdown,
+            NULL
+        };
+        rc = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+    } else if (mode == DB_MEM_HEAP) {
+#ifdef SQLITE_ENABLE_MEMSYS5
+        sqlmem.heap = memAlloc(heapSize, __FILE__, __LINE__);
+        rc = sqlite3_config(SQLITE_CONFIG_HEAP, sqlmem.heap, (int)heapSize, SQLMEM_HEAP_MIN_ALLOC);
+        if (rc != SQLITE_OK) {
+            memFree(sqlmem.heap);
+            sqlmem.heap = NULL;
+        }
+#else
+        LOG_INFO0("Db_configMemory: heap needs SQLITE_ENABLE_MEMSYS5");
+        return FALSE;
+#endif
+    }
+    if (rc != SQLITE_OK) {
+        LOG_INFO1("Db_configMemory: cannot install allocator: %s", sqlite3_errstr(rc));
+        return FALSE;
+    }
+    sqlmem.mode = mode;
+    return TRUE;
+}
+
+/* Db_configPageCache gives SQLite a pre-allocated page cache of npages
+   slots, each large enough for a page of pageSize bytes. Pages that do
+   not fit go to the allocator and count as page cache overflow. It must
+   be called before the first Db is opened. */
+BOOL Db_configPageCache(int pageSize, int npages) {
+    ASSERT(pageSize > 0);
+    ASSERT(npages > 0);
+    ASSERT(!sqlmem.pageCache);
+    int hdrsz = 0;
+    int rc = sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &hdrsz);
+    if (rc != SQLITE_OK) {
+        LOG_INFO1("Db_configPageCache: cannot get page header size: %s", sqlite3_errstr(rc));
+        return FALSE;
+    }
+    int slotSize = (pageSize + hdrsz + 7) & ~7;
+    sqlmem.pageCache = memAlloc((size_t)slotSize * npages, __FILE__, __LINE__);
+    rc = sqlite3_config(SQLITE_CONFIG_PAGECACHE, sqlmem.pageCache, slotSize, npages);
+    if (rc != SQLITE_OK) {
+        LOG_INFO1("Db_configPageCache: cannot install page cache: %s", sqlite3_errstr(rc));
+        memFree(sqlmem.pageCache);
+        sqlmem.pageCache = NULL;
+        return FALSE;
+    }
+    LOG_INFO3("page cache: %d slots of %d bytes (page header %d bytes)", npages, slotSize, hdrsz);
+    return TRUE;
+}
+
+/* Db_configHeapLimits sets SQLite's soft and hard heap limits in bytes,
+   zero is no limit. Above the soft limit, SQLite releases cache pages
+   before it allocates more. An allocation that would exceed the hard limit
+   fails, and the statement that needed it fails with SQLITE_NOMEM. It
+   returns FALSE if the soft limit is above the hard limit, or if SQLite
+   did not take the limits. */
+BOOL Db_configHeapLimits(int64_t soft, int64_t hard) {
+    ASSERT(soft >= 0 && hard >= 0);
+    if (hard && soft > hard) {
+        LOG_INFO2("Db_configHeapLimits: soft limit %" PRId64 " is above hard limit %" PRId64, soft, hard);
+        return FALSE;
+    }
+    sqlite3_hard_heap_limit64(hard);
+    sqlite3_soft_heap_limit64(soft);
+    // with a hard limit, SQLite turns a soft limit of zero into the hard limit
+    int64_t wantSoft = soft || !hard ? soft : hard;
+    if (sqlite3_hard_heap_limit64(-1) != hard || sqlite3_soft_heap_limit64(-1) != wantSoft) {
+        LOG_INFO0("Db_configHeapLimits: cannot set heap limits");
+        return FALSE;
+    }
+    if (soft || hard) {
+        LOG_INFO2("sqlite heap limits: soft %" PRId64 " bytes, hard %" PRId64 " bytes", soft, hard);
+    }
+    return TRUE;
+}
+
+/* Db_printMemory logs SQLite's memory usage and, for the pool, the
+   statistics of each size class. */
+void Db_printMemory() {
+    sqlite3_int64 used = 0;
+    sqlite3_int64 highWater = 0;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &highWater, 0);
+    LOG_INFO2("sqlite memory: %" PRId64 " bytes used, high water %" PRId64 " bytes", (int64_t)used, (int64_t)highWater);
+    if (sqlmem.pageCache) {
+        sqlite3_int64 pages = 0;
+        sqlite3_int64 maxPages = 0;
+        sqlite3_int64 overflow = 0;
+        sqlite3_int64 maxOverflow = 0;
+        sqlite3_status64(SQLITE_STATUS_PAGECACHE_USED, &pages, &maxPages, 0);
+        sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &overflow, &maxOverflow, 0);
+        LOG_INFO4("page cache slots: %" PRId64 " used, high water %" PRId64 ", overflow %" PRId64 " bytes, high water %" PRId64 " bytes",
+            (int64_t)pages, (int64_t)maxPages, (int64_t)overflow, (int64_t)maxOverflow);
+    }
+    if (countvfs.root) {
+        LOG_INFO4("vfs: %" PRId64 " reads (%" PRId64 " bytes), %" PRId64 " mmap fetches, %" PRId64 " fetch misses",
+            countvfs.reads, countvfs.readBytes, countvfs.fetches, countvfs.fetchMisses);
+    }
+    if (sqlmem.mode != DB_MEM_POOL) {
+        return;
+    }
+    for (int c = 0; c <= SQLMEM_NCLASSES; c++) {
+        MemClass *mc = &sqlmem.classes[c];
+        if (!mc->mutex) {
+            continue;
+        }
+        Mutex_lock(mc->mutex);
+        if (mc->nalloc) {
+            if (c < SQLMEM_NCLASSES) {
+                LOG_INFO4("sqlite memory: class %5d bytes: %" PRId64 " allocs, %" PRId64 " in use, peak %" PRId64,
+                    1 << (c + SQLMEM_MIN_SHIFT), mc->nalloc, mc->inuse, mc->peak);
+                LOG_INFO2("sqlite memory: class %5d bytes: %" PRId64 " slabs", 1 << (c + SQLMEM_MIN_SHIFT), mc->nslabs);
+            } else {
+                LOG_INFO3("sqlite memory: large allocs: %" PRId64 " allocs, %" PRId64 " in use, peak %" PRId64,
+                    mc->nalloc, mc->inuse, mc->peak);
+            }
+        }
+        Mutex_unlock(mc->mutex);
+    }
+}
+
+static void _statusStats(Stats *stats, int op, const char *name) {
+    sqlite3_int64 cur = 0;
+    sqlite3_int64 hi = 0;
+    sqlite3_status64(op, &cur, &hi, 0);
+    Stats_addf(stats, cur, "sqlite.%s", name);
+    Stats_addf(stats, hi, "sqlite.%s.highWater", name);
+}
+
+/* Db_memoryStats adds SQLite's global memory counters and, for the pool,
+   the blocks in use per size class. */
+void Db_memoryStats(Stats *stats) {
+    _statusStats(stats, SQLITE_STATUS_MEMORY_USED, "memoryUsed");
+    _statusStats(stats, SQLITE_STATUS_MALLOC_SIZE, "mallocSize");
+    _statusStats(stats, SQLITE_STATUS_MALLOC_COUNT, "mallocCount");
+    _statusStats(stats, SQLITE_STATUS_PAGECACHE_USED, "pageCacheUsed");
+    _statusStats(stats, SQLITE_STATUS_PAGECACHE_OVERFLOW, "pageCacheOverflow");
+    _statusStats(stats, SQLITE_STATUS_PAGECACHE_SIZE, "pageCacheSize");
+    Stats_add(stats, "sqlite.softHeapLimit", sqlite3_soft_heap_limit64(-1));
+    Stats_add(stats, "sqlite.hardHeapLimit", sqlite3_hard_heap_limit64(-1));
+    if (countvfs.root) {
+        _countingVfsStats(stats);
+    }
+    if (sqlmem.mode != DB_MEM_POOL) {
+        return;
+    }
+    for (int c = 0; c < SQLMEM_NCLASSES; c++) {
+        MemClass *mc = &sqlmem.classes[c];
+        if (mc->mutex) {
+            Mutex_lock(mc->mutex);
+            int64_t inuse = mc->inuse;
+            int64_t peak = mc->peak;
+            Mutex_unlock(mc->mutex);
+            Stats_addf(stats, inuse, "sqlite.pool.%d.inUse", 1 << (c + SQLMEM_MIN_SHIFT));
+            Stats_addf(stats, peak, "sqlite.pool.%d.peak", 1 << (c + SQLMEM_MIN_SHIFT));
+        }
+    }
+}
+
+/* Db_shutdown releases SQLite's resources and restores the allocator
+   that was installed before Db_configMemory. All Dbs must be freed. */
+void Db_shutdown() {
+    Db_printMemory();
+    Db_configHeapLimits(0, 0);
+    if (countvfs.root) {
+        sqlite3_vfs_unregister(&countvfs.vfs);
+        memset(&countvfs, 0, sizeof(countvfs));
+    }
+    sqlite3_shutdown();
+    if (sqlmem.mode != DB_MEM_SYSTEM) {
+        sqlite3_config(SQLITE_CONFIG_MALLOC, &sqlmem.saved);
+        sqlmem.mode = DB_MEM_SYSTEM;
+    }
+    if (sqlmem.heap) {
+        memFree(sqlmem.heap);
+        sqlmem.heap = NULL;
+    }
+    if (sqlmem.pageCache) {
+        sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, 0, 0);
+        memFree(sqlmem.pageCache);
+        sqlmem.pageCache = NULL;
+    }
+}
+
+// class Checkpointer
+
+#define CKPT_RESTART_AFTER 3   // escalate to RESTART after that many incomplete PASSIVE checkpoints
+#define CKPT_TRUNCATE_FACTOR 4 // escalate to TRUNCATE if the WAL has grown to that many times the trigger size
+#define CKPT_BUSY_MILLIS 100   // how long RESTART and TRUNCATE wait for readers and writers
+#define CKPT_WRITER_BUSY_MILLIS 1000  // busy timeout of the server's connection, see Db_startCheckpointer
+
+/* A Checkpointer runs WAL checkpoints in a background thread, on its own connection. */
+typedef struct ckpt_s {
+    sqlite3 *db;
+    Thread *thread;
+    Mutex *mutex;
+    Cond *cond;
+    int walPages;        // checkpoint if the WAL has that many pages
+    int intervalMillis;  // or if that many millis have passed and there were commits
+    int walFrames;       // WAL size in pages, as reported by the last commit
+    int commits;         // number of commits since last checkpoint
+    BOOL stop;
+    // metrics
+    int64_t npassive;
+    int64_t nrestart;
+    int64_t ntruncate;
+    int64_t nbusy;
+    int64_t totalNanos;
+    int64_t maxNanos;
+    int maxWalFrames;
+} Ckpt;
+
+static int _ckptWalHook(void *arg, sqlite3 *db, const char *dbname, int nframes) {
+    Ckpt *this = (Ckpt *)arg;
+    Mutex_lock(this->mutex);
+    this->walFrames = nframes;
+    this->commits++;
+    if (nframes >= this->walPages) {
+        Cond_broadcast(this->cond);
+    }
+    Mutex_unlock(this->mutex);
+    return SQLITE_OK;
+}
+
+static BOOL _ckptRun(Ckpt *this, int mode, int *pnlog, int *pnckpt) {
+    int64_t t0 = nanotime();
+    int rc = sqlite3_wal_checkpoint_v2(this->db, "main", mode, pnlog, pnckpt);
+    int64_t nanos = nanotime() - t0;
+    Mutex_lock(this->mutex);
+    if (mode == SQLITE_CHECKPOINT_PASSIVE) {
+        this->npassive++;
+    } else if (mode == SQLITE_CHECKPOINT_RESTART) {
+        this->nrestart++;
+    } else {
+        this->ntruncate++;
+    }
+    if (rc == SQLITE_BUSY) {
+        this->nbusy++;
+    }
+    this->totalNanos += nanos;
+    if (nanos > this->maxNanos) {
+        this->maxNanos = nanos;
+    }
+    if (*pnlog > this->maxWalFrames) {
+        this->maxWalFrames = *pnlog;
+    }
+    Mutex_unlock(this->mutex);
+    LOG_DEBUG4("checkpoint mode=%d rc=%d log=%d ckpt=%d", mode, rc, *pnlog, *pnckpt);
+    if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+        LOG_INFO3("sqlite3_wal_checkpoint_v2 rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+    }
+    return rc == SQLITE_OK;
+}
+
+static void _ckptMain(void *arg) {
+    Ckpt *this = (Ckpt *)arg;
+    int nincomplete = 0;
+    Mutex_lock(this->mutex);
+    while (!this->stop) {
+        if (this->walFrames < this->walPages) {
+            Cond_waitMillis(this->cond, this->mutex, this->intervalMillis);
+        }
+        if (this->stop || !this->commits) {
+            continue;
+        }
+        this->commits = 0;
+        this->walFrames = 0;
+        Mutex_unlock(this->mutex);
+        // a connection finds out about WAL mode only when it reads
+        sqlite3_exec(this->db, "SELECT 1 FROM sqlite_schema LIMIT 1", NULL, NULL, NULL);
+        // PASSIVE never blocks the writer, escalate if it cannot keep up
+        int nlog = 0;
+        int nckpt = 0;
+        BOOL ok = _ckptRun(this, SQLITE_CHECKPOINT_PASSIVE, &nlog, &nckpt);
+        if (ok && nlog > 0) {
+            nincomplete = nckpt < nlog ? nincomplete + 1 : 0;
+            if (nlog >= CKPT_TRUNCATE_FACTOR * this->walPages) {
+                _ckptRun(this, SQLITE_CHECKPOINT_TRUNCATE, &nlog, &nckpt);
+                nincomplete = 0;
+            } else if (nincomplete >= CKPT_RESTART_AFTER) {
+                _ckptRun(this, SQLITE_CHECKPOINT_RESTART, &nlog, &nckpt);
+                nincomplete = 0;
+            }
+        }
+        Mutex_lock(this->mutex);
+    }
+    Mutex_unlock(this->mutex);
+}
+
+static Ckpt *newCkpt(const char *filename, int walPages, int intervalMillis) {
+    Ckpt *this = (Ckpt *)memAlloc(sizeof(Ckpt), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Ckpt));
+    int rc = sqlite3_open_v2(filename, &(this->db), SQLITE_OPEN_READWRITE, NULL);
+    if (rc != SQLITE_OK) {
+        LOG_INFO3("checkpointer: sqlite3_open_v2 rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+        sqlite3_close(this->db);
+        memFree(this);
+        return NULL;
+    }
+    sqlite3_busy_timeout(this->db, CKPT_BUSY_MILLIS);
+    this->walPages = walPages;
+    this->intervalMillis = intervalMillis;
+    this->mutex = newMutex();
+    this->cond = newCond();
+    this->thread = newThread(_ckptMain, this);
+    return this;
+}
+
+static void Ckpt_stats(Ckpt *this, Stats *stats) {
+    Mutex_lock(this->mutex);
+    Stats_add(stats, "ckpt.passive", this->npassive);
+    Stats_add(stats, "ckpt.restart", this->nrestart);
+    Stats_add(stats, "ckpt.truncate", this->ntruncate);
+    Stats_add(stats, "ckpt.busy", this->nbusy);
+    Stats_add(stats, "ckpt.totalNanos", this->totalNanos);
+    Stats_add(stats, "ckpt.maxNanos", this->maxNanos);
+    Stats_add(stats, "ckpt.maxWalPages", this->maxWalFrames);
+    Mutex_unlock(this->mutex);
+}
+
+static void Ckpt_free(Ckpt *this) {
+    Mutex_lock(this->mutex);
+    this->stop = TRUE;
+    Cond_broadcast(this->cond);
+    Mutex_unlock(this->mutex);
+    Thread_join(this->thread);
+    int64_t n = this->npassive + this->nrestart + this->ntruncate;
+    LOG_INFO4("checkpointer: %" PRId64 " checkpoints (%" PRId64 " restart, %" PRId64 " truncate, %" PRId64 " busy)", n, this->nrestart, this->ntruncate, this->nbusy);
+    LOG_INFO3("checkpointer: avg %.3f ms, max %.3f ms, max WAL %d pages", n ? this->totalNanos / 1e6 / n : 0.0, this->maxNanos / 1e6, this->maxWalFrames);
+    sqlite3_close(this->db);
+    Cond_free(this->cond);
+    Mutex_free(this->mutex);
+    memFree(this);
+}
+
 // class Db
 
+
+/* A StmtStat accumulates the statistics of all statements that have the
+   same normalized SQL text, see Db_setStmtStats. */
+typedef struct stmtstat_s {
+    uint32_t hash;          // hash of sql
+    char *sql;              // normalized sql
+    int64_t calls;
+    int64_t rows;           // rows returned
+    int64_t totalNanos;     // prepare to finalize
+    int64_t maxNanos;
+    int64_t fullscanSteps;  // SQLITE_STMTSTATUS_FULLSCAN_STEP
+    int64_t sorts;          // SQLITE_STMTSTATUS_SORT
+    int64_t autoindexes;    // SQLITE_STMTSTATUS_AUTOINDEX
+    int64_t vmSteps;        // SQLITE_STMTSTATUS_VM_STEP
+    int64_t memUsed;        // max. SQLITE_STMTSTATUS_MEMUSED
+} StmtStat;
+
+#define SLOW_PARAMS 8   // number of parameters shown in the slow statement log
+#define SLOW_PREFIX 24  // number of characters shown of a string parameter
+#define SLOW_PLAN 4096  // max. size of a query plan in the slow statement log
+
+/* A SlowParam is a bound parameter, kept in case the statement turns out to
+   be slow, see Db_setSlowLog. Strings are shortened to SLOW_PREFIX chars. */
+typedef struct slowparam_s {
+    char type;
+    int64_t i;                      // VT_INT32 and VT_INT64
+    double d;                       // VT_DOUBLE
+    size_t sz;                      // VT_BLOB
+    char prefix[SLOW_PREFIX + 4];   // VT_STRING, "..." if shortened
+} SlowParam;
+
+/* A RowCodec fetches the columns base, base+1, ... of the current row of
+   stmt and writes them to w, preceded by the hasRow byte if head is set.
+   There is one RowCodec per column-type signature of up to ROW_CODEC_CHUNK
+   columns, generated by the RC_ macros below, so that a query picks its
+   encoder once instead of switching on the type of each value. A RowCodec
+   makes one Writer_reserve per call. It returns FALSE, without writing, if
+   a string is long enough to be sent without a copy, see Writer_zeroCopy. */
+typedef BOOL (*RowCodec)(sqlite3_stmt *stmt, int base, BOOL head, Writer *w);
+
+#define ROW_CODEC_CHUNK 4     // max. columns of a RowCodec
+#define ROW_CODEC_MAX_COLS 8  // max. columns of a row encoded by RowCodecs
+
+static void _putInt32(char *p, int v) {
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)(v);
+}
+
+static void _putInt64(char *p, int64_t v) {
+    _putInt32(p, (int)(v >> 32));
+    _putInt32(p + 4, (int)v);
+}
+
+static void _putDouble(char *p, double d) {
+    int64_t v;
+    memcpy(&v, &d, 8);
+    _putInt64(p, v);
+}
+
+// fetch column k, add its encoded size to size
+#define RC_GET_I(k) \
+    int t##k = sqlite3_column_type(stmt, base + k); \
+    int64_t v##k = t##k == SQLITE_NULL ? 0 : (int64_t)sqlite3_column_int64(stmt, base + k); \
+    size += t##k == SQLITE_NULL ? 1 : 9;
+#define RC_GET_D(k) \
+    int t##k = sqlite3_column_type(stmt, base + k); \
+    double v##k = t##k == SQLITE_NULL ? 0 : sqlite3_column_double(stmt, base + k); \
+    size += t##k == SQLITE_NULL ? 1 : 9;
+#define RC_GET_S(k) \
+    int t##k = sqlite3_column_type(stmt, base + k); \
+    const char *v##k = t##k == SQLITE_NULL ? NULL : (const char *)sqlite3_column_text(stmt, base + k); \
+    size_t n##k = v##k ? strlen(v##k) + 1 : 0; \
+    size_t ref##k = Writer_zeroCopy(w); \
+    if (ref##k && n##k >= ref##k) { \
+        return FALSE;  /* written with Writer_writeBlobRef */ \
+    } \
+    size += v##k ? 5 + n##k : 1;
+
+// write column k at p, same encoding as Writer_writeByte, Writer_writeInt64, ...
+#define RC_PUT_I(k) \
+    if (t##k == SQLITE_NULL) { *p++ = VT_NULL; } else { *p++ = VT_INT64; _putInt64(p, v##k); p += 8; }
+#define RC_PUT_D(k) \
+    if (t##k == SQLITE_NULL) { *p++ = VT_NULL; } else { *p++ = VT_DOUBLE; _putDouble(p, v##k); p += 8; }
+#define RC_PUT_S(k) \
+    if (!v##k) { *p++ = VT_NULL; } else { *p++ = VT_STRING; _putInt32(p, (int)n##k); p += 4; memcpy(p, v##k, n##k); p += n##k; }
+
+#define RC_BEGIN(name) \
+    static BOOL name(sqlite3_stmt *stmt, int base, BOOL head, Writer *w) { \
+        size_t size = head ? 1 : 0;
+#define RC_RESERVE \
+        char *p = Writer_reserve(w, size); \
+        if (!p) { \
+            return TRUE;  /* full, see Writer_full */ \
+        } \
+        if (head) { \
+            *p++ = 1;  /* hasRow = TRUE */ \
+        }
+#define RC_END \
+        return TRUE; \
+    }
+
+#define RC_CODEC1(_, A) \
+    RC_BEGIN(_rc##A) RC_GET_##A(0) RC_RESERVE RC_PUT_##A(0) RC_END
+#define RC_CODEC2(A, B) \
+    RC_BEGIN(_rc##A##B) RC_GET_##A(0) RC_GET_##B(1) \
+    RC_RESERVE RC_PUT_##A(0) RC_PUT_##B(1) RC_END
+#define RC_CODEC3(A, B, C) \
+    RC_BEGIN(_rc##A##B##C) RC_GET_##A(0) RC_GET_##B(1) RC_GET_##C(2) \
+    RC_RESERVE RC_PUT_##A(0) RC_PUT_##B(1) RC_PUT_##C(2) RC_END
+#define RC_CODEC4(A, B, C, D) \
+    RC_BEGIN(_rc##A##B##C##D) RC_GET_##A(0) RC_GET_##B(1) RC_GET_##C(2) RC_GET_##D(3) \
+    RC_RESERVE RC_PUT_##A(0) RC_PUT_##B(1) RC_PUT_##C(2) RC_PUT_##D(3) RC_END
+
+#define RC_REF1(_, A) _rc##A,
+#define RC_REF2(A, B) _rc##A##B,
+#define RC_REF3(A, B, C) _rc##A##B##C,
+#define RC_REF4(A, B, C, D) _rc##A##B##C##D,
+
+// expand L for each signature of I (int64), D (double) and S (string),
+// one RC_FOR per column because a macro does not expand inside itself
+#define RC_FOR1(L, ...) L(__VA_ARGS__, I) L(__VA_ARGS__, D) L(__VA_ARGS__, S)
+#define RC_FOR2(L, ...) L(__VA_ARGS__, I) L(__VA_ARGS__, D) L(__VA_ARGS__, S)
+#define RC_FOR3(L, ...) L(__VA_ARGS__, I) L(__VA_ARGS__, D) L(__VA_ARGS__, S)
+#define RC_FOR4(L, ...) L(__VA_ARGS__, I) L(__VA_ARGS__, D) L(__VA_ARGS__, S)
+#define RC_ALL1(L) RC_FOR1(L, )
+#define RC_ALL2(L) RC_FOR1(RC_N2, L)
+#define RC_N2(L, A) RC_FOR2(L, A)
+#define RC_ALL3(L) RC_FOR1(RC_N3A, L)
+#define RC_N3A(L, A) RC_FOR2(RC_N3B, L, A)
+#define RC_N3B(L, A, B) RC_FOR3(L, A, B)
+#define RC_ALL4(L) RC_FOR1(RC_N4A, L)
+#define RC_N4A(L, A) RC_FOR2(RC_N4B, L, A)
+#define RC_N4B(L, A, B) RC_FOR3(RC_N4C, L, A, B)
+#define RC_N4C(L, A, B, C) RC_FOR4(L, A, B, C)
+
+RC_ALL1(RC_CODEC1)
+RC_ALL2(RC_CODEC2)
+RC_ALL3(RC_CODEC3)
+RC_ALL4(RC_CODEC4)
+
+// indexed by signature, a base-3 number with I=0, D=1, S=2, first column first
+static const RowCodec rowCodecs1[3] = { RC_ALL1(RC_REF1) };
+static const RowCodec rowCodecs2[9] = { RC_ALL2(RC_REF2) };
+static const RowCodec rowCodecs3[27] = { RC_ALL3(RC_REF3) };
+static const RowCodec rowCodecs4[81] = { RC_ALL4(RC_REF4) };
+static const RowCodec *const rowCodecs[ROW_CODEC_CHUNK + 1] = { NULL, rowCodecs1, rowCodecs2, rowCodecs3, rowCodecs4 };
+
+/* _rowCodec returns the RowCodec for n column types, or NULL if there is none. */
+static RowCodec _rowCodec(const char *coltypes, int n) {
+    ASSERT(n > 0 && n <= ROW_CODEC_CHUNK);
+    int index = 0;
+    for (int i = 0; i < n; i++) {
+        switch (coltypes[i]) {
+            case VT_INT64:
+                index = index * 3;
+                break;
+            case VT_DOUBLE:
+                index = index * 3 + 1;
+                break;
+            case VT_STRING:
+                index = index * 3 + 2;
+                break;
+            default:
+                return NULL;
+        }
+    }
+    return rowCodecs[n][index];
+}
+
+/* A Cached is a prepared statement that is kept for reuse. */
+typedef struct cached_s {
+    uint32_t hash;
+    char *sql;
+    sqlite3_stmt *stmt;
+    StmtStat *stat;  // or NULL
+    int64_t lastUsed;
+} Cached;
+
 struct db_s {
     sqlite3 *db;
     sqlite3_stmt *stmt;  // or NULL
+    char *sql;           // sql of stmt, or NULL if stmt must not be cached
+    uint32_t hash;       // hash of sql
     BOOL debug;
+    Ckpt *ckpt;          // or NULL
+    Cached *cache;       // statement cache, not including stmt
+    int cacheSize;
+    int ncache;
+    BOOL errCleared;     // stmt came from the cache, sqlite3_errmsg is stale
+    int64_t ticks;
+    int64_t cacheHits;
+    int64_t cacheMisses;
+    void *lookaside;     // lookaside buffer, or NULL for SQLite's default
+    int lookasideSize;
+    int lookasideSlots;
+    int cachePages;      // PRAGMA cache_size, or 0 for SQLite's default
+    int64_t mmapSize;    // PRAGMA mmap_size, or 0 for SQLite's default
+    StmtStat **stmtStats;  // statement statistics, or NULL if off
+    int nstmtStats;
+    int maxStmtStats;
+    int64_t stmtStatsDropped;
+    BOOL stmtStatsModule;  // sqinn_stmt_stats is registered
+    StmtStat *stat;        // of stmt, or NULL
+    int64_t statStart;     // nanotime of Db_prepare
+    int64_t statRows;      // rows returned by stmt
+    int64_t slowNanos;     // slow statement threshold, or 0 if off
+    int64_t nslow;
+    int nbinds;            // number of binds of stmt, when slow log is on
+    int nparams;           // number of params of the last bind
+    SlowParam slowParams[SLOW_PARAMS];
+    Trace *trace;          // or NULL
+    Arena *arena;          // scratch memory, or NULL for the heap
+    RowCodec codecs[ROW_CODEC_MAX_COLS / ROW_CODEC_CHUNK];  // of stmt, see Db_setRowCodec
+    int ncodecs;           // 0 if stmt has no row codec
+    char coltypes[ROW_CODEC_MAX_COLS];
+    int ncols;
+};
+
+BOOL _step(Db *this, BOOL *phasRowOrNull);
+static BOOL _exec(Db *this, const char *sql);
+
+static Db *_allocDb(BOOL debug) {
+    Db *this = (Db *)memAlloc(sizeof(Db), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Db));
+    this->debug = debug;
+    this->cache = (Cached *)memAlloc(sizeof(Cached), __FILE__, __LINE__);  // cache is off
+    return this;
+}
+
+/* _scratch allocates memory that is needed only until the current statement
+   is finalized, from the connection's Arena if it has one. */
+static void *_scratch(Db *this, size_t size) {
+    if (this->arena) {
+        return Arena_alloc(this->arena, size);
+    }
+    return memAlloc(size, __FILE__, __LINE__);
+}
+
+static void _scratchFree(Db *this, void *p) {
+    if (!this->arena) {
+        memFree(p);
+    }
+}
+
+static uint32_t _hashSql(const char *sql) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    for (const char *p = sql; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    return h;
+}
+
+static void _finalizeCached(Db *this, Cached *c) {
+    int rc = sqlite3_finalize(c->stmt);
+    if (this->debug) {
+        LOG_DEBUG1("sqlite3_finalize (cached) rc=%d", rc);
+    }
+    memFree(c->sql);
+}
+
+static void _clearCache(Db *this) {
+    for (int i = 0; i < this->ncache; i++) {
+        _finalizeCached(this, &this->cache[i]);
+    }
+    this->ncache = 0;
+}
+
+/* _takeCached removes the statement for sql from the cache, or returns NULL if
+   not cached. The cached sql string is handed over to the caller. */
+static sqlite3_stmt *_takeCached(Db *this, const char *sql, uint32_t hash, char **psql, StmtStat **pstat) {
+    for (int i = 0; i < this->ncache; i++) {
+        Cached *c = &this->cache[i];
+        if (c->hash == hash && strcmp(c->sql, sql) == 0) {
+            sqlite3_stmt *stmt = c->stmt;
+            *psql = c->sql;
+            *pstat = c->stat;
+            this->cache[i] = this->cache[--this->ncache];
+            return stmt;
+        }
+    }
+    return NULL;
+}
+
+/* _putCached puts a reset statement into the cache, evicting the least recently used one. */
+static void _putCached(Db *this, char *sql, uint32_t hash, sqlite3_stmt *stmt, StmtStat *stat) {
+    if (this->ncache == this->cacheSize) {
+        int lru = 0;
+        for (int i = 1; i < this->ncache; i++) {
+            if (this->cache[i].lastUsed < this->cache[lru].lastUsed) {
+                lru = i;
+            }
+        }
+        _finalizeCached(this, &this->cache[lru]);
+        this->cache[lru] = this->cache[--this->ncache];
+    }
+    Cached *c = &this->cache[this->ncache++];
+    c->hash = hash;
+    c->sql = sql;
+    c->stmt = stmt;
+    c->stat = stat;
+    c->lastUsed = ++this->ticks;
+}
+
+// statement statistics
+
+/* _normalizeSql copies sql to out, which must be at least as long as sql.
+   Literals are replaced by '?', comments are dropped and whitespace is
+   collapsed, so that statements that differ only in their literals share
+   one StmtStat. */
+static void _normalizeSql(const char *sql, char *out) {
+    char *q = out;
+    const char *p = sql;
+    BOOL space = FALSE;
+    while (*p) {
+        char c = *p;
+        BOOL ident = q > out && (isalnum((unsigned char)q[-1]) || q[-1] == '_' || q[-1] == '$');
+        if (isspace((unsigned char)c)) {
+            space = TRUE;
+            p++;
+            continue;
+        }
+        if (c == '-' && p[1] == '-') {
+            while (*p && *p != '\n') {
+                p++;
+            }
+            space = TRUE;
+            continue;
+        }
+        if (c == '/' && p[1] == '*') {
+            p += 2;
+            while (*p && !(p[0] == '*' && p[1] == '/')) {
+                p++;
+            }
+            p += *p ? 2 : 0;
+            space = TRUE;
+            continue;
+        }
+        if (space && q > out) {
+            *q++ = ' ';
+        }
+        space = FALSE;
+        if (c == '\'' || (!ident && (c == 'x' || c == 'X') && p[1] == '\'')) {
+            // string or blob literal, '' is an escaped quote
+            p += c == '\'' ? 1 : 2;
+            while (*p) {
+                if (*p++ == '\'') {
+                    if (*p != '\'') {
+                        break;
+                    }
+                    p++;
+                }
+            }
+            *q++ = '?';
+        } else if (!ident && (isdigit((unsigned char)c) || (c == '.' && isdigit((unsigned char)p[1])))) {
+            // numeric literal
+            while (isalnum((unsigned char)*p) || *p == '.') {
+                if ((*p == 'e' || *p == 'E') && (p[1] == '+' || p[1] == '-')) {
+                    p++;
+                }
+                p++;
+            }
+            *q++ = '?';
+        } else if (c == '"' || c == '`' || c == '[') {
+            // quoted identifier, copied as is
+            char end = c == '[' ? ']' : c;
+            *q++ = *p++;
+            while (*p && *p != end) {
+                *q++ = *p++;
+            }
+            if (*p) {
+                *q++ = *p++;
+            }
+        } else {
+            *q++ = *p++;
+        }
+    }
+    *q = 0;
+}
+
+/* _stmtStat returns the StmtStat for sql, or NULL if statement statistics
+   are off or the max. number of distinct statements has been reached. */
+static StmtStat *_stmtStat(Db *this, const char *sql) {
+    if (!this->maxStmtStats) {
+        return NULL;
+    }
+    char *norm = (char *)_scratch(this, strlen(sql) + 1);
+    _normalizeSql(sql, norm);
+    uint32_t hash = _hashSql(norm);
+    for (int i = 0; i < this->nstmtStats; i++) {
+        StmtStat *s = this->stmtStats[i];
+        if (s->hash == hash && strcmp(s->sql, norm) == 0) {
+            _scratchFree(this, norm);
+            return s;
+        }
+    }
+    if (this->nstmtStats == this->maxStmtStats) {
+        this->stmtStatsDropped++;
+        _scratchFree(this, norm);
+        return NULL;
+    }
+    StmtStat *s = (StmtStat *)memAlloc(sizeof(StmtStat), __FILE__, __LINE__);
+    memset(s, 0, sizeof(StmtStat));
+    s->hash = hash;
+    s->sql = memStrdup(norm, __FILE__, __LINE__);
+    _scratchFree(this, norm);
+    this->stmtStats[this->nstmtStats++] = s;
+    return s;
+}
+
+/* _recordStmt adds the current call of stmt to its StmtStat. The status
+   counters of stmt are reset, so that a cached statement starts its next
+   call from zero. */
+static void _recordStmt(Db *this, int64_t nanos) {
+    StmtStat *s = this->stat;
+    s->calls++;
+    s->rows += this->statRows;
+    s->totalNanos += nanos;
+    if (nanos > s->maxNanos) {
+        s->maxNanos = nanos;
+    }
+    s->fullscanSteps += sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+    s->sorts += sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_SORT, 1);
+    s->autoindexes += sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+    s->vmSteps += sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+    int64_t memUsed = sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_MEMUSED, 0);
+    if (memUsed > s->memUsed) {
+        s->memUsed = memUsed;
+    }
+    this->stat = NULL;
+}
+
+/* Db_mergeStmtStats adds the statement statistics that reader collected
+   since the last merge to those of this, so that sqinn_stmt_stats shows
+   the statements of all connections. The statistics of reader are zeroed
+   but kept, since its cached statements point to them. Neither connection
+   may be in use by another thread. */
+void Db_mergeStmtStats(Db *this, Db *reader) {
+    ASSERT(this);
+    ASSERT(reader);
+    if (!this->maxStmtStats) {
+        return;
+    }
+    for (int i = 0; i < reader->nstmtStats; i++) {
+        StmtStat *r = reader->stmtStats[i];
+        if (!r->calls) {
+            continue;
+        }
+        StmtStat *s = NULL;
+        for (int k = 0; k < this->nstmtStats && !s; k++) {
+            if (this->stmtStats[k]->hash == r->hash && strcmp(this->stmtStats[k]->sql, r->sql) == 0) {
+                s = this->stmtStats[k];
+            }
+        }
+        if (!s && this->nstmtStats < this->maxStmtStats) {
+            s = (StmtStat *)memAlloc(sizeof(StmtStat), __FILE__, __LINE__);
+            memset(s, 0, sizeof(StmtStat));
+            s->hash = r->hash;
+            s->sql = memStrdup(r->sql, __FILE__, __LINE__);
+            this->stmtStats[this->nstmtStats++] = s;
+        }
+        if (s) {
+            s->calls += r->calls;
+            s->rows += r->rows;
+            s->totalNanos += r->totalNanos;
+            s->maxNanos = r->maxNanos > s->maxNanos ? r->maxNanos : s->maxNanos;
+            s->fullscanSteps += r->fullscanSteps;
+            s->sorts += r->sorts;
+            s->autoindexes += r->autoindexes;
+            s->vmSteps += r->vmSteps;
+            s->memUsed = r->memUsed > s->memUsed ? r->memUsed : s->memUsed;
+        } else {
+            this->stmtStatsDropped++;
+        }
+        char *sql = r->sql;
+        uint32_t hash = r->hash;
+        memset(r, 0, sizeof(StmtStat));
+        r->sql = sql;
+        r->hash = hash;
+    }
+    this->stmtStatsDropped += reader->stmtStatsDropped;
+    reader->stmtStatsDropped = 0;
+}
+
+static void _clearStmtStats(Db *this) {
+    for (int i = 0; i < this->nstmtStats; i++) {
+        memFree(this->stmtStats[i]->sql);
+        memFree(this->stmtStats[i]);
+    }
+    if (this->stmtStats) {
+        memFree(this->stmtStats);
+    }
+    this->stmtStats = NULL;
+    this->nstmtStats = 0;
+}
+
+/* sqinn_stmt_stats is an eponymous-only virtual table over the StmtStats
+   of a connection. It is read-only and always does a full scan. */
+typedef struct statsvtab_s {
+    sqlite3_vtab base;
+    Db *db;
+} StatsVtab;
+
+typedef struct statscursor_s {
+    sqlite3_vtab_cursor base;
+    int i;
+} StatsCursor;
+
+static int _statsConnect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **pvtab, char **perrmsg) {
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(sql TEXT, calls INTEGER, rows INTEGER, total_ns INTEGER, max_ns INTEGER, mean_ns INTEGER, fullscan_steps INTEGER, sorts INTEGER, autoindexes INTEGER, vm_steps INTEGER, mem_used INTEGER)");
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    StatsVtab *vtab = (StatsVtab *)sqlite3_malloc(sizeof(StatsVtab));
+    if (!vtab) {
+        return SQLITE_NOMEM;
+    }
+    memset(vtab, 0, sizeof(StatsVtab));
+    vtab->db = (Db *)aux;
+    *pvtab = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int _statsDisconnect(sqlite3_vtab *vtab) {
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+}
+
+static int _statsBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+    Db *db = ((StatsVtab *)vtab)->db;
+    info->estimatedCost = db->nstmtStats + 1;
+    info->estimatedRows = db->nstmtStats + 1;
+    return SQLITE_OK;
+}
+
+static int _statsOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **pcursor) {
+    StatsCursor *cursor = (StatsCursor *)sqlite3_malloc(sizeof(StatsCursor));
+    if (!cursor) {
+        return SQLITE_NOMEM;
+    }
+    memset(cursor, 0, sizeof(StatsCursor));
+    *pcursor = &cursor->base;
+    return SQLITE_OK;
+}
+
+static int _statsClose(sqlite3_vtab_cursor *cursor) {
+    sqlite3_free(cursor);
+    return SQLITE_OK;
+}
+
+static int _statsFilter(sqlite3_vtab_cursor *cursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    ((StatsCursor *)cursor)->i = 0;
+    return SQLITE_OK;
+}
+
+static int _statsNext(sqlite3_vtab_cursor *cursor) {
+    ((StatsCursor *)cursor)->i++;
+    return SQLITE_OK;
+}
+
+static int _statsEof(sqlite3_vtab_cursor *cursor) {
+    Db *db = ((StatsVtab *)cursor->pVtab)->db;
+    return ((StatsCursor *)cursor)->i >= db->nstmtStats;
+}
+
+static int _statsColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col) {
+    Db *db = ((StatsVtab *)cursor->pVtab)->db;
+    StmtStat *s = db->stmtStats[((StatsCursor *)cursor)->i];
+    switch (col) {
+        case 0: sqlite3_result_text(ctx, s->sql, -1, SQLITE_TRANSIENT); break;
+        case 1: sqlite3_result_int64(ctx, s->calls); break;
+        case 2: sqlite3_result_int64(ctx, s->rows); break;
+        case 3: sqlite3_result_int64(ctx, s->totalNanos); break;
+        case 4: sqlite3_result_int64(ctx, s->maxNanos); break;
+        case 5: sqlite3_result_int64(ctx, s->calls ? s->totalNanos / s->calls : 0); break;
+        case 6: sqlite3_result_int64(ctx, s->fullscanSteps); break;
+        case 7: sqlite3_result_int64(ctx, s->sorts); break;
+        case 8: sqlite3_result_int64(ctx, s->autoindexes); break;
+        case 9: sqlite3_result_int64(ctx, s->vmSteps); break;
+        case 10: sqlite3_result_int64(ctx, s->memUsed); break;
+    }
+    return SQLITE_OK;
+}
+
+static int _statsRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *prowid) {
+    *prowid = ((StatsCursor *)cursor)->i + 1;
+    return SQLITE_OK;
+}
+
+static sqlite3_module statsModule = {
+    0,                 // iVersion
+    NULL,              // xCreate, NULL makes the table eponymous-only
+    _statsConnect,
+    _statsBestIndex,
+    _statsDisconnect,
+    NULL,              // xDestroy
+    _statsOpen,
+    _statsClose,
+    _statsFilter,
+    _statsNext,
+    _statsEof,
+    _statsColumn,
+    _statsRowid,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
 };
 
-Db *newDb(const char *dbname, BOOL debug) {
-    Db *this = (Db *)memAlloc(sizeof(Db), __FILE__, __LINE__);
-    this->stmt = NULL;
-    this->debug = debug;
-    int rc = sqlite3_open(dbname, &(this->db));
-    if (this->debug) {
-        LOG_DEBUG2("sqlite3_open '%s' rc=%d", dbname, rc);
+Db *newDb(const char *dbname, BOOL debug) {
+    Db *this = _allocDb(debug);
+    int rc = sqlite3_open(dbname, &(this->db));
+    if (this->debug) {
+        LOG_DEBUG2("sqlite3_open '%s' rc=%d", dbname, rc);
+    }
+    if (rc != SQLITE_OK) {
+        ASSERT_FAIL("sqlite3_open rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db))
+    }
+    ASSERT(this->db);
+    return this;
+}
+
+void Db_free(Db *this) {
+    ASSERT(this);
+    ASSERT(this->db);
+    if (this->ckpt) {
+        sqlite3_wal_hook(this->db, NULL, NULL);
+        Ckpt_free(this->ckpt);
+    }
+    Db_finalize(this);
+    if (this->cacheHits) {
+        LOG_INFO2("stmt cache: %" PRId64 " hits, %" PRId64 " misses", this->cacheHits, this->cacheMisses);
+    }
+    _clearCache(this);
+    if (this->nstmtStats) {
+        LOG_INFO2("stmt stats: %d statements, %" PRId64 " dropped", this->nstmtStats, this->stmtStatsDropped);
+    }
+    _clearStmtStats(this);
+    int rc = sqlite3_close(this->db);
+    if (rc != SQLITE_OK) {
+        // the connection stays open and keeps using its lookaside buffer
+        LOG_INFO3("sqlite3_close rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+    } else if (this->lookaside) {
+        memFree(this->lookaside);
+    }
+    memFree(this->cache);
+    memFree(this);
+}
+
+/* Db_setLookaside gives the connection a pre-allocated lookaside buffer of
+   nslots slots of slotSize bytes. It must be called before the connection
+   is used. */
+BOOL Db_setLookaside(Db *this, int slotSize, int nslots) {
+    ASSERT(this);
+    ASSERT(this->db);
+    ASSERT(slotSize > 0);
+    ASSERT(nslots > 0);
+    void *buf = memAlloc((size_t)slotSize * nslots, __FILE__, __LINE__);
+    int rc = sqlite3_db_config(this->db, SQLITE_DBCONFIG_LOOKASIDE, buf, slotSize, nslots);
+    if (rc != SQLITE_OK) {
+        LOG_INFO1("Db_setLookaside: %s", sqlite3_errstr(rc));
+        memFree(buf);
+        return FALSE;
+    }
+    if (this->lookaside) {
+        memFree(this->lookaside);
+    }
+    this->lookaside = buf;
+    this->lookasideSize = slotSize;
+    this->lookasideSlots = nslots;
+    return TRUE;
+}
+
+/* Db_setMmapSize sets the max. number of bytes of the database file that
+   are accessed with memory-mapped I/O, see PRAGMA mmap_size. SQLite caps
+   it at SQLITE_MAX_MMAP_SIZE. */
+BOOL Db_setMmapSize(Db *this, int64_t bytes) {
+    ASSERT(this);
+    ASSERT(this->db);
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA mmap_size = %" PRId64, bytes);
+    if (!_exec(this, sql)) {
+        return FALSE;
+    }
+    this->mmapSize = bytes;
+    return TRUE;
+}
+
+/* Db_setCacheSize sets the page cache size of the connection, see PRAGMA cache_size. */
+BOOL Db_setCacheSize(Db *this, int pages) {
+    ASSERT(this);
+    ASSERT(this->db);
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA cache_size = %d", pages);
+    if (!_exec(this, sql)) {
+        return FALSE;
+    }
+    this->cachePages = pages;
+    return TRUE;
+}
+
+static void _dbStatusStats(Db *this, Stats *stats, int op, const char *name, BOOL highWater) {
+    int cur = 0;
+    int hi = 0;
+    sqlite3_db_status(this->db, op, &cur, &hi, 0);
+    char full[64];
+    snprintf(full, sizeof(full), "db.%s", name);
+    Stats_sum(stats, full, highWater ? hi : cur);
+}
+
+/* Db_stats adds the status counters of the connection to the db.* totals
+   in stats, so that it can be called for the main connection and each
+   reader connection. */
+void Db_stats(Db *this, Stats *stats) {
+    ASSERT(this);
+    ASSERT(this->db);
+    Stats_sum(stats, "db.connections", 1);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_CACHE_USED, "cacheUsed", FALSE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_CACHE_HIT, "cacheHits", FALSE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_CACHE_MISS, "cacheMisses", FALSE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_CACHE_WRITE, "cacheWrites", FALSE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_CACHE_SPILL, "cacheSpills", FALSE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_SCHEMA_USED, "schemaUsed", FALSE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_STMT_USED, "stmtUsed", FALSE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_LOOKASIDE_USED, "lookasideUsed", FALSE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_LOOKASIDE_HIT, "lookasideHits", TRUE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, "lookasideMissSize", TRUE);
+    _dbStatusStats(this, stats, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, "lookasideMissFull", TRUE);
+    Stats_sum(stats, "db.stmtCacheHits", this->cacheHits);
+    Stats_sum(stats, "db.stmtCacheMisses", this->cacheMisses);
+    Stats_sum(stats, "db.stmtCacheSize", this->ncache);
+    if (this->slowNanos) {
+        Stats_sum(stats, "db.slowStatements", this->nslow);
+    }
+    if (this->maxStmtStats) {
+        Stats_sum(stats, "db.stmtStats", this->nstmtStats);
+        Stats_sum(stats, "db.stmtStatsDropped", this->stmtStatsDropped);
+    }
+    sqlite3_int64 mmapSize = -1;  // query, do not change
+    if (sqlite3_file_control(this->db, "main", SQLITE_FCNTL_MMAP_SIZE, &mmapSize) != SQLITE_OK) {
+        mmapSize = 0;
+    }
+    Stats_sum(stats, "db.mmapSize", mmapSize);
+    if (this->ckpt) {
+        Ckpt_stats(this->ckpt, stats);
+    }
+}
+
+/* Db_printStatus logs lookaside and page cache usage of the connection.
+   sqinn calls it for the main connection at shutdown. */
+void Db_printStatus(Db *this) {
+    ASSERT(this);
+    ASSERT(this->db);
+    int used = 0;
+    int maxUsed = 0;
+    int hits = 0;
+    int missSize = 0;
+    int missFull = 0;
+    int unused = 0;
+    sqlite3_db_status(this->db, SQLITE_DBSTATUS_LOOKASIDE_USED, &used, &maxUsed, 0);
+    sqlite3_db_status(this->db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &unused, &hits, 0);
+    sqlite3_db_status(this->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &unused, &missSize, 0);
+    sqlite3_db_status(this->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &unused, &missFull, 0);
+    LOG_INFO4("lookaside: high water %d slots, %d hits, %d misses (too large), %d misses (full)", maxUsed, hits, missSize, missFull);
+    int cacheBytes = 0;
+    int cacheHits = 0;
+    int cacheMisses = 0;
+    int cacheSpills = 0;
+    sqlite3_db_status(this->db, SQLITE_DBSTATUS_CACHE_USED, &cacheBytes, &unused, 0);
+    sqlite3_db_status(this->db, SQLITE_DBSTATUS_CACHE_HIT, &cacheHits, &unused, 0);
+    sqlite3_db_status(this->db, SQLITE_DBSTATUS_CACHE_MISS, &cacheMisses, &unused, 0);
+    sqlite3_db_status(this->db, SQLITE_DBSTATUS_CACHE_SPILL, &cacheSpills, &unused, 0);
+    LOG_INFO4("connection cache: %d bytes, %d hits, %d misses, %d spills", cacheBytes, cacheHits, cacheMisses, cacheSpills);
+}
+
+/* Db_startCheckpointer turns off SQLite's auto-checkpoint, which runs inside
+   the commit that crosses the threshold, and runs checkpoints in a background
+   thread instead. A checkpoint is triggered if the WAL has grown to walPages
+   pages, or after intervalMillis if there were commits. A RESTART or TRUNCATE
+   checkpoint holds the write lock for a short time, so the connection gets
+   a busy timeout of CKPT_WRITER_BUSY_MILLIS. That replaces a busy timeout
+   set before, e.g. with PRAGMA busy_timeout. */
+BOOL Db_startCheckpointer(Db *this, int walPages, int intervalMillis) {
+    ASSERT(this);
+    ASSERT(this->db);
+    ASSERT(!this->ckpt);
+    ASSERT(walPages > 0);
+    ASSERT(intervalMillis > 0);
+    const char *filename = sqlite3_db_filename(this->db, "main");
+    if (!filename || !filename[0] || !sqlite3_threadsafe()) {
+        LOG_INFO0("checkpointer: not available for in-memory databases or without thread support");
+        return FALSE;
+    }
+    this->ckpt = newCkpt(filename, walPages, intervalMillis);
+    if (!this->ckpt) {
+        return FALSE;
+    }
+    // the wal hook replaces the auto-checkpoint
+    sqlite3_wal_hook(this->db, _ckptWalHook, this->ckpt);
+    // RESTART and TRUNCATE hold the write lock for a short time
+    sqlite3_busy_timeout(this->db, CKPT_WRITER_BUSY_MILLIS);
+    LOG_INFO3("checkpointer: started, walPages=%d, intervalMillis=%d, busy timeout %d ms", walPages, intervalMillis, CKPT_WRITER_BUSY_MILLIS);
+    return TRUE;
+}
+
+/* Db_setStmtCacheSize sets the number of prepared statements that are kept
+   for reuse. Zero turns the statement cache off. */
+void Db_setStmtCacheSize(Db *this, int size) {
+    ASSERT(this);
+    ASSERT(size >= 0);
+    _clearCache(this);
+    memFree(this->cache);
+    this->cacheSize = size;
+    this->cache = (Cached *)memAlloc((size ? size : 1) * sizeof(Cached), __FILE__, __LINE__);
+}
+
+// slow statement log
+
+/* Db_setSlowLog logs statements that take longer than millis from prepare to
+   finalize, together with their parameters, status counters and query
+   plan. Zero turns the slow log off. */
+void Db_setSlowLog(Db *this, int millis) {
+    ASSERT(this);
+    ASSERT(millis >= 0);
+    this->slowNanos = (int64_t)millis * 1000 * 1000;
+}
+
+/* _saveParams keeps a summary of the params of the current bind. */
+static void _saveParams(Db *this, const Value *params, int nparams) {
+    this->nbinds++;
+    this->nparams = nparams;
+    for (int i = 0; i < nparams && i < SLOW_PARAMS; i++) {
+        SlowParam *sp = &this->slowParams[i];
+        const Value *val = &params[i];
+        sp->type = val->type;
+        switch (val->type) {
+            case VT_INT32: sp->i = val->i32; break;
+            case VT_INT64: sp->i = val->i64; break;
+            case VT_DOUBLE: sp->d = val->d; break;
+            case VT_BLOB: sp->sz = val->sz; break;
+            case VT_STRING: {
+                int n = 0;
+                while (n < SLOW_PREFIX && val->p[n]) {
+                    sp->prefix[n] = val->p[n];
+                    n++;
+                }
+                strcpy(sp->prefix + n, val->p[n] ? "..." : "");
+                break;
+            }
+        }
+    }
+}
+
+/* _formatParams writes the params of the last bind to buf, e.g.
+   "3 params: 42, 'Alice', blob(20)". */
+static void _formatParams(Db *this, char *buf, size_t size) {
+    size_t n = snprintf(buf, size, "%d params", this->nparams);
+    for (int i = 0; i < this->nparams && i < SLOW_PARAMS && n < size; i++) {
+        SlowParam *sp = &this->slowParams[i];
+        const char *sep = i ? ", " : ": ";
+        switch (sp->type) {
+            case VT_INT32:
+            case VT_INT64: n += snprintf(buf + n, size - n, "%s%" PRId64, sep, sp->i); break;
+            case VT_DOUBLE: n += snprintf(buf + n, size - n, "%s%g", sep, sp->d); break;
+            case VT_STRING: n += snprintf(buf + n, size - n, "%s'%s'", sep, sp->prefix); break;
+            case VT_BLOB: n += snprintf(buf + n, size - n, "%sblob(%zu)", sep, sp->sz); break;
+            default: n += snprintf(buf + n, size - n, "%sNULL", sep); break;
+        }
+    }
+    if (this->nparams > SLOW_PARAMS && n < size) {
+        snprintf(buf + n, size - n, ", ...");
+    }
+}
+
+/* _queryPlan runs EXPLAIN QUERY PLAN for sql on a separate statement and
+   writes the plan to buf, one line per step, indented by nesting level. */
+static BOOL _queryPlan(Db *this, const char *sql, char *buf, size_t size) {
+    ASSERT(size > 0);
+    buf[0] = 0;
+    char *eqp = (char *)_scratch(this, strlen(sql) + 20);
+    sprintf(eqp, "EXPLAIN QUERY PLAN %s", sql);
+    sqlite3_stmt *stmt = NULL;
+    int rc = sqlite3_prepare_v2(this->db, eqp, -1, &stmt, NULL);
+    _scratchFree(this, eqp);
+    if (rc != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return FALSE;
+    }
+    int ids[32];
+    int levels[32];
+    int nids = 0;
+    size_t n = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW && n < size) {
+        int id = sqlite3_column_int(stmt, 0);
+        int parent = sqlite3_column_int(stmt, 1);
+        const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+        int level = 0;
+        for (int i = 0; i < nids; i++) {
+            if (ids[i] == parent) {
+                level = levels[i] + 1;
+            }
+        }
+        if (nids < 32) {
+            ids[nids] = id;
+            levels[nids++] = level;
+        }
+        n += snprintf(buf + n, size - n, "%*s%s\n", 2 * level, "", detail ? detail : "");
+    }
+    sqlite3_finalize(stmt);
+    return TRUE;
+}
+
+/* _logSlow logs the statement that is about to be finalized. */
+static void _logSlow(Db *this, int64_t nanos) {
+    this->nslow++;
+    LOG_INFO4("slow statement: %.3f ms, %" PRId64 " rows, %d binds, sql='%s'", nanos / 1e6, this->statRows, this->nbinds, sqlite3_sql(this->stmt));
+    char params[512];
+    _formatParams(this, params, sizeof(params));
+    LOG_INFO2("slow statement: memUsed=%d, %s", sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_MEMUSED, 0), params);
+    LOG_INFO4("slow statement: fullscanSteps=%d, sorts=%d, autoindexes=%d, vmSteps=%d",
+        sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0),
+        sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_SORT, 0),
+        sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_AUTOINDEX, 0),
+        sqlite3_stmt_status(this->stmt, SQLITE_STMTSTATUS_VM_STEP, 0));
+    char *plan = (char *)_scratch(this, SLOW_PLAN);
+    if (!_queryPlan(this, sqlite3_sql(this->stmt), plan, SLOW_PLAN)) {
+        LOG_INFO1("slow statement: no plan, errmsg='%s'", sqlite3_errmsg(this->db));
     }
-    if (rc != SQLITE_OK) {
-        ASSERT_FAIL("sqlite3_open rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db))
+    char *line = plan;
+    char *next;
+    while ((next = strchr(line, '\n')) != NULL) {
+        *next = 0;
+        LOG_INFO1("slow statement: plan %s", line);
+        line = next + 1;
+    }
+    _scratchFree(this, plan);
+}
+
+// tracing
+
+static int _traceCallback(unsigned type, void *ctx, void *p, void *x) {
+    Trace *trace = ((Db *)ctx)->trace;
+    switch (type) {
+        case SQLITE_TRACE_STMT: {
+            const char *sql = (const char *)x;
+            if (sql[0] == '-' && sql[1] == '-') {
+                break;  // trigger, runs as part of the statement
+            }
+            Trace_event(trace, TR_STMT, Trace_text(trace, sql), (int64_t)(intptr_t)p);
+            break;
+        }
+        case SQLITE_TRACE_PROFILE:
+            Trace_event(trace, TR_PROFILE, (int64_t)(intptr_t)p, *(sqlite3_int64 *)x);
+            break;
+        case SQLITE_TRACE_ROW:
+            Trace_event(trace, TR_ROW, (int64_t)(intptr_t)p, 0);
+            break;
     }
+    return 0;
+}
+
+/* Db_setTrace records the statements that run on the connection, and
+   their rows, in trace. The connection must be used by the thread that
+   records the other events of trace. NULL turns tracing off. */
+void Db_setTrace(Db *this, Trace *trace) {
+    ASSERT(this);
     ASSERT(this->db);
-    return this;
+    this->trace = trace;
+    if (trace) {
+        sqlite3_trace_v2(this->db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW, _traceCallback, this);
+    } else {
+        sqlite3_trace_v2(this->db, 0, NULL, NULL);
+    }
 }
 
-void Db_free(Db *this) {
+/* Db_setArena lets the connection take its per-statement scratch memory
+   from arena, which must not be reset before the statement is finalized.
+   NULL takes it from the heap. */
+void Db_setArena(Db *this, Arena *arena) {
+    ASSERT(this);
+    this->arena = arena;
+}
+
+/* Db_setStmtStats turns per-statement statistics on, for up to max distinct
+   normalized SQL texts, and registers the sqinn_stmt_stats virtual table.
+   Zero turns them off and discards the statistics collected so far. */
+BOOL Db_setStmtStats(Db *this, int max) {
     ASSERT(this);
     ASSERT(this->db);
-    int rc = sqlite3_close(this->db);
-    if (rc != SQLITE_OK) {
-        LOG_INFO3("sqlite3_close rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+    ASSERT(!this->stmt);
+    ASSERT(max >= 0);
+    _clearCache(this);  // cached statements point to their StmtStat
+    _clearStmtStats(this);
+    this->maxStmtStats = max;
+    this->stmtStatsDropped = 0;
+    if (!max) {
+        return TRUE;
     }
-    memFree(this);
+    this->stmtStats = (StmtStat **)memAlloc(max * sizeof(StmtStat *), __FILE__, __LINE__);
+    if (!this->stmtStatsModule) {
+        int rc = sqlite3_create_module(this->db, "sqinn_stmt_stats", &statsModule, this);
+        if (rc != SQLITE_OK) {
+            LOG_INFO3("sqlite3_create_module rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+            return FALSE;
+        }
+        this->stmtStatsModule = TRUE;
+    }
+    return TRUE;
 }
 
 BOOL Db_prepare(Db *this, const char *sql) {
@@ -40,34 +1760,195 @@ BOOL Db_prepare(Db *this, const char *sql) {
     ASSERT(this->db);
     ASSERT(!this->stmt);
     ASSERT(sql);
-    int rc = sqlite3_prepare_v2(this->db, sql, -1, &(this->stmt), NULL);
-    if (this->debug) {
-        LOG_DEBUG2("sqlite3_prepare_v2 '%s' rc=%d", sql, rc);
+    this->hash = _hashSql(sql);
+    this->stmt = _takeCached(this, sql, this->hash, &this->sql, &this->stat);
+    if (this->stmt) {
+        this->cacheHits++;
+        this->errCleared = TRUE;  // like sqlite3_prepare would
+        if (this->debug) {
+            LOG_DEBUG1("Db_prepare '%s' cached", sql);
+        }
+    } else {
+        this->cacheMisses++;
+        this->errCleared = FALSE;
+        int rc = sqlite3_prepare_v3(this->db, sql, -1, this->cacheSize ? SQLITE_PREPARE_PERSISTENT : 0, &(this->stmt), NULL);
+        if (this->debug) {
+            LOG_DEBUG2("sqlite3_prepare_v3 '%s' rc=%d", sql, rc);
+        }
+        if (rc != SQLITE_OK) {
+            LOG_INFO4("sqlite3_prepare_v3 sql='%s', rc=%d (%s), errmsg='%s'", sql, rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+            this->stmt = NULL;
+            return FALSE;
+        }
+        this->sql = this->stmt && this->cacheSize ? memStrdup(sql, __FILE__, __LINE__) : NULL;
+        this->stat = this->stmt ? _stmtStat(this, sql) : NULL;
     }
-    if (rc != SQLITE_OK) {
-        LOG_INFO4("sqlite3_prepare_v2 sql='%s', rc=%d (%s), errmsg='%s'", sql, rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
-        this->stmt = NULL;
-        return FALSE;
+    if (this->stat || this->slowNanos) {
+        this->statStart = nanotime();
+        this->statRows = 0;
+        this->nbinds = 0;
+        this->nparams = 0;
     }
     return TRUE;
 }
 
+/* Db_loadCatalog prepares the statements listed in a catalog file and keeps
+   them in the statement cache, so that the first requests after startup do
+   not have to prepare them. The file has one SQL statement per line. Lines
+   that start with '#' are comments. Lines that start with "warmup:" are
+   queries that are executed once, to pull hot pages into the page cache. */
+BOOL Db_loadCatalog(Db *this, const char *filename) {
+    ASSERT(this);
+    ASSERT(this->db);
+    ASSERT(!this->stmt);
+    int64_t t0 = nanotime();
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        LOG_INFO1("catalog: cannot open '%s'", filename);
+        return FALSE;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    if (size < 0) {
+        LOG_INFO1("catalog: cannot determine size of '%s'", filename);
+        fclose(fp);
+        return FALSE;
+    }
+    fseek(fp, 0, SEEK_SET);
+    char *text = (char *)memAlloc(size + 1, __FILE__, __LINE__);
+    size_t n = fread(text, 1, size, fp);
+    fclose(fp);
+    text[n] = 0;
+    int nprepared = 0;
+    int nwarmups = 0;
+    int nerrors = 0;
+    char *next = text;
+    while (next) {
+        char *line = next;
+        next = strchr(line, '\n');
+        if (next) {
+            *next++ = 0;
+        }
+        // trim
+        while (*line == ' ' || *line == '\t') {
+            line++;
+        }
+        size_t len = strlen(line);
+        while (len && (line[len-1] == '\r' || line[len-1] == ' ' || line[len-1] == '\t')) {
+            line[--len] = 0;
+        }
+        if (!len || line[0] == '#') {
+            continue;
+        }
+        BOOL warmup = strncmp(line, "warmup:", 7) == 0;
+        const char *sql = warmup ? line + 7 : line;
+        if (!Db_prepare(this, sql)) {
+            nerrors++;
+            continue;
+        }
+        if (warmup) {
+            BOOL hasRow = TRUE;
+            while (hasRow && _step(this, &hasRow)) {
+                ;  // discard rows
+            }
+            nwarmups++;
+        } else {
+            nprepared++;
+        }
+        Db_finalize(this);
+    }
+    memFree(text);
+    if (nprepared > this->cacheSize) {
+        LOG_INFO2("catalog: %d statements do not fit into statement cache of size %d", nprepared, this->cacheSize);
+    }
+    LOG_INFO4("catalog: %d statements prepared, %d warmup queries, %d errors, ready after %.1f ms", nprepared, nwarmups, nerrors, (nanotime() - t0) / 1e6);
+    return nerrors == 0;
+}
+
+/* Db_isWrite reports whether the prepared statement may write to the database.
+   Transaction control statements (BEGIN, COMMIT, etc.) do not count as writes. */
+BOOL Db_isWrite(Db *this) {
+    ASSERT(this);
+    ASSERT(this->db);
+    return this->stmt && !sqlite3_stmt_readonly(this->stmt);
+}
+
+/* Db_isStandalone reports whether the prepared statement must not run
+   inside a transaction that another statement began: VACUUM, ATTACH,
+   DETACH and PRAGMAs (e.g. journal_mode). All PRAGMAs count, some of them
+   could run inside. */
+BOOL Db_isStandalone(Db *this) {
+    ASSERT(this);
+    ASSERT(this->db);
+    if (!this->stmt) {
+        return FALSE;
+    }
+    static const char *const keywords[] = {"VACUUM", "PRAGMA", "ATTACH", "DETACH"};
+    const char *sql = sqlite3_sql(this->stmt);
+    while (isspace((unsigned char)*sql)) {
+        sql++;
+    }
+    for (int i = 0; i < (int)(sizeof(keywords) / sizeof(keywords[0])); i++) {
+        size_t len = strlen(keywords[i]);
+        if (sqlite3_strnicmp(sql, keywords[i], (int)len) == 0 && !isalnum((unsigned char)sql[len]) && sql[len] != '_') {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Db_columnName returns the name of a result column of the prepared
+   statement, or "" if there is none. */
+const char *Db_columnName(Db *this, int icol) {
+    ASSERT(this);
+    ASSERT(this->db);
+    const char *name = this->stmt ? sqlite3_column_name(this->stmt, icol) : NULL;
+    return name ? name : "";
+}
+
+/* Db_finalize releases the prepared statement. If the statement cache is
+   on, the statement is reset and kept for reuse. */
 void Db_finalize(Db *this) {
     ASSERT(this);
     ASSERT(this->db);
+    this->ncodecs = 0;
     if(this->stmt) {
-        int rc = sqlite3_finalize(this->stmt);
-        if (this->debug) {
-            LOG_DEBUG2("sqlite3_finalize rc=%d", rc, rc);
+        StmtStat *stat = this->stat;
+        if (stat || this->slowNanos) {
+            int64_t nanos = nanotime() - this->statStart;
+            if (this->slowNanos && nanos >= this->slowNanos) {
+                _logSlow(this, nanos);
+            }
+            if (stat) {
+                _recordStmt(this, nanos);
+            }
         }
-        if (rc != SQLITE_OK) {
-            LOG_INFO3("sqlite3_finalize rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+        if (this->sql) {
+            int rc = sqlite3_reset(this->stmt);
+            if (this->debug) {
+                LOG_DEBUG1("sqlite3_reset (cache) rc=%d", rc);
+            }
+            sqlite3_clear_bindings(this->stmt);
+            _putCached(this, this->sql, this->hash, this->stmt, stat);
+            this->sql = NULL;
+        } else {
+            int rc = sqlite3_finalize(this->stmt);
+            if (this->debug) {
+                LOG_DEBUG2("sqlite3_finalize rc=%d", rc, rc);
+            }
+            if (rc != SQLITE_OK) {
+                LOG_INFO3("sqlite3_finalize rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+            }
         }
         this->stmt = NULL;
     }
 }
 
 BOOL _bind(Db *this, const Value *params, int nparams) {
+    this->errCleared = FALSE;
+    if (this->slowNanos) {
+        _saveParams(this, params, nparams);
+    }
     BOOL ok = TRUE;
     for (int i = 0; i < nparams; i++) {
         Value val = params[i];
@@ -140,6 +2021,7 @@ BOOL _bind(Db *this, const Value *params, int nparams) {
 }
 
 BOOL _step(Db *this, BOOL *phasRowOrNull) {
+    this->errCleared = FALSE;
     int rc = sqlite3_step(this->stmt);
     if (this->debug) {
         LOG_DEBUG2("sqlite3_step rc=%d (%s)", rc, sqlite3_errstr(rc));
@@ -148,6 +2030,9 @@ BOOL _step(Db *this, BOOL *phasRowOrNull) {
         LOG_INFO3("sqlite3_step rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
         return FALSE;
     }
+    if (rc == SQLITE_ROW) {
+        this->statRows++;
+    }
     if (phasRowOrNull) {
         *phasRowOrNull = rc == SQLITE_ROW;
     }
@@ -156,6 +2041,7 @@ BOOL _step(Db *this, BOOL *phasRowOrNull) {
 
 void _reset(Db *this) {
     if(this->stmt){
+        this->errCleared = FALSE;
         int rc = sqlite3_reset(this->stmt);
         if (this->debug) {
             LOG_DEBUG1("sqlite3_reset rc=%d", rc);
@@ -257,12 +2143,204 @@ BOOL Db_step_fetch(Db *this, BOOL *phasRow, Value *values, int nvalues) {
     return ok;
 }
 
+/* Db_setRowCodec picks the RowCodecs for the prepared statement, if
+   its column types are VT_INT64, VT_DOUBLE or VT_STRING and there are at
+   most ROW_CODEC_MAX_COLS. It returns FALSE if there are none, or if debug
+   logging is on, then rows must be fetched with Db_step_fetch. */
+BOOL Db_setRowCodec(Db *this, const char *coltypes, int ncols) {
+    ASSERT(this);
+    this->ncodecs = 0;
+    if (!this->stmt || this->debug || ncols < 1 || ncols > ROW_CODEC_MAX_COLS) {
+        return FALSE;
+    }
+    for (int base = 0; base < ncols; base += ROW_CODEC_CHUNK) {
+        int n = ncols - base < ROW_CODEC_CHUNK ? ncols - base : ROW_CODEC_CHUNK;
+        RowCodec codec = _rowCodec(coltypes + base, n);
+        if (!codec) {
+            this->ncodecs = 0;
+            return FALSE;
+        }
+        this->codecs[this->ncodecs++] = codec;
+    }
+    memcpy(this->coltypes, coltypes, ncols);
+    this->ncols = ncols;
+    return TRUE;
+}
+
+/* _encodeValues writes the current row value by value, so that large
+   strings are sent without a copy, see Writer_writeBlobRef. */
+static void _encodeValues(Db *this, Writer *w) {
+    Writer_writeByte(w, 1);  // hasRow = TRUE
+    for (int i = 0; i < this->ncols; i++) {
+        if (sqlite3_column_type(this->stmt, i) == SQLITE_NULL) {
+            Writer_writeByte(w, VT_NULL);
+            continue;
+        }
+        Writer_writeByte(w, this->coltypes[i]);
+        switch (this->coltypes[i]) {
+            case VT_INT64:
+                Writer_writeInt64(w, (int64_t)sqlite3_column_int64(this->stmt, i));
+                break;
+            case VT_DOUBLE:
+                Writer_writeDouble(w, sqlite3_column_double(this->stmt, i));
+                break;
+            case VT_STRING: {
+                const char *str = (const char *)sqlite3_column_text(this->stmt, i);
+                Writer_writeBlobRef(w, str, strlen(str) + 1);
+                break;
+            }
+            default:
+                ASSERT_FAIL("_encodeValues: invalid coltypes[%d] %d", i, this->coltypes[i]);
+        }
+    }
+}
+
+/* Db_encodeRow writes the current row, as returned by Db_step_fetch, to w
+   with the RowCodecs picked by Db_setRowCodec. The encoding is the same as
+   for fetched values. */
+void Db_encodeRow(Db *this, Writer *w) {
+    ASSERT(this);
+    ASSERT(this->ncodecs);
+    size_t mark = Writer_mark(w);
+    for (int i = 0; i < this->ncodecs; i++) {
+        if (!this->codecs[i](this->stmt, i * ROW_CODEC_CHUNK, i == 0, w)) {
+            Writer_rewind(w, mark);
+            _encodeValues(this, w);
+            return;
+        }
+    }
+}
+
+void Db_reset(Db *this) {
+    ASSERT(this);
+    ASSERT(this->db);
+    _reset(this);
+}
+
 const char *Db_errmsg(Db *this){
     ASSERT(this);
     ASSERT(this->db);
+    if (this->errCleared) {
+        return sqlite3_errstr(SQLITE_OK);
+    }
     return sqlite3_errmsg(this->db);
 }
 
+static BOOL _exec(Db *this, const char *sql) {
+    this->errCleared = FALSE;
+    int rc = sqlite3_exec(this->db, sql, NULL, NULL, NULL);
+    if (this->debug) {
+        LOG_DEBUG2("sqlite3_exec '%s' rc=%d", sql, rc);
+    }
+    if (rc != SQLITE_OK) {
+        LOG_INFO4("sqlite3_exec sql='%s', rc=%d (%s), errmsg='%s'", sql, rc, sqlite3_errstr(rc), sqlite3_errmsg(this->db));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL Db_exec(Db *this, const char *sql) {
+    ASSERT(this);
+    ASSERT(this->db);
+    ASSERT(sql);
+    return _exec(this, sql);
+}
+
+/* Db_openReader opens a read-only connection to the same database file.
+   The reader may be used by another thread. Returns NULL for in-memory
+   and temp databases, or if SQLite was compiled without thread support. */
+Db *Db_openReader(Db *this) {
+    ASSERT(this);
+    ASSERT(this->db);
+    const char *filename = sqlite3_db_filename(this->db, "main");
+    if (!filename || !filename[0] || !sqlite3_threadsafe()) {
+        return NULL;
+    }
+    Db *reader = _allocDb(this->debug);
+    int rc = sqlite3_open_v2(filename, &(reader->db), SQLITE_OPEN_READONLY, NULL);
+    if (reader->debug) {
+        LOG_DEBUG2("sqlite3_open_v2 '%s' rc=%d", filename, rc);
+    }
+    if (rc != SQLITE_OK) {
+        LOG_INFO3("sqlite3_open_v2 rc=%d (%s), errmsg='%s'", rc, sqlite3_errstr(rc), sqlite3_errmsg(reader->db));
+        sqlite3_close(reader->db);
+        memFree(reader->cache);
+        memFree(reader);
+        return NULL;
+    }
+    // readers are sized like their writer
+    if (this->lookaside) {
+        Db_setLookaside(reader, this->lookasideSize, this->lookasideSlots);
+    }
+    if (this->cacheSize) {
+        Db_setStmtCacheSize(reader, this->cacheSize);
+    }
+    if (this->cachePages) {
+        Db_setCacheSize(reader, this->cachePages);
+    }
+    if (this->maxStmtStats) {
+        Db_setStmtStats(reader, this->maxStmtStats);  // merged by Db_mergeStmtStats
+    }
+    if (this->mmapSize) {
+        Db_setMmapSize(reader, this->mmapSize);
+    }
+    reader->slowNanos = this->slowNanos;
+    // read the schema, so that the pager has opened the WAL before
+    // Db_beginRead opens a snapshot on it
+    _exec(reader, "SELECT 1 FROM sqlite_schema LIMIT 1");
+    return reader;
+}
+
+BOOL Db_inTransaction(Db *this) {
+    ASSERT(this);
+    ASSERT(this->db);
+    return !sqlite3_get_autocommit(this->db);
+}
+
+/* Db_beginRead starts a read transaction. If from is not NULL, the read
+   transaction opens the same WAL snapshot as the read transaction that
+   is currently open on from. */
+BOOL Db_beginRead(Db *this, Db *from) {
+    ASSERT(this);
+    ASSERT(this->db);
+    if (!_exec(this, "BEGIN")) {
+        return FALSE;
+    }
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    if (from) {
+        sqlite3_snapshot *snapshot = NULL;
+        int rc = sqlite3_snapshot_get(from->db, "main", &snapshot);
+        if (rc != SQLITE_OK) {
+            // not in WAL mode, fall back to the most recent snapshot
+            LOG_DEBUG2("Db_beginRead: no snapshot rc=%d (%s)", rc, sqlite3_errstr(rc));
+        } else {
+            rc = sqlite3_snapshot_open(this->db, "main", snapshot);
+            sqlite3_snapshot_free(snapshot);
+            if (rc == SQLITE_OK) {
+                return TRUE;
+            }
+            // in WAL mode, but this reader cannot see the writer's snapshot
+            LOG_INFO2("Db_beginRead: cannot open snapshot rc=%d (%s), reading the most recent commit", rc, sqlite3_errstr(rc));
+        }
+    }
+#else
+    (void)from;  // without snapshots, readers see the most recent commit
+#endif
+    if (!_exec(this, "SELECT 1 FROM sqlite_schema LIMIT 1")) {
+        _exec(this, "ROLLBACK");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void Db_endRead(Db *this) {
+    ASSERT(this);
+    ASSERT(this->db);
+    if (!sqlite3_get_autocommit(this->db)) {
+        _exec(this, "COMMIT");
+    }
+}
+
 // TEST
 
 static void sq_open(const char *dbname, sqlite3 **pdb) {
@@ -507,10 +2585,459 @@ static void testErrors() {
     ASSERT_STR("no such table: blabla", Db_errmsg(db));
     Db_finalize(db);
     ASSERT_STR("no such table: blabla", Db_errmsg(db));
+    // good, from the statement cache
+    Db_setStmtCacheSize(db, 2);
+    ASSERT(Db_prepare(db, "SELECT 1"));
+    Db_finalize(db);
+    ASSERT(!Db_prepare(db, "SELECT * FROM blabla"));
+    ASSERT_STR("no such table: blabla", Db_errmsg(db));
+    ASSERT(Db_prepare(db, "SELECT 1"));
+    ASSERT_STR("not an error", Db_errmsg(db));
+    Db_finalize(db);
     //
     Db_free(db);
 }
 
+static void testCheckpointer() {
+    const char *dbname = "sqinn_test_ckpt.db";
+    remove(dbname);
+    Db *db = newDb(dbname, FALSE);
+    ASSERT(Db_startCheckpointer(db, 8, 20));
+    ASSERT(_exec(db, "PRAGMA journal_mode=WAL"));
+    ASSERT(_exec(db, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL, name TEXT)"));
+    ASSERT(Db_prepare(db, "INSERT INTO users(name) VALUES(?)"));
+    for (int i = 0; i < 200; i++) {
+        Value param = {.type = VT_STRING, .p = "Alice Alice Alice Alice Alice Alice Alice Alice"};
+        ASSERT(Db_bind_step_reset(db, &param, 1));
+    }
+    Db_finalize(db);
+    // wait until the checkpointer has run
+    Ckpt *ckpt = db->ckpt;
+    int64_t n = 0;
+    for (int i = 0; i < 100 && !n; i++) {
+        sleepMillis(10);
+        Mutex_lock(ckpt->mutex);
+        n = ckpt->npassive;
+        Mutex_unlock(ckpt->mutex);
+    }
+    ASSERT(n > 0);
+    Db_free(db);
+    // in-memory databases have no WAL
+    db = newDb(":memory:", FALSE);
+    ASSERT(!Db_startCheckpointer(db, 8, 20));
+    Db_free(db);
+    remove(dbname);
+}
+
+static void testReadSnapshot() {
+    const char *dbname = "sqinn_test_snapshot.db";
+    remove(dbname);
+    Db *db = newDb(dbname, FALSE);
+    ASSERT(_exec(db, "PRAGMA journal_mode=WAL"));
+    ASSERT(_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY)"));
+    ASSERT(_exec(db, "INSERT INTO t VALUES(1)"));
+    Db *reader = Db_openReader(db);
+    ASSERT(reader);
+    Db *other = newDb(dbname, FALSE);
+    // another connection commits after the writer has begun to read
+    ASSERT(Db_beginRead(db, NULL));
+    ASSERT(_exec(other, "INSERT INTO t VALUES(2)"));
+    ASSERT(Db_beginRead(reader, db));
+    ASSERT(Db_prepare(reader, "SELECT COUNT(*) FROM t"));
+    BOOL hasRow;
+    Value count = {VT_INT64};
+    ASSERT(Db_step_fetch(reader, &hasRow, &count, 1));
+    ASSERT(hasRow);
+    Db_finalize(reader);
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    ASSERT_INT64(1, count.i64);  // the writer's snapshot
+#else
+    ASSERT_INT64(2, count.i64);  // the most recent commit
+#endif
+    Db_endRead(reader);
+    Db_endRead(db);
+    Db_free(other);
+    Db_free(reader);
+    Db_free(db);
+    remove(dbname);
+}
+
+static void testStmtCache() {
+    const char *catalog = "sqinn_test_catalog.txt";
+    FILE *fp = fopen(catalog, "w");
+    ASSERT(fp);
+    fprintf(fp, "# comment\n");
+    fprintf(fp, "SELECT name FROM users WHERE id = ?\n");
+    fprintf(fp, "  INSERT INTO users(name) VALUES(?)  \r\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "warmup:SELECT COUNT(*) FROM users\n");
+    fclose(fp);
+    Db *db = newDb(":memory:", FALSE);
+    Db_setStmtCacheSize(db, 3);
+    ASSERT(Db_exec(db, "CREATE TABLE users(id INTEGER PRIMARY KEY, name TEXT)"));
+    ASSERT(Db_loadCatalog(db, catalog));
+    ASSERT_INT(3, db->ncache);
+    ASSERT_INT64(0, db->cacheHits);
+    // catalog statements are cached
+    ASSERT(Db_prepare(db, "INSERT INTO users(name) VALUES(?)"));
+    ASSERT_INT64(1, db->cacheHits);
+    Value param = {.type = VT_STRING, .p = "Alice"};
+    ASSERT(Db_bind_step_reset(db, &param, 1));
+    Db_finalize(db);
+    ASSERT(Db_prepare(db, "INSERT INTO users(name) VALUES(?)"));
+    ASSERT_INT64(2, db->cacheHits);
+    param.p = "Bob";
+    ASSERT(Db_bind_step_reset(db, &param, 1));
+    Db_finalize(db);
+    // cached statements start with no bindings
+    ASSERT(Db_prepare(db, "INSERT INTO users(name) VALUES(?)"));
+    ASSERT(Db_bind_step_reset(db, NULL, 0));
+    Db_finalize(db);
+    ASSERT(Db_prepare(db, "SELECT COUNT(*), COUNT(name) FROM users"));
+    {
+        BOOL hasRow;
+        Value values[] = {{.type = VT_INT32}, {.type = VT_INT32}};
+        ASSERT(Db_step_fetch(db, &hasRow, values, 2));
+        ASSERT(hasRow);
+        ASSERT_INT(3, values[0].i32);
+        ASSERT_INT(2, values[1].i32);
+    }
+    Db_finalize(db);
+    ASSERT_INT64(3, db->cacheHits);
+    // least recently used statement was evicted
+    ASSERT_INT(3, db->ncache);
+    ASSERT(Db_prepare(db, "SELECT COUNT(*) FROM users"));
+    ASSERT_INT64(4, db->cacheHits);
+    Db_finalize(db);
+    ASSERT(Db_prepare(db, "SELECT name FROM users WHERE id = ?"));
+    ASSERT_INT64(4, db->cacheHits);
+    Db_finalize(db);
+    // cache can be turned off
+    Db_setStmtCacheSize(db, 0);
+    ASSERT(Db_prepare(db, "SELECT 1"));
+    Db_finalize(db);
+    ASSERT_INT(0, db->ncache);
+    Db_free(db);
+    // missing catalog
+    db = newDb(":memory:", FALSE);
+    ASSERT(!Db_loadCatalog(db, "sqinn_test_no_such_catalog.txt"));
+    Db_free(db);
+    remove(catalog);
+}
+
+static void testMemoryPool() {
+    // SQLite must be shut down to change its allocator
+    Db_shutdown();
+    ASSERT(Db_configMemory(DB_MEM_POOL, 0));
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL, name TEXT)"));
+    for (int i = 0; i < 100; i++) {
+        ASSERT(Db_exec(db, "INSERT INTO users(name) VALUES('Alice')"));
+    }
+    Db_free(db);
+    int64_t nalloc = 0;
+    for (int c = 0; c < SQLMEM_NCLASSES; c++) {
+        nalloc += sqlmem.classes[c].nalloc;
+    }
+    ASSERT(nalloc > 0);
+    // size classes and large allocations
+    ASSERT_INT(8, _sqlmemRoundup(1));
+    ASSERT_INT(24, _sqlmemRoundup(9));
+    ASSERT_INT(32 * 1024 - SQLMEM_HDR, _sqlmemRoundup(20000));
+    ASSERT_INT(40000, _sqlmemRoundup(40000));
+    char *p = (char *)sqlite3_malloc(100);
+    ASSERT_INT(120, sqlite3_msize(p));
+    memset(p, 'x', 100);
+    int64_t nlarge = sqlmem.classes[SQLMEM_NCLASSES].nalloc;
+    p = (char *)sqlite3_realloc(p, 50000);
+    ASSERT_INT(50000, sqlite3_msize(p));
+    ASSERT_INT64(nlarge + 1, sqlmem.classes[SQLMEM_NCLASSES].nalloc);
+    ASSERT(p[99] == 'x');
+    sqlite3_free(p);
+    ASSERT_INT64(0, sqlmem.classes[SQLMEM_NCLASSES].inuse);
+    // back to the system allocator
+    Db_shutdown();
+    ASSERT_INT(DB_MEM_SYSTEM, sqlmem.mode);
+    db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "SELECT 1"));
+    Db_free(db);
+}
+
+static void testMemorySizing() {
+    // page cache must be configured while SQLite is shut down
+    Db_shutdown();
+    ASSERT(Db_configPageCache(4096, 8));
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_setLookaside(db, 256, 64));
+    ASSERT(Db_setCacheSize(db, 100));
+    ASSERT(Db_exec(db, "CREATE TABLE users(id INTEGER PRIMARY KEY NOT NULL, name TEXT)"));
+    ASSERT(Db_exec(db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i < 2000) INSERT INTO users(id, name) SELECT i, hex(zeroblob(50)) FROM n"));
+    // more pages than slots: the page cache overflows
+    sqlite3_int64 cur = 0;
+    sqlite3_int64 hi = 0;
+    sqlite3_status64(SQLITE_STATUS_PAGECACHE_USED, &cur, &hi, 0);
+    ASSERT_INT64(8, hi);
+    sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &cur, &hi, 0);
+    ASSERT(cur > 0);
+    ASSERT_INT64(100, db->cachePages);
+    Db_free(db);
+    Db_shutdown();
+    ASSERT(!sqlmem.pageCache);
+}
+
+static void testMmap() {
+    ASSERT(Db_configCountingVfs());
+    const char *dbname = "sqinn_test_mmap.db";
+    remove(dbname);
+    Db *db = newDb(dbname, FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY NOT NULL, b BLOB)"));
+    ASSERT(Db_exec(db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i < 1000) INSERT INTO t(id, b) SELECT i, zeroblob(500) FROM n"));
+    Db_free(db);
+    // without mmap, pages are read with pread
+    db = newDb(dbname, FALSE);
+    ASSERT(Db_setMmapSize(db, 0));
+    int64_t reads = countvfs.reads;
+    int64_t fetches = countvfs.fetches;
+    ASSERT(Db_exec(db, "SELECT SUM(LENGTH(b)) FROM t"));
+    ASSERT(countvfs.reads > reads + 100);
+    ASSERT_INT64(fetches, countvfs.fetches);
+    Db_free(db);
+    // with mmap, pages are served from the mapping
+    db = newDb(dbname, FALSE);
+    ASSERT(Db_setMmapSize(db, 64 * 1024 * 1024));
+    reads = countvfs.reads;
+    ASSERT(Db_exec(db, "SELECT SUM(LENGTH(b)) FROM t"));
+    ASSERT(countvfs.fetches > fetches + 100);
+    ASSERT(countvfs.reads < reads + 10);
+    Stats *stats = newStats();
+    Db_stats(db, stats);
+    ASSERT_INT64(64 * 1024 * 1024, Stats_get(stats, "db.mmapSize", -1));
+    Stats_free(stats);
+    Db_free(db);
+    // the VFS is removed on shutdown
+    Db_shutdown();
+    ASSERT(!countvfs.root);
+    remove(dbname);
+}
+
+static void testHeapLimits() {
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY NOT NULL, s TEXT)"));
+    ASSERT(!Db_configHeapLimits(4 * 1024 * 1024, 1024 * 1024));
+    ASSERT(Db_configHeapLimits(0, 4 * 1024 * 1024));
+    ASSERT(Db_configHeapLimits(1024 * 1024, 4 * 1024 * 1024));
+    Stats *stats = newStats();
+    Db_memoryStats(stats);
+    ASSERT_INT64(4 * 1024 * 1024, Stats_get(stats, "sqlite.hardHeapLimit", -1));
+    Stats_free(stats);
+    // an in-memory db that outgrows the hard limit fails, it does not exit
+    BOOL ok = Db_exec(db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i < 10000) INSERT INTO t(id, s) SELECT i, hex(zeroblob(1000)) FROM n");
+    ASSERT(!ok);
+    ASSERT_STR("out of memory", Db_errmsg(db));
+    // below the limit the connection keeps working
+    ASSERT(Db_exec(db, "INSERT INTO t(id, s) VALUES(1, 'Alice')"));
+    Db_configHeapLimits(0, 0);
+    ASSERT(Db_exec(db, "WITH RECURSIVE n(i) AS (SELECT 2 UNION ALL SELECT i+1 FROM n WHERE i < 10000) INSERT INTO t(id, s) SELECT i, hex(zeroblob(1000)) FROM n"));
+    Db_free(db);
+}
+
+static void testStmtStats() {
+    char norm[256];
+    _normalizeSql("  SELECT *  FROM t\n WHERE id = 42 AND s = 'it''s' -- comment\n", norm);
+    ASSERT_STR("SELECT * FROM t WHERE id = ? AND s = ?", norm);
+    _normalizeSql("INSERT INTO t2(a, \"b 1\") VALUES(1.5e-3, x'00ff', /* c */ ?, .5)", norm);
+    ASSERT_STR("INSERT INTO t2(a, \"b 1\") VALUES(?, ?, ?, ?)", norm);
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_setStmtStats(db, 3));
+    ASSERT(Db_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, s TEXT)"));
+    for (int i = 1; i <= 5; i++) {
+        char sql[64];
+        snprintf(sql, sizeof(sql), "INSERT INTO t(id, s) VALUES(%d, 'x')", i);
+        ASSERT(Db_prepare(db, sql));
+        ASSERT(Db_bind_step_reset(db, NULL, 0));
+        Db_finalize(db);
+    }
+    for (int i = 0; i < 2; i++) {
+        ASSERT(Db_prepare(db, "SELECT s FROM t WHERE s <> 'y' ORDER BY s"));
+        BOOL hasRow = TRUE;
+        Value value = {.type = VT_STRING};
+        while (hasRow) {
+            ASSERT(Db_step_fetch(db, &hasRow, &value, 1));
+        }
+        Db_finalize(db);
+    }
+    // statements that differ only in literals share one row
+    ASSERT(Db_prepare(db, "SELECT sql, calls, rows, fullscan_steps, sorts, vm_steps FROM sqinn_stmt_stats ORDER BY calls DESC"));
+    {
+        BOOL hasRow;
+        Value values[] = {{.type = VT_STRING}, {.type = VT_INT64}, {.type = VT_INT64}, {.type = VT_INT64}, {.type = VT_INT64}, {.type = VT_INT64}};
+        ASSERT(Db_step_fetch(db, &hasRow, values, 6));
+        ASSERT(hasRow);
+        ASSERT_STR("INSERT INTO t(id, s) VALUES(?, ?)", values[0].p);
+        ASSERT_INT64(5, values[1].i64);
+        ASSERT_INT64(0, values[2].i64);
+        ASSERT(Db_step_fetch(db, &hasRow, values, 6));
+        ASSERT(hasRow);
+        ASSERT_STR("SELECT s FROM t WHERE s <> ? ORDER BY s", values[0].p);
+        ASSERT_INT64(2, values[1].i64);
+        ASSERT_INT64(10, values[2].i64);
+        ASSERT_INT64(8, values[3].i64);
+        ASSERT_INT64(2, values[4].i64);
+        ASSERT(values[5].i64 > 0);
+        // the running stats query is counted when it is finalized
+        ASSERT(Db_step_fetch(db, &hasRow, values, 6));
+        ASSERT(hasRow);
+        ASSERT_INT64(0, values[1].i64);
+        ASSERT(Db_step_fetch(db, &hasRow, values, 6));
+        ASSERT(!hasRow);
+    }
+    Db_finalize(db);
+    ASSERT_INT(3, db->nstmtStats);
+    ASSERT(Db_prepare(db, "SELECT COUNT(*) FROM t"));
+    Db_finalize(db);
+    ASSERT_INT64(1, db->stmtStatsDropped);
+    ASSERT(Db_setStmtStats(db, 0));
+    ASSERT_INT(0, db->nstmtStats);
+    Db_free(db);
+}
+
+static void testSlowLog() {
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, s TEXT, n INTEGER)"));
+    ASSERT(Db_exec(db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i < 100) INSERT INTO t(id, s, n) SELECT i, 'x', i FROM n"));
+    Db_setSlowLog(db, 1);
+    ASSERT_INT64(1000000, db->slowNanos);
+    db->slowNanos = 1;  // every statement is slow
+    ASSERT(Db_prepare(db, "SELECT id FROM t WHERE s = ? AND n > ? ORDER BY n"));
+    Value params[] = {
+        {.type = VT_STRING, .p = "a string that is longer than the prefix"},
+        {.type = VT_INT32, .i32 = 10},
+    };
+    ASSERT(Db_bind(db, params, 2));
+    char buf[SLOW_PLAN];
+    _formatParams(db, buf, sizeof(buf));
+    ASSERT_STR("2 params: 'a string that is longer ...', 10", buf);
+    ASSERT(_queryPlan(db, "SELECT id FROM t WHERE s = ? AND n > ? ORDER BY n", buf, sizeof(buf)));
+    ASSERT_STR("SCAN t\nUSE TEMP B-TREE FOR ORDER BY\n", buf);
+    Db_finalize(db);
+    ASSERT_INT64(1, db->nslow);
+    // the plan is captured when the statement is slow, after an index change
+    ASSERT(Db_exec(db, "CREATE INDEX t_s ON t(s)"));
+    ASSERT(_queryPlan(db, "SELECT id FROM t WHERE s = ?", buf, sizeof(buf)));
+    ASSERT_STR("SEARCH t USING COVERING INDEX t_s (s=?)\n", buf);
+    ASSERT(_queryPlan(db, "SELECT id FROM t WHERE id IN (SELECT n FROM t WHERE s = ?)", buf, sizeof(buf)));
+    ASSERT(strstr(buf, "\n  SEARCH t USING INDEX t_s (s=?)\n"));
+    ASSERT(!_queryPlan(db, "SELECT * FROM nosuchtable", buf, sizeof(buf)));
+    Db_setSlowLog(db, 0);
+    ASSERT(Db_prepare(db, "SELECT COUNT(*) FROM t"));
+    Db_finalize(db);
+    ASSERT_INT64(1, db->nslow);
+    Db_free(db);
+}
+
+/* _encodeQuery writes all rows of sql to w, with a row codec if codec is
+   set, else fetched value by value. It returns the number of rows. */
+static int _encodeQuery(Db *db, const char *sql, const char *coltypes, int ncols, BOOL codec, Writer *w) {
+    ASSERT(Db_prepare(db, sql));
+    if (codec) {
+        ASSERT(Db_setRowCodec(db, coltypes, ncols));
+    }
+    Value values[ROW_CODEC_MAX_COLS];
+    BOOL hasRow = TRUE;
+    int nrows = 0;
+    while (TRUE) {
+        for (int i = 0; i < ncols; i++) {
+            values[i].type = coltypes[i];
+        }
+        ASSERT(Db_step_fetch(db, &hasRow, values, codec ? 0 : ncols));
+        if (!hasRow) {
+            break;
+        }
+        nrows++;
+        if (codec) {
+            Db_encodeRow(db, w);
+            continue;
+        }
+        Writer_writeByte(w, 1);
+        for (int i = 0; i < ncols; i++) {
+            Writer_writeByte(w, values[i].type);
+            if (values[i].type == VT_INT64) {
+                Writer_writeInt64(w, values[i].i64);
+            } else if (values[i].type == VT_DOUBLE) {
+                Writer_writeDouble(w, values[i].d);
+            } else if (values[i].type == VT_STRING) {
+                Writer_writeString(w, values[i].p);
+            }
+        }
+    }
+    Db_finalize(db);
+    return nrows;
+}
+
+static void testRowCodec() {
+    ASSERT(_rowCodec("\x02", 1) == _rcI);
+    ASSERT(_rowCodec("\x04\x03", 2) == _rcSD);
+    ASSERT(_rowCodec("\x02\x03\x04\x02", 4) == _rcIDSI);
+    ASSERT(!_rowCodec("\x02\x05", 2));
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE t(i INTEGER, d REAL, s TEXT)"));
+    ASSERT(Db_exec(db, "INSERT INTO t VALUES (1, 1.5, 'one'), (NULL, -2.25, ''), (-3, NULL, 'three'), (4000000000, 4.0, NULL)"));
+    const char *large = "INSERT INTO t VALUES (5, 5.5, printf('%.5000c', 'x'))";  // zero-copy if enabled
+    ASSERT(Db_exec(db, large));
+    struct {
+        const char *sql;
+        const char *coltypes;
+        int ncols;
+    } cases[] = {
+        {"SELECT i FROM t", "\x02", 1},
+        {"SELECT i, d, s FROM t", "\x02\x03\x04", 3},
+        {"SELECT s, i, d, s, i FROM t", "\x04\x02\x03\x04\x02", 5},
+        {"SELECT i, d, s, i, d, s, i, d FROM t", "\x02\x03\x04\x02\x03\x04\x02\x03", 8},
+        {"SELECT d, i FROM t", "\x02\x02", 2},  // conversions
+        {"SELECT s, i FROM t", "\x03\x04", 2},
+    };
+    for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+        Writer *want = newBufWriter(1024);
+        Writer *have = newBufWriter(1024);
+        ASSERT_INT(5, _encodeQuery(db, cases[c].sql, cases[c].coltypes, cases[c].ncols, FALSE, want));
+        ASSERT_INT(5, _encodeQuery(db, cases[c].sql, cases[c].coltypes, cases[c].ncols, TRUE, have));
+        size_t wantLen, haveLen;
+        const char *wantData = Writer_data(want, &wantLen);
+        const char *haveData = Writer_data(have, &haveLen);
+        ASSERT_INT((int)wantLen, (int)haveLen);
+        ASSERTF(memcmp(wantData, haveData, wantLen) == 0, "case %d", c);
+        Writer_free(want);
+        Writer_free(have);
+    }
+    // a string at or above the zero-copy threshold is left to _encodeValues
+    Writer *fdw = newFdWriter(STDOUT_FILENO);
+    Writer_setZeroCopy(fdw, 6);
+    Writer *bufw = newBufWriter(1024);
+    ASSERT(Db_prepare(db, "SELECT s FROM t WHERE i IN (1, 5) ORDER BY i"));
+    Value value = {VT_STRING};
+    BOOL hasRow;
+    ASSERT(Db_step_fetch(db, &hasRow, &value, 0) && hasRow);
+    ASSERT(_rcS(db->stmt, 0, TRUE, fdw));  // 'one' is 4 bytes
+    ASSERT(Db_step_fetch(db, &hasRow, &value, 0) && hasRow);
+    ASSERT(!_rcS(db->stmt, 0, TRUE, fdw));
+    ASSERT(_rcS(db->stmt, 0, TRUE, bufw));  // no zero-copy, always copied
+    Db_finalize(db);
+    Writer_rewind(fdw, 0);
+    Writer_free(fdw);
+    Writer_free(bufw);
+    // no row codec for other types, more than ROW_CODEC_MAX_COLS columns, or debug logging
+    ASSERT(Db_prepare(db, "SELECT i, s FROM t"));
+    ASSERT(!Db_setRowCodec(db, "\x01\x04", 2));
+    ASSERT(!Db_setRowCodec(db, "\x02\x02\x02\x02\x02\x02\x02\x02\x02", 9));
+    Db_finalize(db);
+    Db_free(db);
+    db = newDb(":memory:", TRUE);
+    ASSERT(Db_prepare(db, "SELECT 1"));
+    ASSERT(!Db_setRowCodec(db, "\x02", 1));
+    Db_finalize(db);
+    Db_free(db);
+}
+
 void testDb() {
     LOG_INFO0("testDb testSqlite");
     testSqlite();
@@ -520,4 +3047,24 @@ void testDb() {
     testMemoryDb();
     LOG_INFO0("testDb testErrors");
     testErrors();
+    LOG_INFO0("testDb testCheckpointer");
+    testCheckpointer();
+    LOG_INFO0("testDb testReadSnapshot");
+    testReadSnapshot();
+    LOG_INFO0("testDb testStmtCache");
+    testStmtCache();
+    LOG_INFO0("testDb testMemoryPool");
+    testMemoryPool();
+    LOG_INFO0("testDb testMemorySizing");
+    testMemorySizing();
+    LOG_INFO0("testDb testMmap");
+    testMmap();
+    LOG_INFO0("testDb testHeapLimits");
+    testHeapLimits();
+    LOG_INFO0("testDb testStmtStats");
+    testStmtStats();
+    LOG_INFO0("testDb testSlowLog");
+    testSlowLog();
+    LOG_INFO0("testDb testRowCodec");
+    testRowCodec();
 }
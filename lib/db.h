@@ -18,16 +18,53 @@ typedef struct value_s {
 #define VT_STRING 4
 #define VT_BLOB   5
 
+/* SQLite allocators, see Db_configMemory. */
+#define DB_MEM_SYSTEM 0  // system malloc
+#define DB_MEM_POOL   1  // size-class pool
+#define DB_MEM_HEAP   2  // MEMSYS5 over a fixed heap
+
+BOOL Db_configMemory(int mode, size_t heapSize);
+BOOL Db_configPageCache(int pageSize, int npages);
+BOOL Db_configCountingVfs();
+BOOL Db_configHeapLimits(int64_t soft, int64_t hard);
+void Db_printMemory();
+void Db_memoryStats(Stats *stats);
+void Db_shutdown();
+
 /* A Db provides access to a SQLite database. */
 typedef struct db_s Db;
 Db *newDb(const char *dbname, BOOL debug);
 void Db_free(Db *this);
+BOOL Db_startCheckpointer(Db *this, int walPages, int intervalMillis);
+void Db_setStmtCacheSize(Db *this, int size);
+BOOL Db_setStmtStats(Db *this, int max);
+void Db_mergeStmtStats(Db *this, Db *reader);
+void Db_setSlowLog(Db *this, int millis);
+void Db_setTrace(Db *this, Trace *trace);
+void Db_setArena(Db *this, Arena *arena);
+BOOL Db_setLookaside(Db *this, int slotSize, int nslots);
+BOOL Db_setCacheSize(Db *this, int pages);
+BOOL Db_setMmapSize(Db *this, int64_t bytes);
+void Db_printStatus(Db *this);
+void Db_stats(Db *this, Stats *stats);
+BOOL Db_loadCatalog(Db *this, const char *filename);
+BOOL Db_exec(Db *this, const char *sql);
 BOOL Db_prepare(Db *this, const char *sql);
+BOOL Db_isWrite(Db *this);
+BOOL Db_isStandalone(Db *this);
+const char *Db_columnName(Db *this, int icol);
 void Db_finalize(Db *this);
 BOOL Db_bind(Db *this, const Value *params, int nparams);
 BOOL Db_bind_step_reset(Db *this, const Value *params, int nparams);
 BOOL Db_step_fetch(Db *this, BOOL *phasRow, Value *values, int nvalues);
+BOOL Db_setRowCodec(Db *this, const char *coltypes, int ncols);
+void Db_encodeRow(Db *this, Writer *w);
+void Db_reset(Db *this);
 const char *Db_errmsg(Db *this);
+Db *Db_openReader(Db *this);
+BOOL Db_inTransaction(Db *this);
+BOOL Db_beginRead(Db *this, Db *from);
+void Db_endRead(Db *this);
 
 //
 // Test
@@ -0,0 +1,652 @@
+#include "utl.h"
+#include "io.h"
+#include "db.h"
+#include "import.h"
+
+#define IMPORT_CHUNK (1024*1024)  // bytes per read, a record may span several reads
+#define IMPORT_THREADS 4          // default number of parser threads
+#define IMPORT_MAX_THREADS 16
+#define IMPORT_BATCH 100000       // default rows per transaction
+
+#define CH_FREE   0  // can be read into
+#define CH_BUSY   1  // being parsed
+#define CH_PARSED 2  // can be inserted
+
+/* An ImportChunk holds whole records of the file, and the rows parsed from
+   them. Fields are unquoted and null-terminated in place, values point
+   into buf. */
+typedef struct importchunk_s {
+    int state;           // see CH_...
+    int64_t seq;         // sequence number in file order
+    char *buf;
+    size_t start;        // the records start at buf + start
+    size_t len;          // bytes of whole records
+    size_t cap;
+    size_t nraw;         // bytes read, at buf + start until the carry is taken
+    BOOL readError;
+    size_t split[2];     // end of the last record in the bytes read, 0 if none,
+    int64_t splitLines[2];  // and the newlines before it, for a chunk that
+                         // starts outside [0] or inside [1] quotes
+    int quotes;          // 1 if the bytes read have an odd number of quotes
+    int64_t lines;       // newlines in the bytes read
+    int64_t firstLine;   // line number of the first record, 1-based
+    BOOL last;           // the chunk ends the file
+    Value *values;       // nrows x nparams
+    size_t *ends;        // end of each row in buf
+    int nrows;
+    int maxRows;
+    char errmsg[128];    // not empty if the chunk could not be read or parsed
+} ImportChunk;
+
+struct import_s {
+    Db *db;
+    FILE *fp;            // or NULL if failed
+    char sep;
+    BOOL header;
+    int nfields;         // fields per record
+    int *params;         // param index of each field, or -1 if the field is skipped
+    int nparams;
+    int batch;
+    int nthreads;
+    size_t chunkSize;
+    Thread **threads;    // started by the first Import_next
+    // protected by mutex
+    Mutex *mutex;
+    Cond *cond;
+    ImportChunk *chunks;
+    int nchunks;
+    int64_t nextRead;    // sequence number of the next chunk to read
+    int64_t carrySeq;    // sequence number of the chunk that takes the carry
+    size_t headroom;     // room for the carry before the bytes read, the largest carry so far
+    BOOL eof;
+    BOOL cancel;
+    // used by the parser of chunk carrySeq only, see _takeCarry
+    int64_t nextLine;
+    char *carry;         // start of a record that did not end in the chunks before
+    size_t ncarry;
+    size_t carryCap;
+    int carryQuoted;     // 1 if the carry ends inside quotes
+    int64_t carryLines;  // newlines in the carry
+    // used by Import_next only
+    int64_t nextInsert;  // sequence number of the next chunk to insert
+    int row;             // next row of that chunk
+    BOOL done;
+    char *errmsg;        // NULL if ok
+    int64_t rows;
+    int64_t offset;      // bytes of the chunks inserted so far
+    int64_t bytes;
+    int64_t start;
+};
+
+static void _importFail(Import *this, const char *errmsg) {
+    if (!this->errmsg) {
+        this->errmsg = memStrdup(errmsg, __FILE__, __LINE__);
+    }
+    this->done = TRUE;
+}
+
+/* _quoteIdent appends ident to p as a quoted SQL identifier and returns the
+   end. p must have room for 2 * strlen(ident) + 2 bytes. */
+static char *_quoteIdent(char *p, const char *ident) {
+    *p++ = '"';
+    for (; *ident; ident++) {
+        if (*ident == '"') {
+            *p++ = '"';
+        }
+        *p++ = *ident;
+    }
+    *p++ = '"';
+    return p;
+}
+
+Import *newImport(Db *db, const char *filename, const char *table, const char *const *columns, int nfields,
+        char sep, BOOL header, int nthreads, int batch) {
+    ASSERT(db);
+    ASSERT(nfields >= 0);
+    Import *this = (Import *)memAlloc(sizeof(Import), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Import));
+    this->db = db;
+    this->sep = sep;
+    this->header = header;
+    this->nfields = nfields;
+    this->params = (int *)memAlloc((nfields + 1) * sizeof(int), __FILE__, __LINE__);
+    this->batch = batch > 0 ? batch : IMPORT_BATCH;
+    this->nthreads = nthreads <= 0 ? IMPORT_THREADS : nthreads > IMPORT_MAX_THREADS ? IMPORT_MAX_THREADS : nthreads;
+    this->chunkSize = IMPORT_CHUNK;
+    this->nextLine = 1;
+    this->start = nanotime();
+    // INSERT INTO "table"("col", ...) VALUES(?, ...)
+    size_t size = 32 + 2 * strlen(table);
+    for (int i = 0; i < nfields; i++) {
+        size += 2 * strlen(columns[i]) + 8;
+    }
+    char *sql = (char *)memAlloc(size, __FILE__, __LINE__);
+    char *p = sql;
+    p += sprintf(p, "INSERT INTO ");
+    p = _quoteIdent(p, table);
+    *p++ = '(';
+    for (int i = 0; i < nfields; i++) {
+        this->params[i] = -1;
+        if (columns[i][0]) {
+            this->params[i] = this->nparams++;
+            p += sprintf(p, "%s", this->params[i] ? ", " : "");
+            p = _quoteIdent(p, columns[i]);
+        }
+    }
+    p += sprintf(p, ") VALUES(");
+    for (int i = 0; i < this->nparams; i++) {
+        p += sprintf(p, "%s?", i ? ", " : "");
+    }
+    sprintf(p, ")");
+    char errmsg[600];
+    if (this->nparams == 0) {
+        _importFail(this, "import: no columns");
+    } else if (sep == '"' || sep == '\n' || sep == '\r' || sep == 0) {
+        snprintf(errmsg, sizeof(errmsg), "import: invalid separator %d", sep);
+        _importFail(this, errmsg);
+    } else if (!Db_prepare(db, sql)) {
+        _importFail(this, Db_errmsg(db));
+    } else if (!(this->fp = fopen(filename, "rb"))) {
+        snprintf(errmsg, sizeof(errmsg), "import: cannot open '%.500s'", filename);
+        _importFail(this, errmsg);
+    }
+    memFree(sql);
+    this->mutex = newMutex();
+    this->cond = newCond();
+    this->nchunks = 2 * this->nthreads;
+    this->chunks = (ImportChunk *)memAlloc(this->nchunks * sizeof(ImportChunk), __FILE__, __LINE__);
+    memset(this->chunks, 0, this->nchunks * sizeof(ImportChunk));
+    return this;
+}
+
+void Import_free(Import *this) {
+    ASSERT(this);
+    if (this->threads) {
+        Mutex_lock(this->mutex);
+        this->cancel = TRUE;
+        Cond_broadcast(this->cond);
+        Mutex_unlock(this->mutex);
+        for (int i = 0; i < this->nthreads; i++) {
+            Thread_join(this->threads[i]);
+        }
+        memFree(this->threads);
+    }
+    for (int i = 0; i < this->nchunks; i++) {
+        if (this->chunks[i].buf) {
+            memFree(this->chunks[i].buf);
+        }
+        if (this->chunks[i].values) {
+            memFree(this->chunks[i].values);
+            memFree(this->chunks[i].ends);
+        }
+    }
+    memFree(this->chunks);
+    Cond_free(this->cond);
+    Mutex_free(this->mutex);
+    if (this->carry) {
+        memFree(this->carry);
+    }
+    if (this->fp) {
+        fclose(this->fp);
+    }
+    Db_finalize(this->db);
+    if (this->errmsg) {
+        memFree(this->errmsg);
+    }
+    memFree(this->params);
+    memFree(this);
+}
+
+static void _reserve(char **pbuf, size_t *pcap, size_t cap) {
+    if (*pcap >= cap) {
+        return;
+    }
+    *pbuf = *pbuf ? (char *)memRealloc(*pbuf, cap) : (char *)memAlloc(cap, __FILE__, __LINE__);
+    *pcap = cap;
+}
+
+/* _readChunk reads the next chunkSize bytes of the file into ch, leaving
+   room for the carry of the chunk before. It runs under the mutex, so
+   that chunks are read in file order. */
+static void _readChunk(Import *this, ImportChunk *ch) {
+    ch->seq = this->nextRead++;
+    ch->len = 0;
+    ch->last = FALSE;
+    ch->readError = FALSE;
+    ch->nrows = 0;
+    ch->errmsg[0] = 0;
+    ch->start = this->headroom;
+    _reserve(&ch->buf, &ch->cap, ch->start + this->chunkSize + 1);
+    ch->nraw = fread(ch->buf + ch->start, 1, this->chunkSize, this->fp);
+    if (ch->nraw < this->chunkSize) {
+        ch->readError = ferror(this->fp) != 0;
+        ch->last = TRUE;
+        this->eof = TRUE;
+    }
+}
+
+/* _scanChunk finds the end of the last record in the bytes read. A
+   newline ends a record if it is not inside quotes. Whether the chunk
+   starts inside quotes is known only when the carry is taken, so both
+   cases are scanned, and chunks are scanned in parallel. */
+static void _scanChunk(ImportChunk *ch) {
+    const char *raw = ch->buf + ch->start;
+    int q = 0;
+    int64_t lines = 0;
+    ch->split[0] = ch->split[1] = 0;
+    ch->splitLines[0] = ch->splitLines[1] = 0;
+    for (size_t i = 0; i < ch->nraw; i++) {
+        char c = raw[i];
+        if (c == '"') {
+            q ^= 1;
+        } else if (c == '\n') {
+            lines++;
+            // outside quotes if the chunk starts with quoted == q
+            ch->split[q] = i + 1;
+            ch->splitLines[q] = lines;
+        }
+    }
+    ch->quotes = q;
+    ch->lines = lines;
+}
+
+/* _takeCarry waits until the chunk before has handed over its carry,
+   prepends the carry to the bytes read, and hands over the bytes after
+   the last record to the chunk after. It returns FALSE if the import was
+   cancelled. */
+static BOOL _takeCarry(Import *this, ImportChunk *ch) {
+    Mutex_lock(this->mutex);
+    while (this->carrySeq != ch->seq && !this->cancel) {
+        Cond_wait(this->cond, this->mutex);
+    }
+    BOOL cancel = this->cancel;
+    Mutex_unlock(this->mutex);
+    if (cancel) {
+        return FALSE;
+    }
+    size_t ncarry = this->ncarry;
+    if (ncarry > ch->start) {
+        _reserve(&ch->buf, &ch->cap, ncarry + ch->nraw + 1);
+        memmove(ch->buf + ncarry, ch->buf + ch->start, ch->nraw);
+        ch->start = ncarry;
+    }
+    ch->start -= ncarry;
+    if (ncarry) {
+        memcpy(ch->buf + ch->start, this->carry, ncarry);
+    }
+    int quoted = this->carryQuoted;
+    size_t total = ncarry + ch->nraw;
+    size_t end = 0;      // of the last record, after the carry
+    int64_t lines = 0;
+    if (ch->last) {
+        end = total;
+        lines = this->carryLines + ch->lines;
+    } else if (ch->split[quoted]) {
+        end = ncarry + ch->split[quoted];
+        lines = this->carryLines + ch->splitLines[quoted];
+    }
+    ch->firstLine = this->nextLine;
+    ch->len = end;
+    if (ch->readError) {
+        snprintf(ch->errmsg, sizeof(ch->errmsg), "import: read error after line %" PRId64, ch->firstLine + lines);
+    }
+    this->carryLines += ch->lines - lines;
+    this->carryQuoted = quoted ^ ch->quotes;
+    this->ncarry = total - end;
+    _reserve(&this->carry, &this->carryCap, this->ncarry);
+    if (this->ncarry) {
+        memcpy(this->carry, ch->buf + ch->start + end, this->ncarry);
+    }
+    ch->buf[ch->start + end] = 0;
+    this->nextLine += lines;
+    Mutex_lock(this->mutex);
+    if (this->ncarry > this->headroom) {
+        this->headroom = this->ncarry;
+    }
+    this->carrySeq++;
+    Cond_broadcast(this->cond);
+    Mutex_unlock(this->mutex);
+    return TRUE;
+}
+
+static Value *_nextRow(Import *this, ImportChunk *ch) {
+    if (ch->nrows == ch->maxRows) {
+        ch->maxRows = ch->maxRows ? 2 * ch->maxRows : 1024;
+        size_t size = (size_t)ch->maxRows * this->nparams * sizeof(Value);
+        ch->values = ch->values ? (Value *)memRealloc(ch->values, size) : (Value *)memAlloc(size, __FILE__, __LINE__);
+        size = (size_t)ch->maxRows * sizeof(size_t);
+        ch->ends = ch->ends ? (size_t *)memRealloc(ch->ends, size) : (size_t *)memAlloc(size, __FILE__, __LINE__);
+    }
+    return &ch->values[(size_t)ch->nrows++ * this->nparams];
+}
+
+/* _parseChunk splits the records of a chunk into fields, see RFC 4180. */
+static void _parseChunk(Import *this, ImportChunk *ch) {
+    char *data = ch->buf + ch->start;
+    char *p = data;
+    char *end = data + ch->len;
+    int64_t line = ch->firstLine;
+    BOOL skipHeader = this->header && ch->firstLine == 1;
+    while (p < end && !ch->errmsg[0]) {
+        if (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n')) {
+            // empty line
+            p += *p == '\r' ? 2 : 1;
+            line++;
+            continue;
+        }
+        int64_t recordLine = line;
+        Value *row = _nextRow(this, ch);
+        int f = 0;
+        for (;;) {
+            Value val = {VT_STRING};
+            char *term;  // where the field ends
+            BOOL quotedField = p < end && *p == '"';
+            if (quotedField) {
+                char *w = p;
+                val.p = w;
+                p++;
+                for (;;) {
+                    if (p == end) {
+                        snprintf(ch->errmsg, sizeof(ch->errmsg), "line %" PRId64 ": unterminated quoted field", recordLine);
+                        break;
+                    }
+                    if (*p == '"') {
+                        if (p + 1 < end && p[1] == '"') {
+                            *w++ = '"';
+                            p += 2;
+                            continue;
+                        }
+                        p++;
+                        break;
+                    }
+                    line += *p == '\n';
+                    *w++ = *p++;
+                }
+                if (ch->errmsg[0]) {
+                    break;
+                }
+                term = w;
+                if (p < end && *p == '\r' && (p + 1 == end || p[1] == '\n')) {
+                    p++;
+                }
+            } else {
+                val.p = p;
+                while (p < end && *p != this->sep && *p != '\n') {
+                    p++;
+                }
+                term = p;
+                if (term > val.p && term[-1] == '\r' && (p == end || *p == '\n')) {
+                    term--;
+                }
+                if (term == val.p) {
+                    val.type = VT_NULL;
+                }
+            }
+            char delim = p < end ? *p : '\n';
+            if (delim != this->sep && delim != '\n') {
+                snprintf(ch->errmsg, sizeof(ch->errmsg), "line %" PRId64 ": unexpected character after quoted field", line);
+                break;
+            }
+            if (p < end) {
+                p++;
+                line += delim == '\n';
+            }
+            *term = 0;
+            if (f == this->nfields) {
+                snprintf(ch->errmsg, sizeof(ch->errmsg), "line %" PRId64 ": more than %d fields", recordLine, this->nfields);
+                break;
+            }
+            if (this->params[f] >= 0) {
+                row[this->params[f]] = val;
+            }
+            f++;
+            if (delim == '\n') {
+                break;
+            }
+        }
+        if (!ch->errmsg[0] && f < this->nfields) {
+            snprintf(ch->errmsg, sizeof(ch->errmsg), "line %" PRId64 ": %d fields, want %d", recordLine, f, this->nfields);
+        }
+        ch->ends[ch->nrows - 1] = p - data;
+        if (skipHeader) {
+            ch->nrows--;
+            skipHeader = FALSE;
+        }
+    }
+}
+
+static void _parserMain(void *arg) {
+    Import *this = (Import *)arg;
+    Mutex_lock(this->mutex);
+    while (!this->cancel && !this->eof) {
+        ImportChunk *ch = &this->chunks[this->nextRead % this->nchunks];
+        if (ch->state != CH_FREE) {
+            Cond_wait(this->cond, this->mutex);
+            continue;
+        }
+        ch->state = CH_BUSY;
+        _readChunk(this, ch);
+        Mutex_unlock(this->mutex);
+        _scanChunk(ch);
+        if (!_takeCarry(this, ch)) {
+            return;
+        }
+        if (!ch->errmsg[0]) {
+            _parseChunk(this, ch);
+        }
+        Mutex_lock(this->mutex);
+        ch->state = CH_PARSED;
+        Cond_broadcast(this->cond);
+    }
+    Mutex_unlock(this->mutex);
+}
+
+/* _takeChunk waits until the next chunk in file order has been parsed. */
+static ImportChunk *_takeChunk(Import *this) {
+    Mutex_lock(this->mutex);
+    ImportChunk *ch = &this->chunks[this->nextInsert % this->nchunks];
+    while (ch->state != CH_PARSED) {
+        Cond_wait(this->cond, this->mutex);
+    }
+    Mutex_unlock(this->mutex);
+    return ch;
+}
+
+static void _releaseChunk(Import *this, ImportChunk *ch) {
+    Mutex_lock(this->mutex);
+    ch->state = CH_FREE;
+    this->nextInsert++;
+    this->row = 0;
+    Cond_broadcast(this->cond);
+    Mutex_unlock(this->mutex);
+}
+
+/* Import_next inserts the next batch of rows in one transaction. If a
+   transaction is already open, the rows are inserted into it. On error,
+   the batch is rolled back, batches before stay committed. */
+BOOL Import_next(Import *this) {
+    ASSERT(this);
+    if (this->done) {
+        return FALSE;
+    }
+    if (!this->threads) {
+        this->threads = (Thread **)memAlloc(this->nthreads * sizeof(Thread *), __FILE__, __LINE__);
+        for (int i = 0; i < this->nthreads; i++) {
+            this->threads[i] = newThread(_parserMain, this);
+        }
+    }
+    BOOL own = !Db_inTransaction(this->db);
+    if (own && !Db_exec(this->db, "BEGIN")) {
+        _importFail(this, Db_errmsg(this->db));
+        return FALSE;
+    }
+    int n = 0;
+    size_t partial = 0;  // of the chunk that is not inserted completely
+    while (!this->done && n < this->batch) {
+        ImportChunk *ch = _takeChunk(this);
+        if (ch->errmsg[0]) {
+            _importFail(this, ch->errmsg);
+            break;
+        }
+        while (this->row < ch->nrows && n < this->batch) {
+            if (!Db_bind_step_reset(this->db, &ch->values[(size_t)this->row * this->nparams], this->nparams)) {
+                _importFail(this, Db_errmsg(this->db));
+                break;
+            }
+            this->row++;
+            n++;
+        }
+        if (this->errmsg) {
+            break;
+        }
+        if (this->row == ch->nrows) {
+            this->offset += (int64_t)ch->len;
+            this->done = ch->last;
+            _releaseChunk(this, ch);
+        } else if (this->row > 0) {
+            partial = ch->ends[this->row - 1];
+        }
+    }
+    if (this->errmsg) {
+        if (own) {
+            Db_exec(this->db, "ROLLBACK");
+        }
+        return FALSE;
+    }
+    if (own && !Db_exec(this->db, "COMMIT")) {
+        _importFail(this, Db_errmsg(this->db));
+        Db_exec(this->db, "ROLLBACK");
+        return FALSE;
+    }
+    this->rows += n;
+    this->bytes = this->offset + (int64_t)partial;
+    double secs = (double)Import_nanos(this) / 1e9;
+    LOG_INFO3("import: %" PRId64 " rows, %" PRId64 " bytes, %.0f rows/s", this->rows, this->bytes, secs > 0 ? this->rows / secs : 0);
+    return n > 0;
+}
+
+BOOL Import_ok(Import *this) {
+    return this->errmsg == NULL;
+}
+
+const char *Import_errmsg(Import *this) {
+    return this->errmsg;
+}
+
+int64_t Import_rows(Import *this) {
+    return this->rows;
+}
+
+int64_t Import_bytes(Import *this) {
+    return this->bytes;
+}
+
+int64_t Import_nanos(Import *this) {
+    return nanotime() - this->start;
+}
+
+//
+// Test
+//
+
+static void _writeFile(const char *filename, const char *data) {
+    FILE *fp = fopen(filename, "wb");
+    ASSERT(fp);
+    fwrite(data, 1, strlen(data), fp);
+    fclose(fp);
+}
+
+static int64_t _count(Db *db, const char *sql) {
+    ASSERT(Db_prepare(db, sql));
+    BOOL hasRow;
+    Value value = {VT_INT64};
+    ASSERT(Db_step_fetch(db, &hasRow, &value, 1));
+    ASSERT(hasRow);
+    Db_finalize(db);
+    return value.type == VT_NULL ? -1 : value.i64;
+}
+
+static void testParse() {
+    const char *filename = "sqinn_test_import.csv";
+    _writeFile(filename,
+        "id,name,skip,note\r\n"
+        "1,Alice,x,plain\r\n"
+        "2,\"Bob, Jr.\",x,\"say \"\"hi\"\"\"\r\n"
+        "\n"
+        "3,,x,\"two\nlines\"\n"
+        "4,\"\",x,");
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE t(id INTEGER, name TEXT, note TEXT)"));
+    const char *columns[] = {"id", "name", "", "note"};
+    Import *imp = newImport(db, filename, "t", columns, 4, ',', TRUE, 2, 0);
+    imp->chunkSize = 8;  // many chunks, records span several reads
+    ASSERT(Import_next(imp));
+    ASSERT(!Import_next(imp));
+    ASSERT(Import_ok(imp));
+    ASSERT_INT64(4, Import_rows(imp));
+    ASSERT_INT64(90, Import_bytes(imp));
+    Import_free(imp);
+    ASSERT_INT64(4, _count(db, "SELECT count(*) FROM t"));
+    ASSERT_INT64(10, _count(db, "SELECT sum(id) FROM t WHERE typeof(id) = 'integer'"));
+    ASSERT_INT64(1, _count(db, "SELECT count(*) FROM t WHERE name = 'Bob, Jr.' AND note = 'say \"hi\"'"));
+    ASSERT_INT64(1, _count(db, "SELECT count(*) FROM t WHERE id = 3 AND name IS NULL AND note = 'two' || char(10) || 'lines'"));
+    ASSERT_INT64(1, _count(db, "SELECT count(*) FROM t WHERE id = 4 AND name = '' AND note IS NULL"));
+    Db_free(db);
+    remove(filename);
+}
+
+static void testBatches() {
+    const char *filename = "sqinn_test_import.tsv";
+    FILE *fp = fopen(filename, "wb");
+    ASSERT(fp);
+    for (int i = 1; i <= 10000; i++) {
+        fprintf(fp, "%d\tname %d\n", i, i);
+    }
+    fprintf(fp, "10001\n");  // too few fields
+    fclose(fp);
+    Db *db = newDb(":memory:", FALSE);
+    ASSERT(Db_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT)"));
+    const char *columns[] = {"id", "name"};
+    Import *imp = newImport(db, filename, "t", columns, 2, '\t', FALSE, 4, 3000);
+    imp->chunkSize = 1000;
+    int nbatches = 0;
+    while (Import_next(imp)) {
+        nbatches++;
+        ASSERT_INT64(nbatches * 3000, Import_rows(imp));
+    }
+    ASSERT_INT(3, nbatches);
+    ASSERT(!Import_ok(imp));
+    ASSERT_STR("line 10001: 1 fields, want 2", Import_errmsg(imp));
+    Import_free(imp);
+    // the failed batch was rolled back
+    ASSERT_INT64(9000, _count(db, "SELECT count(*) FROM t"));
+    ASSERT(!Db_inTransaction(db));
+    // constraint errors
+    _writeFile(filename, "9000\tdup\n");
+    imp = newImport(db, filename, "t", columns, 2, '\t', FALSE, 1, 0);
+    ASSERT(!Import_next(imp));
+    ASSERT_STR("UNIQUE constraint failed: t.id", Import_errmsg(imp));
+    Import_free(imp);
+    // setup errors
+    imp = newImport(db, "sqinn_no_such_file.csv", "t", columns, 2, ',', FALSE, 0, 0);
+    ASSERT(!Import_next(imp));
+    ASSERT_STR("import: cannot open 'sqinn_no_such_file.csv'", Import_errmsg(imp));
+    Import_free(imp);
+    imp = newImport(db, filename, "no_such_table", columns, 2, ',', FALSE, 0, 0);
+    ASSERT(!Import_next(imp));
+    ASSERT_STR("no such table: no_such_table", Import_errmsg(imp));
+    Import_free(imp);
+    const char *none[] = {"", ""};
+    imp = newImport(db, filename, "t", none, 2, ',', FALSE, 0, 0);
+    ASSERT_STR("import: no columns", Import_errmsg(imp));
+    Import_free(imp);
+    Db_free(db);
+    remove(filename);
+}
+
+void testImport() {
+    LOG_INFO0("testImport testParse");
+    testParse();
+    LOG_INFO0("testImport testBatches");
+    testBatches();
+}
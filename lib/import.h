@@ -0,0 +1,27 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+/* An Import loads a CSV or TSV file into a table. Parser threads read the
+   file in chunks that end at a record boundary and parse them in parallel.
+   The caller's thread inserts the parsed rows in file order, with one
+   prepared statement, in transactions of a batch of rows each. Empty
+   unquoted fields are NULL, all other fields are bound as text, so that
+   the column affinity applies. */
+typedef struct import_s Import;
+Import *newImport(Db *db, const char *filename, const char *table, const char *const *columns, int nfields,
+    char sep, BOOL header, int nthreads, int batch);  // a column "" skips its field
+void Import_free(Import *this);
+BOOL Import_next(Import *this);  // imports the next batch, FALSE if done or failed
+BOOL Import_ok(Import *this);
+const char *Import_errmsg(Import *this);  // NULL if ok
+int64_t Import_rows(Import *this);   // rows committed
+int64_t Import_bytes(Import *this);  // bytes of the file that have been committed
+int64_t Import_nanos(Import *this);  // time since newImport
+
+//
+// Test
+//
+
+void testImport();
+
+#endif  // IMPORT_H
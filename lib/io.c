@@ -3,30 +3,153 @@
 
 #define MAX_LEN 0x7FFFFFFF
 
-void _readStdin(char *buf, size_t len) {
+void _readFd(int fd, char *buf, size_t len) {
     size_t c = 0;
     while(c < len) {
-        size_t n = read(STDIN_FILENO, buf+c, len-c);
+        size_t n = read(fd, buf+c, len-c);
         if (n<=0) {
-            ASSERT_FAIL("_readStdin: n=%zd", n);
+            ASSERT_FAIL("_readFd: n=%zd", n);
         }
         c += n;
     }
     ASSERT(c == len);
 }
 
-void _writeStdout(char *buf, size_t len) {
+void _writeFd(int fd, const char *buf, size_t len) {
     size_t c = 0;
     while(c < len) {
-        size_t n = write(STDOUT_FILENO, buf+c, len-c);
+        size_t n = write(fd, buf+c, len-c);
         if (n<=0) {
-            ASSERT_FAIL("_writeStdout: n=%zd", n);
+            ASSERT_FAIL("_writeFd: n=%zd", n);
         }
         c += n;
     }
     ASSERT(c == len);
 }
 
+#ifdef _WIN32
+  // no writev, write the parts one by one
+  struct iovec {
+      void *iov_base;
+      size_t iov_len;
+  };
+
+  static void _writevFd(int fd, struct iovec *iov, int iovcnt) {
+      for (int i = 0; i < iovcnt; i++) {
+          _writeFd(fd, (const char *)iov[i].iov_base, iov[i].iov_len);
+      }
+  }
+#else
+  static void _writevFd(int fd, struct iovec *iov, int iovcnt) {
+      while (iovcnt > 0) {
+          ssize_t n = writev(fd, iov, iovcnt);
+          if (n <= 0) {
+              ASSERT_FAIL("_writevFd: n=%zd", n);
+          }
+          // skip what has been written, continue with a partially written part
+          while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+              n -= iov->iov_len;
+              iov++;
+              iovcnt--;
+          }
+          if (iovcnt > 0) {
+              iov->iov_base = (char *)iov->iov_base + n;
+              iov->iov_len -= n;
+          }
+      }
+  }
+#endif
+
+// Capacity
+
+#define IO_INIT_CAP (64*1024)  // default initial buffer capacity
+#define IO_SHRINK_FRAMES 100   // shrink after that many frames in a row ...
+#define IO_SHRINK_RATIO 4      // ... that used less than 1/4 of the capacity
+
+/* A Capacity manages the size of an owned buffer: It grows on demand up to
+   max, and shrinks back towards init after a spike, when IO_SHRINK_FRAMES
+   frames in a row have used only a small part of it. */
+typedef struct capacity_s {
+    size_t init;
+    size_t max;
+    size_t cap;         // current capacity
+    size_t highWater;   // largest frame so far
+    size_t windowMax;   // largest frame since the buffer became idle
+    int idleFrames;
+    int64_t ngrows;
+    int64_t nshrinks;
+} Capacity;
+
+static void _capInit(Capacity *c, size_t init, size_t max) {
+    memset(c, 0, sizeof(Capacity));
+    c->init = init;
+    c->max = max;
+}
+
+/* _capGrow makes room for need bytes and returns the (re)allocated buffer,
+   or NULL if need exceeds the max. capacity. */
+static char *_capGrow(Capacity *c, char *buf, size_t need) {
+    if (need <= c->cap) {
+        return buf;
+    }
+    if (need > c->max) {
+        LOG_INFO2("_capGrow: %zu bytes exceed max. capacity %zu", need, c->max);
+        return NULL;
+    }
+    size_t newCap = c->cap ? c->cap : c->init;
+    while (newCap < need) {
+        newCap = 2 * newCap;
+    }
+    if (newCap > c->max) {
+        newCap = c->max;
+    }
+    LOG_DEBUG2("_capGrow: %zu -> %zu bytes", c->cap, newCap);
+    buf = buf ? memRealloc(buf, newCap) : memAlloc(newCap, __FILE__, __LINE__);
+    c->cap = newCap;
+    c->ngrows++;
+    return buf;
+}
+
+/* _capFrame records a frame of len bytes and shrinks the buffer if it
+   has been idle long enough. The buffer content is not preserved. */
+static char *_capFrame(Capacity *c, char *buf, size_t len) {
+    if (len > c->highWater) {
+        c->highWater = len;
+    }
+    if (c->cap <= c->init || len > c->cap / IO_SHRINK_RATIO) {
+        c->idleFrames = 0;
+        c->windowMax = 0;
+        return buf;
+    }
+    if (len > c->windowMax) {
+        c->windowMax = len;
+    }
+    if (++c->idleFrames < IO_SHRINK_FRAMES) {
+        return buf;
+    }
+    // keep twice the largest recent frame
+    size_t newCap = c->init;
+    while (newCap < 2 * c->windowMax) {
+        newCap = 2 * newCap;
+    }
+    c->idleFrames = 0;
+    c->windowMax = 0;
+    if (newCap < c->cap) {
+        LOG_DEBUG2("_capFrame: shrink %zu -> %zu bytes", c->cap, newCap);
+        memFree(buf);
+        buf = memAlloc(newCap, __FILE__, __LINE__);
+        c->cap = newCap;
+        c->nshrinks++;
+    }
+    return buf;
+}
+
+static void _capPrint(Capacity *c, const char *name) {
+    LOG_INFO4("%s: capacity %zu bytes, high water %zu bytes, %" PRId64 " grows",
+        name, c->cap, c->highWater, c->ngrows);
+    LOG_INFO2("%s: %" PRId64 " shrinks", name, c->nshrinks);
+}
+
 // class Reader
 
 struct reader_s {
@@ -35,25 +158,88 @@ struct reader_s {
     char* buf;
     size_t bufsz;
     size_t rp; // read pointer
+    int fd; // std only
+    Capacity cap; // std only
+    size_t rejected; // length of the current frame if it was too large, else 0
+    int64_t nframes;
+    int64_t nbytes;
+    int64_t nrejected;
+    int64_t nanos; // time spent reading frame payloads
+    Trace *trace; // or NULL
+    FILE *record; // or NULL, std only
+    int64_t nrecorded;
 };
 
 Reader *newStdinReader(){
+    return newFdReader(STDIN_FILENO);
+}
+
+Reader *newFdReader(int fd){
     Reader* this = (Reader*)memAlloc(sizeof(Reader), __FILE__, __LINE__);
     this->std = TRUE;
+    this->fd = fd;
     this->buf = NULL;
     this->bufsz = 0;
     this->rp = 0;
+    _capInit(&this->cap, IO_INIT_CAP, MAX_LEN);
+    this->rejected = 0;
+    this->nframes = 0;
+    this->nbytes = 0;
+    this->nrejected = 0;
+    this->nanos = 0;
+    this->trace = NULL;
+    this->record = NULL;
+    this->nrecorded = 0;
     return this;
 }
 
+/* Reader_setCapacity sets initial and max. capacity of a fd Reader's buffer. */
+void Reader_setCapacity(Reader* this, size_t init, size_t max) {
+    ASSERT(this->std);
+    ASSERT(init > 0 && init <= max && max <= MAX_LEN);
+    this->cap.init = init;
+    this->cap.max = max;
+}
+
+void Reader_print(Reader* this) {
+    if (this->std) {
+        _capPrint(&this->cap, "reader");
+    }
+}
+
+static void _capStats(Capacity *c, Stats *stats, const char *name) {
+    Stats_addf(stats, c->cap, "%s.capacity", name);
+    Stats_addf(stats, c->highWater, "%s.highWater", name);
+    Stats_addf(stats, c->ngrows, "%s.grows", name);
+    Stats_addf(stats, c->nshrinks, "%s.shrinks", name);
+}
+
+void Reader_stats(Reader* this, Stats *stats) {
+    Stats_add(stats, "reader.frames", this->nframes);
+    Stats_add(stats, "reader.bytes", this->nbytes);
+    Stats_add(stats, "reader.rejected", this->nrejected);
+    if (this->std) {
+        _capStats(&this->cap, stats, "reader");
+    }
+}
+
 Reader *newMemReader(char *buf, size_t bufsz) {
     ASSERT(buf);
     ASSERT(bufsz);
     Reader* this = (Reader*)memAlloc(sizeof(Reader), __FILE__, __LINE__);
     this->std = FALSE;
+    this->fd = -1;
     this->buf = buf;
     this->bufsz = bufsz;
     this->rp = 0;
+    this->rejected = 0;
+    this->nframes = 0;
+    this->nbytes = 0;
+    this->nrejected = 0;
+    this->nanos = 0;
+    this->trace = NULL;
+    this->record = NULL;
+    this->nrecorded = 0;
     return this;
 }
 
@@ -61,29 +247,92 @@ void Reader_free(Reader* this) {
     if(this->std && this->buf) {
         memFree(this->buf);
     }
+    if (this->record) {
+        LOG_INFO1("record: %" PRId64 " frames recorded", this->nrecorded);
+        fclose(this->record);
+    }
     memFree(this);
 }
 
+/* Reader_record writes each frame that is read, with its arrival time, to
+   a file, see RECORD_MAGIC. Rejected frames are not recorded. */
+BOOL Reader_record(Reader* this, const char *filename) {
+    ASSERT(this->std);
+    ASSERT(!this->record);
+    this->record = fopen(filename, "wb");
+    if (!this->record) {
+        LOG_INFO1("record: cannot create '%s'", filename);
+        return FALSE;
+    }
+    fwrite(RECORD_MAGIC, 1, 8, this->record);
+    return TRUE;
+}
+
+static void _recordFrame(Reader* this, int64_t nanos, const char *data, size_t len) {
+    char tmp[12];
+    for (int i = 0; i < 8; i++) {
+        tmp[i] = (char)(nanos >> (56 - 8 * i));
+    }
+    tmp[8] = (char)(len >> 24);
+    tmp[9] = (char)(len >> 16);
+    tmp[10] = (char)(len >> 8);
+    tmp[11] = (char)(len);
+    fwrite(tmp, 1, 12, this->record);
+    fwrite(data, 1, len, this->record);
+    this->nrecorded++;
+}
+
+/* Reader_offset returns the read position in a mem Reader's buffer. */
+size_t Reader_offset(Reader* this) {
+    ASSERT(!this->std);
+    return this->rp;
+}
+
 void _readNextFrameIfNeeded(Reader* this) {
     ASSERT(this->std);
     ASSERT(this->rp <= this->bufsz);
     if(this->rp == this->bufsz) {
         char tmp[4];
-        _readStdin(tmp, 4);
+        _readFd(this->fd, tmp, 4);
         size_t len0 = (size_t)(unsigned char)tmp[0] << 24;
         size_t len1 = (size_t)(unsigned char)tmp[1] << 16;
         size_t len2 = (size_t)(unsigned char)tmp[2] <<  8;
         size_t len3 = (size_t)(unsigned char)tmp[3] <<  0;
         size_t len = len0 + len1 + len2 + len3;
         ASSERT(1 <= len && len <= MAX_LEN);
-        if (this->buf) {
-            this->buf = memRealloc(this->buf, len);
-        } else {
-            this->buf = memAlloc(len, __FILE__, __LINE__);
+        this->nframes++;
+        this->nbytes += 4 + len;
+        this->rp = 0;
+        this->rejected = 0;
+        if (this->trace) {
+            Trace_event(this->trace, TR_READ, 4 + len, 0);
         }
-        _readStdin(this->buf, len);
+        int64_t start = nanotime();
+        if (len > this->cap.max) {
+            // too large: keep the function code, so that the caller can send an error response, and skip the rest
+            LOG_INFO2("_readNextFrameIfNeeded: frame of %zu bytes exceeds max. capacity %zu", len, this->cap.max);
+            this->buf = _capGrow(&this->cap, this->buf, 1);
+            _readFd(this->fd, this->buf, 1);
+            char skip[4096];
+            for (size_t n = len - 1; n > 0; ) {
+                size_t chunk = n < sizeof(skip) ? n : sizeof(skip);
+                _readFd(this->fd, skip, chunk);
+                n -= chunk;
+            }
+            this->bufsz = 1;
+            this->rejected = len;
+            this->nrejected++;
+            this->nanos += nanotime() - start;
+            return;
+        }
+        this->buf = _capFrame(&this->cap, this->buf, len);
+        this->buf = _capGrow(&this->cap, this->buf, len);
+        _readFd(this->fd, this->buf, len);
         this->bufsz = len;
-        this->rp = 0;
+        this->nanos += nanotime() - start;
+        if (this->record) {
+            _recordFrame(this, start, this->buf, len);
+        }
         if (LOG_CAN_DEBUG) {
             char * hx = hexdump(this->buf, this->bufsz);
             LOG_DEBUG2("_readNextFrameIfNeeded: %d bytes: %s", this->bufsz, hx);
@@ -92,6 +341,54 @@ void _readNextFrameIfNeeded(Reader* this) {
     }
 }
 
+/* Reader_nanos returns the time spent reading frame payloads. The wait
+   for a frame header is not included, it is idle time. */
+int64_t Reader_nanos(Reader* this) {
+    return this->nanos;
+}
+
+/* Reader_setTrace records the size of each frame read in trace. Only a
+   stdin/fd Reader reads frames. */
+void Reader_setTrace(Reader* this, Trace *trace) {
+    this->trace = trace;
+}
+
+/* Reader_rejected returns the length of the current frame if it exceeded
+   the max. capacity. Only its first byte (the function code) can be read. */
+size_t Reader_rejected(Reader* this) {
+    return this->rejected;
+}
+
+/* Reader_remaining returns the number of bytes of the current frame that
+   have not been read yet. For a mem Reader, the rest of its buffer. */
+size_t Reader_remaining(Reader* this) {
+    return this->bufsz - this->rp;
+}
+
+/* Reader_skipFrame skips the rest of the current frame, e.g. after an
+   invalid request. A mem Reader has no frames, it is not changed. */
+void Reader_skipFrame(Reader* this) {
+    if (this->std) {
+        this->rp = this->bufsz;
+    }
+}
+
+/* Reader_hasInput reports whether the next read will not block, waiting at most millis. */
+BOOL Reader_hasInput(Reader* this, int millis) {
+    if (this->rp < this->bufsz) {
+        return TRUE;
+    }
+    return this->std && fdReadable(this->fd, millis);
+}
+
+char Reader_peekByte(Reader* this) {
+    if(this->std) {
+        _readNextFrameIfNeeded(this);
+    }
+    ASSERT(this->bufsz - this->rp >= 1);
+    return this->buf[this->rp];
+}
+
 char Reader_readByte(Reader* this) {
     if(this->std) {
         _readNextFrameIfNeeded(this);
@@ -173,11 +470,37 @@ const char* Reader_readBlob(Reader* this, size_t *plen) {
 
 // class Writer
 
+#define WRITER_MAX_REFS 64  // max. number of zero-copy values per frame
+
+/* A WriterRef is a value that is sent from the caller's memory, without
+   copying it into the buffer. It goes out at offset off of the buffer. */
+typedef struct writer_ref_s {
+    size_t off;
+    const char *data;
+    size_t len;
+} WriterRef;
+
 struct writer_s {
     BOOL std;
+    BOOL grow; // TRUE if buf is owned and grows on demand
+    int fd;    // if std
     char* buf;
     size_t bufsz;
     size_t wp; // write pointer
+    Capacity cap; // if grow
+    // zero-copy values, std only
+    size_t refThreshold;  // min. length of a zero-copy value, 0 is off
+    WriterRef refs[WRITER_MAX_REFS];
+    int nrefs;
+    size_t refBytes;      // total length of refs
+    int64_t nrefsSent;
+    int64_t refBytesSent;
+    int64_t nframes;
+    int64_t nbytes;
+    BOOL full;            // a write exceeded the max. capacity, see Writer_full
+    int64_t noverflows;
+    int64_t nanos;        // time spent writing frames
+    Trace *trace;         // or NULL
 };
 
 void _validateWriter(Writer *this) {
@@ -188,10 +511,18 @@ void _validateWriter(Writer *this) {
 }
 
 Writer *newStdoutWriter() {
+    return newFdWriter(STDOUT_FILENO);
+}
+
+Writer *newFdWriter(int fd) {
     Writer *this = (Writer *)memAlloc(sizeof(Writer), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Writer));
     this->std = TRUE;
-    this->bufsz = 1024*1024;
-    this->buf = memAlloc(this->bufsz, __FILE__, __LINE__);
+    this->fd = fd;
+    this->grow = TRUE;
+    _capInit(&this->cap, IO_INIT_CAP, MAX_LEN);
+    this->buf = _capGrow(&this->cap, NULL, IO_INIT_CAP);
+    this->bufsz = this->cap.cap;
     this->wp = 0;
     _validateWriter(this);
     return this;
@@ -199,7 +530,9 @@ Writer *newStdoutWriter() {
 
 Writer *newMemWriter(char *buf, size_t bufsz) {
     Writer *this = (Writer *)memAlloc(sizeof(Writer), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Writer));
     this->std = FALSE;
+    this->grow = FALSE;
     this->buf = buf;
     this->bufsz = bufsz;
     this->wp = 0;
@@ -207,51 +540,203 @@ Writer *newMemWriter(char *buf, size_t bufsz) {
     return this;
 }
 
+Writer *newBufWriter(size_t bufsz) {
+    Writer *this = (Writer *)memAlloc(sizeof(Writer), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Writer));
+    this->std = FALSE;
+    this->grow = TRUE;
+    _capInit(&this->cap, bufsz, MAX_LEN);
+    this->buf = _capGrow(&this->cap, NULL, bufsz);
+    this->bufsz = this->cap.cap;
+    this->wp = 0;
+    _validateWriter(this);
+    return this;
+}
+
 void Writer_free(Writer* this) {
     _validateWriter(this);
-    if (this->std) {
+    if (this->grow) {
         memFree(this->buf);
     }
     memFree(this);
 }
 
-static void _growWriter(Writer* this, size_t minSize) {
-    if (this->bufsz < minSize) {
-        size_t newSize = this->bufsz;
-        while( newSize < minSize ) {
-            newSize = 2 * newSize;
-        }
-        LOG_DEBUG1("_growWriter: newSize %ld ", newSize);
-        if (newSize > MAX_LEN) {
-            ASSERT_FAIL("_growWriter: newSize %zd > MAX_LEN", newSize)
-        }   
-        this->buf = memRealloc(this->buf, newSize);
-        this->bufsz = newSize;
-    }    
+/* Writer_setTrace records the size of each frame written in trace. Only
+   a stdout/fd Writer writes frames. */
+void Writer_setTrace(Writer* this, Trace *trace) {
+    this->trace = trace;
 }
 
+/* Writer_setCapacity sets initial and max. capacity of a growing Writer's buffer. */
+void Writer_setCapacity(Writer* this, size_t init, size_t max) {
+    _validateWriter(this);
+    ASSERT(this->grow);
+    ASSERT(init > 0 && init <= max && max <= MAX_LEN);
+    this->cap.init = init;
+    this->cap.max = max;
+    if (this->wp == 0 && this->cap.cap != init) {
+        memFree(this->buf);
+        this->buf = memAlloc(init, __FILE__, __LINE__);
+        this->cap.cap = init;
+        this->bufsz = init;
+    }
+}
+
+/* Writer_setZeroCopy lets blobs and strings of at least threshold bytes
+   be sent from the caller's memory, see Writer_writeBlobRef. Zero turns
+   zero-copy off. Only a stdout/fd Writer supports zero-copy. */
+void Writer_setZeroCopy(Writer* this, size_t threshold) {
+    _validateWriter(this);
+    ASSERT(this->nrefs == 0);
+    this->refThreshold = this->std ? threshold : 0;
+}
+
+/* Writer_zeroCopy returns the min. length of a zero-copy value, 0 if
+   zero-copy is off. */
+size_t Writer_zeroCopy(Writer* this) {
+    return this->refThreshold;
+}
+
+void Writer_print(Writer* this) {
+    if (this->grow) {
+        _capPrint(&this->cap, this->std ? "writer" : "buffer");
+    }
+    if (this->nrefsSent) {
+        LOG_INFO2("writer: %" PRId64 " zero-copy values, %" PRId64 " bytes", this->nrefsSent, this->refBytesSent);
+    }
+}
+
+void Writer_stats(Writer* this, Stats *stats) {
+    Stats_add(stats, "writer.frames", this->nframes);
+    Stats_add(stats, "writer.bytes", this->nbytes);
+    if (this->grow) {
+        _capStats(&this->cap, stats, "writer");
+    }
+    Stats_add(stats, "writer.zeroCopyValues", this->nrefsSent);
+    Stats_add(stats, "writer.zeroCopyBytes", this->refBytesSent);
+    Stats_add(stats, "writer.overflows", this->noverflows);
+}
+
+/* Writer_nanos returns the time spent writing frames. */
+int64_t Writer_nanos(Writer* this) {
+    return this->nanos;
+}
+
+/* Writer_maxCapacity returns the max. capacity of a growing Writer. */
+size_t Writer_maxCapacity(Writer* this) {
+    return this->grow ? this->cap.max : this->bufsz;
+}
+
+/* Writer_full reports whether a write exceeded the max. capacity. A full
+   Writer drops all writes until it is rewound, see Writer_rewind. */
+BOOL Writer_full(Writer* this) {
+    return this->full;
+}
+
+/* Writer_mark returns the current write position, see Writer_rewind. */
+size_t Writer_mark(Writer* this) {
+    return this->wp;
+}
+
+/* Writer_rewind drops everything that was written after mark. */
+void Writer_rewind(Writer* this, size_t mark) {
+    _validateWriter(this);
+    ASSERT(mark <= this->wp);
+    while (this->nrefs && this->refs[this->nrefs - 1].off > mark) {
+        this->nrefs--;
+        this->refBytes -= this->refs[this->nrefs].len;
+    }
+    this->wp = mark;
+    this->full = FALSE;
+}
+
+/* _ensure makes room for n more bytes. A growing Writer whose frame would
+   exceed its max. capacity becomes full instead. */
+static BOOL _ensure(Writer* this, size_t n) {
+    if (this->full) {
+        return FALSE;
+    }
+    if (!this->grow || this->bufsz - this->wp >= n) {
+        return TRUE;  // a fixed buffer is checked by the caller
+    }
+    // zero-copy values count towards the frame length
+    char *buf = this->wp + this->refBytes + n > this->cap.max ? NULL : _capGrow(&this->cap, this->buf, this->wp + n);
+    if (!buf) {
+        this->full = TRUE;
+        this->noverflows++;
+        return FALSE;
+    }
+    this->buf = buf;
+    this->bufsz = this->cap.cap;
+    return TRUE;
+}
+
+/* Writer_markFrame marks a point where the response may be split into
+   frames. The frame is flushed if it is large, or if it holds zero-copy
+   values, because their memory is valid only until the caller moves on. */
 void Writer_markFrame(Writer* this) {
     _validateWriter(this);
-    if (this->std && this->wp > 1024*1024) {
+    if (this->std && (this->nrefs || this->wp > 1024*1024)) {
         Writer_flush(this);
     }
 }
 
+static void _flushRefs(Writer* this, char *header) {
+    struct iovec iov[2 * WRITER_MAX_REFS + 2];
+    int n = 0;
+    iov[n].iov_base = header;
+    iov[n++].iov_len = 4;
+    size_t off = 0;
+    for (int i = 0; i < this->nrefs; i++) {
+        WriterRef *ref = &this->refs[i];
+        if (ref->off > off) {
+            iov[n].iov_base = this->buf + off;
+            iov[n++].iov_len = ref->off - off;
+            off = ref->off;
+        }
+        iov[n].iov_base = (void *)ref->data;
+        iov[n++].iov_len = ref->len;
+    }
+    if (this->wp > off) {
+        iov[n].iov_base = this->buf + off;
+        iov[n++].iov_len = this->wp - off;
+    }
+    _writevFd(this->fd, iov, n);
+    this->nrefsSent += this->nrefs;
+    this->refBytesSent += this->refBytes;
+    this->nrefs = 0;
+    this->refBytes = 0;
+}
+
 void Writer_flush(Writer* this) {
     _validateWriter(this);
-    if (this->std && this->wp) {
+    if (this->std && (this->wp || this->nrefs)) {
         if (LOG_CAN_DEBUG) {
             char * hx = hexdump(this->buf, this->wp);
-            LOG_DEBUG2("Writer_flush: %d bytes: %s", this->wp, hx);
+            LOG_DEBUG3("Writer_flush: %d bytes (+%d zero-copy bytes): %s", this->wp, this->refBytes, hx);
             memFree(hx);
         }
+        size_t len = this->wp + this->refBytes;
         char tmp[4];
-        tmp[0] = (char)(this->wp >> 24);
-        tmp[1] = (char)(this->wp >> 16);
-        tmp[2] = (char)(this->wp >> 8);
-        tmp[3] = (char)(this->wp);
-        _writeStdout(tmp, 4);
-        _writeStdout(this->buf, this->wp);
+        tmp[0] = (char)(len >> 24);
+        tmp[1] = (char)(len >> 16);
+        tmp[2] = (char)(len >> 8);
+        tmp[3] = (char)(len);
+        this->nframes++;
+        this->nbytes += 4 + len;
+        if (this->trace) {
+            Trace_event(this->trace, TR_WRITE, 4 + len, 0);
+        }
+        int64_t start = nanotime();
+        if (this->nrefs) {
+            _flushRefs(this, tmp);
+        } else {
+            _writeFd(this->fd, tmp, 4);
+            _writeFd(this->fd, this->buf, this->wp);
+        }
+        this->nanos += nanotime() - start;
+        this->buf = _capFrame(&this->cap, this->buf, this->wp);
+        this->bufsz = this->cap.cap;
         this->wp = 0;
     }
 }
@@ -259,8 +744,8 @@ void Writer_flush(Writer* this) {
 
 void Writer_writeByte(Writer* this, char value) {
     _validateWriter(this);
-    if (this->std) {
-        _growWriter(this, this->wp + 1);
+    if (!_ensure(this, 1)) {
+        return;
     }
     ASSERT(this->bufsz - this->wp >= 1);
     this->buf[this->wp] = value;
@@ -269,8 +754,8 @@ void Writer_writeByte(Writer* this, char value) {
 
 void Writer_writeInt32(Writer* this, int value) {
     _validateWriter(this);
-    if (this->std) {
-        _growWriter(this, this->wp + 4);
+    if (!_ensure(this, 4)) {
+        return;
     }
     ASSERT(this->bufsz - this->wp >= 4);
     this->buf[this->wp + 0] = (char)(value >> 24);
@@ -282,8 +767,8 @@ void Writer_writeInt32(Writer* this, int value) {
 
 void Writer_writeInt64(Writer* this, int64_t value) {
     _validateWriter(this);
-    if (this->std) {
-        _growWriter(this, this->wp + 8);
+    if (!_ensure(this, 8)) {
+        return;
     }
     ASSERTF(this->bufsz - this->wp >= 8, "this->bufsz %zd - this->wp %zd = %zd", this->bufsz, this->wp, this->bufsz - this->wp);
     this->buf[this->wp + 0] = (char)(value >> 56);
@@ -299,8 +784,8 @@ void Writer_writeInt64(Writer* this, int64_t value) {
 
 void Writer_writeDouble(Writer* this, double value) {
     _validateWriter(this);
-    if (this->std) {
-        _growWriter(this, this->wp + 8);
+    if (!_ensure(this, 8)) {
+        return;
     }
     ASSERT(this->bufsz - this->wp >= 8);
     char* p = (char*)(&value);
@@ -325,8 +810,8 @@ void Writer_writeBlob(Writer* this, const char* data, size_t len) {
     ASSERT(data);
     ASSERT(len < MAX_LEN);
     _validateWriter(this);
-    if (this->std) {
-        _growWriter(this, this->wp + 4 + len);
+    if (!_ensure(this, 4 + len)) {
+        return;
     }
     Writer_writeInt32(this, (int)len);
     ASSERT(this->bufsz - this->wp >= len);
@@ -334,6 +819,56 @@ void Writer_writeBlob(Writer* this, const char* data, size_t len) {
     this->wp += len;
 }
 
+/* Writer_writeBlobRef writes a blob like Writer_writeBlob, but a large
+   blob is not copied: it is sent from data when the frame is flushed, so
+   data must stay valid until the next Writer_markFrame or Writer_flush. */
+void Writer_writeBlobRef(Writer* this, const char* data, size_t len) {
+    if (!this->refThreshold || len < this->refThreshold || this->nrefs == WRITER_MAX_REFS
+            || this->wp + this->refBytes + 4 + len > this->cap.max) {
+        Writer_writeBlob(this, data, len);
+        return;
+    }
+    Writer_writeInt32(this, (int)len);
+    if (this->full) {
+        return;
+    }
+    WriterRef *ref = &this->refs[this->nrefs++];
+    ref->off = this->wp;
+    ref->data = data;
+    ref->len = len;
+    this->refBytes += len;
+}
+
+void Writer_writeRaw(Writer* this, const char* data, size_t len) {
+    ASSERT(data);
+    _validateWriter(this);
+    if (!_ensure(this, len)) {
+        return;
+    }
+    ASSERT(this->bufsz - this->wp >= len);
+    memcpy(this->buf + this->wp, data, len);
+    this->wp += len;
+}
+
+/* Writer_reserve appends len bytes for the caller to fill in and returns a
+   pointer to them, or NULL if they do not fit, see Writer_full. */
+char *Writer_reserve(Writer* this, size_t len) {
+    _validateWriter(this);
+    if (!_ensure(this, len)) {
+        return NULL;
+    }
+    ASSERT(this->bufsz - this->wp >= len);
+    char *p = this->buf + this->wp;
+    this->wp += len;
+    return p;
+}
+
+const char *Writer_data(Writer* this, size_t *plen) {
+    _validateWriter(this);
+    *plen = this->wp;
+    return this->buf;
+}
+
 //
 // Test
 //
@@ -441,7 +976,164 @@ static void testWriteAndRead() {
     Writer_free(w);
 }
 
+static void testCapacity() {
+    Capacity c;
+    _capInit(&c, 1024, 64 * 1024);
+    char *buf = _capGrow(&c, NULL, 100);
+    ASSERT_INT(1024, c.cap);
+    buf = _capFrame(&c, buf, 100);
+    ASSERT_INT(0, c.idleFrames);  // not above init, nothing to shrink
+    // a spike
+    buf = _capGrow(&c, buf, 40000);
+    ASSERT_INT(64 * 1024, c.cap);
+    buf = _capFrame(&c, buf, 40000);
+    ASSERT_INT(40000, c.highWater);
+    // small frames: shrink after IO_SHRINK_FRAMES
+    for (int i = 1; i < IO_SHRINK_FRAMES; i++) {
+        buf = _capFrame(&c, buf, i % 2 ? 100 : 3000);
+    }
+    ASSERT_INT(64 * 1024, c.cap);
+    ASSERT_INT(IO_SHRINK_FRAMES - 1, c.idleFrames);
+    buf = _capFrame(&c, buf, 100);
+    ASSERT_INT(8 * 1024, c.cap);  // twice the largest recent frame
+    ASSERT_INT64(1, c.nshrinks);
+    // a frame that uses the buffer resets the idle count
+    for (int i = 0; i < IO_SHRINK_FRAMES - 1; i++) {
+        buf = _capFrame(&c, buf, 100);
+    }
+    buf = _capFrame(&c, buf, 4000);
+    ASSERT_INT(0, c.idleFrames);
+    ASSERT_INT(8 * 1024, c.cap);
+    ASSERT_INT64(2, c.ngrows);
+    memFree(buf);
+    // growing writer
+    Writer *w = newBufWriter(16);
+    Writer_setCapacity(w, 32, 1024);
+    for (int i = 0; i < 100; i++) {
+        Writer_writeInt32(w, i);
+    }
+    size_t len;
+    const char *data = Writer_data(w, &len);
+    ASSERT_INT(400, len);
+    ASSERT_INT(99, data[399]);
+    Writer_free(w);
+}
+
+static void testWriterFull() {
+    Writer *wr = newBufWriter(16);
+    Writer_setCapacity(wr, 16, 64);
+    ASSERT_INT(64, Writer_maxCapacity(wr));
+    Writer_writeInt32(wr, 1);
+    size_t mark = Writer_mark(wr);
+    ASSERT_INT(4, mark);
+    char big[100];
+    memset(big, 'x', sizeof(big));
+    Writer_writeBlob(wr, big, 50);
+    ASSERT(!Writer_full(wr));
+    // exceeds max. capacity: dropped, and so are all writes until rewind
+    Writer_writeBlob(wr, big, 50);
+    ASSERT(Writer_full(wr));
+    Writer_writeByte(wr, 2);
+    size_t len;
+    Writer_data(wr, &len);
+    ASSERT_INT(4 + 4 + 50, len);
+    Writer_rewind(wr, mark);
+    ASSERT(!Writer_full(wr));
+    Writer_writeByte(wr, 3);
+    const char *data = Writer_data(wr, &len);
+    ASSERT_INT(5, len);
+    ASSERT_INT(3, data[4]);
+    ASSERT_INT64(1, wr->noverflows);
+    Writer_free(wr);
+    // zero-copy values count towards the max. capacity, rewind drops them
+    wr = newFdWriter(STDOUT_FILENO);
+    Writer_setCapacity(wr, 64, 256);
+    Writer_setZeroCopy(wr, 16);
+    Writer_writeBlobRef(wr, big, 100);
+    mark = Writer_mark(wr);
+    Writer_writeBlobRef(wr, big, 100);
+    ASSERT_INT(2, wr->nrefs);
+    Writer_writeBlobRef(wr, big, 100);
+    ASSERT(Writer_full(wr));
+    ASSERT_INT(2, wr->nrefs);
+    Writer_rewind(wr, mark);
+    ASSERT_INT(1, wr->nrefs);
+    ASSERT_INT(100, wr->refBytes);
+    Writer_rewind(wr, 0);
+    ASSERT_INT(0, wr->nrefs);
+    Writer_free(wr);
+}
+
+static void testZeroCopy() {
+    int fds[2];
+#ifdef _WIN32
+    ASSERT(_pipe(fds, 4096, 0x8000) == 0);  // _O_BINARY
+#else
+    ASSERT(pipe(fds) == 0);
+#endif
+    char big[100];
+    memset(big, 'x', sizeof(big));
+    Writer *w = newFdWriter(fds[1]);
+    Writer_setZeroCopy(w, 16);
+    Writer_writeByte(w, 1);
+    Writer_writeBlobRef(w, big, sizeof(big));  // not copied
+    Writer_writeBlobRef(w, "Alice", 6);        // too small, copied
+    Writer_writeByte(w, 2);
+    big[0] = 'y';  // the value is sent as it is when flushed
+    Writer_markFrame(w);
+    // read the frame
+    char buf[256];
+    int len = 4 + 1 + 4 + 100 + 4 + 6 + 1;
+    ASSERT_INT(len, read(fds[0], buf, sizeof(buf)));
+    Reader *r = newMemReader(buf, len);
+    ASSERT_INT(len - 4, Reader_readInt32(r));
+    ASSERT_INT(1, Reader_readByte(r));
+    size_t bloblen;
+    const char *blob = Reader_readBlob(r, &bloblen);
+    ASSERT_INT(100, bloblen);
+    ASSERT(blob[0] == 'y' && blob[99] == 'x');
+    ASSERT_STR("Alice", Reader_readString(r));
+    ASSERT_INT(2, Reader_readByte(r));
+    Reader_free(r);
+    Writer_free(w);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void testSkipFrame() {
+    int fds[2];
+#ifdef _WIN32
+    ASSERT(_pipe(fds, 4096, 0x8000) == 0);  // _O_BINARY
+#else
+    ASSERT(pipe(fds) == 0);
+#endif
+    Writer *w = newFdWriter(fds[1]);
+    Writer_writeInt32(w, 1);
+    Writer_writeInt32(w, 2);
+    Writer_flush(w);
+    Writer_writeByte(w, 3);
+    Writer_flush(w);
+    Reader *r = newFdReader(fds[0]);
+    ASSERT_INT(1, Reader_readInt32(r));
+    ASSERT_INT(4, Reader_remaining(r));
+    Reader_skipFrame(r);
+    ASSERT_INT(0, Reader_remaining(r));
+    ASSERT_INT(3, Reader_readByte(r));  // the next frame
+    Reader_free(r);
+    Writer_free(w);
+    close(fds[0]);
+    close(fds[1]);
+}
+
 void testIo() {
     LOG_INFO0("testIo testWriteAndRead");
     testWriteAndRead();
+    LOG_INFO0("testIo testCapacity");
+    testCapacity();
+    LOG_INFO0("testIo testWriterFull");
+    testWriterFull();
+    LOG_INFO0("testIo testZeroCopy");
+    testZeroCopy();
+    LOG_INFO0("testIo testSkipFrame");
+    testSkipFrame();
 }
@@ -1,10 +1,28 @@
 #ifndef IO_H
 #define IO_H
 
+/* A recording (see Reader_record) starts with RECORD_MAGIC, followed by
+   one entry per frame: arrival time in nanos (8 bytes), payload length
+   (4 bytes), both big-endian, and the payload. */
+#define RECORD_MAGIC "SQREC001"
+
 typedef struct reader_s Reader;
 Reader *newStdinReader();
+Reader *newFdReader(int fd);
 Reader *newMemReader(char *buf, size_t bufsz);
 void Reader_free(Reader* this);
+void Reader_setCapacity(Reader* this, size_t init, size_t max);
+void Reader_print(Reader* this);
+void Reader_stats(Reader* this, Stats *stats);
+int64_t Reader_nanos(Reader* this);
+void Reader_setTrace(Reader* this, Trace *trace);
+BOOL Reader_record(Reader* this, const char *filename);
+size_t Reader_offset(Reader* this);
+size_t Reader_rejected(Reader* this);
+size_t Reader_remaining(Reader* this);
+void Reader_skipFrame(Reader* this);
+BOOL Reader_hasInput(Reader* this, int millis);
+char Reader_peekByte(Reader* this);
 char Reader_readByte(Reader* this);
 int Reader_readInt32(Reader* this);
 int64_t Reader_readInt64(Reader* this);
@@ -14,8 +32,21 @@ const char* Reader_readBlob(Reader* this, size_t *plen);
 
 typedef struct writer_s Writer;
 Writer *newStdoutWriter();
+Writer *newFdWriter(int fd);
 Writer *newMemWriter(char *buf, size_t bufsz);
+Writer *newBufWriter(size_t bufsz);
 void Writer_free(Writer* this);
+void Writer_setCapacity(Writer* this, size_t init, size_t max);
+void Writer_setZeroCopy(Writer* this, size_t threshold);
+size_t Writer_zeroCopy(Writer* this);
+void Writer_print(Writer* this);
+void Writer_stats(Writer* this, Stats *stats);
+int64_t Writer_nanos(Writer* this);
+void Writer_setTrace(Writer* this, Trace *trace);
+size_t Writer_maxCapacity(Writer* this);
+BOOL Writer_full(Writer* this);
+size_t Writer_mark(Writer* this);
+void Writer_rewind(Writer* this, size_t mark);
 void Writer_markFrame(Writer* this);
 void Writer_flush(Writer* this);
 void Writer_writeByte(Writer* this, char value);
@@ -24,6 +55,10 @@ void Writer_writeInt64(Writer* this, int64_t value);
 void Writer_writeDouble(Writer* this, double value);
 void Writer_writeString(Writer* this, const char* str);
 void Writer_writeBlob(Writer* this, const char* data, size_t len);
+void Writer_writeBlobRef(Writer* this, const char* data, size_t len);
+void Writer_writeRaw(Writer* this, const char* data, size_t len);
+char *Writer_reserve(Writer* this, size_t len);
+const char *Writer_data(Writer* this, size_t *plen);
 
 void testIo();
 
@@ -2,11 +2,17 @@
 #include "io.h"
 #include "db.h"
 #include "app.h"
+#include "import.h"
+#include "bench.h"
 #include "sqlite3.h"
 
 #define SQINN_NAME "sqinn"
 #define SQINN_VERSION "2.0.4"
 
+#define MEM_DUMP_SITES 20  // number of call sites in a memory dump
+
+#define TRACE_CAPACITY (64*1024)  // number of events in the trace ring buffer
+
 BOOL hasCommand(int argc, char const *argv[], const char *name) {
     if ( argc >= 2 ) {
         if (strcmp(argv[1], name) == 0) {
@@ -37,6 +43,15 @@ void getOption(int argc, char const *argv[], const char *name, char *value, size
     value[n-1] = 0;
 }
 
+int64_t getIntOption(int argc, char const *argv[], const char *name, int64_t defaultValue) {
+    char value[32];
+    getOption(argc, argv, name, value, sizeof(value), "");
+    if (!value[0]) {
+        return defaultValue;
+    }
+    return strtoll(value, NULL, 10);
+}
+
 Log* makeLog(int argc, char const *argv[]) {
     // -loglevel <level>
     int level = LOG_LEVEL_OFF;
@@ -54,12 +69,103 @@ Log* makeLog(int argc, char const *argv[]) {
     return newLog(level, logfile, stdErr);
 }
 
+BOOL configMemory(int argc, char const *argv[]) {
+    // -sqlitemem <allocator>
+    char allocator[16] = {0};
+    getOption(argc, argv, "-sqlitemem", allocator, sizeof(allocator), "system");
+    int mode = DB_MEM_SYSTEM;
+    if (strcmp(allocator, "pool") == 0) {
+        mode = DB_MEM_POOL;
+    } else if (strcmp(allocator, "heap") == 0) {
+        mode = DB_MEM_HEAP;
+    } else if (strcmp(allocator, "system") != 0) {
+        LOG_INFO1("unknown allocator '%s', using system", allocator);
+    }
+    // -sqliteheap <bytes>
+    size_t heapSize = (size_t)getIntOption(argc, argv, "-sqliteheap", 64 * 1024 * 1024);
+    if (mode != DB_MEM_SYSTEM && !Db_configMemory(mode, heapSize)) {
+        return FALSE;
+    }
+    // -pagecache <pages>, -pagesize <bytes>
+    int npages = (int)getIntOption(argc, argv, "-pagecache", 0);
+    int pageSize = (int)getIntOption(argc, argv, "-pagesize", 4096);
+    if (npages > 0 && pageSize > 0 && !Db_configPageCache(pageSize, npages)) {
+        return FALSE;
+    }
+    // sqlite3_config works only before SQLite is initialized, which
+    // registering a VFS and setting heap limits do, so they come last
+    // -mmap <bytes>
+    if (getIntOption(argc, argv, "-mmap", 0) > 0 && !Db_configCountingVfs()) {
+        return FALSE;
+    }
+    // -softheap <bytes>, -hardheap <bytes>
+    int64_t softHeap = getIntOption(argc, argv, "-softheap", 0);
+    int64_t hardHeap = getIntOption(argc, argv, "-hardheap", 0);
+    if ((softHeap > 0 || hardHeap > 0) && !Db_configHeapLimits(softHeap > 0 ? softHeap : 0, hardHeap > 0 ? hardHeap : 0)) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
 Db* makeDb(int argc, char const *argv[]) {
     // -db <dbname>
     char dbname[256] = {0};
     getOption(argc, argv, "-db", dbname, sizeof(dbname), ":memory:");
     // new Db
-    return newDb(dbname, FALSE);
+    Db *db = newDb(dbname, FALSE);
+    // -lookaside <slots>, -lookasidesize <bytes>
+    int lookasideSlots = (int)getIntOption(argc, argv, "-lookaside", 0);
+    int lookasideSize = (int)getIntOption(argc, argv, "-lookasidesize", 1200);
+    if (lookasideSlots > 0 && lookasideSize > 0) {
+        Db_setLookaside(db, lookasideSize, lookasideSlots);
+    }
+    // -mmap <bytes>
+    int64_t mmapSize = getIntOption(argc, argv, "-mmap", 0);
+    if (mmapSize > 0) {
+        Db_setMmapSize(db, mmapSize);
+    }
+    // -cachesize <pages>
+    int cachePages = (int)getIntOption(argc, argv, "-cachesize", 0);
+    if (cachePages != 0) {
+        Db_setCacheSize(db, cachePages);
+    }
+    // -stmtcache <n>
+    int stmtCacheSize = (int)getIntOption(argc, argv, "-stmtcache", -1);
+    if (stmtCacheSize >= 0) {
+        Db_setStmtCacheSize(db, stmtCacheSize);
+    }
+    // -stmtstats <n>
+    int maxStmtStats = (int)getIntOption(argc, argv, "-stmtstats", 0);
+    if (maxStmtStats > 0) {
+        Db_setStmtStats(db, maxStmtStats);
+    }
+    // -slowms <millis>
+    int slowMillis = (int)getIntOption(argc, argv, "-slowms", 0);
+    if (slowMillis > 0) {
+        Db_setSlowLog(db, slowMillis);
+    }
+    // -checkpoint <pages>, -checkpointms <millis>
+    int walPages = (int)getIntOption(argc, argv, "-checkpoint", 0);
+    int intervalMillis = (int)getIntOption(argc, argv, "-checkpointms", 1000);
+    if (walPages > 0 && intervalMillis > 0) {
+        Db_startCheckpointer(db, walPages, intervalMillis);
+    }
+    // -catalog <file>
+    char catalog[512] = {0};
+    getOption(argc, argv, "-catalog", catalog, sizeof(catalog), "");
+    if (catalog[0]) {
+        Db_loadCatalog(db, catalog);
+    }
+    return db;
+}
+
+void configApp(App *app, int argc, char const *argv[]) {
+    // -groupcommit <n>, -groupwait <millis>
+    int groupMax = (int)getIntOption(argc, argv, "-groupcommit", 0);
+    int groupWait = (int)getIntOption(argc, argv, "-groupwait", 0);
+    App_setGroupCommit(app, groupMax, groupWait);
+    // -timing
+    App_setTiming(app, hasOption(argc, argv, "-timing"));
 }
 
 void help() {
@@ -71,7 +177,17 @@ void help() {
     printf("The commands are:\n");
     printf("\n");
     printf("    run               Read requests from stdin and write responses to stdout.\n");
+    printf("                      Send SIGUSR1 to log the call sites with the most live\n");
+    printf("                      memory, which happens after the next request.\n");
     printf("    test              Execute selftest and exit.\n");
+    printf("    bench             Run benchmark workloads over the protocol and against\n");
+    printf("                      SQLite directly, print results as JSON and exit.\n");
+    printf("    benchio           Measure the encoding and decoding of values and rows,\n");
+    printf("                      print ns/op and bytes/sec as JSON and exit.\n");
+    printf("    replay            Run the requests recorded with -record against the\n");
+    printf("                      database, print throughput and latency as JSON and exit.\n");
+    printf("    tracejson         Convert the trace file given by -trace to Chrome\n");
+    printf("                      trace-event JSON, print it and exit.\n");
     printf("    version           Print version and exit.\n");
     printf("    sqlite            Print SQLite library version and exit.\n");
     printf("    help              Print help page and exit.\n");
@@ -83,6 +199,75 @@ void help() {
     printf("    -logfile <file>   Log to a file. Default is empty (no file logging).\n");
     printf("                      Note: Logfile is appended and will grow unlimited.\n");
     printf("    -logstderr        Log to stderr. Default is off (no stderr logging).\n");
+    printf("    -checkpoint <pages>\n");
+    printf("                      Run WAL checkpoints in a background thread when the WAL\n");
+    printf("                      has that many pages. Default is 0 (SQLite auto-checkpoint).\n");
+    printf("                      Sets a busy timeout of 1000 ms, since checkpoints can\n");
+    printf("                      hold the write lock for a short time.\n");
+    printf("    -checkpointms <millis>\n");
+    printf("                      Background checkpoint interval. Default is 1000.\n");
+    printf("    -stmtcache <n>    Number of prepared statements that are kept for reuse.\n");
+    printf("                      Default is 0 (off). Each reader connection has its own\n");
+    printf("                      cache of the same size.\n");
+    printf("    -stmtstats <n>    Collect statistics for up to n distinct statements and\n");
+    printf("                      make them queryable as table sqinn_stmt_stats. Default\n");
+    printf("                      is 0 (off).\n");
+    printf("    -slowms <millis>  Log statements that take longer than millis, with their\n");
+    printf("                      parameters and query plan. Default is 0 (off).\n");
+    printf("    -catalog <file>   Prepare the statements listed in file at startup. One\n");
+    printf("                      statement per line, '#' starts a comment line, and\n");
+    printf("                      'warmup:' marks a query that is run once at startup.\n");
+    printf("    -groupcommit <n>  Commit up to n pipelined FC_EXEC requests in one\n");
+    printf("                      transaction. Default is 0 (off).\n");
+    printf("    -groupwait <millis>\n");
+    printf("                      How long a group commit waits for more requests, in\n");
+    printf("                      total. Default is 0 (take only requests that are ready).\n");
+    printf("    -sqlitemem <allocator>\n");
+    printf("                      Allocator for SQLite: system, pool (size classes) or\n");
+    printf("                      heap (fixed heap, needs SQLITE_ENABLE_MEMSYS5).\n");
+    printf("                      Default is system.\n");
+    printf("    -sqliteheap <bytes>\n");
+    printf("                      Heap size for '-sqlitemem heap'. Default is 64 MB, at\n");
+    printf("                      most 2147483647 (2 GB - 1).\n");
+    printf("    -softheap <bytes> Soft limit for SQLite's heap. Above it, SQLite frees cache\n");
+    printf("                      pages before it allocates more. Default is 0 (no limit).\n");
+    printf("    -hardheap <bytes> Hard limit for SQLite's heap. A statement that needs more\n");
+    printf("                      fails with 'out of memory'. Default is 0 (no limit).\n");
+    printf("    -pagecache <pages>\n");
+    printf("                      Pre-allocate a page cache of that many pages, shared by\n");
+    printf("                      all connections. Default is 0 (allocate on demand).\n");
+    printf("    -pagesize <bytes> Largest page size for -pagecache. Default is 4096.\n");
+    printf("    -lookaside <slots>\n");
+    printf("                      Pre-allocate that many lookaside slots per connection.\n");
+    printf("                      Default is 0 (SQLite's default lookaside).\n");
+    printf("    -lookasidesize <bytes>\n");
+    printf("                      Size of a lookaside slot. Default is 1200.\n");
+    printf("    -cachesize <pages>\n");
+    printf("                      Page cache size per connection, see PRAGMA cache_size.\n");
+    printf("                      Default is 0 (SQLite's default).\n");
+    printf("    -mmap <bytes>     Access up to that many bytes of the database file with\n");
+    printf("                      memory-mapped I/O (PRAGMA mmap_size), and count pages\n");
+    printf("                      read with pread versus mmap. Default is 0 (off).\n");
+    printf("    -bufsize <bytes>  Initial size of the request and response buffers. Buffers\n");
+    printf("                      grow on demand and shrink back after a spike.\n");
+    printf("                      Default is 65536.\n");
+    printf("    -bufmax <bytes>   Max. size of the request and response buffers. A request\n");
+    printf("                      or row that does not fit is answered with an error.\n");
+    printf("                      Default is 2147483647.\n");
+    printf("    -zerocopy <bytes> Send strings and blobs of at least that size without\n");
+    printf("                      copying them into the response buffer. Default is 0 (off).\n");
+    printf("    -timing           Measure the phases of each request (read, decode,\n");
+    printf("                      prepare, bind, step, encode, flush), not only its total\n");
+    printf("                      time. Default is off.\n");
+    printf("    -trace <file>     Record requests, statements, rows and frames in a binary\n");
+    printf("                      trace file, see 'tracejson'. Default is empty (off).\n");
+    printf("    -record <file>    Record all request frames with their arrival time, see\n");
+    printf("                      'replay'. Default is empty (off).\n");
+    printf("    -paced            Replay requests at their recorded pacing, not as fast as\n");
+    printf("                      possible. Default is off.\n");
+    printf("    -rows <n>         Rows per table for 'bench'. Default is 100000.\n");
+    printf("    -lookups <n>      Point lookups for 'bench'. Default is 10000.\n");
+    printf("    -ops <n>          Operations per function for 'benchio'. Default is 1000000.\n");
     printf("\n");
 }
 
@@ -90,20 +275,62 @@ int main(int argc, char const *argv[]) {
     if (hasCommand(argc, argv, "run")) {
         theLog = makeLog(argc, argv);
         initMem();
+        memDumpOnSignal();
         LOG_INFO2("--- %s v%s start ---", SQINN_NAME, SQINN_VERSION);
+        if (!configMemory(argc, argv)) {
+            fprintf(stderr, "cannot configure memory, see -loglevel 1 -logstderr\n");
+            Log_free(theLog);
+            return 1;
+        }
         Db *db = makeDb(argc, argv);
         Reader *r = newStdinReader();
         Writer *w = newStdoutWriter();
+        // -bufsize <bytes>, -bufmax <bytes>
+        size_t bufInit = (size_t)getIntOption(argc, argv, "-bufsize", 64 * 1024);
+        size_t bufMax = (size_t)getIntOption(argc, argv, "-bufmax", 0x7FFFFFFF);
+        if (bufInit > 0 && bufInit <= bufMax && bufMax <= 0x7FFFFFFF) {
+            Reader_setCapacity(r, bufInit, bufMax);
+            Writer_setCapacity(w, bufInit, bufMax);
+        } else {
+            LOG_INFO2("invalid buffer sizes %zu/%zu, using defaults", bufInit, bufMax);
+        }
+        // -zerocopy <bytes>
+        Writer_setZeroCopy(w, (size_t)getIntOption(argc, argv, "-zerocopy", 0));
+        // -record <file>
+        char recordfile[512] = {0};
+        getOption(argc, argv, "-record", recordfile, sizeof(recordfile), "");
+        if (recordfile[0]) {
+            Reader_record(r, recordfile);
+        }
         App *app = newApp(db, r, w);
+        configApp(app, argc, argv);
+        // -trace <file>
+        char tracefile[512] = {0};
+        getOption(argc, argv, "-trace", tracefile, sizeof(tracefile), "");
+        Trace *trace = tracefile[0] ? newTrace(tracefile, TRACE_CAPACITY) : NULL;
+        if (trace) {
+            App_setTrace(app, trace);
+        }
         while(App_step(app)) {
-            ; // loop until App_step() returns FALSE
+            // loop until App_step() returns FALSE
+            if (memDumpRequested()) {
+                printMemSites(MEM_DUMP_SITES);
+            }
         }
         App_free(app);
+        Reader_print(r);
+        Writer_print(w);
         Writer_free(w);
         Reader_free(r);
+        Db_printStatus(db);
         Db_free(db);
+        if (trace) {
+            Trace_free(trace);
+        }
+        Db_shutdown();
         if (mallocs != frees) {
             LOG_INFO2("found memory leaks: mallocs %d != frees %d", mallocs, frees);
+            printMemSites(MEM_DUMP_SITES);
         }
         LOG_INFO2("--- %s v%s exit ---", SQINN_NAME,SQINN_VERSION);
         Log_free(theLog);
@@ -112,9 +339,12 @@ int main(int argc, char const *argv[]) {
         theLog = makeLog(argc, argv);
         initMem();
         LOG_INFO2("--- %s v%s test start ---", SQINN_NAME, SQINN_VERSION);
+        testUtl();
         testIo();
         testDb();
         testApp();
+        testImport();
+        testBench();
         if (mallocs != frees) {
             printMem(stderr);
             ASSERTF(mallocs == frees, "memory leak: %d mallocs, %d frees", mallocs, frees);
@@ -123,6 +353,91 @@ int main(int argc, char const *argv[]) {
         Log_free(theLog);
         printf("test ok\n");
         return 0;
+    } else if (hasCommand(argc, argv, "bench")) {
+        theLog = makeLog(argc, argv);
+        initMem();
+        LOG_INFO2("--- %s v%s bench start ---", SQINN_NAME, SQINN_VERSION);
+        // -rows <n>, -lookups <n>
+        int nrows = (int)getIntOption(argc, argv, "-rows", 100000);
+        int nlookups = (int)getIntOption(argc, argv, "-lookups", 10000);
+        Bench *bench = newBench(nrows > 0 ? nrows : 1, nlookups > 0 ? nlookups : 1);
+        // over pipes: '<this executable> run' with the same options
+        char **args = (char **)memAlloc((argc + 1) * sizeof(char *), __FILE__, __LINE__);
+        args[0] = (char *)argv[0];
+        args[1] = "run";
+        for (int i = 2; i < argc; i++) {
+            args[i] = (char *)argv[i];
+        }
+        args[argc] = NULL;
+        BOOL ok = Bench_runChild(bench, args);
+        memFree(args);
+        // direct
+        if (ok) {
+            ok = configMemory(argc, argv);
+        }
+        if (ok) {
+            Db *db = makeDb(argc, argv);
+            Bench_runDb(bench, db);
+            Db_free(db);
+            Db_shutdown();
+            Bench_printJson(bench, stdout);
+        } else {
+            fprintf(stderr, "bench failed, see -loglevel 1 -logstderr\n");
+        }
+        Bench_free(bench);
+        LOG_INFO2("--- %s v%s bench exit ---", SQINN_NAME, SQINN_VERSION);
+        Log_free(theLog);
+        return ok ? 0 : 1;
+    } else if (hasCommand(argc, argv, "benchio")) {
+        theLog = makeLog(argc, argv);
+        initMem();
+        // -ops <n>
+        int64_t nops = getIntOption(argc, argv, "-ops", 1000000);
+        CodecBench *codec = newCodecBench(nops > 0 ? nops : 1);
+        CodecBench_run(codec);
+        CodecBench_printJson(codec, stdout);
+        CodecBench_free(codec);
+        Log_free(theLog);
+        return 0;
+    } else if (hasCommand(argc, argv, "replay")) {
+        theLog = makeLog(argc, argv);
+        initMem();
+        LOG_INFO2("--- %s v%s replay start ---", SQINN_NAME, SQINN_VERSION);
+        // -record <file>, -paced
+        char recordfile[512] = {0};
+        getOption(argc, argv, "-record", recordfile, sizeof(recordfile), "sqinn.rec");
+        Replay *replay = newReplay(recordfile);
+        BOOL ok = replay && configMemory(argc, argv);
+        if (ok) {
+            Db *db = makeDb(argc, argv);
+            App *app = newApp(db, Replay_reader(replay), Replay_writer(replay));
+            configApp(app, argc, argv);
+            Replay_run(replay, app, hasOption(argc, argv, "-paced"));
+            App_free(app);
+            Db_free(db);
+            Db_shutdown();
+            Replay_printJson(replay, stdout);
+        } else {
+            fprintf(stderr, "cannot replay '%s', see -loglevel 1 -logstderr\n", recordfile);
+        }
+        if (replay) {
+            Replay_free(replay);
+        }
+        LOG_INFO2("--- %s v%s replay exit ---", SQINN_NAME, SQINN_VERSION);
+        Log_free(theLog);
+        return ok ? 0 : 1;
+    } else if (hasCommand(argc, argv, "tracejson")) {
+        theLog = makeLog(argc, argv);
+        initMem();
+        // -trace <file>
+        char tracefile[512] = {0};
+        getOption(argc, argv, "-trace", tracefile, sizeof(tracefile), "sqinn.trace");
+        BOOL ok = traceToJson(tracefile, stdout);
+        if (!ok) {
+            fprintf(stderr, "cannot read trace file '%s'\n", tracefile);
+        }
+        Log_free(theLog);
+        return ok ? 0 : 1;
     } else if (hasCommand(argc, argv, "version")) {
         printf("%s v%s\n", SQINN_NAME, SQINN_VERSION);
         return 0;
@@ -1,86 +1,640 @@
+#ifdef _WIN32
+  // windows.h has its own BOOL, keep it out of our way
+  #define BOOL WINBOOL
+  #include <windows.h>
+  #undef BOOL
+#endif
+
 #include "utl.h"
 
-#define MAX_BLOCKS 0  // set 0 to disable memory tracking, set 8*1024 (e.g.) for debugging memory issues
-#define MAX_FILE_LEN 64
+#ifndef _WIN32
+  #include <pthread.h>
+  #include <poll.h>
+#endif
+
+#ifndef _WIN32
+  #include <signal.h>
+  #include <sys/types.h>
+  #include <sys/wait.h>
+#endif
+
+// memory tracking
+
+#define MEM_STRIPES 16         // number of locks, must be a power of two
+#define MEM_STRIPE_SITES 128   // call sites per stripe, must be a power of two
+#define MEM_MAX_SITES (MEM_STRIPES * MEM_STRIPE_SITES)
+#define MEM_HDR 16             // header size, keeps the alignment of malloc
+#define MEM_PRINT_SITES 64     // max. call sites that are logged or reported
+
+/* A MemHdr precedes every block and records its size and call site, so that
+   memFree and memRealloc find them without a lookup. */
+typedef struct memhdr_s {
+    size_t size;
+    int site;
+} MemHdr;
+
+/* A MemStripe holds the call sites that hash to it. Each stripe has its own
+   lock, so that threads allocating at different call sites rarely wait for
+   each other. */
+typedef struct memstripe_s {
+    MemSite sites[MEM_STRIPE_SITES];  // site 0 collects call sites that did not fit
+    int nsites;
+} MemStripe;
+
+static struct {
+    MemStripe stripes[MEM_STRIPES];
+    volatile sig_atomic_t dump;  // set by signal handler
+} mem;
+
+#ifdef _WIN32
+  typedef SRWLOCK MemLock;
+  #define MEM_LOCK_INIT SRWLOCK_INIT
+#else
+  typedef pthread_mutex_t MemLock;
+  #define MEM_LOCK_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
 
-typedef struct block_s {
-    char file[MAX_FILE_LEN+1];
-    int line;
-    void *ptr;
-    BOOL free;
-} block_s;
+#define MEM_LOCK_INIT4 MEM_LOCK_INIT, MEM_LOCK_INIT, MEM_LOCK_INIT, MEM_LOCK_INIT
+
+// static, so that they can be used before main
+static MemLock memLocks[MEM_STRIPES] = { MEM_LOCK_INIT4, MEM_LOCK_INIT4, MEM_LOCK_INIT4, MEM_LOCK_INIT4 };
+
+#ifdef _WIN32
+  static void _memLock(int stripe) { AcquireSRWLockExclusive(&memLocks[stripe]); }
+  static void _memUnlock(int stripe) { ReleaseSRWLockExclusive(&memLocks[stripe]); }
+#else
+  static void _memLock(int stripe) { pthread_mutex_lock(&memLocks[stripe]); }
+  static void _memUnlock(int stripe) { pthread_mutex_unlock(&memLocks[stripe]); }
+#endif
 
-block_s blocks[MAX_BLOCKS+1];
-int nblocks = 0;
 int mallocs = 0;
 int frees = 0;
 
 void initMem() {
-    memset(blocks, 0, sizeof(blocks));
-    nblocks = 0;
     mallocs = 0;
     frees = 0;
 }
 
+/* _memSite finds or adds the site for file:line in its stripe, and returns
+   its index over all stripes. file is a __FILE__ literal, so it is compared
+   by pointer. The caller holds the lock of the stripe. */
+static int _memSite(int stripe, size_t h, const char *file, int line) {
+    MemStripe *ms = &mem.stripes[stripe];
+    size_t i = h & (MEM_STRIPE_SITES - 1);
+    for (int n = 0; n < MEM_STRIPE_SITES; n++, i = (i + 1) & (MEM_STRIPE_SITES - 1)) {
+        if (i == 0) {
+            continue;
+        }
+        MemSite *site = &ms->sites[i];
+        if (site->file == file && site->line == line) {
+            return stripe * MEM_STRIPE_SITES + (int)i;
+        }
+        if (!site->file) {
+            if (ms->nsites + 1 >= MEM_STRIPE_SITES / 2) {
+                break;  // keep probe sequences short
+            }
+            site->file = file;
+            site->line = line;
+            ms->nsites++;
+            return stripe * MEM_STRIPE_SITES + (int)i;
+        }
+    }
+    return stripe * MEM_STRIPE_SITES;
+}
+
+static void _memSiteAdd(MemSite *site, int64_t count, int64_t bytes) {
+    site->count += count;
+    site->bytes += bytes;
+    if (count > 0) {
+        site->total += count;
+    }
+    if (site->bytes > site->peakBytes) {
+        site->peakBytes = site->bytes;
+    }
+}
+
+/* _memTrackAlloc adds an allocation to its call site and returns the site. */
+static int _memTrackAlloc(size_t size, const char *file, int line) {
+    uint64_t h = ((uint64_t)(uintptr_t)file + (uint64_t)line * 31) * 0x9E3779B97F4A7C15ull;
+    int stripe = (int)(h >> 60) & (MEM_STRIPES - 1);
+    _memLock(stripe);
+    int site = _memSite(stripe, (size_t)(h >> 32), file, line);
+    _memSiteAdd(&mem.stripes[stripe].sites[site % MEM_STRIPE_SITES], 1, (int64_t)size);
+    _memUnlock(stripe);
+    return site;
+}
+
+/* _memTrack changes the live allocations and bytes of a site. */
+static void _memTrack(int site, int64_t count, int64_t bytes) {
+    int stripe = site / MEM_STRIPE_SITES;
+    _memLock(stripe);
+    _memSiteAdd(&mem.stripes[stripe].sites[site % MEM_STRIPE_SITES], count, bytes);
+    _memUnlock(stripe);
+}
+
+static int _compareSites(const void *a, const void *b) {
+    const MemSite *x = (const MemSite *)a;
+    const MemSite *y = (const MemSite *)b;
+    if (x->bytes != y->bytes) {
+        return x->bytes < y->bytes ? 1 : -1;
+    }
+    return x->peakBytes < y->peakBytes ? 1 : (x->peakBytes > y->peakBytes ? -1 : 0);
+}
+
+/* memGetSites copies up to max call sites into sites, largest live bytes
+   first, and returns how many were copied. */
+int memGetSites(MemSite *sites, int max) {
+    int n = 0;
+    for (int stripe = 0; stripe < MEM_STRIPES; stripe++) {
+        _memLock(stripe);
+        for (int i = 0; i < MEM_STRIPE_SITES; i++) {
+            const MemSite *site = &mem.stripes[stripe].sites[i];
+            if (!site->total) {
+                continue;
+            }
+            // insert into the sorted top max
+            int k = n < max ? n++ : max;
+            while (k > 0 && _compareSites(site, &sites[k - 1]) < 0) {
+                if (k < max) {
+                    sites[k] = sites[k - 1];
+                }
+                k--;
+            }
+            if (k < max) {
+                sites[k] = *site;
+                if (!sites[k].file) {
+                    sites[k].file = "(other)";
+                }
+            }
+        }
+        _memUnlock(stripe);
+    }
+    return n;
+}
+
+static int _memSiteCount() {
+    int n = 0;
+    for (int stripe = 0; stripe < MEM_STRIPES; stripe++) {
+        _memLock(stripe);
+        n += mem.stripes[stripe].nsites;
+        _memUnlock(stripe);
+    }
+    return n;
+}
+
 void printMem(FILE *fp) {
     fprintf(fp, "%d mallocs, %d frees, %d in use\n", mallocs, frees, mallocs-frees);
-    if(MAX_BLOCKS) {
-        fprintf(fp, "%d blocks\n", nblocks);
-        for (int i=0 ; i<nblocks ; i++) {
-            block_s b = blocks[i];
-            fprintf(fp, "block %3d: %16s:%-4d %4s\n", i, b.file, b.line, b.free ? "" : "leak");
-        }
+    MemSite sites[MEM_PRINT_SITES];
+    int n = memGetSites(sites, MEM_PRINT_SITES);
+    for (int i = 0; i < n && sites[i].count; i++) {
+        fprintf(fp, "%s:%d: %" PRId64 " blocks, %" PRId64 " bytes in use\n", sites[i].file, sites[i].line, sites[i].count, sites[i].bytes);
     }
 }
 
+/* printMemSites logs the max call sites with the most live bytes, at most
+   MEM_PRINT_SITES. */
+void printMemSites(int max) {
+    MemSite sites[MEM_PRINT_SITES];
+    int n = memGetSites(sites, max < MEM_PRINT_SITES ? max : MEM_PRINT_SITES);
+    LOG_INFO3("memory: %d mallocs, %d frees, %d call sites", mallocs, frees, _memSiteCount());
+    for (int i = 0; i < n; i++) {
+        MemSite *s = &sites[i];
+        LOG_INFO4("memory: %s:%d: %" PRId64 " blocks, %" PRId64 " bytes", s->file, s->line, s->count, s->bytes);
+        LOG_INFO4("memory: %s:%d: peak %" PRId64 " bytes, %" PRId64 " allocs", s->file, s->line, s->peakBytes, s->total);
+    }
+}
+
+/* memStats adds the memory counters and the max call sites with the most
+   live bytes, at most MEM_PRINT_SITES. */
+void memStats(Stats *stats, int max) {
+    Stats_add(stats, "mem.mallocs", mallocs);
+    Stats_add(stats, "mem.frees", frees);
+    MemSite sites[MEM_PRINT_SITES];
+    int n = memGetSites(sites, max < MEM_PRINT_SITES ? max : MEM_PRINT_SITES);
+    for (int i = 0; i < n; i++) {
+        Stats_addf(stats, sites[i].bytes, "mem.site.%s:%d", sites[i].file, sites[i].line);
+    }
+}
+
+#ifndef _WIN32
+  static void _memSignal(int sig) {
+      mem.dump = 1;
+  }
+#endif
+
+/* memDumpOnSignal lets SIGUSR1 request a dump, see memDumpRequested.
+   Not available on Windows. */
+void memDumpOnSignal() {
+#ifndef _WIN32
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _memSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+#endif
+}
+
+/* memDumpRequested reports, once, whether a dump was requested by signal. */
+BOOL memDumpRequested() {
+    if (!mem.dump) {
+        return FALSE;
+    }
+    mem.dump = 0;
+    return TRUE;
+}
+
 void *memAlloc(size_t size, const char *file, int line) {
-    mallocs ++;
-    void *ptr = malloc(size);
-    if (!ptr) {
+    ATOMIC_ADD(&mallocs, 1);
+    char *block = (char *)malloc(MEM_HDR + size);
+    if (!block) {
         fprintf(stderr, "fatal: out of memory");
         exit(1);
     }
-    if(MAX_BLOCKS) {
-        if(nblocks < MAX_BLOCKS) {
-            strncpy(blocks[nblocks].file, file, MAX_FILE_LEN);
-            blocks[nblocks].line = line;
-            blocks[nblocks].ptr = ptr;
-            blocks[nblocks].free = FALSE;
-            nblocks++;
-        }
-    }
-    return ptr;
+    MemHdr *hdr = (MemHdr *)block;
+    hdr->size = size;
+    hdr->site = _memTrackAlloc(size, file, line);
+    return block + MEM_HDR;
 }
 
 void *memRealloc(void *ptr, size_t newSize) {
-    void *newPtr = realloc(ptr, newSize);
-    if (!newPtr) {
+    MemHdr *hdr = (MemHdr *)((char *)ptr - MEM_HDR);
+    size_t oldSize = hdr->size;
+    hdr = (MemHdr *)realloc(hdr, MEM_HDR + newSize);
+    if (!hdr) {
         fprintf(stderr, "fatal: out of memory");
         exit(1);
     }
-    if(MAX_BLOCKS) {
-        for (int i=0 ; i<nblocks ; i++) {
-            if (blocks[i].ptr == ptr ) {
-                blocks[i].ptr = newPtr;
-            }
-        }
-    }
-    return newPtr;
+    hdr->size = newSize;
+    _memTrack(hdr->site, 0, (int64_t)newSize - (int64_t)oldSize);
+    return (char *)hdr + MEM_HDR;
 }
 
 void memFree(void *ptr) {
     if (!ptr) {
         return;
     }
-    frees ++;
-    free(ptr);
-    if(MAX_BLOCKS) {
-        for (int i=0 ; i<nblocks ; i++) {
-            if (blocks[i].ptr == ptr ) {
-                blocks[i].free = TRUE;
+    ATOMIC_ADD(&frees, 1);
+    MemHdr *hdr = (MemHdr *)((char *)ptr - MEM_HDR);
+    _memTrack(hdr->site, -1, -(int64_t)hdr->size);
+    free(hdr);
+}
+
+char *memStrdup(const char *str, const char *file, int line) {
+    size_t len = strlen(str);
+    char *p = (char *)memAlloc(len + 1, file, line);
+    memcpy(p, str, len + 1);
+    return p;
+}
+
+// class Arena
+
+#define ARENA_ALIGN 16
+#define ARENA_MAX_SIZE (16 * 1024 * 1024)  // the buffer does not grow beyond this
+#define ARENA_TRIM_RESETS 1024             // resets between two checks for shrinking
+
+/* An ArenaBlock holds memory that did not fit into the Arena's buffer. */
+typedef struct arena_block_s {
+    struct arena_block_s *next;
+} ArenaBlock;
+
+struct arena_s {
+    char *buf;
+    size_t size;
+    size_t minSize;      // initial size, the buffer does not shrink below it
+    size_t used;
+    ArenaBlock *blocks;  // overflow blocks, freed on reset
+    size_t overflow;     // bytes in overflow blocks
+    // statistics
+    size_t highWater;    // max. bytes used between two resets
+    size_t trimWater;    // max. bytes used since the last check for shrinking
+    int64_t nresets;
+    int64_t noverflows;
+    int64_t ngrows;
+    int64_t nshrinks;
+};
+
+Arena *newArena(size_t size) {
+    ASSERT(size > 0);
+    Arena *this = (Arena *)memAlloc(sizeof(Arena), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Arena));
+    this->size = size;
+    this->minSize = size;
+    this->buf = (char *)memAlloc(size, __FILE__, __LINE__);
+    return this;
+}
+
+static void _freeArenaBlocks(Arena *this) {
+    while (this->blocks) {
+        ArenaBlock *next = this->blocks->next;
+        memFree(this->blocks);
+        this->blocks = next;
+    }
+    this->overflow = 0;
+}
+
+void Arena_free(Arena *this) {
+    if (!this) {
+        return;
+    }
+    _freeArenaBlocks(this);
+    memFree(this->buf);
+    memFree(this);
+}
+
+void *Arena_alloc(Arena *this, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size == 0) {
+        size = ARENA_ALIGN;
+    }
+    if (this->size - this->used >= size) {
+        void *p = this->buf + this->used;
+        this->used += size;
+        return p;
+    }
+    // does not fit, allocate from heap until next reset
+    size_t hdr = (sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaBlock *block = (ArenaBlock *)memAlloc(hdr + size, __FILE__, __LINE__);
+    block->next = this->blocks;
+    this->blocks = block;
+    this->overflow += size;
+    this->noverflows++;
+    return (char *)block + hdr;
+}
+
+char *Arena_strdup(Arena *this, const char *str) {
+    size_t len = strlen(str);
+    char *p = (char *)Arena_alloc(this, len + 1);
+    memcpy(p, str, len + 1);
+    return p;
+}
+
+static void _resizeArena(Arena *this, size_t newSize) {
+    memFree(this->buf);
+    this->buf = (char *)memAlloc(newSize, __FILE__, __LINE__);
+    this->size = newSize;
+}
+
+/* Arena_reset releases all memory of the Arena. Overflow blocks are always
+   freed. The buffer grows to fit the last request, up to ARENA_MAX_SIZE;
+   larger requests keep using overflow blocks. Every ARENA_TRIM_RESETS
+   resets, a buffer that is more than four times larger than the most bytes
+   used since the last check shrinks back, so that a single large request
+   does not pin its memory for good. */
+void Arena_reset(Arena *this) {
+    size_t used = this->used + this->overflow;
+    if (used > this->highWater) {
+        this->highWater = used;
+    }
+    if (used > this->trimWater) {
+        this->trimWater = used;
+    }
+    if (this->blocks) {
+        _freeArenaBlocks(this);
+        size_t newSize = this->size;
+        while (newSize < used && newSize < ARENA_MAX_SIZE) {
+            newSize *= 2;
+        }
+        if (newSize > this->size) {
+            _resizeArena(this, newSize);
+            this->ngrows++;
+        }
+    }
+    this->used = 0;
+    this->nresets++;
+    if (this->nresets % ARENA_TRIM_RESETS == 0) {
+        if (this->size > this->minSize && this->size / 4 > this->trimWater) {
+            size_t newSize = this->minSize;
+            while (newSize < this->trimWater) {
+                newSize *= 2;
             }
+            _resizeArena(this, newSize);
+            this->nshrinks++;
         }
+        this->trimWater = 0;
+    }
+}
+
+void Arena_print(Arena *this, const char *name) {
+    LOG_INFO4("%s: size %zu, high water %zu bytes, %" PRId64 " overflows", name, this->size, this->highWater, this->noverflows);
+    LOG_INFO4("%s: %" PRId64 " resets, %" PRId64 " grows, %" PRId64 " shrinks", name, this->nresets, this->ngrows, this->nshrinks);
+}
+
+void Arena_stats(Arena *this, Stats *stats, const char *name) {
+    Stats_addf(stats, this->size, "%s.size", name);
+    Stats_addf(stats, this->highWater, "%s.highWater", name);
+    Stats_addf(stats, this->noverflows, "%s.overflows", name);
+    Stats_addf(stats, this->ngrows, "%s.grows", name);
+    Stats_addf(stats, this->nshrinks, "%s.shrinks", name);
+}
+
+// class Stats
+
+#define STATS_NAME_LEN 64
+
+typedef struct stat_s {
+    char name[STATS_NAME_LEN];
+    int64_t value;
+} Stat;
+
+struct stats_s {
+    Stat *stats;
+    int n;
+    int cap;
+};
+
+Stats *newStats() {
+    Stats *this = (Stats *)memAlloc(sizeof(Stats), __FILE__, __LINE__);
+    this->cap = 64;
+    this->n = 0;
+    this->stats = (Stat *)memAlloc(this->cap * sizeof(Stat), __FILE__, __LINE__);
+    return this;
+}
+
+void Stats_free(Stats *this) {
+    memFree(this->stats);
+    memFree(this);
+}
+
+void Stats_reset(Stats *this) {
+    this->n = 0;
+}
+
+/* _statName copies name to dst. A name that does not fit is cut and ends
+   in "...", so that clients can tell. */
+static void _statName(char *dst, const char *name) {
+    size_t len = strlen(name);
+    if (len < STATS_NAME_LEN) {
+        memcpy(dst, name, len + 1);
+        return;
+    }
+    memcpy(dst, name, STATS_NAME_LEN - 4);
+    strcpy(dst + STATS_NAME_LEN - 4, "...");
+}
+
+void Stats_add(Stats *this, const char *name, int64_t value) {
+    if (this->n == this->cap) {
+        this->cap *= 2;
+        this->stats = (Stat *)memRealloc(this->stats, this->cap * sizeof(Stat));
     }
+    Stat *stat = &this->stats[this->n++];
+    _statName(stat->name, name);
+    stat->value = value;
+}
+
+void Stats_addf(Stats *this, int64_t value, const char *fmt, ...) {
+    char name[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(name, sizeof(name), fmt, args);
+    va_end(args);
+    Stats_add(this, name, value);
+}
+
+/* Stats_sum adds value to the named stat, or adds the stat if there is
+   none, so that counters of several sources can be totaled. */
+void Stats_sum(Stats *this, const char *name, int64_t value) {
+    char cut[STATS_NAME_LEN];
+    _statName(cut, name);
+    for (int i = 0; i < this->n; i++) {
+        if (strcmp(this->stats[i].name, cut) == 0) {
+            this->stats[i].value += value;
+            return;
+        }
+    }
+    Stats_add(this, cut, value);
+}
+
+int Stats_count(Stats *this) {
+    return this->n;
+}
+
+const char *Stats_name(Stats *this, int i) {
+    ASSERT(0 <= i && i < this->n);
+    return this->stats[i].name;
+}
+
+int64_t Stats_value(Stats *this, int i) {
+    ASSERT(0 <= i && i < this->n);
+    return this->stats[i].value;
+}
+
+/* Stats_get returns the value of the named stat, or defaultValue if there is none. */
+int64_t Stats_get(Stats *this, const char *name, int64_t defaultValue) {
+    for (int i = 0; i < this->n; i++) {
+        if (strcmp(this->stats[i].name, name) == 0) {
+            return this->stats[i].value;
+        }
+    }
+    return defaultValue;
+}
+
+// class Histogram
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 44  // larger values (about 4.9 hours in nanos) go into the last bucket
+#define HIST_NBUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram_s {
+    int64_t counts[HIST_NBUCKETS];
+    int64_t count;
+    int64_t sum;
+    int64_t max;
+};
+
+static int _histBucket(int64_t value) {
+    if (value < HIST_SUB) {
+        return value < 0 ? 0 : (int)value;
+    }
+    uint64_t v = (uint64_t)value;
+#ifdef _WIN32
+    unsigned long e;
+    _BitScanReverse64(&e, v);
+#else
+    int e = 63 - __builtin_clzll(v);
+#endif
+    int b = ((int)e - HIST_SUB_BITS + 1) * HIST_SUB + (int)(v >> (e - HIST_SUB_BITS)) - HIST_SUB;
+    return b < HIST_NBUCKETS ? b : HIST_NBUCKETS - 1;
+}
+
+/* _histValue returns the largest value of bucket b. */
+static int64_t _histValue(int b) {
+    if (b < HIST_SUB) {
+        return b;
+    }
+    int e = b / HIST_SUB + HIST_SUB_BITS - 1;
+    int64_t low = (int64_t)(HIST_SUB + b % HIST_SUB) << (e - HIST_SUB_BITS);
+    return low + ((int64_t)1 << (e - HIST_SUB_BITS)) - 1;
+}
+
+Histogram *newHistogram() {
+    Histogram *this = (Histogram *)memAlloc(sizeof(Histogram), __FILE__, __LINE__);
+    Histogram_reset(this);
+    return this;
+}
+
+void Histogram_free(Histogram *this) {
+    memFree(this);
+}
+
+void Histogram_reset(Histogram *this) {
+    memset(this, 0, sizeof(Histogram));
+}
+
+void Histogram_record(Histogram *this, int64_t value) {
+    this->counts[_histBucket(value)]++;
+    this->count++;
+    this->sum += value;
+    if (value > this->max) {
+        this->max = value;
+    }
+}
+
+int64_t Histogram_count(Histogram *this) {
+    return this->count;
+}
+
+int64_t Histogram_max(Histogram *this) {
+    return this->max;
+}
+
+/* Histogram_percentile returns the value that p percent of all values
+   are less than or equal to, rounded up to the end of its bucket. */
+int64_t Histogram_percentile(Histogram *this, double p) {
+    if (!this->count) {
+        return 0;
+    }
+    int64_t rank = (int64_t)(p / 100.0 * (double)this->count + 0.5);
+    rank = rank < 1 ? 1 : rank;
+    int64_t n = 0;
+    for (int b = 0; b < HIST_NBUCKETS; b++) {
+        n += this->counts[b];
+        if (n >= rank) {
+            int64_t value = _histValue(b);
+            return value < this->max ? value : this->max;
+        }
+    }
+    return this->max;
+}
+
+void Histogram_print(Histogram *this, const char *name) {
+    if (!this->count) {
+        return;
+    }
+    LOG_INFO4("%s: %" PRId64 " values, mean %" PRId64 ", max %" PRId64,
+        name, this->count, this->sum / this->count, this->max);
+    LOG_INFO4("%s: p50 %" PRId64 ", p99 %" PRId64 ", p999 %" PRId64,
+        name, Histogram_percentile(this, 50), Histogram_percentile(this, 99), Histogram_percentile(this, 99.9));
+}
+
+void Histogram_stats(Histogram *this, Stats *stats, const char *name) {
+    Stats_addf(stats, this->count, "%s.count", name);
+    Stats_addf(stats, this->count ? this->sum / this->count : 0, "%s.mean", name);
+    Stats_addf(stats, Histogram_percentile(this, 50), "%s.p50", name);
+    Stats_addf(stats, Histogram_percentile(this, 99), "%s.p99", name);
+    Stats_addf(stats, Histogram_percentile(this, 99.9), "%s.p999", name);
+    Stats_addf(stats, this->max, "%s.max", name);
 }
 
 char *hexdump(const char *data, size_t len) {
@@ -107,45 +661,513 @@ char *hexdump(const char *data, size_t len) {
 }
 
 
-static void _vfprintf(FILE *fp, int level, const char *fmt, va_list args) {
-    time_t now = time(NULL);
-    struct tm *pt = localtime(&now);
-    char tstamp[64];
-    strftime(tstamp, sizeof(tstamp), "%Y-%m-%d %H:%M:%S", pt);
-    fprintf(fp, "%s ", tstamp);
-    switch (level) {
-        case LOG_LEVEL_INFO:
-            fprintf(fp, "INFO  ");
-            break;
-        case LOG_LEVEL_DEBUG:
-            fprintf(fp, "DEBUG ");
-            break;
-        default:
-            fprintf(fp, "LEVEL%d ", level);
-            break;
+// class Thread, Mutex, Cond
+
+#ifdef _WIN32
+
+struct thread_s {
+    HANDLE handle;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+static DWORD WINAPI _threadMain(LPVOID param) {
+    Thread *this = (Thread *)param;
+    this->fn(this->arg);
+    return 0;
+}
+
+Thread *newThread(void (*fn)(void *arg), void *arg) {
+    Thread *this = (Thread *)memAlloc(sizeof(Thread), __FILE__, __LINE__);
+    this->fn = fn;
+    this->arg = arg;
+    this->handle = CreateThread(NULL, 0, _threadMain, this, 0, NULL);
+    ASSERT(this->handle);
+    return this;
+}
+
+void Thread_join(Thread *this) {
+    WaitForSingleObject(this->handle, INFINITE);
+    CloseHandle(this->handle);
+    memFree(this);
+}
+
+BOOL Thread_isCurrent(Thread *this) {
+    return GetThreadId(this->handle) == GetCurrentThreadId();
+}
+
+struct mutex_s {
+    CRITICAL_SECTION cs;
+};
+
+Mutex *newMutex() {
+    Mutex *this = (Mutex *)memAlloc(sizeof(Mutex), __FILE__, __LINE__);
+    InitializeCriticalSection(&this->cs);
+    return this;
+}
+
+void Mutex_free(Mutex *this) {
+    DeleteCriticalSection(&this->cs);
+    memFree(this);
+}
+
+void Mutex_lock(Mutex *this) {
+    EnterCriticalSection(&this->cs);
+}
+
+void Mutex_unlock(Mutex *this) {
+    LeaveCriticalSection(&this->cs);
+}
+
+struct cond_s {
+    CONDITION_VARIABLE cv;
+};
+
+Cond *newCond() {
+    Cond *this = (Cond *)memAlloc(sizeof(Cond), __FILE__, __LINE__);
+    InitializeConditionVariable(&this->cv);
+    return this;
+}
+
+void Cond_free(Cond *this) {
+    memFree(this);
+}
+
+void Cond_wait(Cond *this, Mutex *mutex) {
+    SleepConditionVariableCS(&this->cv, &mutex->cs, INFINITE);
+}
+
+void Cond_waitMillis(Cond *this, Mutex *mutex, int millis) {
+    SleepConditionVariableCS(&this->cv, &mutex->cs, (DWORD)millis);
+}
+
+void Cond_broadcast(Cond *this) {
+    WakeAllConditionVariable(&this->cv);
+}
+
+#else
+
+struct thread_s {
+    pthread_t thread;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+static void *_threadMain(void *param) {
+    Thread *this = (Thread *)param;
+    this->fn(this->arg);
+    return NULL;
+}
+
+Thread *newThread(void (*fn)(void *arg), void *arg) {
+    Thread *this = (Thread *)memAlloc(sizeof(Thread), __FILE__, __LINE__);
+    this->fn = fn;
+    this->arg = arg;
+    int rc = pthread_create(&this->thread, NULL, _threadMain, this);
+    ASSERTF(rc == 0, "pthread_create rc=%d", rc);
+    return this;
+}
+
+void Thread_join(Thread *this) {
+    int rc = pthread_join(this->thread, NULL);
+    ASSERTF(rc == 0, "pthread_join rc=%d", rc);
+    memFree(this);
+}
+
+BOOL Thread_isCurrent(Thread *this) {
+    return pthread_equal(this->thread, pthread_self()) != 0;
+}
+
+struct mutex_s {
+    pthread_mutex_t mutex;
+};
+
+Mutex *newMutex() {
+    Mutex *this = (Mutex *)memAlloc(sizeof(Mutex), __FILE__, __LINE__);
+    pthread_mutex_init(&this->mutex, NULL);
+    return this;
+}
+
+void Mutex_free(Mutex *this) {
+    pthread_mutex_destroy(&this->mutex);
+    memFree(this);
+}
+
+void Mutex_lock(Mutex *this) {
+    pthread_mutex_lock(&this->mutex);
+}
+
+void Mutex_unlock(Mutex *this) {
+    pthread_mutex_unlock(&this->mutex);
+}
+
+struct cond_s {
+    pthread_cond_t cond;
+};
+
+Cond *newCond() {
+    Cond *this = (Cond *)memAlloc(sizeof(Cond), __FILE__, __LINE__);
+    pthread_cond_init(&this->cond, NULL);
+    return this;
+}
+
+void Cond_free(Cond *this) {
+    pthread_cond_destroy(&this->cond);
+    memFree(this);
+}
+
+void Cond_wait(Cond *this, Mutex *mutex) {
+    pthread_cond_wait(&this->cond, &mutex->mutex);
+}
+
+void Cond_waitMillis(Cond *this, Mutex *mutex, int millis) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += millis / 1000;
+    ts.tv_nsec += (long)(millis % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&this->cond, &mutex->mutex, &ts);
+}
+
+void Cond_broadcast(Cond *this) {
+    pthread_cond_broadcast(&this->cond);
+}
+
+#endif
+
+
+// Time
+
+#ifdef _WIN32
+
+int64_t nanotime() {
+    static LARGE_INTEGER freq = {0};
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (int64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+}
+
+void sleepMillis(int millis) {
+    Sleep((DWORD)millis);
+}
+
+BOOL fdReadable(int fd, int millis) {
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    int64_t deadline = nanotime() + (int64_t)millis * 1000000;
+    for (;;) {
+        DWORD avail = 0;
+        if (!PeekNamedPipe(h, NULL, 0, NULL, &avail, NULL)) {
+            return TRUE;  // not a pipe (or broken), a read will not block for long
+        }
+        if (avail) {
+            return TRUE;
+        }
+        if (nanotime() >= deadline) {
+            return FALSE;
+        }
+        Sleep(0);
+    }
+}
+
+#else
+
+int64_t nanotime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void sleepMillis(int millis) {
+    struct timespec ts;
+    ts.tv_sec = millis / 1000;
+    ts.tv_nsec = (long)(millis % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+BOOL fdReadable(int fd, int millis) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, millis) > 0;
+}
+
+#endif
+
+
+// class Child
+
+#ifdef _WIN32
+
+struct child_s {
+    HANDLE process;
+    int in;
+    int out;
+};
+
+Child *newChild(char *const argv[]) {
+    // command line: arguments in double quotes
+    char cmdline[4096] = {0};
+    size_t n = 0;
+    for (int i = 0; argv[i]; i++) {
+        int len = snprintf(cmdline + n, sizeof(cmdline) - n, "%s\"%s\"", i ? " " : "", argv[i]);
+        if (len < 0 || (size_t)len >= sizeof(cmdline) - n) {
+            return NULL;
+        }
+        n += (size_t)len;
+    }
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    HANDLE inRead, inWrite, outRead, outWrite;
+    if (!CreatePipe(&inRead, &inWrite, &sa, 0)) {
+        return NULL;
+    }
+    if (!CreatePipe(&outRead, &outWrite, &sa, 0)) {
+        CloseHandle(inRead);
+        CloseHandle(inWrite);
+        return NULL;
+    }
+    // the child inherits only its ends of the pipes
+    SetHandleInformation(inWrite, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(outRead, HANDLE_FLAG_INHERIT, 0);
+    STARTUPINFOA si;
+    memset(&si, 0, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = inRead;
+    si.hStdOutput = outWrite;
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    PROCESS_INFORMATION pi;
+    BOOL ok = CreateProcessA(NULL, cmdline, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi) ? TRUE : FALSE;
+    CloseHandle(inRead);
+    CloseHandle(outWrite);
+    if (!ok) {
+        CloseHandle(inWrite);
+        CloseHandle(outRead);
+        return NULL;
     }
-    vfprintf(fp, fmt, args);
-    fprintf(fp, "\n");
-    fflush(fp);
+    CloseHandle(pi.hThread);
+    Child *this = (Child *)memAlloc(sizeof(Child), __FILE__, __LINE__);
+    this->process = pi.hProcess;
+    this->in = _open_osfhandle((intptr_t)inWrite, 0);
+    this->out = _open_osfhandle((intptr_t)outRead, 0x8000);  // _O_BINARY
+    return this;
+}
+
+int Child_wait(Child *this) {
+    _close(this->in);
+    _close(this->out);
+    WaitForSingleObject(this->process, INFINITE);
+    DWORD code = 0;
+    GetExitCodeProcess(this->process, &code);
+    CloseHandle(this->process);
+    memFree(this);
+    return (int)code;
 }
 
+#else
+
+struct child_s {
+    pid_t pid;
+    int in;
+    int out;
+};
+
+Child *newChild(char *const argv[]) {
+    int in[2];
+    int out[2];
+    if (pipe(in) != 0) {
+        return NULL;
+    }
+    if (pipe(out) != 0) {
+        close(in[0]);
+        close(in[1]);
+        return NULL;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) {
+        close(in[1]);
+        close(out[0]);
+        return NULL;
+    }
+    Child *this = (Child *)memAlloc(sizeof(Child), __FILE__, __LINE__);
+    this->pid = pid;
+    this->in = in[1];
+    this->out = out[0];
+    return this;
+}
+
+int Child_wait(Child *this) {
+    close(this->in);
+    close(this->out);
+    int status = 0;
+    while (waitpid(this->pid, &status, 0) < 0 && errno == EINTR) {
+        // retry
+    }
+    memFree(this);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+#endif
+
+int Child_stdin(Child *this) {
+    return this->in;
+}
+
+int Child_stdout(Child *this) {
+    return this->out;
+}
+
+
+// class Log
+
+#define LOG_SLOTS 1024        // messages in the ring, power of two
+#define LOG_MSG 480           // max. length of a message, longer ones are truncated
+#define LOG_FLUSH_MILLIS 20   // how often the background thread writes the ring
+
+/* A LogSlot is a formatted message in the ring. */
+typedef struct logslot_s {
+    time_t secs;
+    int level;
+    int len;
+    char msg[LOG_MSG];
+} LogSlot;
+
+/* A Log formats messages on the caller's stack and copies them into a
+   preallocated ring of slots under a short lock. A background thread
+   writes them out in batches, with one flush per batch, so the caller
+   never waits for the file or stderr. */
 struct log_s {
     int level;  // 0, 1, ...
     FILE *fp;   // NULL for no file output
     BOOL stdErr;
+    LogSlot *ring;    // NULL if nothing is logged
+    int64_t head;     // next slot to fill, protected by mutex
+    int64_t tail;     // next slot to write, protected by mutex
+    int64_t dropped;  // messages dropped because the ring was full, protected by mutex
+    BOOL stop;        // protected by mutex
+    Mutex *mutex;
+    Cond *cond;
+    Mutex *drain;     // held while slots are written
+    Thread *writer;   // set under mutex, before the writer runs
+    time_t tsecs;     // second of tstamp, used while drain is held
+    char tstamp[32];
 };
 
+static const char *_levelName(int level) {
+    switch (level) {
+        case LOG_LEVEL_INFO:
+            return "INFO  ";
+        case LOG_LEVEL_DEBUG:
+            return "DEBUG ";
+        default:
+            return "LEVEL ";
+    }
+}
+
+static void _logWrite(Log *this, FILE *fp, LogSlot *slot) {
+    if (slot->secs != this->tsecs) {
+        // the timestamp changes at most once per second
+        this->tsecs = slot->secs;
+        struct tm *pt = localtime(&this->tsecs);
+        strftime(this->tstamp, sizeof(this->tstamp), "%Y-%m-%d %H:%M:%S", pt);
+    }
+    fputs(this->tstamp, fp);
+    fputc(' ', fp);
+    fputs(_levelName(slot->level), fp);
+    fwrite(slot->msg, 1, (size_t)slot->len, fp);
+    fputc('\n', fp);
+}
+
+/* _logDrain writes all filled slots and flushes the outputs once. */
+static void _logDrain(Log *this) {
+    Mutex_lock(this->drain);
+    Mutex_lock(this->mutex);
+    int64_t head = this->head;
+    int64_t tail = this->tail;
+    int64_t dropped = this->dropped;
+    this->dropped = 0;
+    Mutex_unlock(this->mutex);
+    // slots between tail and head are not touched by producers until tail moves
+    FILE *fps[2] = {this->fp, this->stdErr ? stderr : NULL};
+    for (int f = 0; f < 2; f++) {
+        if (!fps[f] || (tail == head && !dropped)) {
+            continue;
+        }
+        for (int64_t i = tail; i < head; i++) {
+            _logWrite(this, fps[f], &this->ring[i & (LOG_SLOTS - 1)]);
+        }
+        if (dropped) {
+            LogSlot slot = {time(NULL), LOG_LEVEL_INFO, 0, {0}};
+            slot.len = snprintf(slot.msg, LOG_MSG, "log: %" PRId64 " messages dropped, ring buffer was full", dropped);
+            _logWrite(this, fps[f], &slot);
+        }
+        fflush(fps[f]);
+    }
+    Mutex_lock(this->mutex);
+    this->tail = head;
+    Mutex_unlock(this->mutex);
+    Mutex_unlock(this->drain);
+}
+
+static void _logMain(void *arg) {
+    Log *this = (Log *)arg;
+    for (;;) {
+        Mutex_lock(this->mutex);
+        if (!this->stop) {
+            Cond_waitMillis(this->cond, this->mutex, LOG_FLUSH_MILLIS);
+        }
+        BOOL stop = this->stop;
+        Mutex_unlock(this->mutex);
+        _logDrain(this);
+        if (stop) {
+            break;
+        }
+    }
+}
+
 Log *newLog(int level, const char *filename, BOOL stdErr) {
     Log *this = (Log *)memAlloc(sizeof(Log), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Log));
     this->level = level;
     this->fp = NULL;
     this->stdErr = stdErr;
+    this->tsecs = -1;
     if (strlen(filename) > 0) {
         this->fp = fopen(filename, "a");
         if (!this->fp) {
             fprintf(stderr, "cannot open logfile\n");
         }
     }
+    if (level > LOG_LEVEL_OFF && (this->fp || this->stdErr)) {
+        this->ring = (LogSlot *)memAlloc(LOG_SLOTS * sizeof(LogSlot), __FILE__, __LINE__);
+        this->mutex = newMutex();
+        this->cond = newCond();
+        this->drain = newMutex();
+        // _logMain takes the mutex first, so writer is set before it drains
+        Mutex_lock(this->mutex);
+        this->writer = newThread(_logMain, this);
+        Mutex_unlock(this->mutex);
+    } else {
+        this->level = LOG_LEVEL_OFF;
+    }
     return this;
 }
 
@@ -153,12 +1175,20 @@ void Log_free(Log *this) {
     if (!this) {
         return;
     }
+    if (this->ring) {
+        Mutex_lock(this->mutex);
+        this->stop = TRUE;
+        Cond_broadcast(this->cond);
+        Mutex_unlock(this->mutex);
+        Thread_join(this->writer);
+        Mutex_free(this->drain);
+        Cond_free(this->cond);
+        Mutex_free(this->mutex);
+        memFree(this->ring);
+    }
     if (this->fp) {
         fclose(this->fp);
     }
-    if (this->stdErr) {
-        fflush(stderr);
-    }    
     memFree(this);
 }
 
@@ -176,20 +1206,704 @@ void Log_print(Log *this, int level, const char *fmt, ...) {
     if (this->level < level) {
         return;
     }
-    if (this->fp) {
-        va_list args;
-        va_start(args, fmt);
-        _vfprintf(this->fp, level, fmt, args);
-        va_end(args);
-        fflush(this->fp);
+    time_t secs = time(NULL);
+    char msg[LOG_MSG];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(msg, LOG_MSG, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        len = 0;
+    } else if (len >= LOG_MSG) {
+        len = LOG_MSG - 1;
+        memcpy(msg + len - 3, "...", 3);
+    }
+    Mutex_lock(this->mutex);
+    if (this->head - this->tail >= LOG_SLOTS) {
+        this->dropped++;
+        Mutex_unlock(this->mutex);
+        return;
+    }
+    LogSlot *slot = &this->ring[this->head & (LOG_SLOTS - 1)];
+    slot->secs = secs;
+    slot->level = level;
+    slot->len = len;
+    memcpy(slot->msg, msg, (size_t)len);
+    this->head++;
+    if (this->head - this->tail == LOG_SLOTS / 2) {
+        // wake the writer early so that a burst does not fill the ring
+        Cond_broadcast(this->cond);
+    }
+    Mutex_unlock(this->mutex);
+}
+
+void Log_flush(Log *this) {
+    if (!this || !this->ring) {
+        return;
     }
-    if (this->stdErr) {
-        va_list args;
-        va_start(args, fmt);
-        _vfprintf(stderr, level, fmt, args);
-        va_end(args);
-        fflush(stderr);
+    if (Thread_isCurrent(this->writer)) {
+        // an ASSERT while draining, the writer already holds drain
+        return;
     }
+    _logDrain(this);
 }
 
 Log *theLog = NULL;
+
+// class Trace
+
+#define TRACE_FLUSH_MILLIS 10  // how often the background thread flushes the ring
+#define TRACE_SEEN 256         // number of recently recorded text ids
+
+#ifdef _WIN32
+  // aligned 64-bit volatile accesses are atomic, with acquire/release semantics on MSVC
+  #define _loadAcquire(p)     (*(volatile int64_t *)(p))
+  #define _storeRelease(p, v) (*(volatile int64_t *)(p) = (v))
+#else
+  #define _loadAcquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+  #define _storeRelease(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+/* A TraceRecord is one event in a trace file. */
+typedef struct tracerecord_s {
+    int64_t nanos;
+    int32_t type;  // see TR_...
+    int32_t reserved;
+    int64_t a;
+    int64_t b;
+} TraceRecord;
+
+struct trace_s {
+    FILE *fp;
+    TraceRecord *ring;
+    int64_t cap;     // power of two
+    int64_t mask;
+    int64_t head;    // next record to write, written by the producer
+    int64_t tail;    // next record to flush, written by the flusher
+    int64_t stop;    // set by Trace_free
+    int64_t dropped;
+    int64_t seen[TRACE_SEEN];  // text ids that have been recorded
+    Thread *flusher;
+};
+
+/* _traceFlush writes all records between tail and head to the file and
+   returns their number. */
+static int64_t _traceFlush(Trace *this) {
+    int64_t head = _loadAcquire(&this->head);
+    int64_t tail = this->tail;
+    int64_t n = head - tail;
+    while (tail < head) {
+        int64_t i = tail & this->mask;
+        int64_t chunk = head - tail < this->cap - i ? head - tail : this->cap - i;
+        fwrite(&this->ring[i], sizeof(TraceRecord), (size_t)chunk, this->fp);
+        tail += chunk;
+    }
+    _storeRelease(&this->tail, tail);
+    return n;
+}
+
+static void _traceMain(void *arg) {
+    Trace *this = (Trace *)arg;
+    for (;;) {
+        BOOL stop = _loadAcquire(&this->stop) != 0;
+        if (!_traceFlush(this)) {
+            if (stop) {
+                break;
+            }
+            sleepMillis(TRACE_FLUSH_MILLIS);
+        }
+    }
+}
+
+Trace *newTrace(const char *filename, int capacity) {
+    ASSERT(capacity > 0);
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        LOG_INFO1("trace: cannot create '%s'", filename);
+        return NULL;
+    }
+    fwrite(TRACE_MAGIC, 1, 8, fp);
+    Trace *this = (Trace *)memAlloc(sizeof(Trace), __FILE__, __LINE__);
+    memset(this, 0, sizeof(Trace));
+    this->fp = fp;
+    this->cap = 1;
+    while (this->cap < capacity) {
+        this->cap *= 2;
+    }
+    this->mask = this->cap - 1;
+    this->ring = (TraceRecord *)memAlloc(this->cap * sizeof(TraceRecord), __FILE__, __LINE__);
+    this->flusher = newThread(_traceMain, this);
+    return this;
+}
+
+void Trace_free(Trace *this) {
+    ASSERT(this);
+    _storeRelease(&this->stop, 1);
+    Thread_join(this->flusher);
+    fclose(this->fp);
+    if (this->dropped) {
+        LOG_INFO1("trace: %" PRId64 " events dropped, ring buffer was full", this->dropped);
+    }
+    memFree(this->ring);
+    memFree(this);
+}
+
+/* _traceReserve returns TRUE if n records fit into the ring. */
+static BOOL _traceReserve(Trace *this, int64_t n) {
+    if (this->head + n - _loadAcquire(&this->tail) > this->cap) {
+        this->dropped++;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void Trace_event(Trace *this, int type, int64_t a, int64_t b) {
+    if (!_traceReserve(this, 1)) {
+        return;
+    }
+    TraceRecord *rec = &this->ring[this->head & this->mask];
+    rec->nanos = nanotime();
+    rec->type = type;
+    rec->reserved = 0;
+    rec->a = a;
+    rec->b = b;
+    _storeRelease(&this->head, this->head + 1);
+}
+
+/* Trace_text returns an id for text, a hash. The text is recorded only if
+   the id has not been recorded recently, so that repeated texts (e.g. the
+   SQL of a cached statement) cost a hash, not a copy. */
+int64_t Trace_text(Trace *this, const char *text) {
+    uint64_t h = 14695981039346656037u;  // FNV-1a
+    size_t len = 0;
+    for (const char *p = text; *p; p++, len++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211u;
+    }
+    int64_t id = (int64_t)(h >> 1) | 1;  // positive, never 0
+    int64_t *seen = &this->seen[id & (TRACE_SEEN - 1)];
+    if (*seen == id) {
+        return id;
+    }
+    int64_t nrecs = 1 + ((int64_t)len + sizeof(TraceRecord) - 1) / sizeof(TraceRecord);
+    if (!_traceReserve(this, nrecs)) {
+        return id;
+    }
+    TraceRecord *rec = &this->ring[this->head & this->mask];
+    rec->nanos = nanotime();
+    rec->type = TR_TEXT;
+    rec->reserved = 0;
+    rec->a = id;
+    rec->b = (int64_t)len;
+    for (int64_t i = 1; i < nrecs; i++) {
+        size_t off = (size_t)(i - 1) * sizeof(TraceRecord);
+        size_t n = len - off < sizeof(TraceRecord) ? len - off : sizeof(TraceRecord);
+        memcpy(&this->ring[(this->head + i) & this->mask], text + off, n);
+    }
+    _storeRelease(&this->head, this->head + nrecs);
+    *seen = id;
+    return id;
+}
+
+int64_t Trace_dropped(Trace *this) {
+    return this->dropped;
+}
+
+/* A TraceMap maps ids (never 0) to indexes, with open addressing. */
+typedef struct tracemap_s {
+    int64_t *keys;
+    int *vals;
+    int cap;  // power of two
+    int n;
+} TraceMap;
+
+static void _traceMapInit(TraceMap *map, int cap) {
+    map->keys = (int64_t *)memAlloc(cap * sizeof(int64_t), __FILE__, __LINE__);
+    memset(map->keys, 0, cap * sizeof(int64_t));
+    map->vals = (int *)memAlloc(cap * sizeof(int), __FILE__, __LINE__);
+    map->cap = cap;
+    map->n = 0;
+}
+
+static void _traceMapFree(TraceMap *map) {
+    memFree(map->keys);
+    memFree(map->vals);
+}
+
+/* _traceMapGet returns the index of key, or -1 if not found. */
+static int _traceMapGet(TraceMap *map, int64_t key) {
+    for (int i = (int)(((uint64_t)key * 11400714819323198485u) >> 40) & (map->cap - 1); map->keys[i]; i = (i + 1) & (map->cap - 1)) {
+        if (map->keys[i] == key) {
+            return map->vals[i];
+        }
+    }
+    return -1;
+}
+
+static void _traceMapPut(TraceMap *map, int64_t key, int val) {
+    if (2 * (map->n + 1) > map->cap) {
+        TraceMap old = *map;
+        _traceMapInit(map, old.cap * 2);
+        for (int i = 0; i < old.cap; i++) {
+            if (old.keys[i]) {
+                _traceMapPut(map, old.keys[i], old.vals[i]);
+            }
+        }
+        _traceMapFree(&old);
+    }
+    int i = (int)(((uint64_t)key * 11400714819323198485u) >> 40) & (map->cap - 1);
+    while (map->keys[i] && map->keys[i] != key) {
+        i = (i + 1) & (map->cap - 1);
+    }
+    if (!map->keys[i]) {
+        map->keys[i] = key;
+        map->n++;
+    }
+    map->vals[i] = val;
+}
+
+/* A TraceStmt is the state of a statement while a trace is converted. */
+typedef struct tracestmt_s {
+    int64_t sql;    // text id
+    int64_t start;  // nanos of TR_STMT, or -1 if not running
+    int64_t rows;
+} TraceStmt;
+
+static void _jsonString(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/* traceToJson converts a trace file to the Chrome trace-event format, see
+   chrome://tracing or https://ui.perfetto.dev. Requests are begin/end
+   events, statement runs are complete events (from TR_STMT to
+   TR_PROFILE) with their row count, and frames are instant events. */
+BOOL traceToJson(const char *filename, FILE *out) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return FALSE;
+    }
+    char magic[8];
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0) {
+        fclose(fp);
+        return FALSE;
+    }
+    TraceMap textMap;
+    _traceMapInit(&textMap, 64);
+    char **texts = NULL;
+    int ntexts = 0;
+    TraceMap stmtMap;
+    _traceMapInit(&stmtMap, 64);
+    TraceStmt *stmts = NULL;
+    int nstmts = 0;
+    int64_t t0 = -1;
+    const char *sep = "\n";
+    fprintf(out, "{\"traceEvents\":[");
+    TraceRecord rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (t0 < 0) {
+            t0 = rec.nanos;
+        }
+        double ts = (rec.nanos - t0) / 1e3;
+        switch (rec.type) {
+            case TR_TEXT: {
+                int64_t nrecs = (rec.b + sizeof(TraceRecord) - 1) / sizeof(TraceRecord);
+                char *text = (char *)memAlloc(nrecs * sizeof(TraceRecord) + 1, __FILE__, __LINE__);
+                if (nrecs && fread(text, sizeof(TraceRecord), (size_t)nrecs, fp) != (size_t)nrecs) {
+                    memFree(text);
+                    break;
+                }
+                text[rec.b] = 0;
+                int i = _traceMapGet(&textMap, rec.a);
+                if (i >= 0) {
+                    memFree(texts[i]);
+                    texts[i] = text;
+                } else {
+                    texts = (char **)(texts ? memRealloc(texts, (ntexts + 1) * sizeof(char *)) : memAlloc(sizeof(char *), __FILE__, __LINE__));
+                    texts[ntexts] = text;
+                    _traceMapPut(&textMap, rec.a, ntexts++);
+                }
+                break;
+            }
+            case TR_BEGIN:
+            case TR_END: {
+                int i = _traceMapGet(&textMap, rec.a);
+                fprintf(out, "%s{\"name\":", sep);
+                _jsonString(out, i >= 0 ? texts[i] : "?");
+                fprintf(out, ",\"cat\":\"request\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":1}", rec.type == TR_BEGIN ? "B" : "E", ts);
+                sep = ",\n";
+                break;
+            }
+            case TR_STMT: {
+                int i = _traceMapGet(&stmtMap, rec.b);
+                if (i < 0) {
+                    stmts = (TraceStmt *)(stmts ? memRealloc(stmts, (nstmts + 1) * sizeof(TraceStmt)) : memAlloc(sizeof(TraceStmt), __FILE__, __LINE__));
+                    i = nstmts++;
+                    _traceMapPut(&stmtMap, rec.b, i);
+                }
+                stmts[i].sql = rec.a;
+                stmts[i].start = rec.nanos;
+                stmts[i].rows = 0;
+                break;
+            }
+            case TR_ROW: {
+                int i = _traceMapGet(&stmtMap, rec.a);
+                if (i >= 0) {
+                    stmts[i].rows++;
+                }
+                break;
+            }
+            case TR_PROFILE: {
+                int i = _traceMapGet(&stmtMap, rec.a);
+                if (i < 0 || stmts[i].start < 0) {
+                    break;
+                }
+                int j = _traceMapGet(&textMap, stmts[i].sql);
+                fprintf(out, "%s{\"name\":", sep);
+                _jsonString(out, j >= 0 ? texts[j] : "?");
+                fprintf(out, ",\"cat\":\"sql\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1", (stmts[i].start - t0) / 1e3, (rec.nanos - stmts[i].start) / 1e3);
+                fprintf(out, ",\"args\":{\"rows\":%" PRId64 ",\"sqliteNanos\":%" PRId64 "}}", stmts[i].rows, rec.b);
+                stmts[i].start = -1;
+                sep = ",\n";
+                break;
+            }
+            case TR_READ:
+            case TR_WRITE: {
+                fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":1", sep, rec.type == TR_READ ? "read" : "write", ts);
+                fprintf(out, ",\"args\":{\"bytes\":%" PRId64 "}}", rec.a);
+                sep = ",\n";
+                break;
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fclose(fp);
+    for (int i = 0; i < ntexts; i++) {
+        memFree(texts[i]);
+    }
+    if (texts) {
+        memFree(texts);
+    }
+    if (stmts) {
+        memFree(stmts);
+    }
+    _traceMapFree(&textMap);
+    _traceMapFree(&stmtMap);
+    return TRUE;
+}
+
+//
+// Test
+//
+
+static BOOL _findSite(int line, MemSite *site) {
+    MemSite sites[MEM_MAX_SITES];
+    int n = memGetSites(sites, MEM_MAX_SITES);
+    for (int i = 0; i < n; i++) {
+        if (sites[i].line == line && strcmp(sites[i].file, __FILE__) == 0) {
+            *site = sites[i];
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+#define MEM_TEST_ALLOCS 10000
+
+static int memTestLine;
+
+static void _memTestThread(void *arg) {
+    for (int i = 0; i < MEM_TEST_ALLOCS; i++) {
+        memFree(memAlloc(8 + i % 64, __FILE__, memTestLine));
+    }
+}
+
+static void testMemTrack() {
+    MemSite site;
+    int line = __LINE__ + 1;
+    char *p = memAlloc(1000, __FILE__, __LINE__);
+    ASSERT(_findSite(line, &site));
+    ASSERT_INT64(1, site.count);
+    ASSERT_INT64(1000, site.bytes);
+    p = memRealloc(p, 5000);
+    ASSERT(_findSite(line, &site));
+    ASSERT_INT64(5000, site.bytes);
+    p = memRealloc(p, 10);
+    ASSERT(_findSite(line, &site));
+    ASSERT_INT64(10, site.bytes);
+    ASSERT_INT64(5000, site.peakBytes);
+    memFree(p);
+    ASSERT(_findSite(line, &site));
+    ASSERT_INT64(0, site.count);
+    ASSERT_INT64(0, site.bytes);
+    ASSERT_INT64(1, site.total);
+    // many live pointers
+    int n = 10000;
+    void **ptrs = (void **)malloc(n * sizeof(void *));
+    line = __LINE__ + 2;
+    for (int i = 0; i < n; i++) {
+        ptrs[i] = memAlloc(16, __FILE__, __LINE__);
+    }
+    ASSERT(_findSite(line, &site));
+    ASSERT_INT64(n, site.count);
+    for (int i = 0; i < n; i += 2) {
+        memFree(ptrs[i]);
+    }
+    for (int i = 1; i < n; i += 2) {
+        memFree(ptrs[i]);
+    }
+    ASSERT(_findSite(line, &site));
+    ASSERT_INT64(0, site.count);
+    ASSERT_INT64(16 * (int64_t)n, site.peakBytes);
+    free(ptrs);
+    // many threads, one call site
+    memTestLine = __LINE__;
+    Thread *threads[4];
+    for (int i = 0; i < 4; i++) {
+        threads[i] = newThread(_memTestThread, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        Thread_join(threads[i]);
+    }
+    ASSERT(_findSite(memTestLine, &site));
+    ASSERT_INT64(0, site.count);
+    ASSERT_INT64(0, site.bytes);
+    ASSERT_INT64(4 * MEM_TEST_ALLOCS, site.total);
+}
+
+static void testStats() {
+    Stats *stats = newStats();
+    Stats_add(stats, "a", 1);
+    Stats_addf(stats, 2, "b.%d", 7);
+    Stats_sum(stats, "a", 10);
+    Stats_sum(stats, "c", 5);
+    ASSERT_INT(3, Stats_count(stats));
+    ASSERT_INT64(11, Stats_get(stats, "a", -1));
+    ASSERT_INT64(2, Stats_get(stats, "b.7", -1));
+    ASSERT_INT64(5, Stats_get(stats, "c", -1));
+    // long names are cut and marked
+    char longName[100];
+    memset(longName, 'x', sizeof(longName) - 1);
+    longName[sizeof(longName) - 1] = 0;
+    Stats_addf(stats, 4, "mem.site.%s", longName);
+    const char *name = Stats_name(stats, 3);
+    ASSERT_INT(63, strlen(name));
+    ASSERT_STR("...", name + 60);
+    Stats_sum(stats, longName, 1);
+    Stats_sum(stats, longName, 1);
+    ASSERT_INT(5, Stats_count(stats));
+    ASSERT_INT64(2, Stats_value(stats, 4));
+    Stats_free(stats);
+}
+
+static void testArena() {
+    Arena *arena = newArena(1024);
+    Stats *stats = newStats();
+    // fits
+    char *p = Arena_alloc(arena, 100);
+    ASSERT(p);
+    ASSERT_STR("hello", Arena_strdup(arena, "hello"));
+    Arena_reset(arena);
+    Arena_stats(arena, stats, "arena");
+    ASSERT_INT64(1024, Stats_get(stats, "arena.size", -1));
+    ASSERT_INT64(0, Stats_get(stats, "arena.overflows", -1));
+    // overflows, grows on reset
+    Arena_alloc(arena, 3000);
+    Arena_reset(arena);
+    Stats_reset(stats);
+    Arena_stats(arena, stats, "arena");
+    ASSERT_INT64(4096, Stats_get(stats, "arena.size", -1));
+    ASSERT_INT64(1, Stats_get(stats, "arena.overflows", -1));
+    ASSERT_INT64(1, Stats_get(stats, "arena.grows", -1));
+    // small requests only, shrinks back after a full trim period
+    for (int i = 0; i < 2 * ARENA_TRIM_RESETS; i++) {
+        Arena_alloc(arena, 100);
+        Arena_reset(arena);
+    }
+    Stats_reset(stats);
+    Arena_stats(arena, stats, "arena");
+    ASSERT_INT64(1024, Stats_get(stats, "arena.size", -1));
+    ASSERT_INT64(1, Stats_get(stats, "arena.shrinks", -1));
+    ASSERT_INT64(3008, Stats_get(stats, "arena.highWater", -1));
+    // larger than ARENA_MAX_SIZE, does not grow beyond
+    Arena_alloc(arena, 2 * ARENA_MAX_SIZE);
+    Arena_reset(arena);
+    Stats_reset(stats);
+    Arena_stats(arena, stats, "arena");
+    ASSERT_INT64(ARENA_MAX_SIZE, Stats_get(stats, "arena.size", -1));
+    Stats_free(stats);
+    Arena_free(arena);
+}
+
+static void testHistogram() {
+    // bucket boundaries
+    ASSERT_INT(0, _histBucket(0));
+    ASSERT_INT(15, _histBucket(15));
+    ASSERT_INT(16, _histBucket(16));
+    ASSERT_INT(31, _histBucket(31));
+    ASSERT_INT(32, _histBucket(32));
+    ASSERT_INT(32, _histBucket(33));
+    ASSERT_INT(33, _histBucket(34));
+    ASSERT_INT(HIST_NBUCKETS - 1, _histBucket(INT64_MAX));
+    for (int b = 1; b < HIST_NBUCKETS; b++) {
+        ASSERT_INT(b, _histBucket(_histValue(b)));
+        ASSERT_INT(b, _histBucket(_histValue(b - 1) + 1));
+    }
+    // percentiles of 1..1000
+    Histogram *hist = newHistogram();
+    ASSERT_INT64(0, Histogram_percentile(hist, 50));
+    for (int i = 1; i <= 1000; i++) {
+        Histogram_record(hist, i);
+    }
+    ASSERT_INT64(1000, Histogram_count(hist));
+    ASSERT_INT64(1000, Histogram_max(hist));
+    int64_t p50 = Histogram_percentile(hist, 50);
+    ASSERT(500 <= p50 && p50 <= 500 + 500 / HIST_SUB);
+    int64_t p99 = Histogram_percentile(hist, 99);
+    ASSERT(990 <= p99 && p99 <= 1000);
+    ASSERT_INT64(1000, Histogram_percentile(hist, 100));
+    ASSERT_INT64(1, Histogram_percentile(hist, 0));
+    Stats *stats = newStats();
+    Histogram_stats(hist, stats, "h");
+    ASSERT_INT64(500, Stats_get(stats, "h.mean", -1));
+    ASSERT_INT64(p99, Stats_get(stats, "h.p99", -1));
+    Stats_free(stats);
+    Histogram_reset(hist);
+    ASSERT_INT64(0, Histogram_count(hist));
+    Histogram_free(hist);
+}
+
+static void testTrace() {
+    const char *filename = "sqinn_test.trace";
+    Trace *trace = newTrace(filename, 1024);
+    ASSERT(trace);
+    int64_t query = Trace_text(trace, "query");
+    int64_t sql = Trace_text(trace, "SELECT \"a\"\n");
+    ASSERT(sql != query);
+    Trace_event(trace, TR_READ, 30, 0);
+    Trace_event(trace, TR_BEGIN, query, 0);
+    ASSERT_INT64(sql, Trace_text(trace, "SELECT \"a\"\n"));  // recorded once
+    Trace_event(trace, TR_STMT, sql, 0x1000);
+    for (int i = 0; i < 3; i++) {
+        Trace_event(trace, TR_ROW, 0x1000, 0);
+    }
+    Trace_event(trace, TR_PROFILE, 0x1000, 5000);
+    Trace_event(trace, TR_WRITE, 50, 0);
+    Trace_event(trace, TR_END, query, 0);
+    ASSERT_INT64(0, Trace_dropped(trace));
+    Trace_free(trace);
+    // two records for each text, and 9 events
+    FILE *fp = fopen(filename, "rb");
+    ASSERT(fp);
+    fseek(fp, 0, SEEK_END);
+    ASSERT_INT64(8 + 13 * 32, ftell(fp));
+    fclose(fp);
+    // convert
+    FILE *out = tmpfile();
+    ASSERT(out);
+    ASSERT(traceToJson(filename, out));
+    char json[4096];
+    rewind(out);
+    size_t n = fread(json, 1, sizeof(json) - 1, out);
+    json[n] = 0;
+    fclose(out);
+    ASSERT(strncmp(json, "{\"traceEvents\":[", 16) == 0);
+    ASSERT(strstr(json, "{\"name\":\"query\",\"cat\":\"request\",\"ph\":\"B\""));
+    ASSERT(strstr(json, "{\"name\":\"query\",\"cat\":\"request\",\"ph\":\"E\""));
+    ASSERT(strstr(json, "{\"name\":\"SELECT \\\"a\\\"\\u000a\",\"cat\":\"sql\",\"ph\":\"X\""));
+    ASSERT(strstr(json, "\"args\":{\"rows\":3,\"sqliteNanos\":5000}}"));
+    ASSERT(strstr(json, "{\"name\":\"read\",\"cat\":\"frame\",\"ph\":\"i\""));
+    ASSERT(strstr(json, "\"args\":{\"bytes\":50}}"));
+    ASSERT_STR("\n]}\n", json + n - 4);
+    remove(filename);
+    // not a trace file
+    ASSERT(!traceToJson("sqinn_no_such_file.trace", stdout));
+    // a full ring drops events, it never blocks
+    trace = newTrace(filename, 4);
+    for (int i = 0; i < 100000; i++) {
+        Trace_event(trace, TR_ROW, 1, 0);
+    }
+    int64_t dropped = Trace_dropped(trace);
+    Trace_free(trace);
+    fp = fopen(filename, "rb");
+    fseek(fp, 0, SEEK_END);
+    ASSERT_INT64(8 + (100000 - dropped) * 32, ftell(fp));
+    fclose(fp);
+    remove(filename);
+}
+
+static void testLog() {
+    const char *filename = "sqinn_test.log";
+    remove(filename);
+    Log *log = newLog(LOG_LEVEL_INFO, filename, FALSE);
+    ASSERT_INT(LOG_LEVEL_INFO, Log_level(log));
+    Log_print(log, LOG_LEVEL_INFO, "hello %s %d", "log", 42);
+    Log_print(log, LOG_LEVEL_DEBUG, "not logged");
+    char big[1000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+    Log_print(log, LOG_LEVEL_INFO, "%s", big);
+    // Log_flush writes pending messages without waiting for the writer
+    Log_flush(log);
+    FILE *fp = fopen(filename, "rb");
+    char text[2048];
+    size_t n = fread(text, 1, sizeof(text) - 1, fp);
+    text[n] = 0;
+    fclose(fp);
+    ASSERT(n > 0);
+    char *line = strchr(text, '\n');
+    ASSERT(line);
+    *line = 0;
+    ASSERT_STR("INFO  hello log 42", text + 20);
+    char *next = line + 1;
+    line = strchr(next, '\n');
+    ASSERT(line);
+    *line = 0;
+    ASSERT_INT(26 + LOG_MSG - 1, (int)strlen(next));
+    ASSERT_STR("xxx...", next + strlen(next) - 6);
+    ASSERT_STR("", line + 1);
+    // only the writer itself skips the drain in Log_flush
+    ASSERT(!Thread_isCurrent(log->writer));
+    // Log_free writes the rest
+    for (int i = 0; i < 100; i++) {
+        Log_print(log, LOG_LEVEL_INFO, "message %d", i);
+    }
+    Log_free(log);
+    fp = fopen(filename, "rb");
+    int lines = 0;
+    int ch;
+    while ((ch = fgetc(fp)) != EOF) {
+        lines += ch == '\n';
+    }
+    fclose(fp);
+    ASSERT_INT(102, lines);
+    remove(filename);
+    // an off log has no ring and no thread
+    log = newLog(LOG_LEVEL_OFF, "", TRUE);
+    Log_print(log, LOG_LEVEL_INFO, "not logged");
+    Log_flush(log);
+    Log_free(log);
+}
+
+void testUtl() {
+    LOG_INFO0("testUtl testLog");
+    testLog();
+    LOG_INFO0("testUtl testMemTrack");
+    testMemTrack();
+    LOG_INFO0("testUtl testStats");
+    testStats();
+    LOG_INFO0("testUtl testArena");
+    testArena();
+    LOG_INFO0("testUtl testHistogram");
+    testHistogram();
+    LOG_INFO0("testUtl testTrace");
+    testTrace();
+}
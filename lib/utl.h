@@ -1,14 +1,21 @@
 #ifndef UTL_H
 #define UTL_H
 
+#ifndef _WIN32
+  // we need POSIX functions (pthreads, clock_gettime, poll) with -std=c99
+  #define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <time.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #ifdef _WIN32
   // MSVC does not have unistd.h, it has io.h
@@ -16,8 +23,10 @@
   #define STDIN_FILENO  0
   #define STDOUT_FILENO 1
   #define STDERR_FILENO 2
+  #include <intrin.h>
 #else
   #include <unistd.h>
+  #include <sys/uio.h>
 #endif
 
 /* A BOOL is either FALSE (zero) or TRUE (not zero).*/
@@ -27,15 +36,71 @@ typedef char BOOL;
 #define TRUE  1
 
 
+//
+// Stats: Named counters
+//
+
+/* A Stats is a list of named counters, see FC_STATS. Names are at most 63
+   characters; longer names are cut and end in "...". */
+typedef struct stats_s Stats;
+Stats *newStats();
+void Stats_free(Stats *this);
+void Stats_reset(Stats *this);
+void Stats_add(Stats *this, const char *name, int64_t value);
+void Stats_addf(Stats *this, int64_t value, const char *fmt, ...);
+void Stats_sum(Stats *this, const char *name, int64_t value);
+int Stats_count(Stats *this);
+const char *Stats_name(Stats *this, int i);
+int64_t Stats_value(Stats *this, int i);
+int64_t Stats_get(Stats *this, const char *name, int64_t defaultValue);
+
+
+//
+// Histograms: Value distributions with bounded relative error
+//
+
+/* A Histogram counts non-negative values in log-bucketed buckets: each
+   power of two is split into 16 sub-buckets, so a percentile is off by
+   at most 1/16 of its value. */
+typedef struct histogram_s Histogram;
+Histogram *newHistogram();
+void Histogram_free(Histogram *this);
+void Histogram_reset(Histogram *this);
+void Histogram_record(Histogram *this, int64_t value);
+int64_t Histogram_count(Histogram *this);
+int64_t Histogram_max(Histogram *this);
+int64_t Histogram_percentile(Histogram *this, double p);  // p in [0,100]
+void Histogram_print(Histogram *this, const char *name);
+void Histogram_stats(Histogram *this, Stats *stats, const char *name);
+
+
 //
 // Memory primitives: Wrap malloc() and free()
 //
 
 void initMem();
 void printMem(FILE *fp);
+
+/* A MemSite holds the allocations of one call site. memAlloc tracks them
+   always, see memGetSites. */
+typedef struct memsite_s {
+    const char *file;
+    int line;
+    int64_t count;      // live allocations
+    int64_t bytes;      // live bytes
+    int64_t peakBytes;  // max. live bytes
+    int64_t total;      // allocations so far
+} MemSite;
+
+int memGetSites(MemSite *sites, int max);
+void printMemSites(int max);
+void memDumpOnSignal();
+BOOL memDumpRequested();
+void memStats(Stats *stats, int max);
 void *memAlloc(size_t size, const char *file, int line);
 void *memRealloc(void *ptr, size_t newSize);
 void memFree(void *ptr);
+char *memStrdup(const char *str, const char *file, int line);
 
 /* hexdump writes a hexdump into a newly allocated buffer. The buffer must be memFree'd after use. */
 char *hexdump(const char *data, size_t len);
@@ -45,6 +110,89 @@ extern int mallocs;
 extern int frees;
 
 
+//
+// Arena: Scratch memory that is released all at once
+//
+
+/* An Arena is a bump allocator for memory that is needed only while a request
+   is being processed. Arena_reset releases all of it. An Arena that ran out of
+   space grows on reset, so that it will not run out for requests of the same
+   size again, and shrinks back when such requests stop coming. */
+typedef struct arena_s Arena;
+Arena *newArena(size_t size);
+void Arena_free(Arena *this);
+void *Arena_alloc(Arena *this, size_t size);
+char *Arena_strdup(Arena *this, const char *str);
+void Arena_reset(Arena *this);
+void Arena_print(Arena *this, const char *name);
+void Arena_stats(Arena *this, Stats *stats, const char *name);
+
+
+//
+// Atomic counters: Can be incremented from more than one thread
+//
+
+#ifdef _WIN32
+  #define ATOMIC_ADD(ptr, n) _InterlockedExchangeAdd((volatile long *)(ptr), (long)(n))
+  #define ATOMIC_ADD64(ptr, n) _InterlockedExchangeAdd64((volatile __int64 *)(ptr), (__int64)(n))
+#else
+  #define ATOMIC_ADD(ptr, n) __atomic_fetch_add((ptr), (n), __ATOMIC_SEQ_CST)
+  #define ATOMIC_ADD64(ptr, n) __atomic_fetch_add((ptr), (int64_t)(n), __ATOMIC_SEQ_CST)
+#endif
+
+
+//
+// Threads: Wrap pthreads and Win32 threads
+//
+
+/* A Thread runs a function in the background. */
+typedef struct thread_s Thread;
+Thread *newThread(void (*fn)(void *arg), void *arg);
+void Thread_join(Thread *this);  // waits for the thread to finish and frees it
+BOOL Thread_isCurrent(Thread *this);  // TRUE if called from this thread
+
+/* A Mutex protects data that is shared between threads. */
+typedef struct mutex_s Mutex;
+Mutex *newMutex();
+void Mutex_free(Mutex *this);
+void Mutex_lock(Mutex *this);
+void Mutex_unlock(Mutex *this);
+
+/* A Cond lets threads wait for a condition that is protected by a Mutex. */
+typedef struct cond_s Cond;
+Cond *newCond();
+void Cond_free(Cond *this);
+void Cond_wait(Cond *this, Mutex *mutex);
+void Cond_waitMillis(Cond *this, Mutex *mutex, int millis);  // waits at most millis
+void Cond_broadcast(Cond *this);
+
+
+//
+// Time
+//
+
+/* nanotime returns nanoseconds from a monotonic clock. */
+int64_t nanotime();
+
+/* sleepMillis suspends the calling thread. */
+void sleepMillis(int millis);
+
+/* fdReadable reports whether a read on fd would not block, waiting at most millis. */
+BOOL fdReadable(int fd, int millis);
+
+
+//
+// Child processes
+//
+
+/* A Child is a process whose stdin and stdout are pipes to the parent. */
+typedef struct child_s Child;
+Child *newChild(char *const argv[]);  // NULL if the process cannot be started
+int Child_stdin(Child *this);         // fd that writes to the child's stdin
+int Child_stdout(Child *this);        // fd that reads from the child's stdout
+int Child_wait(Child *this);          // closes the pipes, waits for the exit and frees the Child
+
+
 //
 // Logging utilities
 //
@@ -53,12 +201,16 @@ extern int frees;
 #define LOG_LEVEL_INFO 1
 #define LOG_LEVEL_DEBUG 2
 
-/* A Log writes log mesages. */
+/* A Log writes log mesages. Log_print formats a message into a ring
+   buffer and returns, a background thread writes the messages to the file
+   and stderr. Messages that do not fit into a full ring are dropped and
+   counted. */
 typedef struct log_s Log;
 Log *newLog(int level, const char *filename, BOOL stdErr);  // TODO add maxFilesize parameter
-void Log_free(Log *this);
+void Log_free(Log *this);  // writes all pending messages
 int Log_level(Log *this);
 void Log_print(Log *this, int level, const char *fmt, ...);
+void Log_flush(Log *this);  // writes all pending messages now, does nothing on the writer thread
 
 /* The (one and only) global Log instance. */
 extern Log *theLog;
@@ -80,6 +232,37 @@ extern Log *theLog;
 #define LOG_DEBUG4(msg,a,b,c,d)  Log_print(theLog, LOG_LEVEL_DEBUG, (msg), (a), (b), (c), (d))
 
 
+//
+// Binary trace
+//
+
+/* Trace event types. A trace file starts with TRACE_MAGIC, followed by
+   32-byte records in host byte order. */
+#define TRACE_MAGIC "SQTRACE1"
+#define TR_TEXT    1  // a=text id, b=length, followed by ceil(b/32) records of text
+#define TR_BEGIN   2  // a=text id of the name, e.g. a request
+#define TR_END     3  // a=text id of the name
+#define TR_STMT    4  // a=text id of the SQL, b=statement, SQLITE_TRACE_STMT
+#define TR_PROFILE 5  // a=statement, b=nanos as estimated by SQLite, SQLITE_TRACE_PROFILE
+#define TR_ROW     6  // a=statement, SQLITE_TRACE_ROW
+#define TR_READ    7  // a=frame size in bytes, incl. header
+#define TR_WRITE   8  // a=frame size in bytes, incl. header
+
+/* A Trace writes timestamped binary events to a file. Events go into a
+   lock-free ring buffer that a background thread flushes, so recording an
+   event never does I/O. There must be only one thread that records
+   events. Events are dropped if the ring is full. */
+typedef struct trace_s Trace;
+Trace *newTrace(const char *filename, int capacity);  // NULL if the file cannot be created
+void Trace_free(Trace *this);  // flushes and closes the file
+void Trace_event(Trace *this, int type, int64_t a, int64_t b);
+int64_t Trace_text(Trace *this, const char *text);  // returns the text id
+int64_t Trace_dropped(Trace *this);
+
+/* traceToJson converts a trace file to Chrome trace-event JSON. */
+BOOL traceToJson(const char *filename, FILE *out);
+
+
 //
 // ASSERT macros
 //
@@ -87,18 +270,21 @@ extern Log *theLog;
 #define ASSERT(condition) if(!(condition)) { \
     Log_print(theLog, LOG_LEVEL_INFO, "%s:%d ASSERT FAIL: " #condition ""  , __FILE__, __LINE__); \
                       fprintf(stderr, "%s:%d ASSERT FAIL: " #condition "\n", __FILE__, __LINE__); \
+    Log_flush(theLog); \
     exit(1); \
 }
 
 #define ASSERTF(condition, fmt, ...) if(!(condition)) { \
     Log_print(theLog, LOG_LEVEL_INFO, "%s:%d ASSERT FAIL: " #condition ": " #fmt ""  , __FILE__, __LINE__, ##__VA_ARGS__); \
                       fprintf(stderr, "%s:%d ASSERT FAIL: " #condition ": " #fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+    Log_flush(theLog); \
     exit(1); \
 }
 
 #define ASSERT_FAIL(fmt, ...) { \
     Log_print(theLog, LOG_LEVEL_INFO, "%s:%d ASSERT FAIL: " #fmt ""  , __FILE__, __LINE__, ##__VA_ARGS__); \
                       fprintf(stderr, "%s:%d ASSERT FAIL: " #fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+    Log_flush(theLog); \
     exit(1); \
 }
 
@@ -108,6 +294,7 @@ extern Log *theLog;
     if(w != h) { \
         Log_print(theLog, LOG_LEVEL_INFO, "%s:%d ASSERT FAIL: want %d but have %d"  , __FILE__, __LINE__, w, h); \
                           fprintf(stderr, "%s:%d ASSERT FAIL: want %d but have %d\n", __FILE__, __LINE__, w, h); \
+        Log_flush(theLog); \
         exit(1); \
     } \
 }
@@ -118,6 +305,7 @@ extern Log *theLog;
     if(w != h) { \
         Log_print(theLog, LOG_LEVEL_INFO, "%s:%d ASSERT FAIL: want %" PRId64 " but have %" PRId64 ""  , __FILE__, __LINE__, w, h); \
                           fprintf(stderr, "%s:%d ASSERT FAIL: want %" PRId64 " but have %" PRId64 "\n", __FILE__, __LINE__, w, h); \
+        Log_flush(theLog); \
         exit(1); \
     } \
 }
@@ -128,6 +316,7 @@ extern Log *theLog;
     if(w != h) { \
         Log_print(theLog, LOG_LEVEL_INFO, "%s:%d ASSERT FAIL: want %f but have %f"  , __FILE__, __LINE__, w, h); \
                           fprintf(stderr, "%s:%d ASSERT FAIL: want %f but have %f\n", __FILE__, __LINE__, w, h); \
+        Log_flush(theLog); \
         exit(1); \
     } \
 }
@@ -138,8 +327,15 @@ extern Log *theLog;
     if(strcmp(w,h) != 0) { \
         Log_print(theLog, LOG_LEVEL_INFO, "%s:%d ASSERT FAIL: want '%s' but have '%s'"  , __FILE__, __LINE__, w, h); \
                           fprintf(stderr, "%s:%d ASSERT FAIL: want '%s' but have '%s'\n", __FILE__, __LINE__, w, h); \
+        Log_flush(theLog); \
         exit(1); \
     } \
 }
 
+//
+// Test
+//
+
+void testUtl();
+
 #endif  // UTL_H
\ No newline at end of file
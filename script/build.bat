@@ -1,2 +1,3 @@
 REM Must have MSVC Build Tools installed
-cl.exe /Fe:sqinn.exe lib\*.c
+REM Flags must match script/build.sh, reader connections need SQLITE_THREADSAFE=2
+cl.exe /Fe:sqinn.exe /DSQLITE_ENABLE_SNAPSHOT /DSQLITE_ENABLE_MEMSYS5 /DSQLITE_OMIT_LOAD_EXTENSION /DSQLITE_THREADSAFE=2 /DSQLITE_MAX_MMAP_SIZE=0x1000000000 lib\*.c
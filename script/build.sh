@@ -6,7 +6,7 @@ mkdir -p bin    # bin directory will hold all buld artefacts
 
 # setup
 CC="gcc"
-CFLAGS="-std=c99 -Wall -Werror -O2"
+CFLAGS="-std=c99 -Wall -Werror -O2 -DSQLITE_ENABLE_SNAPSHOT -DSQLITE_ENABLE_MEMSYS5"
 LDFLAGS="-static"
 if test "$(uname)" = "Darwin"; then
     CC="clang"
@@ -14,13 +14,18 @@ if test "$(uname)" = "Darwin"; then
 fi
 
 # compile
-if ! test -f bin/sqlite3.o; then
-    $CC $CFLAGS -c lib/sqlite3.c -o bin/sqlite3.o -DSQLITE_OMIT_LOAD_EXTENSION -DSQLITE_THREADSAFE=0
+# sqlite3.o takes long, it is rebuilt only if its flags changed (readers need SQLITE_THREADSAFE=2)
+SQLITE_CFLAGS="$CFLAGS -DSQLITE_OMIT_LOAD_EXTENSION -DSQLITE_THREADSAFE=2 -DSQLITE_MAX_MMAP_SIZE=0x1000000000"
+if ! test -f bin/sqlite3.o || test "$(cat bin/sqlite3.flags 2>/dev/null)" != "$CC $SQLITE_CFLAGS"; then
+    $CC $SQLITE_CFLAGS -c lib/sqlite3.c -o bin/sqlite3.o
+    echo "$CC $SQLITE_CFLAGS" > bin/sqlite3.flags
 fi
 $CC $CFLAGS -c lib/utl.c  -o bin/utl.o
 $CC $CFLAGS -c lib/io.c   -o bin/io.o
 $CC $CFLAGS -c lib/db.c   -o bin/db.o
 $CC $CFLAGS -c lib/app.c  -o bin/app.o
+$CC $CFLAGS -c lib/import.c -o bin/import.o
+$CC $CFLAGS -c lib/bench.c -o bin/bench.o
 $CC $CFLAGS -c lib/main.c -o bin/main.o
 
 # link
@@ -30,6 +35,9 @@ $CC $LDFLAGS \
     bin/io.o \
     bin/db.o \
     bin/app.o \
+    bin/import.o \
+    bin/bench.o \
     bin/main.o \
+    -lpthread \
     -o bin/sqinn
 